@@ -0,0 +1,126 @@
+/*
+ This file is part of the Kernel Quantum Probability library (KQP).
+
+ KQP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ KQP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with KQP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <chrono>
+#include <deque>
+#include <sstream>
+
+#include <boost/lexical_cast.hpp>
+
+#include <kqp/kqp.hpp>
+#include <kqp/feature_matrix/dense.hpp>
+#include <kqp/feature_matrix/unary_kernel.hpp>
+
+DEFINE_LOGGER(logger,  "kqp.benchmark.gauss-transform");
+
+namespace kqp {
+
+    /**
+     * Error against speed of the approximate Gaussian inner products (fast Gauss transform).
+     *
+     * Pre-images are uniformly drawn in [0, extent]^dimension. For each tolerance, outputs the time (in ms) 
+     * and the relative error (Frobenius norm) of the inner products \f$X_1^\dagger X_2 Y\f$, the 
+     * tolerance 0 giving the exact computation.
+     */
+    int bm_gauss_transform(std::deque<std::string> &args) {
+        typedef GaussianSpace<double>::ScalarMatrix ScalarMatrix;
+        typedef GaussianSpace<double>::FMatrixBasePtr FMatrixBasePtr;
+
+        Index dimension = 2;
+        Index size = 10000;
+        Index columns = 5;
+        double sigma = 1;
+        double extent = 20;
+        std::vector<double> tolerances = { 0, 1e-2, 1e-4, 1e-6, 1e-8 };
+
+        while (args.size() > 0) {
+            if (args[0] == "--dimension" && args.size() >= 2) {
+                args.pop_front();
+                dimension = boost::lexical_cast<Index>(args[0]);
+                args.pop_front();
+            }
+
+            else if (args[0] == "--size" && args.size() >= 2) {
+                args.pop_front();
+                size = boost::lexical_cast<Index>(args[0]);
+                args.pop_front();
+            }
+
+            else if (args[0] == "--columns" && args.size() >= 2) {
+                args.pop_front();
+                columns = boost::lexical_cast<Index>(args[0]);
+                args.pop_front();
+            }
+
+            else if (args[0] == "--sigma" && args.size() >= 2) {
+                args.pop_front();
+                sigma = boost::lexical_cast<double>(args[0]);
+                args.pop_front();
+            }
+
+            else if (args[0] == "--extent" && args.size() >= 2) {
+                args.pop_front();
+                extent = boost::lexical_cast<double>(args[0]);
+                args.pop_front();
+            }
+
+            else if (args[0] == "--tolerance" && args.size() >= 2) {
+                args.pop_front();
+                tolerances = { 0, boost::lexical_cast<double>(args[0]) };
+                args.pop_front();
+            }
+
+            else break;
+        }
+
+        if (args.size() > 0)
+            KQP_THROW_EXCEPTION_F(illegal_argument_exception, "There are %d unprocessed command line arguments, starting with [%s]", %args.size() %args[0]);
+
+        std::cout << "dimension\t" << dimension << std::endl;
+        std::cout << "size\t" << size << std::endl;
+        std::cout << "columns\t" << columns << std::endl;
+        std::cout << "sigma\t" << sigma << std::endl;
+        std::cout << "extent\t" << extent << std::endl;
+
+        DenseSpace<double> base(dimension);
+        FMatrixBasePtr mX1 = base.newMatrix(ScalarMatrix((ScalarMatrix::Random(dimension, size).array() + 1) * extent / 2));
+        FMatrixBasePtr mX2 = base.newMatrix(ScalarMatrix((ScalarMatrix::Random(dimension, size).array() + 1) * extent / 2));
+        const ScalarMatrix mY = ScalarMatrix::Random(size, columns);
+
+        GaussianSpace<double> space(sigma, base.copy());
+        const SpaceBase<double> &fs = space;
+        ScalarMatrix exact;
+        for(size_t t = 0; t < tolerances.size(); t++) {
+            KQP_LOG_INFO_F(logger, "Benchmarking tolerance %g", %tolerances[t]);
+            space.tolerance(tolerances[t]);
+
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            ScalarMatrix k = fs.k(*mX1, Eigen::Identity<double>(size, size), *mX2, mY);
+            double time = std::chrono::duration_cast< std::chrono::duration<double, std::milli> >(std::chrono::steady_clock::now() - start).count();
+            if (tolerances[t] == 0) 
+                exact = k;
+
+            std::ostringstream name;
+            name << "tolerance." << tolerances[t];
+            std::cout << name.str() << ".time\t" << time << std::endl;
+            std::cout << name.str() << ".error\t" << (k - exact).norm() / exact.norm() << std::endl;
+        }
+
+        return 0;
+    }
+}
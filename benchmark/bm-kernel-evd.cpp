@@ -67,6 +67,9 @@ namespace kqp {
         // Noise ratio for generated vector components
         float noise;
         
+        // Storage precision of the pre-images (single for the mixed precision mode)
+        DensePrecision::Type precision;
+        
         // --- Settings for the generation
         
         // Range for the number of pre-images at each update
@@ -84,6 +87,7 @@ namespace kqp {
         useLC(true),
         nbVectors(0),
         noise(0),
+        precision(DensePrecision::FULL),
         min_preimages(1),
         max_preimages(1),
         min_lc(1),
@@ -211,7 +215,8 @@ namespace kqp {
             
             int run(const KernelEVDBenchmark &bm) {
                 
-                FSpace fs = KQPSpace::create(bm.dimension);
+                boost::shared_ptr<KQPSpace> space(new KQPSpace(bm.dimension, bm.precision));
+                FSpace fs = space;
                 fs->setUseLinearCombination(bm.useLC);
                 init(bm);
                 
@@ -230,7 +235,7 @@ namespace kqp {
                 Real alpha;
                 for(int i = 0; i < bm.updates; i++) {
                     getNext(bm, alpha, mU, mA);
-                    builder->add(alpha, KQPMatrix::create(mU), mA);
+                    builder->add(alpha, space->newMatrix(mU), mA);
                 }        
                 
                 Decomposition<Scalar> result = builder->getDecomposition();
@@ -528,6 +533,14 @@ namespace kqp {
                     
                     if (scalarName == "double") builderChooser.reset(new BuilderChooser<double>());
                     
+                    else if (scalarName == "float") builderChooser.reset(new BuilderChooser<float>());
+                    
+                    // Mixed precision: single precision pre-images and inner products, double precision EVD
+                    else if (scalarName == "mixed") {
+                        builderChooser.reset(new BuilderChooser<double>());
+                        precision = DensePrecision::SINGLE;
+                    }
+                    
                     else KQP_THROW_EXCEPTION_F(illegal_argument_exception, "Unknown scalar type [%s]", %scalarName);
                     
                 }
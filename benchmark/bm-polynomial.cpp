@@ -0,0 +1,110 @@
+/*
+ This file is part of the Kernel Quantum Probability library (KQP).
+
+ KQP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ KQP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with KQP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <chrono>
+#include <deque>
+
+#include <boost/lexical_cast.hpp>
+
+#include <kqp/kqp.hpp>
+#include <kqp/feature_matrix/dense.hpp>
+#include <kqp/feature_matrix/unary_kernel.hpp>
+
+DEFINE_LOGGER(logger,  "kqp.benchmark.polynomial");
+
+namespace kqp {
+
+    /**
+     * Polynomial kernel: elementwise pow against the integer degree path.
+     *
+     * For each degree, outputs the time (in ms) to compute \f$(K + b)^p\f$ from the base Gram matrix
+     * with pow and with repeated squaring, and the relative error (Frobenius norm) between both.
+     */
+    int bm_polynomial(std::deque<std::string> &args) {
+        typedef PolynomialSpace<double>::ScalarMatrix ScalarMatrix;
+        typedef std::chrono::steady_clock Clock;
+        typedef std::chrono::duration<double, std::milli> Milliseconds;
+
+        Index dimension = 10;
+        Index size = 2000;
+        double bias = 1;
+        int minDegree = 2, maxDegree = 8;
+
+        while (args.size() > 0) {
+            if (args[0] == "--dimension" && args.size() >= 2) {
+                args.pop_front();
+                dimension = boost::lexical_cast<Index>(args[0]);
+                args.pop_front();
+            }
+
+            else if (args[0] == "--size" && args.size() >= 2) {
+                args.pop_front();
+                size = boost::lexical_cast<Index>(args[0]);
+                args.pop_front();
+            }
+
+            else if (args[0] == "--bias" && args.size() >= 2) {
+                args.pop_front();
+                bias = boost::lexical_cast<double>(args[0]);
+                args.pop_front();
+            }
+
+            else if (args[0] == "--degrees" && args.size() >= 3) {
+                args.pop_front();
+                minDegree = boost::lexical_cast<int>(args[0]);
+                args.pop_front();
+                maxDegree = boost::lexical_cast<int>(args[0]);
+                args.pop_front();
+            }
+
+            else break;
+        }
+
+        if (args.size() > 0)
+            KQP_THROW_EXCEPTION_F(illegal_argument_exception, "There are %d unprocessed command line arguments, starting with [%s]", %args.size() %args[0]);
+
+        std::cout << "dimension\t" << dimension << std::endl;
+        std::cout << "size\t" << size << std::endl;
+        std::cout << "bias\t" << bias << std::endl;
+
+        // Normalised vectors, so that the kernel values stay bounded
+        ScalarMatrix m = ScalarMatrix::Random(dimension, size);
+        for(Index j = 0; j < size; j++)
+            m.col(j).normalize();
+        const ScalarMatrix gram = m.adjoint() * m;
+
+        for(int degree = minDegree; degree <= maxDegree; degree++) {
+            KQP_LOG_INFO_F(logger, "Benchmarking degree %d", %degree);
+
+            Clock::time_point start = Clock::now();
+            ScalarMatrix expected = (gram + ScalarMatrix::Constant(size, size, bias)).array().pow(degree);
+            double powTime = std::chrono::duration_cast<Milliseconds>(Clock::now() - start).count();
+
+            start = Clock::now();
+            ScalarMatrix k = PolynomialSpace<double>::power(gram, bias, degree);
+            double time = std::chrono::duration_cast<Milliseconds>(Clock::now() - start).count();
+
+            const std::string name = "degree." + boost::lexical_cast<std::string>(degree);
+            std::cout << name << ".pow.time\t" << powTime << std::endl;
+            std::cout << name << ".time\t" << time << std::endl;
+            std::cout << name << ".error\t" << (k - expected).norm() / expected.norm() << std::endl;
+        }
+
+        return 0;
+    }
+}
@@ -0,0 +1,111 @@
+/*
+ This file is part of the Kernel Quantum Probability library (KQP).
+
+ KQP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ KQP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with KQP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <iostream>
+#include <ctime>
+#include <deque>
+
+#include <boost/lexical_cast.hpp>
+
+#include <kqp/kqp.hpp>
+#include <kqp/feature_matrix/dense.hpp>
+
+DEFINE_LOGGER(logger,  "kqp.benchmark.reduced-precision");
+
+namespace kqp {
+
+    /**
+     * Accuracy and throughput of reduced precision dense feature matrices.
+     *
+     * For each precision, outputs the relative error (Frobenius norm) of the Gram matrix
+     * and of the inner products with another set of vectors, and the time (in ms) taken to compute them.
+     */
+    int bm_reduced_precision(std::deque<std::string> &args) {
+        typedef DenseSpace<double>::ScalarMatrix ScalarMatrix;
+        typedef DenseSpace<double>::FMatrixBasePtr FMatrixBasePtr;
+
+        Index dimension = 768;
+        Index size = 2000;
+        Index iterations = 5;
+
+        while (args.size() > 0) {
+            if (args[0] == "--dimension" && args.size() >= 2) {
+                args.pop_front();
+                dimension = boost::lexical_cast<Index>(args[0]);
+                args.pop_front();
+            }
+
+            else if (args[0] == "--size" && args.size() >= 2) {
+                args.pop_front();
+                size = boost::lexical_cast<Index>(args[0]);
+                args.pop_front();
+            }
+
+            else if (args[0] == "--iterations" && args.size() >= 2) {
+                args.pop_front();
+                iterations = boost::lexical_cast<Index>(args[0]);
+                args.pop_front();
+            }
+
+            else break;
+        }
+
+        if (args.size() > 0)
+            KQP_THROW_EXCEPTION_F(illegal_argument_exception, "There are %d unprocessed command line arguments, starting with [%s]", %args.size() %args[0]);
+
+        std::cout << "dimension\t" << dimension << std::endl;
+        std::cout << "size\t" << size << std::endl;
+        std::cout << "iterations\t" << iterations << std::endl;
+
+        const ScalarMatrix m1 = ScalarMatrix::Random(dimension, size);
+        const ScalarMatrix m2 = ScalarMatrix::Random(dimension, size / 10);
+        const ScalarMatrix gram = m1.adjoint() * m1;
+        const ScalarMatrix inner = m1.adjoint() * m2;
+
+        const DensePrecision::Type precisions[] = { DensePrecision::FULL, DensePrecision::SINGLE, DensePrecision::HALF, DensePrecision::BFLOAT16 };
+        for(size_t p = 0; p < sizeof(precisions) / sizeof(precisions[0]); p++) {
+            const std::string name = DensePrecision::name(precisions[p]);
+            KQP_LOG_INFO_F(logger, "Benchmarking %s precision", %name);
+            DenseSpace<double> space(dimension, precisions[p]);
+
+            FMatrixBasePtr mX1 = space.newMatrix(m1);
+            FMatrixBasePtr mX2 = space.newMatrix(m2);
+
+            // Gram matrix (computed as inner products, since it is cached by the feature matrix)
+            ScalarMatrix g;
+            std::clock_t start = std::clock();
+            for(Index i = 0; i < iterations; i++)
+                g = space.k(*mX1, *mX1);
+            double gramTime = 1000. * (std::clock() - start) / CLOCKS_PER_SEC / iterations;
+
+            // Inner products
+            ScalarMatrix k;
+            start = std::clock();
+            for(Index i = 0; i < iterations; i++)
+                k = space.k(*mX1, *mX2);
+            double innerTime = 1000. * (std::clock() - start) / CLOCKS_PER_SEC / iterations;
+
+            std::cout << name << ".gram.error\t" << (g - gram).norm() / gram.norm() << std::endl;
+            std::cout << name << ".gram.time\t" << gramTime << std::endl;
+            std::cout << name << ".inner.error\t" << (k - inner).norm() / inner.norm() << std::endl;
+            std::cout << name << ".inner.time\t" << innerTime << std::endl;
+            std::cout << name << ".storage\t" << (precisions[p] == DensePrecision::FULL ? sizeof(double) : DensePrecision::units(precisions[p]) * sizeof(uint16_t)) * dimension * size << std::endl;
+        }
+
+        return 0;
+    }
+}
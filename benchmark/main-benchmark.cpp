@@ -45,6 +45,9 @@ namespace kqp {
     namespace { Declare name ## _decl (id, &kqp::name); }
 
 DEFINE_BENCHMARK("kernel-evd", bm_kernel_evd);
+DEFINE_BENCHMARK("reduced-precision", bm_reduced_precision);
+DEFINE_BENCHMARK("gauss-transform", bm_gauss_transform);
+DEFINE_BENCHMARK("polynomial", bm_polynomial);
 
 DEFINE_LOGGER(logger,  "kqp.benchmark.main");
 
@@ -599,15 +599,22 @@ namespace kqp {
     //! Alt Matrix
     template<typename T1, typename T2> 
     class AltMatrix : public AltMatrixBase< AltMatrix<T1, T2> > {
+    public:
+        typedef typename Eigen::internal::traits<T1>::Scalar Scalar;
+        typedef typename Eigen::NumTraits<Scalar>::Real Real;
+        typedef const AltMatrix& Nested;
+        typedef Eigen::SparseMatrix<Scalar> SparseType;
+
+    private:
         storage<T1> m_t1;
         storage<T2> m_t2;
         
         bool m_isT1;
+
+        //! Sparse representation of T1 (shared between copies, dropped on any modification)
+        boost::shared_ptr<const SparseType> m_sparse;
         
     public:
-        typedef typename Eigen::internal::traits<T1>::Scalar Scalar;
-        typedef typename Eigen::NumTraits<Scalar>::Real Real;
-        typedef const AltMatrix& Nested;
         
         AltMatrix() : m_isT1(true) {}
         AltMatrix(const T1 &t1) : m_t1(t1), m_t2(), m_isT1(true) {}
@@ -623,6 +630,7 @@ namespace kqp {
 
         template<typename CwiseUnaryOp>
         void unaryExprInPlace(const CwiseUnaryOp &op) {
+            m_sparse.reset();
             if (isT1()) m_t1.unaryExprInPlace(op);
             else m_t2.unaryExprInPlace(op);
         }
@@ -637,21 +645,59 @@ namespace kqp {
         inline typename storage<T1>::ConstReturnType t1() const { return m_t1.get(); }
         inline typename storage<T2>::ConstReturnType t2() const { return m_t2.get(); }
         
-        inline typename storage<T1>::ReturnType t1() { return m_t1.get(); }
+        //! Mutable access (drops the sparse representation)
+        inline typename storage<T1>::ReturnType t1() { m_sparse.reset(); return m_t1.get(); }
         inline typename storage<T2>::ReturnType t2() { return m_t2.get(); }
         
         const storage<T1> &getStorage1() const { return m_t1; }
         const storage<T2> &getStorage2() const { return m_t2; }
         
+        // ---- Sparse representation ----
+
+        //! Returns true if a sparse representation of T1 is available
+        bool isSparse() const { return m_sparse.get() != 0; }
+
+        //! The sparse representation of T1 (only valid if isSparse() is true)
+        const SparseType &sparse() const { return *m_sparse; }
+
+        //! Ratio of non null coefficients (1 if the matrix is not of type T1)
+        Real fillRatio() const {
+            Index size = rows() * cols();
+            if (!m_isT1 || size == 0) return 1;
+            return (m_sparse ? m_sparse->nonZeros() : (m_t1.get().array() != Scalar(0)).count()) / (Real)size;
+        }
+
+        /**
+         * @brief Computes a sparse representation of T1 if it is sparse enough
+         *
+         * The dense storage is kept, so expressions are not affected: only the
+         * products computed with kqp::multiply use the sparse representation.
+         *
+         * @param maxFillRatio The maximum ratio of non null coefficients
+         * @return true if the matrix has a sparse representation
+         */
+        bool sparsify(Real maxFillRatio) {
+            if (m_sparse || !m_isT1 || m_t1.rows() * m_t1.cols() == 0) return isSparse();
+            if (fillRatio() < maxFillRatio) {
+                boost::shared_ptr<SparseType> sparse(new SparseType(m_t1.get().sparseView()));
+                sparse->makeCompressed();
+                m_sparse = sparse;
+            }
+            return isSparse();
+        }
+
+        //! Drops the sparse representation
+        void densify() { m_sparse.reset(); }
         
         void swap(AltMatrix &other) {
             m_t1.swap(other.m_t1);
             m_t2.swap(other.m_t2);
             std::swap(m_isT1, other.m_isT1);
+            m_sparse.swap(other.m_sparse);
         }
         
-        void swap(T1 &t1) { m_isT1 = true; m_t1.swap(t1); }
-        void swap(T2 &t2) { m_isT1 = true; m_t2.swap(t2); }
+        void swap(T1 &t1) { m_isT1 = true; m_sparse.reset(); m_t1.swap(t1); }
+        void swap(T2 &t2) { m_isT1 = true; m_sparse.reset(); m_t2.swap(t2); }
         
         //! Returns the adjoint
         Adjoint<AltMatrix> adjoint() const { return Adjoint<AltMatrix>(const_cast<AltMatrix&>(*this)); }
@@ -682,6 +728,7 @@ namespace kqp {
         
         
         void conservativeResize(Index rows, Index cols) {
+            m_sparse.reset();
             if (m_isT1)
                 m_t1.conservativeResize(rows, cols);
             else
@@ -689,6 +736,7 @@ namespace kqp {
         }
         
         void resize(Index rows, Index cols) {
+            m_sparse.reset();
             if (m_isT1)
                 m_t1.resize(rows, cols);
             else
@@ -1461,6 +1509,63 @@ namespace Eigen {
 
 namespace kqp {
 
+    // ---- Products using the sparse representation of dense/identity AltMatrix
+
+    //! Product of a sparse matrix with a (rectangular) identity, on the right or on the left
+    template<typename Scalar>
+    Eigen::Matrix<Scalar,Dynamic,Dynamic> identityProduct(const Eigen::SparseMatrix<Scalar> &mS, const Eigen::Identity<Scalar> &mI, bool onTheRight) {
+        Eigen::Matrix<Scalar,Dynamic,Dynamic> r = Eigen::Matrix<Scalar,Dynamic,Dynamic>::Zero(onTheRight ? mS.rows() : mI.rows(), onTheRight ? mI.cols() : mS.cols());
+        Index n = std::min(mI.rows(), mI.cols());
+        for(Index k = 0; k < (onTheRight ? n : mS.cols()); k++)
+            for(typename Eigen::SparseMatrix<Scalar>::InnerIterator it(mS, k); it; ++it)
+                if (onTheRight || it.row() < n)
+                    r(it.row(), k) = it.value();
+        return r;
+    }
+
+    //! Computes \f$ A B \f$ (using the sparse representation of A if it exists)
+    template<typename Scalar, typename Derived>
+    Eigen::Matrix<Scalar,Dynamic,Dynamic> multiply(const AltMatrix<Eigen::Matrix<Scalar,Dynamic,Dynamic>, Eigen::Identity<Scalar>> &mA, const Eigen::MatrixBase<Derived> &mB) {
+        if (mA.isSparse()) return mA.sparse() * mB.derived();
+        return mA * mB.derived();
+    }
+
+    //! Computes \f$ A B \f$ (using the sparse representation of B if it exists)
+    template<typename Scalar, typename Derived>
+    Eigen::Matrix<Scalar,Dynamic,Dynamic> multiply(const Eigen::MatrixBase<Derived> &mA, const AltMatrix<Eigen::Matrix<Scalar,Dynamic,Dynamic>, Eigen::Identity<Scalar>> &mB) {
+        if (mB.isSparse()) return mA.derived() * mB.sparse();
+        return mA.derived() * mB;
+    }
+
+    //! Computes \f$ A B \f$ (using the sparse representations of A and B if they exist)
+    template<typename Scalar>
+    Eigen::Matrix<Scalar,Dynamic,Dynamic> multiply(const AltMatrix<Eigen::Matrix<Scalar,Dynamic,Dynamic>, Eigen::Identity<Scalar>> &mA, 
+                                                   const AltMatrix<Eigen::Matrix<Scalar,Dynamic,Dynamic>, Eigen::Identity<Scalar>> &mB) {
+        if (mA.isSparse() && mB.isSparse()) 
+            return Eigen::SparseMatrix<Scalar>(mA.sparse() * mB.sparse()).toDense();
+        if (mA.isSparse()) 
+            return mB.isT1() ? Eigen::Matrix<Scalar,Dynamic,Dynamic>(mA.sparse() * mB.t1()) : identityProduct(mA.sparse(), mB.t2(), true);
+        if (mB.isSparse()) 
+            return mA.isT1() ? Eigen::Matrix<Scalar,Dynamic,Dynamic>(mA.t1() * mB.sparse()) : identityProduct(mB.sparse(), mA.t2(), false);
+        return mA * mB;
+    }
+
+    //! Computes \f$ A^\dagger B \f$ (using the sparse representation of A if it exists)
+    template<typename Scalar, typename Derived>
+    Eigen::Matrix<Scalar,Dynamic,Dynamic> multiplyAdjoint(const AltMatrix<Eigen::Matrix<Scalar,Dynamic,Dynamic>, Eigen::Identity<Scalar>> &mA, const Eigen::MatrixBase<Derived> &mB) {
+        if (mA.isSparse()) return mA.sparse().adjoint() * mB.derived();
+        return mA.adjoint() * mB.derived();
+    }
+
+    //! Computes \f$ Y_1^\dagger K Y_2 \f$ (using the sparse representations of the Y if they exist)
+    template<typename Scalar, typename Derived>
+    Eigen::Matrix<Scalar,Dynamic,Dynamic> bilinear(const AltMatrix<Eigen::Matrix<Scalar,Dynamic,Dynamic>, Eigen::Identity<Scalar>> &mY1, const Eigen::MatrixBase<Derived> &mK,
+                                                   const AltMatrix<Eigen::Matrix<Scalar,Dynamic,Dynamic>, Eigen::Identity<Scalar>> &mY2) {
+        if (!mY1.isSparse() && !mY2.isSparse())
+            return mY1.adjoint() * mK.derived() * mY2;
+        return multiplyAdjoint(mY1, multiply(mK, mY2));
+    }
+
 # define KQP_SCALAR_GEN(type)  \
     extern template class AltMatrix<AltDense<type>::DenseType, Eigen::Identity<type>>; \
     extern template class AltMatrix<AltVector<type>::VectorType, AltVector<type>::ConstantVectorType>;
@@ -0,0 +1,259 @@
+/*
+ This file is part of the Kernel Quantum Probability library (KQP).
+
+ KQP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ KQP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with KQP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __KQP_BATCHED_EVD_H__
+#define __KQP_BATCHED_EVD_H__
+
+#include <algorithm>
+#include <complex>
+#include <vector>
+
+#include <boost/type_traits/is_complex.hpp>
+
+#include <kqp/kqp.hpp>
+#include <Eigen/Eigenvalues>
+
+#include <kqp/cpu.hpp>
+#include <kqp/decomposition.hpp>
+#include <kqp/evd_utils.hpp>
+
+namespace kqp {
+
+#   include <kqp/define_header_logger.hpp>
+    DEFINE_KQP_HLOGGER("kqp.batched-evd");
+
+    /**
+     * @brief EVDs of many small self-adjoint matrices
+     *
+     * With small matrices, computing the EVDs one at a time (one SelfAdjointEigenSolver each) is
+     * dominated by the per-call overhead. Here, the matrices are grouped by size, and the matrices of
+     * a group are interleaved (cpu::JACOBI_LANES at a time) so that the Jacobi kernel
+     * (cpu::Kernels::jacobi) vectorizes each rotation across the problems. The groups are
+     * distributed over the OpenMP threads, and each thread reuses its workspace for all its groups.
+     *
+     * Matrices larger than the maximum size (and complex matrices) are decomposed with a
+     * SelfAdjointEigenSolver, still in parallel.
+     *
+     * @ingroup KernelEVD
+     */
+    template<typename Scalar> class BatchedEVD {
+    public:
+        KQP_SCALAR_TYPEDEFS(Scalar);
+
+        BatchedEVD() : maxSize(16), maxSweeps(30) {}
+
+        //! Sets the maximum size of the matrices decomposed with the Jacobi kernel
+        void setMaxSize(Index maxSize) {
+            this->maxSize = maxSize;
+        }
+
+        //! Sets the maximum number of Jacobi sweeps
+        void setMaxSweeps(int maxSweeps) {
+            if (maxSweeps < 1)
+                KQP_THROW_EXCEPTION_F(illegal_argument_exception, "The number of sweeps should be positive (got %d)", %maxSweeps);
+            this->maxSweeps = maxSweeps;
+        }
+
+        /**
+         * @brief EVD of each matrix
+         *
+         * As with SelfAdjointEigenSolver, only the lower part of the matrices is used,
+         * and the eigenvalues are sorted by increasing order.
+         */
+        void compute(const std::vector<ScalarMatrix> &matrices,
+                     std::vector<RealVector> &eigenvalues,
+                     std::vector<ScalarMatrix> &eigenvectors) const {
+            const Index count = matrices.size();
+            eigenvalues.resize(count);
+            eigenvectors.resize(count);
+
+            // Groups of matrices of the same size
+            std::vector<Index> order(count);
+            for(Index i = 0; i < count; i++)
+                order[i] = i;
+            std::stable_sort(order.begin(), order.end(), [&matrices](Index i, Index j) {
+                return matrices[i].rows() < matrices[j].rows();
+            });
+
+            std::vector< std::pair<Index,Index> > groups;
+            for(Index i = 0; i < count;) {
+                const Index n = matrices[order[i]].rows();
+                const Index size = useJacobi(n) ? cpu::JACOBI_LANES : 1;
+                Index j = i + 1;
+                while (j < count && j - i < size && matrices[order[j]].rows() == n)
+                    j++;
+                groups.push_back(std::make_pair(i, j));
+                i = j;
+            }
+
+            const cpu::Kernels &kernels = cpu::kernels();
+
+#pragma omp parallel
+            {
+                // Workspace of the thread
+                std::vector<double> a, v;
+
+#pragma omp for schedule(dynamic)
+                for(Index k = 0; k < (Index)groups.size(); k++) {
+                    const Index begin = groups[k].first, end = groups[k].second;
+                    const Index n = matrices[order[begin]].rows();
+
+                    if (!useJacobi(n)) {
+                        for(Index i = begin; i < end; i++) {
+                            const Index p = order[i];
+                            if (n == 0) {
+                                eigenvalues[p].resize(0);
+                                eigenvectors[p].resize(0, 0);
+                                continue;
+                            }
+                            Eigen::SelfAdjointEigenSolver<ScalarMatrix> evd(matrices[p].template selfadjointView<Eigen::Lower>());
+                            eigenvalues[p] = evd.eigenvalues();
+                            eigenvectors[p] = evd.eigenvectors();
+                        }
+                        continue;
+                    }
+
+                    jacobi(kernels, matrices, order, begin, end, a, v, eigenvalues, eigenvectors);
+                }
+            }
+        }
+
+        //! Thin EVD of each matrix (see ThinEVD)
+        void thin(const std::vector<ScalarMatrix> &matrices,
+                  std::vector<ScalarMatrix> &eigenvectors,
+                  std::vector<RealVector> &eigenvalues) const {
+            std::vector<RealVector> d;
+            std::vector<ScalarMatrix> u;
+            compute(matrices, d, u);
+
+            eigenvectors.resize(matrices.size());
+            eigenvalues.resize(matrices.size());
+            for(size_t i = 0; i < matrices.size(); i++)
+                ThinEVD<ScalarMatrix>::run(d[i], u[i], eigenvectors[i], eigenvalues[i]);
+        }
+
+        /**
+         * @brief Orthonormalizes decompositions (see Orthonormalize)
+         *
+         * The EVDs of the Gram matrices of decompositions with positive eigenvalues are
+         * batched; the other decompositions are orthonormalized one by one.
+         */
+        void orthonormalize(std::vector< Decomposition<Scalar> > &decompositions) const {
+            std::vector<Index> batched;
+            std::vector<ScalarMatrix> grams;
+
+            for(size_t i = 0; i < decompositions.size(); i++) {
+                Decomposition<Scalar> &d = decompositions[i];
+                if (d.orthonormal)
+                    continue;
+
+                if (d.mD.rows() > 0 && RealVector(d.mD).minCoeff() < 0) {
+                    Orthonormalize<Scalar>::run(d.fs, d.mX, d.mY, d.mD);
+                    d.orthonormal = true;
+                } else {
+                    batched.push_back(i);
+                    grams.push_back(d.fs->k(d.mX, d.mY, RealAltVector(RealVector(d.mD).cwiseSqrt())));
+                }
+            }
+
+            std::vector<ScalarMatrix> mU;
+            std::vector<RealVector> mL;
+            thin(grams, mU, mL);
+
+            // Y D Y^T = (Y D^1/2 U L^-1/2) L (Y D^1/2 U L^-1/2)^T
+            for(size_t k = 0; k < batched.size(); k++) {
+                Decomposition<Scalar> &d = decompositions[batched[k]];
+                RealVector mD(d.mD);
+                ScalarMatrix mY(d.mY);
+                mL[k] = mL[k].cwiseAbs(); // just in case of small rounding errors
+                mY = mY * mD.cwiseSqrt().asDiagonal() * mU[k] * mL[k].cwiseSqrt().cwiseInverse().asDiagonal();
+
+                d.mY.swap(mY);
+                d.mD.swap(mL[k]);
+                d.orthonormal = true;
+            }
+        }
+
+    private:
+        //! True if matrices of size n are decomposed with the Jacobi kernel
+        bool useJacobi(Index n) const {
+            return !boost::is_complex<Scalar>::value && n > 0 && n <= maxSize;
+        }
+
+        //! Decomposes the matrices order[begin..end[ with the Jacobi kernel
+        void jacobi(const cpu::Kernels &kernels, const std::vector<ScalarMatrix> &matrices,
+                    const std::vector<Index> &order, Index begin, Index end,
+                    std::vector<double> &a, std::vector<double> &v,
+                    std::vector<RealVector> &eigenvalues,
+                    std::vector<ScalarMatrix> &eigenvectors) const {
+            const Index L = cpu::JACOBI_LANES;
+            const Index n = matrices[order[begin]].rows();
+
+            // Interleaves the matrices (unused lanes are null matrices)
+            a.assign(n * n * L, 0.);
+            v.assign(n * n * L, 0.);
+            for(Index i = 0; i < n; i++)
+                for(Index l = 0; l < L; l++)
+                    v[(i * n + i) * L + l] = 1.;
+
+            for(Index l = 0; l < end - begin; l++) {
+                const ScalarMatrix &m = matrices[order[begin + l]];
+                for(Index j = 0; j < n; j++)
+                    for(Index i = j; i < n; i++)
+                        a[(i * n + j) * L + l] = a[(j * n + i) * L + l] = (double)std::real(m(i, j));
+            }
+
+            if (kernels.jacobi(&a[0], &v[0], n, maxSweeps) == maxSweeps) {
+                KQP_HLOG_DEBUG_F("The Jacobi EVD did not converge in %d sweeps (size %d)", %maxSweeps %n);
+            }
+
+            // Sorts the eigenvalues
+            std::vector<Index> indices(n);
+            for(Index l = 0; l < end - begin; l++) {
+                const Index p = order[begin + l];
+                for(Index i = 0; i < n; i++)
+                    indices[i] = i;
+                std::sort(indices.begin(), indices.end(), [&a, n, L, l](Index i, Index j) {
+                    return a[(i * n + i) * L + l] < a[(j * n + j) * L + l];
+                });
+
+                RealVector &d = eigenvalues[p];
+                ScalarMatrix &u = eigenvectors[p];
+                d.resize(n);
+                u.resize(n, n);
+                for(Index j = 0; j < n; j++) {
+                    const Index c = indices[j];
+                    d[j] = (Real)a[(c * n + c) * L + l];
+                    for(Index i = 0; i < n; i++)
+                        u(i, j) = (Scalar)v[(i * n + c) * L + l];
+                }
+            }
+        }
+
+        //! Maximum size of the matrices for the Jacobi kernel
+        Index maxSize;
+
+        //! Maximum number of Jacobi sweeps
+        int maxSweeps;
+    };
+}
+
+#ifndef SWIG
+#define KQP_SCALAR_GEN(scalar) extern template class kqp::BatchedEVD<scalar>;
+#include <kqp/for_all_scalar_gen.h.inc>
+#endif
+
+#endif
@@ -0,0 +1,334 @@
+/*
+ This file is part of the Kernel Quantum Probability library (KQP).
+
+ KQP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ KQP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with KQP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __KQP_CHECKPOINT_H__
+#define __KQP_CHECKPOINT_H__
+
+#include <complex>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include <kqp/decomposition.hpp>
+#include <kqp/space_factory.hpp>
+#include <kqp/feature_matrix/dense.hpp>
+#include <kqp/feature_matrix/sparse.hpp>
+#include <kqp/feature_matrix/mapped.hpp>
+
+namespace kqp {
+
+    /**
+     * @brief Header of a checkpoint file.
+     *
+     * A checkpoint is a set of named blocks (matrices, values or text). The file is made of
+     * this 64 bytes header, the blocks (each one starting on a 64 bytes boundary, in column-major order)
+     * and a table of entries describing them. All the values are stored in the native byte order.
+     */
+    struct CheckpointHeader {
+        //! The magic string "KQPCKPT" (null terminated)
+        char magic[8];
+        //! Format version (1)
+        uint32_t version;
+        uint32_t reserved;
+        //! Number of entries
+        uint64_t entries;
+        //! Offset of the table of entries
+        uint64_t tableOffset;
+        //! Size of the file (to detect truncated files)
+        uint64_t size;
+        char padding[24];
+
+        static const char *MAGIC() { return "KQPCKPT"; }
+        enum {
+            //! Current version of the format
+            VERSION = 1,
+            //! Alignment of the blocks
+            ALIGNMENT = 64
+        };
+    };
+
+    //! An entry of the checkpoint table (128 bytes)
+    struct CheckpointEntry {
+        //! Kind of the elements
+        enum Kind { INTEGER = 0, REAL = 1, COMPLEX = 2, TEXT = 3 };
+
+        //! Name of the block (null terminated)
+        char name[96];
+        //! Kind of the elements
+        uint32_t kind;
+        //! Size of an element (in bytes)
+        uint32_t elementSize;
+        //! Dimensions of the block
+        uint64_t rows, cols;
+        //! Offset of the block (from the start of the file)
+        uint64_t offset;
+    };
+
+    //! Kind of the elements of a checkpoint block
+    template<typename T> struct CheckpointKind;
+    template<> struct CheckpointKind<int32_t> { enum { value = CheckpointEntry::INTEGER }; };
+    template<> struct CheckpointKind<int64_t> { enum { value = CheckpointEntry::INTEGER }; };
+    template<> struct CheckpointKind<float> { enum { value = CheckpointEntry::REAL }; };
+    template<> struct CheckpointKind<double> { enum { value = CheckpointEntry::REAL }; };
+    template<> struct CheckpointKind< std::complex<float> > { enum { value = CheckpointEntry::COMPLEX }; };
+    template<> struct CheckpointKind< std::complex<double> > { enum { value = CheckpointEntry::COMPLEX }; };
+    template<> struct CheckpointKind<char> { enum { value = CheckpointEntry::TEXT }; };
+
+
+    /**
+     * @brief Writes a checkpoint file.
+     *
+     * The blocks are written to a temporary file (the path followed by ".tmp"), which
+     * replaces the checkpoint when commit() is called: a crash while writing never leaves
+     * a partial checkpoint. The temporary file is removed if the writer is destroyed
+     * before commit().
+     */
+    class CheckpointWriter {
+    public:
+        explicit CheckpointWriter(const std::string &path);
+        ~CheckpointWriter();
+
+        //! Writes a matrix
+        template<typename Derived>
+        void writeMatrix(const std::string &name, const Eigen::DenseBase<Derived> &m) {
+            typedef typename Derived::Scalar T;
+            begin(name, CheckpointKind<T>::value, sizeof(T), m.rows(), m.cols());
+            Eigen::Matrix<T, Eigen::Dynamic, 1> column;
+            for(Index j = 0; j < m.cols(); j++) {
+                column = m.col(j);
+                append(column.data(), column.size() * sizeof(T));
+            }
+        }
+
+        //! Writes a single value
+        template<typename T>
+        void writeValue(const std::string &name, T value) {
+            begin(name, CheckpointKind<T>::value, sizeof(T), 1, 1);
+            append(&value, sizeof(T));
+        }
+
+        //! Writes a text
+        void writeText(const std::string &name, const std::string &text);
+
+        //! Writes a feature matrix (only dense and sparse matrices are supported)
+        template<typename Scalar>
+        void writeFeatures(const std::string &name, const boost::shared_ptr< FeatureMatrixBase<Scalar> > &mX) {
+            if (const Dense<Scalar> *dense = dynamic_cast<const Dense<Scalar> *>(mX.get())) {
+                writeText(name + ".type", "dense");
+                if (dense->isCompact())
+                    writeMatrix(name, dense->toDense());
+                else
+                    writeMatrix(name, dense->view());
+            } else if (const Sparse<Scalar> *sparse = dynamic_cast<const Sparse<Scalar> *>(mX.get())) {
+                typedef typename Sparse<Scalar>::StorageIndex StorageIndex;
+                typename Sparse<Scalar>::ConstView view = sparse->view();
+                const StorageIndex *outer = view.outerIndexPtr();
+                const StorageIndex start = outer[0], nnz = outer[view.cols()] - start;
+
+                writeText(name + ".type", "sparse");
+                writeValue<int64_t>(name + ".rows", view.rows());
+                writeMatrix(name + ".outer", (Eigen::Map<const Eigen::Matrix<StorageIndex, Eigen::Dynamic, 1>>(outer, view.cols() + 1).array() - start).matrix());
+                writeMatrix(name + ".inner", Eigen::Map<const Eigen::Matrix<StorageIndex, Eigen::Dynamic, 1>>(view.innerIndexPtr() + start, nnz));
+                writeMatrix(name + ".values", Eigen::Map<const Eigen::Matrix<Scalar, Eigen::Dynamic, 1>>(view.valuePtr() + start, nnz));
+            } else
+                KQP_THROW_EXCEPTION_F(not_implemented_exception, "Cannot checkpoint feature matrices of type %s", %KQP_DEMANGLE(*mX));
+        }
+
+        //! Writes a dense or identity matrix
+        template<typename Scalar>
+        void writeAlt(const std::string &name, const typename ScalarDefinitions<Scalar>::ScalarAltMatrix &m) {
+            if (m.isT1())
+                writeMatrix(name, m.t1());
+            else
+                writeMatrix(name + ".identity", Eigen::Matrix<int64_t, 1, 2>(m.rows(), m.cols()));
+        }
+
+        /**
+         * @brief Writes a decomposition
+         * @param space If false, the feature space is not saved (it should then be given when reading)
+         */
+        template<typename Scalar>
+        void writeDecomposition(const std::string &prefix, const Decomposition<Scalar> &d, bool space = true) {
+            if (space && d.fs) {
+                pugi::xml_document doc;
+                d.fs->save(doc);
+                std::ostringstream buffer;
+                doc.save(buffer);
+                writeText(prefix + "space", buffer.str());
+            }
+            writeFeatures<Scalar>(prefix + "mX", d.mX);
+            writeAlt<Scalar>(prefix + "mY", d.mY);
+            writeMatrix(prefix + "mD", Eigen::Matrix<typename Eigen::NumTraits<Scalar>::Real, Eigen::Dynamic, 1>(d.mD));
+            writeValue<int32_t>(prefix + "orthonormal", d.orthonormal);
+            writeValue<int64_t>(prefix + "updates", d.updateCount);
+        }
+
+        //! Writes the table of entries and replaces the checkpoint file
+        void commit();
+
+    private:
+        //! Starts a new block
+        void begin(const std::string &name, int kind, std::size_t elementSize, uint64_t rows, uint64_t cols);
+
+        //! Appends data to the file
+        void append(const void *data, std::size_t size);
+
+        std::string m_path, m_temporary;
+        int m_fd;
+        uint64_t m_position;
+        std::vector<CheckpointEntry> m_entries;
+    };
+
+
+    /**
+     * @brief Reads a checkpoint file.
+     *
+     * The file is mapped in memory: matrices are returned as maps on the file (no copy), which
+     * remain valid as long as the reader exists. Dense and sparse feature matrices are also
+     * views on the file, which stays mapped as long as they (or their copies) exist.
+     */
+    class CheckpointReader {
+    public:
+        explicit CheckpointReader(const std::string &path);
+
+        //! Returns true if the checkpoint has a block with this name
+        bool has(const std::string &name) const;
+
+        //! Names of the blocks
+        std::vector<std::string> names() const;
+
+        //! Returns a matrix (without copy)
+        template<typename T>
+        Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>> matrix(const std::string &name) const {
+            const CheckpointEntry &e = entry(name, CheckpointKind<T>::value, sizeof(T));
+            return Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>>(m_file->at<T>(e.offset), e.rows, e.cols);
+        }
+
+        //! Returns a single value
+        template<typename T>
+        T value(const std::string &name) const {
+            Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>> m = matrix<T>(name);
+            if (m.size() != 1)
+                KQP_THROW_EXCEPTION_F(illegal_argument_exception, "Block %s of %s is not a single value", %name %m_file->path());
+            return m(0, 0);
+        }
+
+        //! Returns a text
+        std::string text(const std::string &name) const;
+
+        /**
+         * @brief Returns a feature matrix (a view on the file)
+         *
+         * Since the arrays of the file are not copied, their consistency is checked.
+         * @param dimension The dimension of the pre-images, if known (positive)
+         */
+        template<typename Scalar>
+        boost::shared_ptr< FeatureMatrixBase<Scalar> > features(const std::string &name, Index dimension = -1) const {
+            const std::string type = text(name + ".type");
+            boost::shared_ptr<void> region = m_file->region();
+            ReleaseFunction release = [region]() {};
+
+            if (type == "dense") {
+                Eigen::Map<const Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>> m = matrix<Scalar>(name);
+                checkDimension(name, m.rows(), m.cols(), dimension);
+                return Dense<Scalar>::wrap(m.data(), m.rows(), m.cols(), release);
+            }
+            if (type == "sparse") {
+                typedef typename Sparse<Scalar>::StorageIndex StorageIndex;
+                auto outer = matrix<StorageIndex>(name + ".outer");
+                auto inner = matrix<StorageIndex>(name + ".inner");
+                auto values = matrix<Scalar>(name + ".values");
+                const int64_t rows = value<int64_t>(name + ".rows");
+                const Index cols = outer.size() - 1;
+
+                const char *error = 0;
+                if (cols < 0 || outer(0) != 0)
+                    error = "the outer indices should start with 0";
+                for(Index j = 0; !error && j < cols; j++)
+                    if (outer(j + 1) < outer(j)) 
+                        error = "the outer indices should be non decreasing";
+                if (!error && (outer(cols) != inner.size() || outer(cols) != values.size()))
+                    error = "the number of inner indices and values should be the last outer index";
+                for(Index k = 0; !error && k < inner.size(); k++)
+                    if (inner(k) < 0 || inner(k) >= rows) 
+                        error = "the inner indices should be between 0 and the number of rows";
+                if (error)
+                    KQP_THROW_EXCEPTION_F(illegal_argument_exception, "Invalid sparse matrix %s in %s: %s", %name %m_file->path() %error);
+
+                checkDimension(name, rows, cols, dimension);
+                return Sparse<Scalar>::wrap(rows, cols, outer.data(), inner.data(), values.data(), release);
+            }
+            KQP_THROW_EXCEPTION_F(illegal_argument_exception, "Unknown feature matrix type %s in %s", %type %m_file->path());
+        }
+
+        //! Returns a dense or identity matrix (copied)
+        template<typename Scalar>
+        typename ScalarDefinitions<Scalar>::ScalarAltMatrix alt(const std::string &name) const {
+            typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> ScalarMatrix;
+            if (has(name + ".identity")) {
+                auto size = matrix<int64_t>(name + ".identity");
+                return Eigen::Identity<Scalar>(size(0, 0), size(0, 1));
+            }
+            return ScalarMatrix(matrix<Scalar>(name));
+        }
+
+        /**
+         * @brief Returns a decomposition
+         *
+         * The pre-images are a view on the file, while the mixture and diagonal matrices are copied.
+         * @param fs The feature space, or null to use the one saved in the checkpoint (its type
+         * should be registered in the SpaceFactory)
+         */
+        template<typename Scalar>
+        Decomposition<Scalar> decomposition(const std::string &prefix,
+                                            const boost::shared_ptr< SpaceBase<Scalar> > &fs = boost::shared_ptr< SpaceBase<Scalar> >()) const {
+            typedef typename Eigen::NumTraits<Scalar>::Real Real;
+            Decomposition<Scalar> d;
+            d.fs = fs ? fs : kqp::our_dynamic_cast< SpaceBase<Scalar> >(SpaceFactory::loadFromString(text(prefix + "space")));
+            d.mX = features<Scalar>(prefix + "mX", d.fs->dimension());
+            d.mY = alt<Scalar>(prefix + "mY");
+            d.mD = Eigen::Matrix<Real, Eigen::Dynamic, 1>(matrix<Real>(prefix + "mD"));
+            d.orthonormal = value<int32_t>(prefix + "orthonormal");
+            d.updateCount = value<int64_t>(prefix + "updates");
+            if (!d.check())
+                KQP_THROW_EXCEPTION_F(illegal_argument_exception, "Inconsistent decomposition %s in %s", %prefix %m_file->path());
+            return d;
+        }
+
+        //! The mapping of the file
+        const boost::shared_ptr<void> &region() const {
+            return m_file->region();
+        }
+
+    private:
+        //! Checks the dimension of the pre-images of a (non empty) feature matrix
+        void checkDimension(const std::string &name, Index rows, Index cols, Index dimension) const {
+            if (dimension > 0 && cols > 0 && rows != dimension)
+                KQP_THROW_EXCEPTION_F(illegal_argument_exception, "The pre-images of %s in %s have dimension %d instead of %d", 
+                                      %name %m_file->path() %rows %dimension);
+        }
+
+        //! Returns an entry, checking its type
+        const CheckpointEntry &entry(const std::string &name, int kind, std::size_t elementSize) const;
+
+        boost::shared_ptr<MappedFile> m_file;
+        std::map<std::string, const CheckpointEntry *> m_index;
+    };
+}
+
+#endif
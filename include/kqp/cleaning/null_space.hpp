@@ -167,6 +167,102 @@ namespace kqp {
             return mF->subset(selection.begin(), selection.end());
         }
         
+        /**
+         * @brief Computes the null space of a Gram matrix with a LU decomposition
+         * @return The rank of the Gram matrix
+         */
+        static Index nullSpace(const ScalarMatrix &gram, Real epsilon, ScalarMatrix &kernel, RealVector &diagonal) {
+            Eigen::FullPivLU<ScalarMatrix> lu_decomposition(gram);
+
+            // Set the thresholds according to the same heuristic than Eigen
+            lu_decomposition.setThreshold(epsilon * lu_decomposition.matrixLU().diagonalSize());
+            
+            Index rank = lu_decomposition.rank();
+            if (rank < gram.rows())
+                kernel = lu_decomposition.kernel();
+            diagonal = gram.diagonal().real();
+            return rank;
+        }
+        
+        /**
+         * @brief Computes the null space of a sparse Gram matrix
+         *
+         * Pre-images are partitioned into the connected components of the graph whose edges are the
+         * non null inner products: the Gram matrix is block diagonal (up to a permutation), and 
+         * the null space is the union of the null spaces of the (dense) blocks.
+         * @return The rank of the Gram matrix
+         */
+        static Index nullSpace(const Eigen::SparseMatrix<Scalar> &gram, Real epsilon, ScalarMatrix &kernel, RealVector &diagonal) {
+            typedef typename Eigen::SparseMatrix<Scalar>::InnerIterator Iterator;
+            const Index N = gram.rows();
+            
+            // Connected components (union-find)
+            std::vector<Index> parent(N);
+            for(Index i = 0; i < N; i++) 
+                parent[i] = i;
+            struct Find {
+                static Index root(std::vector<Index> &parent, Index i) {
+                    while (parent[i] != i) 
+                        i = parent[i] = parent[parent[i]];
+                    return i;
+                }
+            };
+            
+            diagonal = RealVector::Zero(N);
+            for(Index j = 0; j < N; j++)
+                for(Iterator it(gram, j); it; ++it) {
+                    if (it.row() == j) 
+                        diagonal[j] = Eigen::internal::real(it.value());
+                    else if (it.value() != Scalar(0)) 
+                        parent[Find::root(parent, it.row())] = Find::root(parent, j);
+                }
+            
+            std::vector< std::vector<Index> > components;
+            std::vector<Index> component(N, -1), position(N);
+            for(Index i = 0; i < N; i++) {
+                Index root = Find::root(parent, i);
+                if (component[root] < 0) {
+                    component[root] = components.size();
+                    components.push_back(std::vector<Index>());
+                }
+                position[i] = components[component[root]].size();
+                components[component[root]].push_back(i);
+            }
+            
+            // Null space of each block
+            Index rank = 0;
+            RealVector blockDiagonal;
+            std::vector<ScalarMatrix> kernels(components.size());
+            Index kernelSize = 0;
+            for(size_t c = 0; c < components.size(); c++) {
+                const std::vector<Index> &indices = components[c];
+                const Index n = indices.size();
+                
+                ScalarMatrix block = ScalarMatrix::Zero(n, n);
+                for(Index j = 0; j < n; j++)
+                    for(Iterator it(gram, indices[j]); it; ++it)
+                        block(position[it.row()], j) = it.value();
+                
+                Index blockRank = nullSpace(block, epsilon, kernels[c], blockDiagonal);
+                rank += blockRank;
+                if (blockRank < n) 
+                    kernelSize += kernels[c].cols();
+                else 
+                    kernels[c].resize(0, 0);
+            }
+            
+            // Assemble the null space basis
+            kernel = ScalarMatrix::Zero(N, kernelSize);
+            Index offset = 0;
+            for(size_t c = 0; c < components.size(); c++) {
+                for(Index k = 0; k < kernels[c].cols(); k++, offset++)
+                    for(size_t i = 0; i < components[c].size(); i++)
+                        kernel(components[c][i], offset) = kernels[c](i, k);
+            }
+            
+            return rank;
+        }
+        
         /**
          * @brief Removes unuseful pre-images 
          *
@@ -183,21 +279,19 @@ namespace kqp {
             Index N = mY.rows();
             assert(N == mF->size());
             
-            // LDL decomposition (stores the L^T matrix)
-            Eigen::FullPivLU<ScalarMatrix> lu_decomposition(fs->k(mF));
-
-            // Set the thresholds according to the same heuristic than Eigen
-            lu_decomposition.setThreshold(epsilon * lu_decomposition.matrixLU().diagonalSize());
+            // Null space of the Gram matrix (block by block when it is sparse)
+            ScalarMatrix kernel;
+            RealVector diagonal;
+            Index rank = fs->hasSparseGram() ? nullSpace(fs->sparseK(*mF), epsilon, kernel, diagonal) 
+                                             : nullSpace(fs->k(mF), epsilon, kernel, diagonal);
             
             // Stop if full rank
-            Index rank = lu_decomposition.rank();
             KQP_HLOG_DEBUG_F("Rank of LU decomposition is %d/%d [epsilon=%g]", %rank %N %epsilon);
             if (rank == N) 
                 return;
             
             // Remove pre-images using the kernel
-            ScalarMatrix kernel = lu_decomposition.kernel();
-            RealVector weights = mY.rowwise().squaredNorm().array() * fs->k(mF).diagonal().array().abs();
+            RealVector weights = mY.rowwise().squaredNorm().array() * diagonal.array().abs();
             Eigen::PermutationMatrix<Dynamic, Dynamic, Index> mP;
             *mF = std::move(*remove(mF, kernel, mP, weights));
             
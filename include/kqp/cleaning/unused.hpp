@@ -56,6 +56,7 @@ namespace kqp {
         
         virtual void cleanup(Decomposition<Scalar> &d) const override {
             run(d.mX, d.mY);
+            d.sparsify();
         }
         
         /**
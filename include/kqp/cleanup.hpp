@@ -95,6 +95,7 @@ DEFINE_KQP_HLOGGER("kqp.cleaner");
                 d.mY.conservativeResize(list.getRank(), list.getRank());
             } else {
                 select_columns(list.getSelected(), d.mY, d.mY);
+                d.sparsify();
             }
             
         }
@@ -0,0 +1,90 @@
+/*
+ This file is part of the Kernel Quantum Probability library (KQP).
+
+ KQP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ KQP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with KQP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __KQP_CPU_H__
+#define __KQP_CPU_H__
+
+#include <cstddef>
+#include <stdint.h>
+
+namespace kqp {
+    /**
+     * @brief Runtime selection of the numerical kernels
+     *
+     * The hot loops of KQP (exponentials of the Gaussian kernel, evaluation of the secular
+     * equation, sparse inner products, batched Jacobi EVDs, half precision conversion) are compiled several times, once per instruction set level,
+     * in separate translation units. The best level supported by both the build and the host
+     * is selected at the first use; it can be lowered with the KQP_CPU environment variable
+     * (baseline, avx2 or avx512) or with setLevel().
+     */
+    namespace cpu {
+        //! Instruction set levels (baseline is the one of the build, i.e. SSE2 on x86-64)
+        enum Level {
+            BASELINE,
+            AVX2,
+            AVX512
+        };
+
+        //! Name of a level
+        const char *name(Level level);
+
+        //! Best level supported by the host and compiled in the library
+        Level detect();
+
+        //! Current level
+        Level level();
+
+        //! Sets the current level (capped by detect()), and returns the level in use
+        Level setLevel(Level level);
+
+        //! Number of problems interleaved by the batched Jacobi kernel
+        const std::ptrdiff_t JACOBI_LANES = 8;
+
+        //! The numerical kernels
+        struct Kernels {
+            //! Level of the kernels
+            Level level;
+
+            //! In-place exponential of an array (results below 1e-307 are flushed to zero)
+            void (*exp)(double *x, std::ptrdiff_t n);
+
+            //! Secular equation terms \f$ \sum_i z^2_i / (d_i - \mathrm{shift}) \f$
+            double (*secular)(const double *z2, const double *d, std::ptrdiff_t n, double shift);
+
+            //! Sparse inner product \f$ \sum_i \mathrm{values}_i x_{\mathrm{indices}_i} \f$
+            double (*gatherDot)(const int *indices, const double *values, std::ptrdiff_t n, const double *x);
+
+            /**
+             * Cyclic Jacobi EVD of JACOBI_LANES symmetric n x n matrices, interleaved: element (i,j) of
+             * problem l is at index (i * n + j) * JACOBI_LANES + l. On return, the diagonal of a holds the
+             * (unsorted) eigenvalues and the columns of v the eigenvectors (v should be initialized, e.g.
+             * with the identity). Returns the number of sweeps.
+             */
+            int (*jacobi)(double *a, double *v, std::ptrdiff_t n, int maxSweeps);
+
+            //! Conversion of IEEE half precision values to double (with F16C from the AVX2 level)
+            void (*decodeHalf)(const uint16_t *in, std::ptrdiff_t n, double *out);
+        };
+
+        //! Kernels of the current level
+        const Kernels &kernels();
+
+        //! Kernels of a given level (capped by detect())
+        const Kernels &kernels(Level level);
+    }
+}
+
+#endif
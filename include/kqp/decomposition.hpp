@@ -116,6 +116,16 @@ struct Decomposition
         return fs->k(mX, mY, mD, other.mX, other.mY, other.mD);
     }
 
+    /**
+     * Gives the mixture matrix a sparse representation (used in inner
+     * products and products with the mixture matrix) if its ratio of non null coefficients is small enough
+     *
+     * @return true if mY has a sparse representation
+     */
+    bool sparsify(Real maxFillRatio = 0.1) {
+        return mY.sparsify(maxFillRatio);
+    }
+
     /** Check that the decomposition is valid */
     bool check() const {
         return mX->size() == mY.rows() && mY.cols() == mD.rows();
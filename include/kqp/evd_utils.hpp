@@ -41,11 +41,19 @@ namespace kqp {
                         RealVector &eigenvalues,
                         ScalarMatrix *nullEigenvectors = nullptr,
                         Real threshold = -1) {
+            run(evd.eigenvalues(), evd.eigenvectors(), eigenvectors, eigenvalues, nullEigenvectors, threshold);
+        }
+        
+        //! Thin EVD from a full EVD (eigenvalues sorted by increasing order)
+        static void run(const RealVector &d, const ScalarMatrix &vectors,
+                        ScalarMatrix &eigenvectors, 
+                        RealVector &eigenvalues,
+                        ScalarMatrix *nullEigenvectors = nullptr,
+                        Real threshold = -1) {
             
             // We expect eigenvalues to be sorted by increasing order
-            Index dimension = evd.eigenvectors().rows();
+            Index dimension = vectors.rows();
             
-            const Eigen::Matrix<Real,Dynamic,1> &d = evd.eigenvalues();
             if (threshold < 0)
                 threshold = Eigen::NumTraits<Scalar>::epsilon() * (Real)d.size() *  d.cwiseAbs().maxCoeff();
             
@@ -66,11 +74,11 @@ namespace kqp {
             eigenvalues.tail(positives) = d.tail(positives);
             
             eigenvectors.resize(dimension, positives + negatives);
-            eigenvectors.leftCols(negatives) = evd.eigenvectors().leftCols(negatives);
-            eigenvectors.rightCols(positives) = evd.eigenvectors().rightCols(positives);
+            eigenvectors.leftCols(negatives) = vectors.leftCols(negatives);
+            eigenvectors.rightCols(positives) = vectors.rightCols(positives);
             
             if (nullEigenvectors) {
-                *nullEigenvectors = evd.eigenvectors().block(0, negatives, dimension, zeros);
+                *nullEigenvectors = vectors.block(0, negatives, dimension, zeros);
             }
         }
         
@@ -103,6 +111,45 @@ namespace kqp {
     
     
     
+    /**
+     * @brief Thin EVD of a signed sum of rank-one operators
+     *
+     * Given the Gram matrix \f$G = F^\dagger F\f$ of n vectors and their signs \f$S\f$,
+     * computes \f$Y\f$ and \f$D\f$ such that \f$ F S F^\dagger = F Y D Y^\dagger F^\dagger \f$ 
+     * and \f$F Y\f$ is orthonormal. 
+     *
+     * If \f$G = U \Lambda U^\dagger\f$, the operator restricted to the orthonormal basis
+     * \f$F U \Lambda^{-1/2}\f$ is \f$\Lambda^{1/2} U^\dagger S U \Lambda^{1/2}\f$: its EVD \f$V D V^\dagger\f$ 
+     * gives \f$Y = U \Lambda^{-1/2} V\f$. Opposite vectors thus cancel out exactly (up to rounding errors).
+     */
+    template<typename Scalar>
+    struct SignedEVD {
+        KQP_SCALAR_TYPEDEFS(Scalar);
+        
+        /**
+         * @param gram The Gram matrix (only the lower part is used)
+         * @param signs The signs (1 or -1) of the vectors
+         */
+        static void run(const ScalarMatrix &gram, const RealVector &signs, ScalarMatrix &mY, RealVector &mD) {
+            // Basis of the space spanned by F
+            Eigen::SelfAdjointEigenSolver<ScalarMatrix> evd(gram.template selfadjointView<Eigen::Lower>());
+            ScalarMatrix mU;
+            RealVector mL;
+            ThinEVD<ScalarMatrix>::run(evd, mU, mL);
+            mL = mL.cwiseAbs().cwiseSqrt();
+            
+            // Operator in this basis; the null space threshold is relative to the Gram matrix,
+            // since the operator can be null
+            ScalarMatrix m = mL.asDiagonal() * (mU.adjoint() * signs.template cast<Scalar>().asDiagonal() * mU) * mL.asDiagonal();
+            Real threshold = Eigen::NumTraits<Scalar>::epsilon() * (Real)gram.rows() * (mL.size() > 0 ? mL.maxCoeff() * mL.maxCoeff() : 0);
+            Eigen::SelfAdjointEigenSolver<ScalarMatrix> evd_m(m);
+            ScalarMatrix mV;
+            ThinEVD<ScalarMatrix>::run(evd_m, mV, mD, nullptr, threshold);
+            
+            mY.noalias() = mU * mL.cwiseInverse().asDiagonal() * mV;
+        }
+    };
+    
     // template<typename Scalar, typename Cond = void> struct Orthonormalize;
     
     template<typename Scalar>
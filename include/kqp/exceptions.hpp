@@ -88,6 +88,9 @@ namespace kqp {
     /** Illegal argument */
     class bad_cast_exception : public virtual exception {};
 
+    /** Input/output error */
+    class io_exception : public virtual exception {};
+
     #undef BOOST_THROW_EXCEPTION
     #define BOOST_THROW_EXCEPTION(x) kqp::throw_exception_(x,BOOST_CURRENT_FUNCTION,__FILE__,__LINE__)
 
@@ -21,6 +21,7 @@
 #include <pugixml.hpp>
 #include <kqp/kqp.hpp>
 #include <boost/shared_ptr.hpp>
+#include <boost/function.hpp>
 #include <kqp/alt_matrix.hpp>
 
 
@@ -114,6 +115,25 @@ template<> struct ScalarInfo<std::complex<float> >
 template<typename Scalar> class FeatureMatrixBase;
 template<typename Scalar> class SpaceBase;
 
+#ifndef SWIG
+//! Function called when some external memory is not used anymore
+typedef boost::function<void ()> ReleaseFunction;
+
+/**
+ * @brief Returns an holder for external memory 
+ *
+ * The release function (if any) is called when the last copy of the holder is destroyed.
+ */
+inline boost::shared_ptr<void> externalHolder(const void *data, const ReleaseFunction &release) {
+    struct Release {
+        ReleaseFunction release;
+        Release(const ReleaseFunction &release) : release(release) {}
+        void operator()(void *) const { if (release) release(); }
+    };
+    return boost::shared_ptr<void>(const_cast<void*>(data), Release(release));
+}
+#endif
+
 
 /**
   * Store for kernel values when computing kernels 
@@ -132,6 +152,49 @@ public:
     Scalar _inner, _innerX, _innerY;
 };
 
+#ifndef SWIG
+/**
+ * @brief Kernel values for a block of pairs (x,y)
+ *
+ * Column k stores the kernel value k (see SpaceBase::numberOfKernelValues) of every pair,
+ * so that a kernel value can be computed for the whole block with vectorized expressions.
+ */
+template<typename Scalar> class KernelValuesBlock {
+public:
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> ScalarMatrix;
+    typedef typename ScalarMatrix::ColXpr Column;
+    typedef typename ScalarMatrix::ConstColXpr ConstColumn;
+
+    KernelValuesBlock() {}
+    KernelValuesBlock(Index size, int count) : _inner(size, count), _innerX(size, count), _innerY(size, count) {}
+
+    //! Number of pairs
+    Index size() const { return _inner.rows(); }
+
+    inline ConstColumn inner(int k, int mode = 0) const { if (mode == -1) return _innerX.col(k); return mode == 1 ? _innerY.col(k) : _inner.col(k); }
+    inline ConstColumn innerX(int k, int mode = 0) const { if (mode == 1) return _innerY.col(k); return _innerX.col(k); }
+    inline ConstColumn innerY(int k, int mode = 0) const { if (mode == -1) return _innerX.col(k); return _innerY.col(k); }
+
+    //! Copies the kernel values of a pair
+    void get(Index i, std::vector< KernelValues<Scalar> > &values) const {
+        values.resize(_inner.cols());
+        for(Index k = 0; k < _inner.cols(); k++)
+            values[k] = KernelValues<Scalar>(_inner(i, k), _innerX(i, k), _innerY(i, k));
+    }
+
+    //! Sets the kernel values of a pair
+    void set(Index i, const std::vector< KernelValues<Scalar> > &values) {
+        for(Index k = 0; k < _inner.cols(); k++) {
+            _inner(i, k) = values[k]._inner;
+            _innerX(i, k) = values[k]._innerX;
+            _innerY(i, k) = values[k]._innerY;
+        }
+    }
+
+    ScalarMatrix _inner, _innerX, _innerY;
+};
+#endif
+
 
 /**
  * @brief Base for all feature matrix classes
@@ -234,6 +297,10 @@ class SpaceBase : public AbstractSpace
 public:
     KQP_SCALAR_TYPEDEFS(Scalar);
 
+#ifndef SWIG
+    //! Type of the feature matrices (spaces redefine it when they have statically typed versions of k)
+    typedef FeatureMatrixBase<Scalar> FMatrixType;
+#endif
     
     static int &counter() { static int counter = 0; return counter; }
 
@@ -256,10 +323,28 @@ public:
     //! Gram matrix
     virtual const ScalarMatrix &k(const FMatrixBase &mX) const = 0;
 
+    /**
+     * @brief Returns whether Gram matrices are (mostly) sparse
+     *
+     * When true, builders and cleaners should use sparseK() rather than k()
+     */
+    virtual bool hasSparseGram() const
+    {
+        return false;
+    }
+
+#ifndef SWIG
+    //! Gram matrix as a sparse matrix (by default, a sparse view of the dense Gram matrix)
+    virtual Eigen::SparseMatrix<Scalar> sparseK(const FMatrixBase &mX) const
+    {
+        return k(mX).sparseView();
+    }
+#endif
+
     //! Inner products \f$D_1^\dagger Y_1^\dagger X_1^\dagger X_2 Y_2 D_2\f$
     virtual ScalarMatrix k(const FMatrixBase &mX, const ScalarAltMatrix &mY, const RealAltVector &mD) const
     {
-        return mD.asDiagonal() * mY.adjoint() * k(mX) * mY * mD.asDiagonal();
+        return mD.asDiagonal() * bilinear(mY, k(mX), mY) * mD.asDiagonal();
     }
 
     //! Inner products \f$D_1^\dagger Y_1^\dagger X_1^\dagger X_2 Y_2 D_2\f$
@@ -301,6 +386,39 @@ public:
 
     virtual void update(std::vector< KernelValues<Scalar> > &, int /* kOffset */ = 0) const {}
 
+#ifndef SWIG
+    /**
+     * \brief Update the partials for a block of pairs.
+     *
+     * Same as the single pair version, with one weight per pair: the partials are summed over the block.
+     * The default implementation calls the single pair version for each pair; the kernel values 
+     * computed by update() should be reused rather than recomputed.
+     */
+    virtual void updatePartials(const RealVector &alpha, std::vector<Real> &partials, int offset, 
+                                const KernelValuesBlock<Scalar> &kernelValues, int kOffset, int mode) const {
+        std::vector< KernelValues<Scalar> > values;
+        for(Index i = 0; i < kernelValues.size(); i++) {
+            kernelValues.get(i, values);
+            updatePartials(alpha[i], partials, offset, values, kOffset, mode);
+        }
+    }
+
+    void updatePartials(const RealVector &alpha, std::vector<Real> &partials, 
+        const KernelValuesBlock<Scalar> &kernelValues, int mode) const {
+        updatePartials(alpha, partials, 0, kernelValues, 0, mode);
+    }
+
+    //! Computes the kernel values of a block of pairs from the values of the leaves
+    virtual void update(KernelValuesBlock<Scalar> &kernelValues, int kOffset = 0) const {
+        std::vector< KernelValues<Scalar> > values;
+        for(Index i = 0; i < kernelValues.size(); i++) {
+            kernelValues.get(i, values);
+            update(values, kOffset);
+            kernelValues.set(i, values);
+        }
+    }
+#endif
+
     /**
      * Returns the number of parameters for this feature space
     */
@@ -491,6 +609,78 @@ private:
 };
 
 
+#ifndef SWIG
+/**
+ * @brief Statically typed access to a feature space
+ *
+ * The type of the feature space is checked once, when the object is built. Feature
+ * matrices are checked once with cast() (e.g. when they are added to a builder), and
+ * the inner products are then computed by the non virtual methods of Space. With 
+ * Space = SpaceBase<Scalar> (or any space without statically typed methods), this 
+ * is the polymorphic API.
+ */
+template<typename Scalar, typename Space = SpaceBase<Scalar> >
+class StaticSpace
+{
+public:
+    KQP_SCALAR_TYPEDEFS(Scalar);
+    typedef typename Space::FMatrixType FMatrixType;
+
+    StaticSpace(const FSpace &fs) : m_fs(fs), m_space(&kqp::our_dynamic_cast<const Space &>(*fs)) {}
+
+    //! The space
+    inline const Space &space() const { return *m_space; }
+
+    //! Casts a feature matrix of the space (throws an illegal_argument_exception if it is not one)
+    inline static const FMatrixType &cast(const FMatrixBase &mX)
+    {
+        const FMatrixType *m = dynamic_cast<const FMatrixType *>(&mX);
+        if (!m)
+            KQP_THROW_EXCEPTION_F(illegal_argument_exception, "Feature matrix %s is not a %s", %KQP_DEMANGLE(mX) %KQP_DEMANGLE(FMatrixType));
+        return *m;
+    }
+
+    //! Casts a feature matrix already checked with cast()
+    inline static const FMatrixType &staticCast(const FMatrixBase &mX)
+    {
+        return static_cast<const FMatrixType &>(mX);
+    }
+
+    //! Gram matrix
+    inline const ScalarMatrix &k(const FMatrixType &mX) const
+    {
+        return m_space->k(mX);
+    }
+
+    //! Inner products \f$D_1^\dagger Y_1^\dagger X_1^\dagger X_2 Y_2 D_2\f$
+    inline ScalarMatrix k(const FMatrixType &mX1, const ScalarAltMatrix &mY1, const RealAltVector &mD1,
+                          const FMatrixType &mX2, const ScalarAltMatrix &mY2, const RealAltVector &mD2) const
+    {
+        return m_space->k(mX1, mY1, mD1, mX2, mY2, mD2);
+    }
+
+    //! Inner products \f$Y_1^\dagger X_1^\dagger X_2 Y_2\f$
+    inline ScalarMatrix k(const FMatrixType &mX1, const ScalarAltMatrix &mY1, const FMatrixType &mX2, const ScalarAltMatrix &mY2) const
+    {
+        return k(mX1, mY1, RealVector::Ones(mY1.cols()), mX2, mY2, RealVector::Ones(mY2.cols()));
+    }
+
+    //! Inner products \f$Y^\dagger X^\dagger X Y\f$
+    inline ScalarMatrix k(const FMatrixType &mX, const ScalarAltMatrix &mY) const
+    {
+        return k(mX, mY, RealVector::Ones(mY.cols()), mX, mY, RealVector::Ones(mY.cols()));
+    }
+
+private:
+    //! Keeps the space alive
+    FSpace m_fs;
+
+    //! The space
+    const Space *m_space;
+};
+#endif
+
+
 
 
 # ifndef SWIG
@@ -0,0 +1,416 @@
+/*
+ This file is part of the Kernel Quantum Probability library (KQP).
+
+ KQP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ KQP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with KQP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __KQP_BINARY_FEATURE_MATRIX_H__
+#define __KQP_BINARY_FEATURE_MATRIX_H__
+
+#include <numeric>
+#include <vector>
+#include <stdint.h>
+#include <boost/lexical_cast.hpp>
+
+#include <kqp/feature_matrix.hpp>
+#include <kqp/intervals.hpp>
+
+namespace kqp {
+
+    template <typename Scalar> class BinaryMatrix;
+    template <typename Scalar> class BinarySpace;
+
+#   include <kqp/define_header_logger.hpp>
+    DEFINE_KQP_HLOGGER("kqp.feature-matrix.binary");
+
+#ifndef SWIG
+    //! Number of bits set in a word (a single instruction when the CPU supports it, e.g. with -mpopcnt)
+    inline Index popcount(uint64_t x) {
+#if defined(__GNUC__)
+        return __builtin_popcountll(x);
+#else
+        x = x - ((x >> 1) & 0x5555555555555555ULL);
+        x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+        x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+        return (x * 0x0101010101010101ULL) >> 56;
+#endif
+    }
+#endif
+
+    /**
+     * @brief A feature matrix where vectors are binary vectors (e.g. fingerprints) in a fixed dimension
+     *
+     * Vectors are packed in 64 bits words (one bit per component), which uses
+     * 64 times less memory than dense double vectors.
+     *
+     * @ingroup FeatureMatrix
+     */
+    template <typename Scalar>
+    class BinaryMatrix : public FeatureMatrixBase<Scalar> {
+    public:
+        typedef BinaryMatrix<Scalar> Self;
+        KQP_SPACE_TYPEDEFS("binary", Scalar);
+
+        //! Number of bits in a word
+        enum { WORD_BITS = 64 };
+
+        virtual ~BinaryMatrix() {}
+
+        //! Construct an empty feature matrix of a given dimension
+        BinaryMatrix(Index dimension = 0) : m_dimension(dimension), m_size(0) {}
+
+        //! Construction from a dense matrix (non zero components are set)
+        template<typename Derived>
+        explicit BinaryMatrix(const Eigen::DenseBase<Derived> &m) : m_dimension(m.rows()), m_size(0) {
+            add(m);
+        }
+
+        //! Number of words used to store one vector
+        Index wordsPerVector() const {
+            return (m_dimension + WORD_BITS - 1) / WORD_BITS;
+        }
+
+        //! Words of the i<sup>th</sup> vector (bit j of the vector is bit j % 64 of word j / 64)
+        const uint64_t *words(Index i) const {
+            return &m_words[i * wordsPerVector()];
+        }
+
+        //! Returns a component of a vector
+        bool get(Index i, Index j) const {
+            return (words(i)[j / WORD_BITS] >> (j % WORD_BITS)) & 1;
+        }
+
+        //! Number of components set in the i<sup>th</sup> vector
+        Index count(Index i) const {
+            return m_counts[i];
+        }
+
+        /**
+         * @brief Adds vectors from a dense matrix (non zero components are set)
+         */
+        template<typename Derived>
+        void add(const Eigen::DenseBase<Derived> &m, const std::vector<bool> *which = NULL) {
+            checkDimension(m.rows());
+            Intervals intervals(which, m.cols());
+            for(auto i = intervals.begin(); i != intervals.end(); i++)
+                for(Index j = (Index)i->first; j <= (Index)i->second; j++) {
+                    uint64_t *w = newVector();
+                    for(Index r = 0; r < m_dimension; r++)
+                        if (m(r, j) != typename Derived::Scalar(0))
+                            w[r / WORD_BITS] |= (uint64_t)1 << (r % WORD_BITS);
+                    commit();
+                }
+        }
+
+        /**
+         * @brief Adds vectors from a sparse matrix (stored components are set)
+         */
+        template<typename Derived>
+        void add(const Eigen::SparseMatrixBase<Derived> &m, const std::vector<bool> *which = NULL) {
+            checkDimension(m.rows());
+            const Derived &sparse = m.derived();
+            Intervals intervals(which, m.cols());
+            for(auto i = intervals.begin(); i != intervals.end(); i++)
+                for(Index j = (Index)i->first; j <= (Index)i->second; j++) {
+                    uint64_t *w = newVector();
+                    for(typename Derived::InnerIterator it(sparse, j); it; ++it)
+                        w[it.index() / WORD_BITS] |= (uint64_t)1 << (it.index() % WORD_BITS);
+                    commit();
+                }
+        }
+
+        /**
+         * @brief Adds packed vectors
+         * @param words The words of the n vectors (wordsPerVector() words each, see words())
+         * @param n The number of vectors
+         */
+        void addWords(const uint64_t *words, Index n) {
+            if (m_dimension % WORD_BITS) {
+                const uint64_t mask = ((uint64_t)1 << (m_dimension % WORD_BITS)) - 1;
+                for(Index i = 0; i < n; i++)
+                    if (words[(i + 1) * wordsPerVector() - 1] & ~mask)
+                        KQP_THROW_EXCEPTION_F(illegal_argument_exception, "Vector %d has bits set beyond dimension %d", %i %m_dimension);
+            }
+            for(Index i = 0; i < n; i++) {
+                std::copy(words + i * wordsPerVector(), words + (i + 1) * wordsPerVector(), newVector());
+                commit();
+            }
+        }
+
+#ifndef SWIG
+        inline static const Self &cast(const FMatrixBase &m) {
+            return kqp::our_dynamic_cast<const Self&>(m);
+        }
+#endif
+
+        void add(const FMatrixBase &_other, const std::vector<bool> *which = NULL) override {
+            const Self &other = cast(_other);
+            checkDimension(other.m_dimension);
+            Intervals intervals(which, other.size());
+            for(auto i = intervals.begin(); i != intervals.end(); i++) {
+                m_words.insert(m_words.end(), other.m_words.begin() + i->first * wordsPerVector(), other.m_words.begin() + (i->second + 1) * wordsPerVector());
+                m_counts.insert(m_counts.end(), other.m_counts.begin() + i->first, other.m_counts.begin() + i->second + 1);
+                m_size += i->second - i->first + 1;
+            }
+        }
+
+        virtual Index size() const override {
+            return m_size;
+        }
+
+        Index dimension() const {
+            return m_dimension;
+        }
+
+        //! Converts to a dense matrix
+        ScalarMatrix toDense() const {
+            ScalarMatrix m = ScalarMatrix::Zero(m_dimension, m_size);
+            for(Index j = 0; j < m_size; j++)
+                for(Index i = 0; i < m_dimension; i++)
+                    if (get(j, i)) m(i, j) = 1;
+            return m;
+        }
+
+        FMatrixBasePtr subset(const std::vector<bool>::const_iterator &begin, const std::vector<bool>::const_iterator &end) const override {
+            Self *result = new Self(m_dimension);
+            auto it = begin;
+            for(Index j = 0; j < m_size && it != end; j++, it++)
+                if (*it) {
+                    result->m_words.insert(result->m_words.end(), m_words.begin() + j * wordsPerVector(), m_words.begin() + (j + 1) * wordsPerVector());
+                    result->m_counts.push_back(m_counts[j]);
+                    result->m_size++;
+                }
+            return FMatrixBasePtr(result);
+        }
+
+        virtual FMatrixBasePtr copy() const override {
+            return FMatrixBasePtr(new Self(*this));
+        }
+
+        Self& operator=(const Self &other) {
+            m_dimension = other.m_dimension;
+            m_size = other.m_size;
+            m_words = other.m_words;
+            m_counts = other.m_counts;
+            std::copy(other.m_gramMatrices, other.m_gramMatrices + 3, m_gramMatrices);
+            return *this;
+        }
+
+        virtual FMatrixBase& operator=(const FMatrixBase &other) override {
+            return *this = cast(other);
+        }
+
+    private:
+        //! Sets the dimension (if empty) or check it
+        void checkDimension(Index dimension) {
+            if (m_size == 0)
+                m_dimension = dimension;
+            else if (dimension != m_dimension)
+                KQP_THROW_EXCEPTION_F(illegal_operation_exception,
+                                      "Cannot add a vector of dimension %d (dimension is %d)", %dimension %m_dimension);
+        }
+
+        //! Appends a zero vector (finalized by commit())
+        uint64_t *newVector() {
+            m_words.resize(m_words.size() + wordsPerVector(), 0);
+            return &m_words[m_size * wordsPerVector()];
+        }
+
+        //! Finalize the last vector
+        void commit() {
+            const uint64_t *w = &m_words[m_size * wordsPerVector()];
+            Index count = 0;
+            for(Index k = 0; k < wordsPerVector(); k++)
+                count += popcount(w[k]);
+            m_counts.push_back(count);
+            m_size++;
+        }
+
+        //! Dimension (number of bits)
+        Index m_dimension;
+
+        //! Number of vectors
+        Index m_size;
+
+        //! Packed vectors
+        std::vector<uint64_t> m_words;
+
+        //! Number of bits set in each vector
+        std::vector<Index> m_counts;
+
+        //! Cache of the Gram matrix (for each kernel of BinarySpace)
+        mutable ScalarMatrix m_gramMatrices[3];
+
+        friend class BinarySpace<Scalar>;
+    };
+
+
+    /**
+     * @brief The feature space of binary vectors
+     *
+     * Inner products are computed with population counts, by blocks of vectors (in parallel
+     * when OpenMP is available). Three kernels are defined:
+     * - linear: number of common components, \f$ \vert x \wedge y \vert \f$
+     * - hamming: number of equal components, \f$ d - \vert x \oplus y \vert \f$
+     * - tanimoto: \f$ \frac{\vert x \wedge y \vert}{\vert x \vee y \vert} \f$ (1 if both vectors are null)
+     *
+     * Within a GaussianSpace, the linear and hamming kernels give \f$\exp(-H(x,y)/\sigma^2)\f$ and \f$\exp(-2 H(x,y)/\sigma^2)\f$
+     * where \f$H\f$ is the Hamming distance, and the tanimoto kernel gives \f$\exp(-2 (1 - T(x,y))/\sigma^2)\f$.
+     */
+    template<typename Scalar>
+    class BinarySpace : public SpaceBase<Scalar> {
+    public:
+        typedef BinarySpace<Scalar> Self;
+        KQP_SPACE_TYPEDEFS("binary", Scalar);
+#ifndef SWIG
+        using SpaceBase<Scalar>::k;
+#endif
+        //! The kernel between binary vectors
+        enum Kernel { LINEAR, HAMMING, TANIMOTO };
+
+        //! Number of vectors in the blocks used to compute inner products
+        enum { BLOCK_SIZE = 64 };
+
+        static FSpace create(Index dimension, Kernel kernel = LINEAR) { return FSpace(new BinarySpace(dimension, kernel)); }
+
+        BinarySpace(Index dimension, Kernel kernel = LINEAR) : m_dimension(dimension), m_kernel(kernel) {}
+        BinarySpace() : m_dimension(0), m_kernel(LINEAR) {}
+
+        FSpacePtr copy() const override {
+            return FSpacePtr(new BinarySpace(*this));
+        }
+
+        inline static const BinaryMatrix<Scalar>& cast(const FMatrixBase &mX) { return kqp::our_dynamic_cast<const BinaryMatrix<Scalar> &>(mX); }
+
+        Index dimension() const override { return m_dimension; }
+        void dimension(Index dimension) { m_dimension = dimension; }
+
+        Kernel kernel() const { return m_kernel; }
+
+        virtual FMatrixBasePtr newMatrix() const override {
+            return FMatrixBasePtr(new BinaryMatrix<Scalar>(m_dimension));
+        }
+        virtual FMatrixBasePtr newMatrix(const FMatrixBase &mX) const override {
+            return FMatrixBasePtr(new BinaryMatrix<Scalar>(cast(mX)));
+        }
+
+        const ScalarMatrix &k(const FeatureMatrixBase<Scalar> &mX) const override {
+            const BinaryMatrix<Scalar> &bX = cast(mX);
+            ScalarMatrix &gram = bX.m_gramMatrices[m_kernel];
+            if (bX.size() == gram.rows()) return gram;
+
+            Index current = gram.rows();
+            Index tofill = bX.size() - current;
+            gram.conservativeResize(bX.size(), bX.size());
+
+            // Only computes the upper part of the new columns
+            ScalarMatrix products(bX.size(), tofill);
+            inner(bX, 0, bX.size(), bX, current, tofill, true, products);
+            for(Index j = 0; j < tofill; j++)
+                products.col(j).tail(tofill - j - 1) = products.row(current + j).tail(tofill - j - 1).adjoint();
+
+            gram.rightCols(tofill) = products;
+            gram.bottomLeftCorner(tofill, current) = products.topRows(current).adjoint();
+            return gram;
+        }
+
+        virtual ScalarMatrix k(const FeatureMatrixBase<Scalar> &mX1, const ScalarAltMatrix &mY1, const RealAltVector &mD1,
+                               const FeatureMatrixBase<Scalar> &mX2, const ScalarAltMatrix &mY2, const RealAltVector &mD2) const override {
+            const BinaryMatrix<Scalar> &bX1 = cast(mX1), &bX2 = cast(mX2);
+            ScalarMatrix products(bX1.size(), bX2.size());
+            inner(bX1, 0, bX1.size(), bX2, 0, bX2.size(), false, products);
+            return mD1.asDiagonal() * bilinear(mY1, products, mY2) * mD2.asDiagonal();
+        };
+
+        virtual void load(const pugi::xml_node &node) override {
+            m_dimension = boost::lexical_cast<Index>(node.attribute("dimension").value());
+            std::string kernel = kqp::attribute<std::string>(node, "kernel", "linear");
+            if (kernel == "linear") m_kernel = LINEAR;
+            else if (kernel == "hamming") m_kernel = HAMMING;
+            else if (kernel == "tanimoto") m_kernel = TANIMOTO;
+            else KQP_THROW_EXCEPTION_F(illegal_argument_exception, "Unknown binary kernel [%s]", %kernel);
+        }
+
+        virtual pugi::xml_node save(pugi::xml_node &node) const override {
+            static const char *names[] = { "linear", "hamming", "tanimoto" };
+            pugi::xml_node self = SpaceBase<Scalar>::save(node);
+            self.append_attribute("dimension") = boost::lexical_cast<std::string>(m_dimension).c_str();
+            self.append_attribute("kernel") = names[m_kernel];
+            return self;
+        }
+
+    private:
+        //! Kernel value given the number of common bits and the number of bits of each vector
+        inline Scalar value(Index common, Index count1, Index count2) const {
+            switch(m_kernel) {
+                case LINEAR:
+                    return (Scalar)common;
+                case HAMMING:
+                    return (Scalar)(m_dimension - (count1 + count2 - 2 * common));
+                case TANIMOTO:
+                    return count1 + count2 == 0 ? (Scalar)1 : (Scalar)common / (Scalar)(count1 + count2 - common);
+            }
+            return 0;
+        }
+
+        /**
+         * @brief Computes the kernel between vectors [i0, i0 + n1[ of mX1 and [i0, i0 + n2[ of mX2
+         *
+         * The vectors are processed by blocks so that the words of both blocks stay in cache.
+         *
+         * @param upper If true, only computes the kernel values such that (i0 + i) <= (j0 + j)
+         */
+        void inner(const BinaryMatrix<Scalar> &mX1, Index i0, Index n1, const BinaryMatrix<Scalar> &mX2, Index j0, Index n2,
+                   bool upper, ScalarMatrix &result) const {
+            if (mX1.dimension() != mX2.dimension())
+                KQP_THROW_EXCEPTION_F(illegal_argument_exception, "Cannot compute inner products between vectors of dimensions %d and %d",
+                                      %mX1.dimension() %mX2.dimension());
+
+            const Index words = mX1.wordsPerVector();
+            const Index blocks1 = (n1 + BLOCK_SIZE - 1) / BLOCK_SIZE;
+            const Index blocks = blocks1 * ((n2 + BLOCK_SIZE - 1) / BLOCK_SIZE);
+            KQP_HLOG_DEBUG_F("Computing %d x %d binary inner products with %d blocks", %n1 %n2 %blocks);
+
+#pragma omp parallel for schedule(dynamic)
+            for(Index block = 0; block < blocks; block++) {
+                const Index ib = (block % blocks1) * BLOCK_SIZE, jb = (block / blocks1) * BLOCK_SIZE;
+                const Index ie = std::min<Index>(ib + BLOCK_SIZE, n1), je = std::min<Index>(jb + BLOCK_SIZE, n2);
+                if (upper && i0 + ib > j0 + je - 1) continue;
+
+                for(Index j = jb; j < je; j++) {
+                    const uint64_t *y = mX2.words(j0 + j);
+                    for(Index i = ib; i < ie; i++) {
+                        if (upper && i0 + i > j0 + j) break;
+                        const uint64_t *x = mX1.words(i0 + i);
+                        Index common = 0;
+                        for(Index w = 0; w < words; w++)
+                            common += popcount(x[w] & y[w]);
+                        result(i, j) = value(common, mX1.count(i0 + i), mX2.count(j0 + j));
+                    }
+                }
+            }
+        }
+
+        Index m_dimension;
+        Kernel m_kernel;
+    };
+
+# // Extern templates
+# ifndef SWIG
+# define KQP_SCALAR_GEN(scalar) extern template class BinaryMatrix<scalar>; extern template class BinarySpace<scalar>;
+# include <kqp/for_all_scalar_gen.h.inc>
+# endif
+
+} // end namespace kqp
+
+#endif
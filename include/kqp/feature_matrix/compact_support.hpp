@@ -0,0 +1,372 @@
+/*
+ This file is part of the Kernel Quantum Probability library (KQP).
+
+ KQP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ KQP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with KQP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __KQP_COMPACT_SUPPORT_SPACE_H__
+#define __KQP_COMPACT_SUPPORT_SPACE_H__
+
+#include <algorithm>
+#include <vector>
+
+#include <kqp/feature_matrix/dense.hpp>
+#include <kqp/feature_matrix/unary_kernel.hpp>
+
+namespace kqp {
+
+#ifndef SWIG
+    /**
+     * @brief A k-d tree over a set of points, used for fixed radius neighbour searches
+     *
+     * Nodes are split at the median of their widest coordinate.
+     */
+    template<typename Real>
+    class KDTree {
+    public:
+        typedef Eigen::Matrix<Real, Eigen::Dynamic, Eigen::Dynamic> RealMatrix;
+
+        //! Builds a tree over the columns of a matrix (which are copied)
+        KDTree(const RealMatrix &points, Index leafSize = 16) : m_points(points), m_leafSize(std::max(leafSize, Index(1))) {
+            m_indices.resize(points.cols());
+            for(Index i = 0; i < points.cols(); i++)
+                m_indices[i] = i;
+            if (points.cols() > 0)
+                build(0, points.cols());
+        }
+
+        /**
+         * @brief Calls f(j, d) for every point j whose squared distance d to x is at most radius^2
+         */
+        template<typename Derived, typename Function>
+        void search(const Eigen::MatrixBase<Derived> &x, Real radius, Function &f) const {
+            if (!m_nodes.empty())
+                search(0, x, radius, radius * radius, f);
+        }
+
+    private:
+        struct Node {
+            //! Range of points (in m_indices)
+            Index begin, end;
+            //! Split axis (-1 for leaves) and value
+            Index axis;
+            Real split;
+            //! Children
+            Index left, right;
+        };
+
+        Index build(Index begin, Index end) {
+            Index id = m_nodes.size();
+            m_nodes.push_back(Node());
+            Node node = { begin, end, -1, 0, -1, -1 };
+
+            if (end - begin > m_leafSize) {
+                // Split along the widest coordinate
+                Real width = -1;
+                for(Index d = 0; d < m_points.rows(); d++) {
+                    Real lower = m_points(d, m_indices[begin]), upper = lower;
+                    for(Index i = begin + 1; i < end; i++) {
+                        lower = std::min(lower, m_points(d, m_indices[i]));
+                        upper = std::max(upper, m_points(d, m_indices[i]));
+                    }
+                    if (upper - lower > width) {
+                        width = upper - lower;
+                        node.axis = d;
+                    }
+                }
+
+                if (width > 0) {
+                    Index middle = (begin + end) / 2;
+                    const Index axis = node.axis;
+                    const RealMatrix &points = m_points;
+                    std::nth_element(m_indices.begin() + begin, m_indices.begin() + middle, m_indices.begin() + end,
+                                     [&points, axis](Index i, Index j) { return points(axis, i) < points(axis, j); });
+                    node.split = m_points(axis, m_indices[middle]);
+                    node.left = build(begin, middle);
+                    node.right = build(middle, end);
+                } else node.axis = -1;
+            }
+
+            m_nodes[id] = node;
+            return id;
+        }
+
+        template<typename Derived, typename Function>
+        void search(Index id, const Eigen::MatrixBase<Derived> &x, Real radius, Real radius2, Function &f) const {
+            const Node &node = m_nodes[id];
+            if (node.axis < 0) {
+                for(Index i = node.begin; i < node.end; i++) {
+                    Real d = (m_points.col(m_indices[i]) - x).squaredNorm();
+                    if (d <= radius2)
+                        f(m_indices[i], d);
+                }
+                return;
+            }
+
+            // Left (resp. right) points have a coordinate lower (resp. greater) or equal to the split value
+            Real v = x[node.axis];
+            if (v - radius <= node.split)
+                search(node.left, x, radius, radius2, f);
+            if (v + radius >= node.split)
+                search(node.right, x, radius, radius2, f);
+        }
+
+        RealMatrix m_points;
+        Index m_leafSize;
+        std::vector<Index> m_indices;
+        std::vector<Node> m_nodes;
+    };
+#endif
+
+    /**
+     * @brief Compactly supported radial kernel over dense pre-images
+     *
+     * The kernel \f$k(x,y) = \phi(\Vert x - y \Vert / s)\f$ is zero whenever the distance between
+     * x and y is greater than the support s. Gram matrices are thus sparse, and are computed
+     * as sparse matrices with a k-d tree over the pre-images: builders and cleaners use them
+     * (see SpaceBase::hasSparseGram), and inner products never compute a dense Gram matrix.
+     *
+     * The base space must be a dense space (the pre-images being real).
+     */
+    template<typename Scalar> class CompactSupportSpace : public UnaryKernelSpace<Scalar> {
+    public:
+        typedef CompactSupportSpace<Scalar> Self;
+        KQP_SPACE_TYPEDEFS("compact-support", Scalar);
+        typedef Eigen::SparseMatrix<Scalar> SparseMatrix;
+#ifndef SWIG
+        using UnaryKernelSpace<Scalar>::m_base;
+        using SpaceBase<Scalar>::k;
+        // Kernel value blocks are processed pair by pair
+        using SpaceBase<Scalar>::update;
+        using SpaceBase<Scalar>::updatePartials;
+#endif
+
+        enum Kernel {
+            //! Wendland function \f$\phi_{3,1}(r) = (1-r)_+^4 (4r+1)\f$ (positive definite up to dimension 3)
+            WENDLAND,
+            //! Gaussian \f$\exp(-9 r^2)\f$ truncated at r = 1 (not positive definite in general)
+            TRUNCATED_GAUSSIAN
+        };
+
+        CompactSupportSpace(Real support, const FSpaceCPtr &base, Kernel kernel = WENDLAND)
+            : UnaryKernelSpace<Scalar>(base), m_support(support), m_kernel(kernel) {
+            if (base && !base->template castable_as< const DenseSpace<Scalar> >())
+                KQP_THROW_EXCEPTION_F(illegal_argument_exception, "The base of a compact support space should be a dense space (got %s)", %KQP_DEMANGLE(*base));
+        }
+        CompactSupportSpace() : UnaryKernelSpace<Scalar>(FSpace()), m_support(1), m_kernel(WENDLAND) {}
+
+        virtual FSpacePtr copy() const override { return FSpacePtr(new Self(m_support, m_base, m_kernel)); }
+
+        virtual Index dimension() const override { return -1; }
+        virtual bool _canLinearlyCombine() const override { return false; }
+
+        //! The support of the kernel
+        Real support() const { return m_support; }
+        Kernel kernel() const { return m_kernel; }
+
+        virtual bool hasSparseGram() const override { return true; }
+
+#ifndef SWIG
+        virtual SparseMatrix sparseK(const FMatrixBase &mX) const override {
+            return sparseK(mX, mX);
+        }
+
+        //! Inner products \f$X_1^\dagger X_2\f$ as a sparse matrix
+        SparseMatrix sparseK(const FMatrixBase &mX1, const FMatrixBase &mX2) const {
+            ScalarMatrix decoded1, decoded2;
+            const ScalarMatrix &x1 = points(mX1, decoded1), &x2 = points(mX2, decoded2);
+            SparseMatrix result(x1.cols(), x2.cols());
+            if (x1.cols() == 0 || x2.cols() == 0)
+                return result;
+
+            // Search for the neighbours of the smallest set within the largest one
+            bool swap = x1.cols() < x2.cols();
+            const KDTree<Real> tree(swap ? x2.real() : x1.real());
+            const ScalarMatrix &queries = swap ? x1 : x2;
+
+            std::vector< Eigen::Triplet<Scalar> > triplets;
+#pragma omp parallel
+            {
+                std::vector< Eigen::Triplet<Scalar> > local;
+                Collector collector(*this, local, swap);
+#pragma omp for schedule(dynamic, 64)
+                for(Index j = 0; j < queries.cols(); j++) {
+                    collector.query = j;
+                    tree.search(queries.col(j).real(), m_support, collector);
+                }
+#pragma omp critical
+                triplets.insert(triplets.end(), local.begin(), local.end());
+            }
+
+            result.setFromTriplets(triplets.begin(), triplets.end());
+            return result;
+        }
+#endif
+
+        /**
+         * @brief Dense Gram matrix
+         *
+         * This is only provided for compatibility, since it uses a quadratic amount of memory:
+         * use sparseK() instead.
+         */
+        virtual const ScalarMatrix &k(const FMatrixBase &mX) const override {
+            m_gram = sparseK(mX).toDense();
+            return m_gram;
+        }
+
+        virtual ScalarMatrix k(const FMatrixBase &mX, const ScalarAltMatrix &mY, const RealAltVector &mD) const override {
+            ScalarMatrix right = mY * mD.asDiagonal();
+            return right.adjoint() * (sparseK(mX) * right);
+        }
+
+        virtual ScalarMatrix k(const FMatrixBase &mX1, const ScalarAltMatrix &mY1, const RealAltVector &mD1,
+                               const FMatrixBase &mX2, const ScalarAltMatrix &mY2, const RealAltVector &mD2) const override {
+            ScalarMatrix left = mY1 * mD1.asDiagonal();
+            ScalarMatrix right = mY2 * mD2.asDiagonal();
+            return left.adjoint() * (sparseK(mX1, mX2) * right);
+        }
+
+        virtual void update(std::vector< KernelValues<Scalar> > &values, int kOffset = 0) const override {
+            auto &self = values[kOffset];
+            auto &child = values[kOffset+1];
+            m_base->update(values, kOffset+1);
+            self._inner = phi(distance2(child, 0));
+            self._innerX = phi(0);
+            self._innerY = phi(0);
+        }
+
+        virtual void updatePartials(Real alpha, std::vector<Real> &partials, int offset, const std::vector< KernelValues<Scalar> > &values, int kOffset, int mode) const override {
+            // k(x,x) does not depend on the parameters
+            if (mode != 0)
+                return;
+
+            Real d2 = distance2(values[kOffset+1], 0);
+            Real s2 = m_support * m_support;
+            if (d2 >= s2)
+                return;
+
+            // Derivatives with respect to the support and the squared distance
+            Real dk_ds, dk_dd2;
+            if (m_kernel == WENDLAND) {
+                Real r = std::sqrt(d2) / m_support;
+                Real c = (1 - r) * (1 - r) * (1 - r);
+                dk_ds = 20. * r * r * c / m_support;
+                dk_dd2 = -10. * c / s2;
+            } else {
+                Real v = std::exp(-9. * d2 / s2);
+                dk_ds = 18. * v * d2 / (s2 * m_support);
+                dk_dd2 = -9. * v / s2;
+            }
+
+            partials[offset] += alpha * dk_ds;
+
+            // d2 = k(x,x) + k(y,y) - 2 Re k(x,y)
+            Real beta = alpha * dk_dd2;
+            m_base->updatePartials(-2 * beta, partials, offset+1, values, kOffset + 1, 0);
+            m_base->updatePartials(beta, partials, offset+1, values, kOffset + 1, -1);
+            m_base->updatePartials(beta, partials, offset+1, values, kOffset + 1, 1);
+        }
+
+        virtual int numberOfParameters() const override {
+            return 1 + m_base->numberOfParameters();
+        }
+
+        virtual void getParameters(std::vector<Real> & parameters, int offset) const override {
+            parameters[offset] = m_support;
+            m_base->getParameters(parameters, offset + 1);
+        }
+
+        virtual void setParameters(const std::vector<Real> & parameters, int offset) override {
+            m_support = std::abs(parameters[offset]);
+            if (m_support < EPSILON) m_support = kqp::EPSILON;
+            m_base->setParameters(parameters, offset + 1);
+        }
+
+        virtual void load(const pugi::xml_node &node) override {
+            m_support = kqp::attribute(node, "support", 1.);
+            std::string kernel = kqp::attribute<std::string>(node, "kernel", "wendland");
+            if (kernel == "wendland") m_kernel = WENDLAND;
+            else if (kernel == "truncated-gaussian") m_kernel = TRUNCATED_GAUSSIAN;
+            else KQP_THROW_EXCEPTION_F(illegal_argument_exception, "Unknown compact support kernel [%s]", %kernel);
+            UnaryKernelSpace<Scalar>::load(node);
+        }
+
+        virtual pugi::xml_node save(pugi::xml_node &node) const override {
+            pugi::xml_node self = UnaryKernelSpace<Scalar>::save(node);
+            self.append_attribute("support") = boost::lexical_cast<std::string>(m_support).c_str();
+            self.append_attribute("kernel") = m_kernel == WENDLAND ? "wendland" : "truncated-gaussian";
+            if (m_base)
+                m_base->save(self);
+            return self;
+        }
+
+    protected:
+        virtual void fillGram(ScalarMatrix &gram, Index tofill, const FMatrixBase &mX) const override {
+            gram.rightCols(tofill) = sparseK(mX).toDense().rightCols(tofill);
+        }
+
+    private:
+        //! Collects the kernel values of the neighbours of a query point
+        struct Collector {
+            const Self &space;
+            std::vector< Eigen::Triplet<Scalar> > &triplets;
+            bool swap;
+            Index query;
+
+            Collector(const Self &space, std::vector< Eigen::Triplet<Scalar> > &triplets, bool swap)
+                : space(space), triplets(triplets), swap(swap), query(0) {}
+
+            inline void operator()(Index j, Real d2) {
+                Real v = space.phi(d2);
+                if (v == 0) return;
+                if (swap) triplets.push_back(Eigen::Triplet<Scalar>(query, j, v));
+                else triplets.push_back(Eigen::Triplet<Scalar>(j, query, v));
+            }
+        };
+
+        //! Pre-images of a (dense) feature matrix (decoded in @c buffer if stored in reduced precision)
+        static const ScalarMatrix &points(const FMatrixBase &mX, ScalarMatrix &buffer) {
+            return kqp::our_dynamic_cast<const Dense<Scalar> &>(mX).getMatrix(buffer);
+        }
+
+        static inline Real distance2(const KernelValues<Scalar> &child, int mode) {
+            return std::max(Real(0), Eigen::internal::real(child.innerX(mode)) + Eigen::internal::real(child.innerY(mode))
+                                     - 2 * Eigen::internal::real(child.inner(mode)));
+        }
+
+        //! Kernel value given the squared distance
+        inline Real phi(Real d2) const {
+            Real s2 = m_support * m_support;
+            if (d2 >= s2) return 0;
+            if (m_kernel == TRUNCATED_GAUSSIAN)
+                return std::exp(-9. * d2 / s2);
+            Real r = std::sqrt(d2) / m_support;
+            Real u = (1 - r) * (1 - r);
+            return u * u * (4 * r + 1);
+        }
+
+        Real m_support;
+        Kernel m_kernel;
+
+        //! Dense Gram matrix (see k())
+        mutable ScalarMatrix m_gram;
+    };
+
+# ifndef SWIG
+# define KQP_SCALAR_GEN(scalar) extern template class CompactSupportSpace<scalar>;
+# include <kqp/for_all_scalar_gen.h.inc>
+# endif
+
+} // end namespace kqp
+
+#endif
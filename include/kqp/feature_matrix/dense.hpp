@@ -18,11 +18,14 @@
 #define __KQP_DENSE_FEATURE_MATRIX_H__
 
 #include <numeric>
+#include <vector>
 #include <boost/lexical_cast.hpp>
+#include <boost/shared_ptr.hpp>
 
 #include <kqp/feature_matrix.hpp>
 #include <kqp/subset.hpp>
 #include <kqp/intervals.hpp>
+#include <kqp/half_precision.hpp>
 
 namespace kqp {
     
@@ -43,37 +46,78 @@ namespace kqp {
         typedef Dense<Scalar> Self;
         KQP_SPACE_TYPEDEFS("dense", Scalar);
 
+        //! Read-only view on the pre-images (owned or external storage)
+        typedef Eigen::Map<const ScalarMatrix> ConstMap;
+
         virtual ~Dense() {}
         
         //! Null constructor: will set the dimension with the first feature vector
-        Dense() {}
+        Dense() : m_data(0), m_rows(0), m_cols(0), m_precision(DensePrecision::FULL) {}
         
         //! Construct an empty feature matrix of a given dimension
-        Dense(Index dimension) : m_matrix(dimension, 0) {
+        Dense(Index dimension) : m_matrix(dimension, 0), m_data(0), m_rows(0), m_cols(0), m_precision(DensePrecision::FULL) {
+        }
+
+        /**
+         * @brief Construct an empty feature matrix of a given dimension and storage precision
+         *
+         * With a reduced precision (real scalars only), the pre-images are stored on 16 bits
+         * and inner products are computed in double precision. With the single precision, pre-images
+         * are stored as floats and the inner products between two such matrices are computed in single precision.
+         */
+        Dense(Index dimension, DensePrecision::Type precision) 
+            : m_data(0), m_rows(precision == DensePrecision::FULL ? 0 : dimension), m_cols(0), m_precision(precision) {
+            if (precision == DensePrecision::FULL)
+                m_matrix.resize(dimension, 0);
+            else if (Eigen::NumTraits<Scalar>::IsComplex)
+                KQP_THROW_EXCEPTION(not_implemented_exception, "Reduced precision storage is only available for real scalars");
         }
 
         //! Construction by copying a dense matrix
-        Dense(const ScalarMatrix &m) : m_matrix(m) {}
+        Dense(const ScalarMatrix &m) : m_matrix(m), m_data(0), m_rows(0), m_cols(0), m_precision(DensePrecision::FULL) {}
         
-        //! Copy constructor
-        Dense(const Self &other) : m_gramMatrix(other.m_gramMatrix),  m_matrix(other.m_matrix) {}
+        //! Copy constructor (external storage is shared, not copied)
+        Dense(const Self &other) : m_gramMatrix(other.m_gramMatrix),  m_matrix(other.m_matrix),
+            m_holder(other.m_holder), m_data(other.m_data), m_rows(other.m_rows), m_cols(other.m_cols),
+            m_precision(other.m_precision), m_compact(other.m_compact) {}
         
         
 #ifndef SWIG
         inline static SelfPtr create(Index dimension) { return SelfPtr(new Self(dimension)); }
 
-        //! Construction by copying a dense matrix
-        Dense(ScalarMatrix &&m) : m_matrix(m) {}
+        //! Construction by taking the content of a dense matrix (which is left empty)
+        Dense(ScalarMatrix &&m) : m_data(0), m_rows(0), m_cols(0), m_precision(DensePrecision::FULL) {
+            m_matrix.swap(m);
+        }
 
         //! Creates from a matrix
         static FMatrix create(const ScalarMatrix &m) {
             return FMatrix(new Self(m));
         }
         
-        //! Creates from a matrix
-        static FMatrix create(const ScalarMatrix &&m) {
+        //! Creates from a matrix (no copy, the matrix is left empty)
+        static FMatrix create(ScalarMatrix &&m) {
             return FMatrix(new Self(std::move(m)));
         }
+        
+        /**
+         * @brief Construction from external memory (no copy)
+         *
+         * The pre-images are the columns of the (column-major) map, whose data is never modified. 
+         * The release function is called when no matrix uses the memory anymore; if it is empty, 
+         * the memory should outlive the matrix and its copies.
+         */
+        template<typename MatrixType, int MapOptions>
+        explicit Dense(const Eigen::Map<MatrixType, MapOptions> &map, const ReleaseFunction &release = ReleaseFunction())
+            : m_holder(externalHolder(map.data(), release)), m_data(map.data()), m_rows(map.rows()), m_cols(map.cols()),
+              m_precision(DensePrecision::FULL) {
+            static_assert(!(MatrixType::Flags & Eigen::RowMajorBit), "Dense matrices can only map column-major storage");
+        }
+        
+        //! Creates a matrix from external memory (column-major, no copy)
+        static SelfPtr wrap(const Scalar *data, Index rows, Index cols, const ReleaseFunction &release = ReleaseFunction()) {
+            return SelfPtr(new Self(ConstMap(data, rows, cols), release));
+        }
 #endif
 
    
@@ -83,6 +127,9 @@ namespace kqp {
          */
         template<typename Derived>
         void add(const Eigen::DenseBase<Derived> &m, const std::vector<bool> *which = NULL) {
+            if (isCompact()) 
+                return addCompact(m, which);
+            if (m_holder) detach();
             if (m_matrix.cols() == 0) 
                 m_matrix.resize(m.rows(), 0);
             if (m.rows() != m_matrix.rows())
@@ -105,13 +152,66 @@ namespace kqp {
                                 
         }
         
-        //! Get a const reference to the m_matrix
+        /**
+         * @brief Get a const reference to the m_matrix
+         *
+         * Only owned full precision storage can be returned: pre-images stored in external 
+         * memory (see isExternal()) should be accessed through view(), and reduced precision 
+         * ones through toDense() or getMatrix(ScalarMatrix &).
+         */
         const ScalarMatrix& getMatrix() const {
+            checkFullPrecision();
+            if (m_holder)
+                KQP_THROW_EXCEPTION(illegal_operation_exception, "Pre-images are stored in external memory: use view()");
             return this->m_matrix;
         }
+
+        /**
+         * @brief Full precision pre-images, whatever the storage
+         *
+         * Returns getMatrix() or, with a reduced precision or an external storage, 
+         * a copy of the (decoded) pre-images in @c buffer.
+         */
+        const ScalarMatrix& getMatrix(ScalarMatrix &buffer) const {
+            if (!isCompact() && !m_holder) return getMatrix();
+            buffer = toDense();
+            return buffer;
+        }
         
-        const ScalarMatrix &toDense() const {
-            return this->m_matrix;
+        //! Returns a full precision copy of the pre-images (reduced precision ones are decoded, and not kept)
+        ScalarMatrix toDense() const {
+            if (!isCompact()) 
+                return view();
+            Eigen::MatrixXd decoded(m_rows, m_cols);
+            if (!m_compact.empty())
+                decodePrecision(m_precision, &m_compact[0], m_rows * m_cols, decoded.data());
+            return decoded.template cast<Scalar>();
+        }
+
+        /**
+         * @brief Read-only view on the full precision pre-images, whatever the storage
+         *
+         * Reduced precision pre-images cannot be viewed: use toDense().
+         */
+        ConstMap view() const {
+            checkFullPrecision();
+            if (m_holder) return ConstMap(m_data, m_rows, m_cols);
+            return ConstMap(m_matrix.data(), m_matrix.rows(), m_matrix.cols());
+        }
+        
+        //! Returns true if the pre-images are stored in memory not owned by this matrix
+        bool isExternal() const {
+            return (bool)m_holder;
+        }
+
+        //! Storage precision of the pre-images
+        DensePrecision::Type precision() const {
+            return m_precision;
+        }
+        
+        //! Returns true if the pre-images are stored with a reduced precision
+        bool isCompact() const {
+            return m_precision != DensePrecision::FULL;
         }
 
 #ifndef SWIG
@@ -121,32 +221,45 @@ namespace kqp {
 #endif
         
         void add(const FMatrixBase &other, const std::vector<bool> *which = NULL) override {
-           this->add(cast(other).getMatrix(), which);
+            const Self &dOther = cast(other);
+            if (isCompact() && dOther.m_precision == m_precision)
+                return addCompact(dOther, which);
+            if (dOther.isCompact())
+                return this->add(dOther.toDense(), which);
+            this->add(dOther.view(), which);
         }
         
                        
         virtual Index size() const override { 
-            return m_matrix.cols();
+            return m_holder || isCompact() ? m_cols : m_matrix.cols();
         }
         
         Index dimension() const {
-            return m_matrix.rows();
+            return m_holder || isCompact() ? m_rows : m_matrix.rows();
         }
 
         //! Returns the Gram matrix
         const ScalarMatrix &gramMatrix() const {
-            if (m_matrix.cols() == m_gramMatrix.rows()) return m_gramMatrix;
+            if (size() == m_gramMatrix.rows()) return m_gramMatrix;
             
             // We lose space here, could be used otherwise???
             Index current = m_gramMatrix.rows();
-            if (current < m_matrix.cols()) 
-                m_gramMatrix.conservativeResize(m_matrix.cols(), m_matrix.cols());
+            if (current < size()) 
+                m_gramMatrix.conservativeResize(size(), size());
             
-            Index tofill = m_matrix.cols() - current;
+            Index tofill = size() - current;
+
+            if (isCompact()) {
+                ScalarMatrix products = compactProduct(0, size(), *this, current, tofill);
+                m_gramMatrix.rightCols(tofill) = products;
+                m_gramMatrix.bottomLeftCorner(tofill, current) = products.topRows(current).adjoint();
+                return m_gramMatrix;
+            }
             
             // Compute the remaining inner products
-            m_gramMatrix.bottomRightCorner(tofill, tofill).noalias() = this->getMatrix().rightCols(tofill).adjoint() * this->getMatrix().rightCols(tofill);
-            m_gramMatrix.topRightCorner(current, tofill).noalias() = this->getMatrix().leftCols(current).adjoint() * this->getMatrix().rightCols(tofill);
+            const ConstMap matrix = view();
+            m_gramMatrix.bottomRightCorner(tofill, tofill).noalias() = matrix.rightCols(tofill).adjoint() * matrix.rightCols(tofill);
+            m_gramMatrix.topRightCorner(current, tofill).noalias() = matrix.leftCols(current).adjoint() * matrix.rightCols(tofill);
             m_gramMatrix.bottomLeftCorner(tofill, current) = m_gramMatrix.topRightCorner(current, tofill).adjoint().eval();
             
             return m_gramMatrix;
@@ -155,22 +268,77 @@ namespace kqp {
         //! Computes the inner product with another m_matrix
         template<class DerivedMatrix>
         void _inner(const Self &other, DerivedMatrix &result) const {
-            result = this->getMatrix().adjoint() * other.getMatrix();
+            if (isCompact() || other.isCompact()) 
+                result = compactProduct(0, size(), other, 0, other.size());
+            else
+                result = this->view().adjoint() * other.view();
         }
         
         
+        //! Computes \f$ X A \f$ (reduced precision pre-images are decoded by blocks of columns)
+        ScalarMatrix combine(const ScalarAltMatrix &mA) const {
+            if (!isCompact())
+                return view() * mA;
+
+            const ScalarMatrix a = mA;
+            ScalarMatrix result = ScalarMatrix::Zero(m_rows, a.cols());
+            Eigen::MatrixXd panel;
+            for(Index j = 0; j < m_cols; j += PANEL_COLUMNS) {
+                Index nc = std::min<Index>(PANEL_COLUMNS, m_cols - j);
+                pack(0, m_rows, j, nc, panel);
+                result.noalias() += panel.template cast<Scalar>() * a.middleRows(j, nc);
+            }
+            return result;
+        }
+
         FMatrixBasePtr linearCombination(const ScalarAltMatrix & mA, Scalar alpha, const Self *mY, const ScalarAltMatrix *mB, Scalar beta) const override {
-            ScalarMatrix m(alpha * (getMatrix() * mA));            
+            ScalarMatrix m(alpha * combine(mA));            
             if (mY != 0) 
-                m +=  beta * mY->getMatrix() * *mB;
-                
+                m +=  beta * mY->combine(*mB);
+            
+            if (isCompact()) {
+                Self *result = new Self(m.rows(), m_precision);
+                result->add(m);
+                return FMatrixBasePtr(result);
+            }
             return FMatrixBasePtr(new Self(std::move(m)));   
         }
         
 
         FMatrixBasePtr subset(const std::vector<bool>::const_iterator &begin, const std::vector<bool>::const_iterator &end) const override {
-            ScalarMatrix m;
-            select_columns(begin, end, this->m_matrix, m);
+            if (isCompact()) {
+                Self *result = new Self(m_rows, m_precision);
+                auto it = begin;
+                for(Index j = 0; j < m_cols && it != end; j++, it++) 
+                    if (*it) {
+                        result->m_compact.insert(result->m_compact.end(), m_compact.begin() + j * stride(), m_compact.begin() + (j+1) * stride());
+                        result->m_cols++;
+                    }
+                return FMatrixBasePtr(result);
+            }
+            
+            if (!m_holder) {
+                ScalarMatrix m;
+                select_columns(begin, end, this->m_matrix, m);
+                return FMatrixBasePtr(new Self(std::move(m)));
+            }
+
+            // External storage: a contiguous selection is a view on the same memory
+            std::vector<Index> selected;
+            auto it = begin;
+            for(Index i = 0; i < m_cols && it != end; i++, it++) 
+                if (*it)
+                    selected.push_back(i);
+            
+            if (selected.empty() || selected.back() - selected.front() + 1 == (Index)selected.size()) {
+                Index first = selected.empty() ? 0 : selected.front();
+                return FMatrixBasePtr(new Self(m_data + first * m_rows, m_rows, selected.size(), m_holder));
+            }
+            
+            const ConstMap matrix = view();
+            ScalarMatrix m(m_rows, selected.size());
+            for(size_t j = 0; j < selected.size(); j++)
+                m.col(j) = matrix.col(selected[j]);
             return FMatrixBasePtr(new Self(std::move(m)));
         }
         
@@ -183,6 +351,12 @@ namespace kqp {
         Self& operator=(const Self &other)  {
             m_matrix = other.m_matrix;
             m_gramMatrix = other.m_gramMatrix;
+            m_holder = other.m_holder;
+            m_data = other.m_data;
+            m_rows = other.m_rows;
+            m_cols = other.m_cols;
+            m_precision = other.m_precision;
+            m_compact = other.m_compact;
             return *this;
         }
 
@@ -191,20 +365,176 @@ namespace kqp {
         }
 
         
+        //! Direct access to the owned matrix (see getMatrix())
         const ScalarMatrix * operator->() const {
-            return &m_matrix;
+            return &getMatrix();
         }
-        const ScalarMatrix & operator*() const {
-            return m_matrix;
+        //! Read-only view on the pre-images (see view())
+        ConstMap operator*() const {
+            return view();
         }
 
+    protected:
+        /**
+         * @brief Construction from external memory (no copy)
+         *
+         * @param data The column-major pre-images 
+         * @param holder Keeps the memory alive as long as a matrix refers to it
+         */
+        Dense(const Scalar *data, Index rows, Index cols, const boost::shared_ptr<void> &holder) 
+            : m_holder(holder), m_data(data), m_rows(rows), m_cols(cols), m_precision(DensePrecision::FULL) {}
+        
+        //! Sets the external storage (the Gram matrix cache is kept, and should be still valid for the first columns)
+        void setExternal(const Scalar *data, Index rows, Index cols, const boost::shared_ptr<void> &holder) {
+            m_matrix.resize(0,0);
+            m_holder = holder;
+            m_data = data;
+            m_rows = rows;
+            m_cols = cols;
+        }
+
+        //! Copy the external pre-images into an owned matrix (before any modification)
+        void detach() {
+            m_matrix = view();
+            m_holder.reset();
+            m_data = 0;
+            m_rows = m_cols = 0;
+        }
+        
     private:        
+        //! Number of rows and columns of the blocks used in reduced precision products
+        enum { PANEL_ROWS = 256, PANEL_COLUMNS = 128 };
+
+        //! Throws an exception if the pre-images have no full precision storage
+        void checkFullPrecision() const {
+            if (isCompact())
+                KQP_THROW_EXCEPTION_F(illegal_operation_exception, "Pre-images are stored in %s precision: use toDense()", %DensePrecision::name(m_precision));
+        }
+
+        //! Appends pre-images to the reduced precision storage
+        template<typename Derived>
+        void addCompact(const Eigen::DenseBase<Derived> &m, const std::vector<bool> *which) {
+            if (m_cols == 0) 
+                m_rows = m.rows();
+            if (m.rows() != m_rows)
+                KQP_THROW_EXCEPTION_F(illegal_operation_exception, 
+                                      "Cannot add a vector of dimension %d (dimension is %d)", % m.rows() % m_rows);
+            
+            Intervals intervals(which, m.cols());
+            m_compact.resize((m_cols + intervals.selected()) * stride());
+            Eigen::VectorXd column;
+            for(auto i = intervals.begin(); i != intervals.end(); i++) 
+                for(Index j = (Index)i->first; j <= (Index)i->second; j++, m_cols++) {
+                    column = m.col(j).real().template cast<double>();
+                    encodePrecision(m_precision, column.data(), column.data() + m_rows, &m_compact[m_cols * stride()]);
+                }
+        }
+
+        //! Appends pre-images of a matrix with the same reduced precision (no conversion)
+        void addCompact(const Self &other, const std::vector<bool> *which) {
+            if (m_cols == 0) 
+                m_rows = other.m_rows;
+            if (other.m_rows != m_rows)
+                KQP_THROW_EXCEPTION_F(illegal_operation_exception, 
+                                      "Cannot add a vector of dimension %d (dimension is %d)", % other.m_rows % m_rows);
+            
+            Intervals intervals(which, other.m_cols);
+            for(auto i = intervals.begin(); i != intervals.end(); i++) {
+                m_compact.insert(m_compact.end(), other.m_compact.begin() + i->first * stride(), other.m_compact.begin() + (i->second + 1) * stride());
+                m_cols += i->second - i->first + 1;
+            }
+        }
+
+        //! Copies a block of the pre-images in double precision
+        void pack(Index row, Index rows, Index col, Index cols, Eigen::MatrixXd &panel) const {
+            panel.resize(rows, cols);
+            if (isCompact()) {
+                for(Index j = 0; j < cols; j++)
+                    decodePrecision(m_precision, &m_compact[(col + j) * stride() + row * DensePrecision::units(m_precision)], rows, &panel(0, j));
+            } else 
+                panel = view().block(row, col, rows, cols).real().template cast<double>();
+        }
+
+        //! Copies a block of the (single precision) pre-images
+        void pack(Index row, Index rows, Index col, Index cols, Eigen::MatrixXf &panel) const {
+            panel.resize(rows, cols);
+            for(Index j = 0; j < cols; j++)
+                decodeSingle(&m_compact[(col + j) * stride() + row * 2], rows, &panel(0, j));
+        }
+
+        //! Offset between two columns in the reduced precision storage
+        inline Index stride() const {
+            return m_rows * DensePrecision::units(m_precision);
+        }
+
+        /**
+         * @brief Computes the inner products between columns of this matrix and of another one
+         *
+         * Blocks of rows are converted to double precision just before being multiplied,
+         * so that the full precision pre-images are never stored.
+         *
+         * @return The matrix of inner products between columns [i0, i0 + ni[ and columns [j0, j0 + nj[ of other
+         */
+        ScalarMatrix compactProduct(Index i0, Index ni, const Self &other, Index j0, Index nj) const {
+            if (other.dimension() != dimension())
+                KQP_THROW_EXCEPTION_F(illegal_argument_exception, "Cannot compute inner products between vectors of dimensions %d and %d", 
+                                      %dimension() %other.dimension());
+            
+            Eigen::MatrixXd result = Eigen::MatrixXd::Zero(ni, nj);
+            if (m_precision == DensePrecision::SINGLE && other.m_precision == DensePrecision::SINGLE) {
+                // Mixed precision: products of blocks in single precision, summed in double precision
+                Eigen::MatrixXf panel1, panel2;
+                for(Index jb = 0; jb < nj; jb += PANEL_COLUMNS) {
+                    Index nc2 = std::min<Index>(PANEL_COLUMNS, nj - jb);
+                    for(Index ib = 0; ib < ni; ib += PANEL_COLUMNS) {
+                        Index nc1 = std::min<Index>(PANEL_COLUMNS, ni - ib);
+                        for(Index r = 0; r < dimension(); r += PANEL_ROWS) {
+                            Index nr = std::min<Index>(PANEL_ROWS, dimension() - r);
+                            pack(r, nr, i0 + ib, nc1, panel1);
+                            other.pack(r, nr, j0 + jb, nc2, panel2);
+                            result.block(ib, jb, nc1, nc2) += (panel1.adjoint() * panel2).template cast<double>();
+                        }
+                    }
+                }
+                return result.template cast<Scalar>();
+            }
+            
+            Eigen::MatrixXd panel1, panel2;
+            for(Index jb = 0; jb < nj; jb += PANEL_COLUMNS) {
+                Index nc2 = std::min<Index>(PANEL_COLUMNS, nj - jb);
+                for(Index ib = 0; ib < ni; ib += PANEL_COLUMNS) {
+                    Index nc1 = std::min<Index>(PANEL_COLUMNS, ni - ib);
+                    for(Index r = 0; r < dimension(); r += PANEL_ROWS) {
+                        Index nr = std::min<Index>(PANEL_ROWS, dimension() - r);
+                        pack(r, nr, i0 + ib, nc1, panel1);
+                        other.pack(r, nr, j0 + jb, nc2, panel2);
+                        result.block(ib, jb, nc1, nc2).noalias() += panel1.adjoint() * panel2;
+                    }
+                }
+            }
+            return result.template cast<Scalar>();
+        }
 
         //! Cache of the gram m_matrix
         mutable ScalarMatrix m_gramMatrix;
         
-        //! Our m_matrix
+        //! Our m_matrix (when the storage is owned)
         ScalarMatrix m_matrix;
+        
+        //! Keeps the external storage alive (null when the storage is owned)
+        boost::shared_ptr<void> m_holder;
+        
+        //! External storage (column-major)
+        const Scalar *m_data;
+
+        //! Dimensions of the external or reduced precision storage
+        Index m_rows, m_cols;
+
+        //! Storage precision
+        DensePrecision::Type m_precision;
+
+        //! Reduced precision storage (column-major)
+        std::vector<uint16_t> m_compact;
 
         friend class DenseSpace<Scalar>;
 
@@ -214,7 +544,7 @@ namespace kqp {
     
     template<typename Scalar>
     std::ostream& operator<<(std::ostream &out, const Dense<Scalar> &f) {
-        return out << "[Dense Matrix with scalar " << KQP_DEMANGLE((Scalar)0) << "]" << std::endl << f.getMatrix();
+        return out << "[Dense Matrix with scalar " << KQP_DEMANGLE((Scalar)0) << "]" << std::endl << f.toDense();
     }
     
     
@@ -229,10 +559,17 @@ namespace kqp {
 #ifndef SWIG
         using SpaceBase<Scalar>::k;
 #endif        
-        static FSpace create(Index dimension) { return FSpace(new DenseSpace(dimension)); }
+        static FSpace create(Index dimension, DensePrecision::Type precision = DensePrecision::FULL) { 
+            return FSpace(new DenseSpace(dimension, precision)); 
+        }
         
-        DenseSpace(Index dimension) : m_dimension(dimension) {}
-        DenseSpace() : m_dimension(0) {}
+        /**
+         * @brief Creates a dense space
+         * @param precision The storage precision of the feature matrices created by this space
+         */
+        DenseSpace(Index dimension, DensePrecision::Type precision = DensePrecision::FULL) 
+            : m_dimension(dimension), m_precision(precision) {}
+        DenseSpace() : m_dimension(0), m_precision(DensePrecision::FULL) {}
         
         FSpacePtr copy() const override {
             return FSpacePtr(new DenseSpace(*this));
@@ -241,7 +578,11 @@ namespace kqp {
         inline static const Dense<Scalar>& cast(const FMatrixBase &mX) { return kqp::our_dynamic_cast<const Dense<Scalar> &>(mX); }
 
         FMatrixBasePtr newMatrix(const ScalarMatrix &mX) const {
-            return FMatrixBasePtr(new Dense<Scalar>(mX));            
+            if (m_precision == DensePrecision::FULL)
+                return FMatrixBasePtr(new Dense<Scalar>(mX));            
+            Dense<Scalar> *m = new Dense<Scalar>(mX.rows(), m_precision);
+            m->add(mX);
+            return FMatrixBasePtr(m);
         }
         
         
@@ -250,12 +591,21 @@ namespace kqp {
         Index dimension() const override { return m_dimension; }
         void dimension(Index dimension) { m_dimension = dimension; }
 
+        //! Storage precision of the feature matrices
+        DensePrecision::Type precision() const { return m_precision; }
+        void precision(DensePrecision::Type precision) { m_precision = precision; }
+
 
         virtual FMatrixBasePtr newMatrix() const override {
-            return FMatrixBasePtr(new Dense<Scalar>(m_dimension));
+            return FMatrixBasePtr(new Dense<Scalar>(m_dimension, m_precision));
         }
         virtual FMatrixBasePtr newMatrix(const FMatrixBase &mX) const override {
-            return FMatrixBasePtr(new Dense<Scalar>(cast(mX)));            
+            const Dense<Scalar> &dX = cast(mX);
+            if (dX.precision() == m_precision)
+                return FMatrixBasePtr(new Dense<Scalar>(dX));            
+            Dense<Scalar> *m = new Dense<Scalar>(dX.dimension(), m_precision);
+            m->add(dX);
+            return FMatrixBasePtr(m);
         }
 
         virtual bool _canLinearlyCombine() const override {
@@ -268,8 +618,33 @@ namespace kqp {
         
         virtual ScalarMatrix k(const FeatureMatrixBase<Scalar> &mX1, const ScalarAltMatrix &mY1, const RealAltVector &mD1,
                                const FeatureMatrixBase<Scalar> &mX2, const ScalarAltMatrix &mY2, const RealAltVector &mD2) const override {        
-            return mD1.asDiagonal() * mY1.adjoint() * cast(mX1)->adjoint() * *cast(mX2) * mY2 * mD2.asDiagonal();
+            return k(cast(mX1), mY1, mD1, cast(mX2), mY2, mD2);
         };
+
+#ifndef SWIG
+        // --- Statically typed versions (see StaticSpace)
+
+        //! Type of the feature matrices
+        typedef Dense<Scalar> FMatrixType;
+
+        //! Gram matrix
+        inline const ScalarMatrix &k(const Dense<Scalar> &mX) const {
+            return mX.gramMatrix();
+        }
+
+        //! Inner products \f$D_1^\dagger Y_1^\dagger X_1^\dagger X_2 Y_2 D_2\f$
+        ScalarMatrix k(const Dense<Scalar> &mX1, const ScalarAltMatrix &mY1, const RealAltVector &mD1,
+                       const Dense<Scalar> &mX2, const ScalarAltMatrix &mY2, const RealAltVector &mD2) const {
+            if (mX1.isCompact() || mX2.isCompact()) {
+                ScalarMatrix inner;
+                mX1._inner(mX2, inner);
+                return mD1.asDiagonal() * bilinear(mY1, inner, mY2) * mD2.asDiagonal();
+            }
+            if (mY1.isSparse() || mY2.isSparse())
+                return mD1.asDiagonal() * (multiply(mX1.view(), mY1).adjoint() * multiply(mX2.view(), mY2)) * mD2.asDiagonal();
+            return mD1.asDiagonal() * mY1.adjoint() * mX1.view().adjoint() * mX2.view() * mY2 * mD2.asDiagonal();
+        }
+#endif
         
         virtual FMatrixBasePtr linearCombination(const FMatrixBase &mX, const ScalarAltMatrix &mA, Scalar alpha, 
                                              const FMatrixBase *mY, const ScalarAltMatrix *mB, Scalar beta) const override {
@@ -279,16 +654,20 @@ namespace kqp {
 
         virtual void load(const pugi::xml_node &node) override {
             m_dimension = boost::lexical_cast<Index>(node.attribute("dimension").value());
+            m_precision = DensePrecision::get(node.attribute("precision").value());
         }
 
         virtual pugi::xml_node save(pugi::xml_node &node) const override {
             pugi::xml_node self = SpaceBase<Scalar>::save(node);
             self.append_attribute("dimension") = boost::lexical_cast<std::string>(m_dimension).c_str();
+            if (m_precision != DensePrecision::FULL)
+                self.append_attribute("precision") = DensePrecision::name(m_precision).c_str();
             return self;
         }
 
     private:
         Index m_dimension;
+        DensePrecision::Type m_precision;
     };
     
 # // Extern templates
@@ -1,16 +1,16 @@
 /*
  This file is part of the Kernel Quantum Probability library (KQP).
- 
+
  KQP is free software: you can redistribute it and/or modify
  it under the terms of the GNU General Public License as published by
  the Free Software Foundation, either version 3 of the License, or
  (at your option) any later version.
- 
+
  KQP is distributed in the hope that it will be useful,
  but WITHOUT ANY WARRANTY; without even the implied warranty of
  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
  GNU General Public License for more details.
- 
+
  You should have received a copy of the GNU General Public License
  along with KQP.  If not, see <http://www.gnu.org/licenses/>.
  */
@@ -18,91 +18,399 @@
 #ifndef __KQP_GENERIC_FEATURE_MATRIX_H__
 #define __KQP_GENERIC_FEATURE_MATRIX_H__
 
+#include <mutex>
+#include <numeric>
+#include <vector>
+#include <stdint.h>
+#include <boost/function.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/functional/hash.hpp>
+
 #include <kqp/feature_matrix.hpp>
+#include <kqp/intervals.hpp>
 
 namespace kqp {
-    
-    
+
+    template <typename Scalar> class FeatureList;
+    template <typename Scalar> class GenericSpace;
+
+#   include <kqp/define_header_logger.hpp>
+    DEFINE_KQP_HLOGGER("kqp.feature-matrix.generic");
+
     /**
-     * @brief A class that supposes that feature vectors know how to compute their inner product, i.e. inner(a,b)
-     *        is defined.
+     * @brief Base class for structured pre-images (strings, trees, graphs, ...)
+     *
+     * Each vector has a unique identifier, which is used to cache kernel values.
+     * Vectors should not be modified once they are in a feature list.
+     */
+    class GenericVector {
+    public:
+        GenericVector() : m_id(nextId()) {}
+        GenericVector(const GenericVector &) : m_id(nextId()) {}
+        virtual ~GenericVector() {}
+
+        //! The unique identifier of this vector
+        uint64_t id() const { return m_id; }
+
+    private:
+        GenericVector &operator=(const GenericVector &);
+        static uint64_t nextId();
+        const uint64_t m_id;
+    };
+
+
+    /**
+     * @brief User-defined kernel between generic vectors
+     *
+     * The kernel is always called on blocks of pairs, so that implementations can
+     * vectorize or parallelize the computation.
+     */
+    template<typename Scalar>
+    class GenericKernel {
+    public:
+        KQP_SCALAR_TYPEDEFS(Scalar);
+        typedef std::vector< boost::shared_ptr<const GenericVector> > List;
+
+        virtual ~GenericKernel() {}
+
+        /**
+         * @brief Computes the kernel values between two lists of vectors
+         * @param result A matrix of size x.size() times y.size() that should be filled with \f$ k(x_i, y_j) \f$
+         */
+        virtual void inner(const List &x, const List &y, ScalarMatrix &result) const = 0;
+    };
+
+#ifndef SWIG
+    //! A generic kernel defined by a function
+    template<typename Scalar>
+    class FunctionKernel : public GenericKernel<Scalar> {
+    public:
+        KQP_SCALAR_TYPEDEFS(Scalar);
+        typedef typename GenericKernel<Scalar>::List List;
+        typedef boost::function<void (const List &, const List &, ScalarMatrix &)> Function;
+
+        FunctionKernel(const Function &function) : m_function(function) {}
+
+        virtual void inner(const List &x, const List &y, ScalarMatrix &result) const override {
+            m_function(x, y, result);
+        }
+
+    private:
+        Function m_function;
+    };
+#endif
+
+
+    /**
+     * @brief A feature matrix whose pre-images are generic vectors, whose inner products
+     *        are computed by a user-defined kernel (see GenericSpace)
+     *
+     * Pre-images are shared between copies and subsets of the list. The Gram matrix is cached
+     * for the last kernel it was computed with.
+     *
      * @ingroup FeatureMatrix
      */
-    template <class FVector> 
-    class FeatureList : public FeatureMatrix< FeatureList<FVector> > {
+    template <typename Scalar>
+    class FeatureList : public FeatureMatrixBase<Scalar> {
     public:
-        KQP_FMATRIX_COMMON_DEFS(FeatureMatrix<FVector>);
+        typedef FeatureList<Scalar> Self;
+        KQP_SPACE_TYPEDEFS("generic", Scalar);
+        typedef boost::shared_ptr<const GenericVector> VectorPtr;
+        typedef std::vector<VectorPtr> List;
+
+        virtual ~FeatureList() {}
+
+        FeatureList() {}
+        FeatureList(const List &list) : m_list(list) {}
+        FeatureList(const Self &other) : FeatureMatrixBase<Scalar>(other) {
+            *this = other;
+        }
+
+        //! Adds a pre-image
+        void add(const VectorPtr &vector) {
+            m_list.push_back(vector);
+        }
+
+#ifndef SWIG
+        inline static const Self &cast(const FMatrixBase &m) {
+            return kqp::our_dynamic_cast<const Self&>(m);
+        }
+#endif
+
+        void add(const FMatrixBase &_other, const std::vector<bool> *which = NULL) override {
+            const Self &other = cast(_other);
+            Intervals intervals(which, other.size());
+            for(auto i = intervals.begin(); i != intervals.end(); i++)
+                m_list.insert(m_list.end(), other.m_list.begin() + i->first, other.m_list.begin() + i->second + 1);
+        }
 
-        FeatureList(Index dimension) : m_dimension(dimension) {}
-        
-        
-                
-    protected:
-        Index _size() const { return this->list.size(); }
+        virtual Index size() const override {
+            return m_list.size();
+        }
 
-        void _add(const Self &other, std::vector<bool> *which = NULL)  {
-            this->list.push_back(f);
+        //! Returns the i<sup>th</sup> pre-image
+        const VectorPtr &get(Index i) const {
+            return m_list[i];
         }
-        
-        const ScalarMatrix &_inner() const {
+
+        //! Returns the list of pre-images
+        const List &list() const {
+            return m_list;
         }
-        
-        template<class DerivedMatrix>
-        void _inner(const Self &other, const Eigen::MatrixBase<DerivedMatrix> &result) const {
-            if (result.rows() != _size() || result.cols() != other.size())
-                result.derived().resize(result.rows(), result.cols());
+
+        FMatrixBasePtr subset(const std::vector<bool>::const_iterator &begin, const std::vector<bool>::const_iterator &end) const override {
+            Self *result = new Self();
+            auto it = begin;
+            for(size_t j = 0; j < m_list.size() && it != end; j++, it++)
+                if (*it)
+                    result->m_list.push_back(m_list[j]);
+            return FMatrixBasePtr(result);
         }
-        
-        // Computes alpha * X * A + beta * Y * B (X = *this)
-        Self _linear_combination(const ScalarAltMatrix &mA, Scalar alpha, const Self *mY, const ScalarAltMatrix *mB, Scalar beta) const {
+
+        virtual FMatrixBasePtr copy() const override {
+            return FMatrixBasePtr(new Self(*this));
         }
-        
-        void _subset(const std::vector<bool>::const_iterator &begin, const std::vector<bool>::const_iterator &end, Self &into) const {
+
+        Self& operator=(const Self &other) {
+            if (this == &other) return *this;
+            m_list = other.m_list;
+            std::lock_guard<std::mutex> lock(other.m_gramMutex);
+            m_gramMatrix = other.m_gramMatrix;
+            m_gramOwner = other.m_gramOwner;
+            return *this;
         }
-        
+
+        virtual FMatrixBase& operator=(const FMatrixBase &other) override {
+            return *this = cast(other);
+        }
+
     private:
-        //! Our inner product
-        mutable ScalarMatrix m_gramMatrix;
-        
         //! Our list of pre-images
-        std::vector<FVector> m_list;
-        
-        //! Dimension
-        Index m_dimension;
+        List m_list;
+
+        //! Cache of the gram matrix
+        mutable ScalarMatrix m_gramMatrix;
+
+        //! Kernel values cache of the space that computed the Gram matrix (identifies its kernel)
+        mutable boost::weak_ptr<const void> m_gramOwner;
+
+        //! Guards the Gram matrix (spaces can be evaluated concurrently)
+        mutable std::mutex m_gramMutex;
+
+        friend class GenericSpace<Scalar>;
     };
-    
-    
-    // Informations about the generic feature matrix
-    template <typename FVector> struct FeatureMatrixTypes<FVector> {
-        typedef FVector::Scalar Scalar;
-        enum {
-            can_linearly_combine = FVector::can_linearly_combine
+
+
+    /**
+     * @brief The feature space of generic vectors, whose kernel is user-defined
+     *
+     * Kernel values are cached for each pair of vector identifiers (in a cache shared
+     * by copies of the space), so that the kernel is only evaluated once for a given pair,
+     * even for copies or subsets of feature lists (e.g. during cleaning). The cache is 
+     * thread-safe, so the kernel can be called by several threads at once.
+     *
+     * The kernel is called on blocks: the vectors involved in pairs that are not in the cache are
+     * grouped, and blocks of at most blockSize x blockSize pairs are computed at once.
+     */
+    template<typename Scalar>
+    class GenericSpace : public SpaceBase<Scalar> {
+    public:
+        typedef GenericSpace<Scalar> Self;
+        KQP_SPACE_TYPEDEFS("generic", Scalar);
+#ifndef SWIG
+        using SpaceBase<Scalar>::k;
+#endif
+        typedef typename FeatureList<Scalar>::List List;
+        typedef boost::shared_ptr< const GenericKernel<Scalar> > KernelPtr;
+
+        /**
+         * @param kernel The kernel
+         * @param blockSize The maximum number of rows and columns in one call to the kernel
+         * @param cacheCapacity The maximum number of cached kernel values (the cache is emptied when full)
+         */
+        GenericSpace(const KernelPtr &kernel, Index blockSize = 1024, size_t cacheCapacity = 1 << 24)
+            : m_kernel(kernel), m_blockSize(blockSize), m_cache(new Cache()), m_cacheCapacity(cacheCapacity) {}
+        GenericSpace() : m_blockSize(1024), m_cache(new Cache()), m_cacheCapacity(1 << 24) {}
+
+        FSpacePtr copy() const override {
+            return FSpacePtr(new GenericSpace(*this));
+        }
+
+        inline static const FeatureList<Scalar>& cast(const FMatrixBase &mX) { return kqp::our_dynamic_cast<const FeatureList<Scalar> &>(mX); }
+
+        //! Sets the kernel (the cache is cleared)
+        void kernel(const KernelPtr &kernel) {
+            m_kernel = kernel;
+            m_cache.reset(new Cache());
+        }
+
+        //! Number of cached kernel values
+        size_t cacheSize() const { 
+            std::lock_guard<std::mutex> lock(m_cache->mutex);
+            return m_cache->size(); 
+        }
+
+        //! Clears the kernel values cache
+        void clearCache() { 
+            std::lock_guard<std::mutex> lock(m_cache->mutex);
+            m_cache->clear(); 
+        }
+
+        //! Number of kernel values computed by the kernel so far
+        size_t evaluations() const { 
+            std::lock_guard<std::mutex> lock(m_cache->mutex);
+            return m_cache->evaluations; 
+        }
+
+        Index dimension() const override { return -1; }
+
+        virtual FMatrixBasePtr newMatrix() const override {
+            return FMatrixBasePtr(new FeatureList<Scalar>());
+        }
+        virtual FMatrixBasePtr newMatrix(const FMatrixBase &mX) const override {
+            return FMatrixBasePtr(new FeatureList<Scalar>(cast(mX)));
+        }
+
+        const ScalarMatrix &k(const FeatureMatrixBase<Scalar> &mX) const override {
+            const FeatureList<Scalar> &list = cast(mX);
+            std::lock_guard<std::mutex> lock(list.m_gramMutex);
+            ScalarMatrix &gram = list.m_gramMatrix;
+
+            // The Gram matrix is only valid for the kernel it was computed with
+            if (list.m_gramOwner.lock() != m_cache) {
+                gram.resize(0, 0);
+                list.m_gramOwner = m_cache;
+            }
+            if (list.size() == gram.rows()) return gram;
+
+            Index current = gram.rows();
+            Index tofill = list.size() - current;
+            gram.conservativeResize(list.size(), list.size());
+
+            List added(list.m_list.begin() + current, list.m_list.end());
+            ScalarMatrix products;
+            inner(list.m_list, added, products);
+
+            gram.rightCols(tofill) = products;
+            gram.bottomLeftCorner(tofill, current) = products.topRows(current).adjoint();
+            return gram;
+        }
+
+        virtual ScalarMatrix k(const FeatureMatrixBase<Scalar> &mX1, const ScalarAltMatrix &mY1, const RealAltVector &mD1,
+                               const FeatureMatrixBase<Scalar> &mX2, const ScalarAltMatrix &mY2, const RealAltVector &mD2) const override {
+            ScalarMatrix products;
+            inner(cast(mX1).m_list, cast(mX2).m_list, products);
+            return mD1.asDiagonal() * bilinear(mY1, products, mY2) * mD2.asDiagonal();
         };
-    };
-    
-    
-    //! A generic vector
-    template<typename _Scalar, bool _can_linearly_combine>
-    struct GenericVector<Scalar> {
-        typedef _Scalar Scalar;
-        enum {
-            can_linearly_combine = _can_linearly_combine;
-        }
-        
-        virtual Scalar inner() = 0;
-        virtual Scalar inner(const GenericVector<Scalar> &other) = 0;
+
+        //! The kernel is user-defined: it cannot be loaded, and has to be set with kernel()
+        virtual void load(const pugi::xml_node &node) override {
+            m_blockSize = kqp::attribute<Index>(node, "block-size", 1024);
+        }
+
+        virtual pugi::xml_node save(pugi::xml_node &node) const override {
+            pugi::xml_node self = SpaceBase<Scalar>::save(node);
+            self.append_attribute("block-size") = boost::lexical_cast<std::string>(m_blockSize).c_str();
+            return self;
+        }
+
+    private:
+        typedef std::pair<uint64_t, uint64_t> Key;
+
+        //! Kernel values indexed by pairs of identifiers (smallest first)
+        struct Cache : public boost::unordered_map<Key, Scalar, boost::hash<Key> > {
+            Cache() : evaluations(0) {}
+            size_t evaluations;
+            //! Guards the values and the number of evaluations
+            std::mutex mutex;
+        };
+
+        //! Gets a cached value (the cache should be locked)
+        inline bool get(uint64_t id1, uint64_t id2, Scalar &value) const {
+            auto it = m_cache->find(id1 <= id2 ? Key(id1, id2) : Key(id2, id1));
+            if (it == m_cache->end()) return false;
+            value = id1 <= id2 ? it->second : Eigen::internal::conj(it->second);
+            return true;
+        }
+
+        /**
+         * @brief Computes the kernel values between two lists
+         *
+         * Cached values are retrieved first. The rows and columns with missing values
+         * are then computed by blocks.
+         */
+        void inner(const List &x, const List &y, ScalarMatrix &result) const {
+            if (!m_kernel)
+                KQP_THROW_EXCEPTION(illegal_operation_exception, "No kernel was given to the generic space");
+
+            result.resize(x.size(), y.size());
+            std::vector<bool> missingRows(x.size(), false), missingCols(y.size(), false);
+            {
+                std::lock_guard<std::mutex> lock(m_cache->mutex);
+                for(size_t j = 0; j < y.size(); j++)
+                    for(size_t i = 0; i < x.size(); i++)
+                        if (!get(x[i]->id(), y[j]->id(), result(i, j)))
+                            missingRows[i] = missingCols[j] = true;
+            }
+
+            std::vector<Index> rows, cols;
+            for(size_t i = 0; i < x.size(); i++) if (missingRows[i]) rows.push_back(i);
+            for(size_t j = 0; j < y.size(); j++) if (missingCols[j]) cols.push_back(j);
+            if (rows.empty()) return;
+
+            {
+                std::lock_guard<std::mutex> lock(m_cache->mutex);
+                if (m_cache->size() + rows.size() * cols.size() > m_cacheCapacity) {
+                    KQP_HLOG_DEBUG_F("Clearing the kernel cache (%d values)", %m_cache->size());
+                    m_cache->clear();
+                }
+            }
+
+            ScalarMatrix block;
+            for(size_t jb = 0; jb < cols.size(); jb += m_blockSize) {
+                List blockY;
+                for(size_t j = jb; j < std::min<size_t>(jb + m_blockSize, cols.size()); j++)
+                    blockY.push_back(y[cols[j]]);
+
+                for(size_t ib = 0; ib < rows.size(); ib += m_blockSize) {
+                    List blockX;
+                    for(size_t i = ib; i < std::min<size_t>(ib + m_blockSize, rows.size()); i++)
+                        blockX.push_back(x[rows[i]]);
+
+                    KQP_HLOG_DEBUG_F("Computing a block of %d x %d generic kernel values", %blockX.size() %blockY.size());
+                    block.resize(blockX.size(), blockY.size());
+                    m_kernel->inner(blockX, blockY, block);
+
+                    std::lock_guard<std::mutex> lock(m_cache->mutex);
+                    m_cache->evaluations += block.size();
+                    for(Index j = 0; j < block.cols(); j++)
+                        for(Index i = 0; i < block.rows(); i++) {
+                            uint64_t id1 = blockX[i]->id(), id2 = blockY[j]->id();
+                            (*m_cache)[id1 <= id2 ? Key(id1, id2) : Key(id2, id1)] = id1 <= id2 ? block(i, j) : Eigen::internal::conj(block(i, j));
+                            result(rows[ib + i], cols[jb + j]) = block(i, j);
+                        }
+                }
+            }
+        }
+
+        //! The kernel
+        KernelPtr m_kernel;
+
+        //! Maximum number of rows or columns of blocks
+        Index m_blockSize;
+
+        //! The cache (shared between copies)
+        boost::shared_ptr<Cache> m_cache;
+        size_t m_cacheCapacity;
     };
 
-	template<Scalar>
-	inline Scalar inner(const GenericVector<Scalar> &a, const GenericVector<Scalar> &b) {
-		return a.inner(b);
-	}
+# // Extern templates
+# ifndef SWIG
+# define KQP_SCALAR_GEN(scalar) extern template class FeatureList<scalar>; extern template class GenericSpace<scalar>;
+# include <kqp/for_all_scalar_gen.h.inc>
+# endif
 
-	template<Scalar>
-	inline Scalar inner(GenericVector<Scalar> &a) {
-		return a.inner();
-	}
-    
 } // end namespace kqp
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,154 @@
+/*
+ This file is part of the Kernel Quantum Probability library (KQP).
+
+ KQP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ KQP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with KQP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __KQP_HASHED_SPARSE_FEATURE_MATRIX_H__
+#define __KQP_HASHED_SPARSE_FEATURE_MATRIX_H__
+
+#include <vector>
+#include <stdint.h>
+
+#include <kqp/feature_matrix/sparse.hpp>
+
+namespace kqp {
+
+    /**
+     * @brief A sparse space where features are identified by arbitrary 64 bits identifiers (feature hashing)
+     *
+     * Each identifier is mapped to a component of a fixed dimension space, and to a sign,
+     * by hash functions that depend on a seed. Collisions add up, but since the signs are independent,
+     * the inner product between hashed vectors is an unbiased estimate of the inner product between
+     * the original vectors.
+     *
+     * Feature matrices are ordinary Sparse matrices: use a Builder to create them from (identifier, value) streams.
+     */
+    template<typename Scalar>
+    class HashedSparseSpace : public SparseSpace<Scalar> {
+    public:
+        typedef HashedSparseSpace<Scalar> Self;
+        KQP_SPACE_TYPEDEFS("hashed-sparse", Scalar);
+        typedef typename Sparse<Scalar>::Storage Storage;
+
+        static FSpace create(Index dimension, uint64_t seed = 0) { return FSpace(new Self(dimension, seed)); }
+
+        HashedSparseSpace() : m_seed(0) {}
+        HashedSparseSpace(Index dimension, uint64_t seed = 0) : SparseSpace<Scalar>(dimension), m_seed(seed) {}
+
+        virtual FSpacePtr copy() const override { return FSpacePtr(new Self(*this)); }
+
+        //! The seed of the hash functions
+        uint64_t seed() const { return m_seed; }
+
+        //! Component of a feature identifier
+        inline Index index(uint64_t id) const {
+            return mix(id) % (uint64_t)this->dimension();
+        }
+
+        //! Sign of a feature identifier
+        inline Real sign(uint64_t id) const {
+            return mix(id) >> 63 ? -1 : 1;
+        }
+
+        /**
+         * @brief Builds a sparse feature matrix from (identifier, value) streams
+         *
+         * Vectors are added one after the other (values of the current vector are given by add(),
+         * and next() starts a new vector). The storage is built only once by matrix().
+         */
+        class Builder {
+        public:
+            Builder(const Self &space) : m_space(space), m_cols(0), m_empty(true) {}
+
+            //! Adds a component to the current vector (values of identical identifiers are summed)
+            void add(uint64_t id, Scalar value) {
+                m_triplets.push_back(Eigen::Triplet<Scalar>(m_space.index(id), m_cols, m_space.sign(id) * value));
+                m_empty = false;
+            }
+
+            //! Adds components to the current vector from a range of (identifier, value) pairs
+            template<typename Iterator>
+            void add(Iterator begin, Iterator end) {
+                for(; begin != end; ++begin)
+                    add(begin->first, begin->second);
+            }
+
+            //! Ends the current vector (which may be null)
+            void next() {
+                m_cols++;
+                m_empty = true;
+            }
+
+            //! Number of vectors (including the current one if it is not empty)
+            Index size() const {
+                return m_cols + (m_empty ? 0 : 1);
+            }
+
+            //! Returns the sparse matrix of all the vectors, and clears the builder
+            boost::shared_ptr< Sparse<Scalar> > matrix() {
+                Storage storage(m_space.dimension(), size());
+                storage.setFromTriplets(m_triplets.begin(), m_triplets.end());
+                m_triplets.clear();
+                m_cols = 0;
+                m_empty = true;
+                return boost::shared_ptr< Sparse<Scalar> >(new Sparse<Scalar>(std::move(storage)));
+            }
+
+        private:
+            const Self &m_space;
+            std::vector< Eigen::Triplet<Scalar> > m_triplets;
+            Index m_cols;
+            bool m_empty;
+        };
+
+        //! Hashes a vector given as a range of (identifier, value) pairs
+        template<typename Iterator>
+        boost::shared_ptr< Sparse<Scalar> > hash(Iterator begin, Iterator end) const {
+            Builder builder(*this);
+            builder.add(begin, end);
+            builder.next();
+            return builder.matrix();
+        }
+
+        virtual void load(const pugi::xml_node &node) override {
+            SparseSpace<Scalar>::load(node);
+            m_seed = kqp::attribute<uint64_t>(node, "seed", 0);
+        }
+
+        virtual pugi::xml_node save(pugi::xml_node &node) const override {
+            pugi::xml_node self = SparseSpace<Scalar>::save(node);
+            self.append_attribute("seed") = boost::lexical_cast<std::string>(m_seed).c_str();
+            return self;
+        }
+
+    private:
+        //! Hash of an identifier (splitmix64 finalizer)
+        inline uint64_t mix(uint64_t id) const {
+            uint64_t z = id + (m_seed + 1) * 0x9e3779b97f4a7c15ULL;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            return z ^ (z >> 31);
+        }
+
+        uint64_t m_seed;
+    };
+
+# ifndef SWIG
+# define KQP_SCALAR_GEN(scalar) extern template class HashedSparseSpace<scalar>;
+# include <kqp/for_all_scalar_gen.h.inc>
+# endif
+
+} // end namespace kqp
+
+#endif
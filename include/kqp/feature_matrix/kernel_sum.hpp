@@ -17,6 +17,9 @@
 #ifndef __KQP_KERNEL_SUM_H__
 #define __KQP_KERNEL_SUM_H__
 
+#include <exception>
+#include <map>
+#include <set>
 #include <vector>
 #include <boost/lexical_cast.hpp>
 #include <kqp/feature_matrix.hpp>
@@ -159,29 +162,25 @@ namespace kqp {
             // So we suppose we are not multithreaded... and compute it each time.
             // ScalarMatrix &gram = m_gramCache[static_cast<const void*>(&mX)];
             
-            static ScalarMatrix gram;
+            // (one per thread, since subspaces can be evaluated concurrently)
+            static thread_local ScalarMatrix gram;
 
             gram = ScalarMatrix::Zero(mX.size(), mX.size());
 
-            for(size_t i = 0; i < m_spaces.size(); i++) {
-                gram += getNormalizedWeight(i) * m_spaces[i]->k(mX.template as<TMatrix>()[i]);
-            }    
+            const TMatrix &m = mX.template as<TMatrix>();
+            accumulate(gram, [&](size_t i) -> const ScalarMatrix & { return m_spaces[i]->k(m[i]); }, distinct(m, m));
             return gram;
         }
 
         virtual ScalarMatrix k(const FMatrixBase &mX1, const ScalarAltMatrix &mY1, const RealAltVector &mD1, 
                                const FMatrixBase &mX2, const ScalarAltMatrix &mY2, const RealAltVector &mD2) const override {
-        	ScalarMatrix k = ScalarMatrix::Zero(mX1.size(), mX2.size());
-
-        	for(size_t i = 0; i < m_spaces.size(); i++) {
-        		k += getNormalizedWeight(i) * m_spaces[i]->k(mX1.template as<TMatrix>()[i], mY1, mD1, mX2.template as<TMatrix>()[i], mY2, mD2);
-        	}
+        	ScalarMatrix k = ScalarMatrix::Zero(mY1.cols(), mY2.cols());
 
+            const TMatrix &m1 = mX1.template as<TMatrix>(), &m2 = mX2.template as<TMatrix>();
+            accumulate(k, [&](size_t i) { return m_spaces[i]->k(m1[i], mY1, mD1, m2[i], mY2, mD2); }, distinct(m1, m2));
         	return k;
         }
 
-     
-        
         virtual void update(std::vector< KernelValues<Scalar> > &values, int kOffset = 0) const override {
             auto &self = values[kOffset];
             kOffset++;
@@ -212,6 +211,36 @@ namespace kqp {
 
         }
 
+#ifndef SWIG
+        virtual void update(KernelValuesBlock<Scalar> &values, int kOffset = 0) const override {
+            const int self = kOffset++;
+
+            values._inner.col(self).setZero();
+            values._innerX.col(self).setZero();
+            values._innerY.col(self).setZero();
+            for(size_t i = 0; i < m_spaces.size(); i++) {
+                m_spaces[i]->update(values, kOffset);
+                values._inner.col(self) += getNormalizedWeight(i) * values._inner.col(kOffset);
+                values._innerX.col(self) += getNormalizedWeight(i) * values._innerX.col(kOffset);
+                values._innerY.col(self) += getNormalizedWeight(i) * values._innerY.col(kOffset);
+                kOffset += m_spaces[i]->numberOfKernelValues();
+            }
+        }
+
+        virtual void updatePartials(const RealVector &alpha, std::vector<Real> &partials, int offset, const KernelValuesBlock<Scalar> &values,  int kOffset, int mode) const override {
+            const int self = kOffset++;
+
+            for(size_t i = 0; i < m_spaces.size(); i++) {
+                partials[offset] += 2. * (m_weights[i]*m_weights[i]) / m_sum 
+                        * (alpha.array() * (values.inner(kOffset, mode) - values.inner(self, mode)).real().array()).sum();
+                m_spaces[i]->updatePartials(RealVector(alpha * getNormalizedWeight(i)), partials, offset + 1, values, kOffset, mode);
+
+                offset += m_spaces[i]->numberOfParameters() + 1;
+                kOffset +=  m_spaces[i]->numberOfKernelValues();
+            }
+        }
+#endif
+
         virtual int numberOfKernelValues() const {
             int n = 1;
             for(size_t i = 0; i < m_spaces.size(); i++)
@@ -294,6 +323,62 @@ namespace kqp {
         inline Real getNormalizedWeight(size_t i) const {
             return m_weights[i] * m_weights[i] / m_sum;
         }
+
+#ifndef SWIG
+        /**
+         * @brief Adds the weighted kernel matrices of the subspaces to a result
+         *
+         * When concurrent, the subspaces are evaluated in parallel: each thread sums the
+         * matrices it computes in its own matrix, and these partial sums are added to the
+         * result at the end (so that threads only synchronize once).
+         */
+        template<typename Function>
+        void accumulate(ScalarMatrix &result, const Function &function, bool concurrent) const {
+            if (!concurrent || m_spaces.size() < 2) {
+                for(size_t i = 0; i < m_spaces.size(); i++)
+                    result += getNormalizedWeight(i) * function(i);
+                return;
+            }
+
+            std::exception_ptr error;
+#pragma omp parallel
+            {
+                ScalarMatrix partial = ScalarMatrix::Zero(result.rows(), result.cols());
+#pragma omp for schedule(dynamic)
+                for(size_t i = 0; i < m_spaces.size(); i++) {
+                    try {
+                        partial += getNormalizedWeight(i) * function(i);
+                    } catch(...) {
+#pragma omp critical(kqp_kernel_sum)
+                        error = std::current_exception();
+                    }
+                }
+#pragma omp critical(kqp_kernel_sum)
+                result += partial;
+            }
+            if (error)
+                std::rethrow_exception(error);
+        }
+
+        /**
+         * @brief Returns true if the subspaces can be evaluated concurrently
+         *
+         * Spaces and feature matrices may cache values (e.g. Gram matrices) without synchronization,
+         * so no subspace and no feature matrix should be used twice.
+         */
+        bool distinct(const TMatrix &m1, const TMatrix &m2) const {
+            std::set<const void *> spaces;
+            std::map<const void *, size_t> owners;
+            for(size_t i = 0; i < m_spaces.size(); i++) {
+                if (!spaces.insert(m_spaces[i].get()).second)
+                    return false;
+                for(const void *p: { (const void *)m1[i].get(), (const void *)m2[i].get() })
+                    if (!owners.insert(std::make_pair(p, i)).second && owners[p] != i)
+                        return false;
+            }
+            return true;
+        }
+#endif
     private:
     	std::vector<FSpace> m_spaces;
     	std::vector<Real> m_weights;
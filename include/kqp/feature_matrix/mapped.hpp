@@ -0,0 +1,437 @@
+/*
+ This file is part of the Kernel Quantum Probability library (KQP).
+
+ KQP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ KQP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with KQP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __KQP_MAPPED_FEATURE_MATRIX_H__
+#define __KQP_MAPPED_FEATURE_MATRIX_H__
+
+#include <cstring>
+#include <stdint.h>
+#include <limits>
+
+#include <kqp/feature_matrix/dense.hpp>
+#include <kqp/feature_matrix/sparse.hpp>
+
+namespace kqp {
+
+#   include <kqp/define_header_logger.hpp>
+    DEFINE_KQP_HLOGGER("kqp.feature-matrix.mapped");
+
+    /**
+     * @brief Header of a memory-mapped feature matrix file.
+     *
+     * A file is made of this 128 bytes header followed by data sections. All the
+     * values are stored in the native byte order, and sections start on 64 bytes boundaries.
+     *
+     * - Dense files (type 0) have one section (at valuesOffset) containing
+     *   the pre-images in column-major order, with room for colCapacity columns of rows scalars.
+     * - Sparse files (type 1) use the compressed sparse column (CSC) format:
+     *   outer offsets (colCapacity + 1 indices, at outerOffset), row indices (nnzCapacity indices, at innerOffset)
+     *   and values (nnzCapacity scalars, at valuesOffset). The first cols + 1 outer offsets and the first nnz
+     *   indices and values are used.
+     *
+     * Pre-images are only appended: when the capacity is exceeded, the file is extended
+     * (dense files) or the sections are copied at the end of the file (sparse files), so that
+     * the data seen by matrices sharing the previous mapping never changes.
+     */
+    struct MappedHeader {
+        enum Type { DENSE = 0, SPARSE = 1 };
+
+        //! The magic string "KQPFMAT" (null terminated)
+        char magic[8];
+        //! Format version (1)
+        uint32_t version;
+        //! Type of matrix (DENSE or SPARSE)
+        uint32_t type;
+        //! Size of a scalar (in bytes)
+        uint32_t scalarSize;
+        //! 1 if the scalar is complex, 0 otherwise
+        uint32_t complex;
+        //! Size of an index (in bytes, sparse only)
+        uint32_t indexSize;
+        uint32_t reserved;
+
+        //! Number of rows (dimension of the space) and columns (pre-images)
+        uint64_t rows, cols;
+        //! Number of non zero values (sparse only)
+        uint64_t nnz;
+        //! Number of columns and non zero values that can be stored
+        uint64_t colCapacity, nnzCapacity;
+        //! Offsets of the sections (from the start of the file)
+        uint64_t outerOffset, innerOffset, valuesOffset;
+
+        char padding[32];
+
+        static const char *MAGIC() { return "KQPFMAT"; }
+        enum { 
+            //! Current version of the format
+            VERSION = 1, 
+            //! Alignment of the sections
+            ALIGNMENT = 64 
+        };
+
+        //! Returns the first aligned offset after position
+        static uint64_t align(uint64_t position) {
+            return (position + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+        }
+    };
+
+
+    /**
+     * @brief A file mapped in memory.
+     *
+     * Each time the file is extended, it is mapped again; the previous mappings remain valid
+     * as long as some matrix holds a reference on them (see region()).
+     */
+    class MappedFile {
+    public:
+        //! Creates a new file (overwriting any existing one) with the given header
+        static boost::shared_ptr<MappedFile> create(const std::string &path, const MappedHeader &header, std::size_t size);
+
+        //! Opens an existing feature matrix file
+        static boost::shared_ptr<MappedFile> open(const std::string &path, bool writable);
+
+        //! Maps an existing file of any format (header() should not be used)
+        static boost::shared_ptr<MappedFile> openAny(const std::string &path, bool writable);
+
+        ~MappedFile();
+
+        //! Checks that the file holds matrices of the given type
+        template<typename Scalar>
+        void check(MappedHeader::Type type, std::size_t indexSize) const {
+            const MappedHeader &h = header();
+            if (h.type != (uint32_t)type || h.scalarSize != sizeof(Scalar) || h.complex != (uint32_t)Eigen::NumTraits<Scalar>::IsComplex
+                || h.indexSize != indexSize)
+                KQP_THROW_EXCEPTION_F(illegal_argument_exception, "File %s holds a matrix of type %d with scalars of size %d (complex=%d) and indices of size %d, not compatible with %s (type %d)",
+                                      %m_path %h.type %h.scalarSize %h.complex %h.indexSize %KQP_DEMANGLE((Scalar)0) %type);
+        }
+
+        //! The header
+        MappedHeader &header() const { return *reinterpret_cast<MappedHeader*>(m_base); }
+
+        //! Returns a pointer on the data at a given offset (valid until the next resize())
+        template<typename T> T *at(uint64_t offset) const { return reinterpret_cast<T*>(m_base + offset); }
+
+        //! The current mapping (keeps it alive)
+        const boost::shared_ptr<void> &region() const { return m_region; }
+
+        //! Size of the file
+        std::size_t size() const { return m_size; }
+
+        //! Extends the file and maps it again
+        void resize(std::size_t size);
+
+        //! Flushes the changes to disk
+        void sync();
+
+        bool writable() const { return m_writable; }
+        const std::string &path() const { return m_path; }
+
+    private:
+        MappedFile(const std::string &path, int fd, bool writable);
+        void map();
+
+        std::string m_path;
+        int m_fd;
+        bool m_writable;
+        char *m_base;
+        std::size_t m_size;
+        boost::shared_ptr<void> m_region;
+    };
+
+
+    /**
+     * @brief A dense feature matrix stored in a memory-mapped file.
+     *
+     * The matrix can be used anywhere a Dense matrix can (e.g. with DenseSpace) without copying
+     * the pre-images. Copies and subsets (of contiguous columns) are read-only views on
+     * the file, while adding pre-images appends them to the file.
+     *
+     * @ingroup FeatureMatrix
+     */
+    template <typename Scalar>
+    class MappedDense : public Dense<Scalar> {
+    public:
+        typedef MappedDense<Scalar> Self;
+        KQP_MATRIX_TYPEDEFS(Scalar);
+
+        virtual ~MappedDense() {}
+
+        /**
+         * Creates a new file (if dimension is 0, it will be set with the first pre-image, and
+         * the capacity is only allocated then)
+         */
+        static SelfPtr create(const std::string &path, Index dimension, Index capacity = 0) {
+            MappedHeader h = header(MappedHeader::DENSE, dimension);
+            h.colCapacity = dimension > 0 ? capacity : 0;
+            h.valuesOffset = MappedHeader::align(sizeof(MappedHeader));
+            return SelfPtr(new Self(MappedFile::create(path, h, h.valuesOffset + capacity * dimension * sizeof(Scalar))));
+        }
+
+        //! Opens an existing file
+        static SelfPtr open(const std::string &path, bool writable = false) {
+            boost::shared_ptr<MappedFile> file = MappedFile::open(path, writable);
+            file->check<Scalar>(MappedHeader::DENSE, 0);
+            return SelfPtr(new Self(file));
+        }
+
+        //! Appends pre-images to the file
+        template<typename Derived>
+        void add(const Eigen::DenseBase<Derived> &m, const std::vector<bool> *which = NULL) {
+            if (!m_file->writable())
+                KQP_THROW_EXCEPTION_F(illegal_operation_exception, "File %s was opened read-only", %m_file->path());
+
+            if (m_file->header().cols == 0 && m_file->header().rows == 0)
+                m_file->header().rows = m.rows();
+            if ((uint64_t)m.rows() != m_file->header().rows)
+                KQP_THROW_EXCEPTION_F(illegal_operation_exception,
+                                      "Cannot add a vector of dimension %d (dimension is %d)", % m.rows() % m_file->header().rows);
+
+            Intervals intervals(which, m.cols());
+            Index offset = m_file->header().cols;
+            reserve(offset + intervals.selected());
+
+            const MappedHeader &h = m_file->header();
+            Eigen::Map<ScalarMatrix> matrix(m_file->template at<Scalar>(h.valuesOffset), h.rows, h.colCapacity);
+            for(auto i = intervals.begin(); i != intervals.end(); i++) {
+                Index cols = i->second - i->first + 1;
+                matrix.block(0, offset, h.rows, cols) = m.block(0, i->first, h.rows, cols);
+                offset += cols;
+            }
+
+            m_file->header().cols = offset;
+            refresh();
+        }
+
+        void add(const FMatrixBase &other, const std::vector<bool> *which = NULL) override {
+            const Dense<Scalar> &dOther = Dense<Scalar>::cast(other);
+            if (dOther.isCompact())
+                return this->add(dOther.toDense(), which);
+            this->add(dOther.view(), which);
+        }
+
+        virtual FMatrixBase& operator=(const FMatrixBase &) override {
+            KQP_THROW_EXCEPTION(illegal_operation_exception, "Cannot assign to a memory-mapped matrix");
+        }
+
+        //! Flushes the changes to disk
+        void sync() {
+            m_file->sync();
+        }
+
+        //! Path of the underlying file
+        const std::string &path() const {
+            return m_file->path();
+        }
+
+    private:
+        MappedDense(const boost::shared_ptr<MappedFile> &file) : m_file(file) {
+            refresh();
+        }
+
+        static MappedHeader header(MappedHeader::Type type, Index rows) {
+            MappedHeader h;
+            std::memset(&h, 0, sizeof(h));
+            std::strcpy(h.magic, MappedHeader::MAGIC());
+            h.version = MappedHeader::VERSION;
+            h.type = type;
+            h.scalarSize = sizeof(Scalar);
+            h.complex = Eigen::NumTraits<Scalar>::IsComplex;
+            h.rows = rows;
+            return h;
+        }
+
+        //! Ensures that the file can hold a given number of columns
+        void reserve(Index cols) {
+            const MappedHeader &h = m_file->header();
+            if ((uint64_t)cols <= h.colCapacity) return;
+
+            uint64_t capacity = std::max<uint64_t>(cols, 2 * h.colCapacity);
+            KQP_HLOG_DEBUG_F("Extending %s to %d columns", %m_file->path() %capacity);
+            m_file->resize(h.valuesOffset + capacity * h.rows * sizeof(Scalar));
+            m_file->header().colCapacity = capacity;
+        }
+
+        //! Points the dense matrix to the current mapping
+        void refresh() {
+            const MappedHeader &h = m_file->header();
+            this->setExternal(m_file->template at<Scalar>(h.valuesOffset), h.rows, h.cols, m_file->region());
+        }
+
+        boost::shared_ptr<MappedFile> m_file;
+
+        template<typename> friend class MappedSparse;
+    };
+
+
+    /**
+     * @brief A sparse feature matrix stored in a memory-mapped file (CSC format).
+     *
+     * The matrix can be used anywhere a Sparse matrix can (e.g. with SparseSpace) without copying
+     * the pre-images. Copies and subsets (of contiguous columns) are read-only views on
+     * the file, while adding pre-images appends them to the file.
+     *
+     * @ingroup FeatureMatrix
+     */
+    template <typename Scalar>
+    class MappedSparse : public Sparse<Scalar> {
+    public:
+        typedef MappedSparse<Scalar> Self;
+        KQP_MATRIX_TYPEDEFS(Scalar);
+        typedef typename Sparse<Scalar>::StorageIndex StorageIndex;
+        typedef typename Sparse<Scalar>::External External;
+
+        virtual ~MappedSparse() {}
+
+        //! Creates a new file
+        static SelfPtr create(const std::string &path, Index dimension, Index colCapacity = 0, Index nnzCapacity = 0) {
+            MappedHeader h = MappedDense<Scalar>::header(MappedHeader::SPARSE, dimension);
+            h.indexSize = sizeof(StorageIndex);
+            layout(h, MappedHeader::align(sizeof(MappedHeader)), colCapacity, nnzCapacity);
+            boost::shared_ptr<MappedFile> file = MappedFile::create(path, h, size(h));
+            *file->template at<StorageIndex>(h.outerOffset) = 0;
+            return SelfPtr(new Self(file));
+        }
+
+        //! Opens an existing file
+        static SelfPtr open(const std::string &path, bool writable = false) {
+            boost::shared_ptr<MappedFile> file = MappedFile::open(path, writable);
+            file->check<Scalar>(MappedHeader::SPARSE, sizeof(StorageIndex));
+            return SelfPtr(new Self(file));
+        }
+
+        //! Appends pre-images to the file
+        void add(const FMatrixBase &_other, const std::vector<bool> *which = NULL) override {
+            if (!m_file->writable())
+                KQP_THROW_EXCEPTION_F(illegal_operation_exception, "File %s was opened read-only", %m_file->path());
+
+            const typename Sparse<Scalar>::ConstView other = kqp::our_dynamic_cast<const Sparse<Scalar> &>(_other).view();
+            if ((uint64_t)other.rows() != m_file->header().rows)
+                KQP_THROW_EXCEPTION_F(illegal_operation_exception,
+                                      "Cannot add a vector of dimension %d (dimension is %d)", % other.rows() % m_file->header().rows);
+
+            // Computes the indices of the vectors to add and the number of non zero values
+            std::vector<Index> ix;
+            uint64_t nnz = 0;
+            for(Index i = 0; i < other.cols(); i++)
+                if (!which || (*which)[i]) {
+                    ix.push_back(i);
+                    nnz += other.outerIndexPtr()[i+1] - other.outerIndexPtr()[i];
+                }
+
+            uint64_t cols = m_file->header().cols;
+            nnz += m_file->header().nnz;
+            if (nnz > (uint64_t)std::numeric_limits<StorageIndex>::max())
+                KQP_THROW_EXCEPTION_F(out_of_bound_exception, "Too many non zero values (%d) in %s", %nnz %m_file->path());
+            reserve(cols + ix.size(), nnz);
+
+            // Copy the columns
+            const MappedHeader &h = m_file->header();
+            StorageIndex *outer = m_file->template at<StorageIndex>(h.outerOffset);
+            StorageIndex *inner = m_file->template at<StorageIndex>(h.innerOffset);
+            Scalar *values = m_file->template at<Scalar>(h.valuesOffset);
+
+            for(size_t i = 0; i < ix.size(); i++) {
+                StorageIndex start = other.outerIndexPtr()[ix[i]], end = other.outerIndexPtr()[ix[i]+1];
+                StorageIndex offset = outer[cols + i];
+                std::copy(other.innerIndexPtr() + start, other.innerIndexPtr() + end, inner + offset);
+                std::copy(other.valuePtr() + start, other.valuePtr() + end, values + offset);
+                outer[cols + i + 1] = offset + end - start;
+            }
+
+            m_file->header().cols = cols + ix.size();
+            m_file->header().nnz = nnz;
+            refresh();
+        }
+
+        virtual FMatrixBase& operator=(const FMatrixBase &) override {
+            KQP_THROW_EXCEPTION(illegal_operation_exception, "Cannot assign to a memory-mapped matrix");
+        }
+
+        //! Flushes the changes to disk
+        void sync() {
+            m_file->sync();
+        }
+
+        //! Path of the underlying file
+        const std::string &path() const {
+            return m_file->path();
+        }
+
+    private:
+        MappedSparse(const boost::shared_ptr<MappedFile> &file) : m_file(file) {
+            refresh();
+        }
+
+        //! Computes the section offsets starting at a given position
+        static void layout(MappedHeader &h, uint64_t position, uint64_t colCapacity, uint64_t nnzCapacity) {
+            h.colCapacity = colCapacity;
+            h.nnzCapacity = nnzCapacity;
+            h.outerOffset = position;
+            h.innerOffset = MappedHeader::align(h.outerOffset + (colCapacity + 1) * sizeof(StorageIndex));
+            h.valuesOffset = MappedHeader::align(h.innerOffset + nnzCapacity * sizeof(StorageIndex));
+        }
+
+        //! Size of the file for a given layout
+        static uint64_t size(const MappedHeader &h) {
+            return h.valuesOffset + h.nnzCapacity * sizeof(Scalar);
+        }
+
+        //! Ensures that the file can hold a given number of columns and non zero values
+        void reserve(uint64_t cols, uint64_t nnz) {
+            MappedHeader h = m_file->header();
+            if (cols <= h.colCapacity && nnz <= h.nnzCapacity) return;
+
+            // Copy the sections at the end of the file
+            MappedHeader n = h;
+            layout(n, MappedHeader::align(m_file->size()), std::max(cols, 2 * h.colCapacity), std::max(nnz, 2 * h.nnzCapacity));
+            KQP_HLOG_DEBUG_F("Moving the sections of %s to offset %d (%d columns and %d non zero values)",
+                             %m_file->path() %n.outerOffset %n.colCapacity %n.nnzCapacity);
+            m_file->resize(size(n));
+
+            std::copy(m_file->template at<StorageIndex>(h.outerOffset), m_file->template at<StorageIndex>(h.outerOffset) + h.cols + 1,
+                      m_file->template at<StorageIndex>(n.outerOffset));
+            std::copy(m_file->template at<StorageIndex>(h.innerOffset), m_file->template at<StorageIndex>(h.innerOffset) + h.nnz,
+                      m_file->template at<StorageIndex>(n.innerOffset));
+            std::copy(m_file->template at<Scalar>(h.valuesOffset), m_file->template at<Scalar>(h.valuesOffset) + h.nnz,
+                      m_file->template at<Scalar>(n.valuesOffset));
+            m_file->header() = n;
+        }
+
+        //! Points the sparse matrix to the current mapping
+        void refresh() {
+            const MappedHeader &h = m_file->header();
+            External e;
+            e.rows = h.rows;
+            e.cols = h.cols;
+            e.outer = m_file->template at<StorageIndex>(h.outerOffset);
+            e.inner = m_file->template at<StorageIndex>(h.innerOffset);
+            e.values = m_file->template at<Scalar>(h.valuesOffset);
+            this->setExternal(e, m_file->region());
+        }
+
+        boost::shared_ptr<MappedFile> m_file;
+    };
+
+
+# // Extern templates
+# ifndef SWIG
+# define KQP_SCALAR_GEN(scalar) extern template class MappedDense<scalar>; extern template class MappedSparse<scalar>;
+# include <kqp/for_all_scalar_gen.h.inc>
+# endif
+
+} // end namespace kqp
+
+#endif
@@ -19,6 +19,8 @@
 #define __KQP_SPARSE_FEATURE_MATRIX_H__
 
 #include <boost/lexical_cast.hpp>
+#include <boost/shared_ptr.hpp>
+#include <kqp/cpu.hpp>
 #include <kqp/subset.hpp>
 #include <kqp/feature_matrix.hpp>
 #include <Eigen/Sparse>
@@ -40,20 +42,61 @@ namespace kqp {
         KQP_SCALAR_TYPEDEFS(Scalar);
         typedef Sparse<Scalar> Self;
         typedef Eigen::SparseMatrix<Scalar, Eigen::ColMajor> Storage;
+        typedef typename Storage::Index StorageIndex;
+        
+        //! Read-only (compressed) view on the pre-images, whatever the storage
+        typedef Eigen::MappedSparseMatrix<Scalar, Eigen::ColMajor, StorageIndex> ConstView;
         
         virtual ~Sparse() {}
         
-        Sparse()  {}
-        Sparse(Index dimension) : m_matrix(dimension, 0) {}
-        Sparse(const Self &other) : m_matrix(other.m_matrix) {}
+        Sparse()  { m_external.clear(); }
+        Sparse(Index dimension) : m_matrix(dimension, 0) { m_external.clear(); }
+        
+        //! Copy constructor (external storage is shared, not copied)
+        Sparse(const Self &other) : m_matrix(other.m_matrix), m_holder(other.m_holder), m_external(other.m_external) {}
         
 #ifndef SWIG
-        Sparse(Storage &&storage) : m_matrix(std::move(storage)) {}
-        Sparse(Self &&other) : m_matrix(std::move(other.m_matrix)) {}
+        //! Construction by taking the content of a sparse matrix (which is left empty)
+        Sparse(Storage &&storage) { 
+            m_matrix.swap(storage); 
+            m_matrix.makeCompressed(); 
+            m_external.clear(); 
+        }
+        Sparse(Self &&other) : m_holder(std::move(other.m_holder)), m_external(other.m_external) {
+            m_matrix.swap(other.m_matrix);
+        }
+        
+        /**
+         * @brief Construction from external memory in compressed column storage (no copy)
+         *
+         * The data is never modified. The release function is called when no matrix uses the memory anymore; 
+         * if it is empty, the memory should outlive the matrix and its copies.
+         */
+        explicit Sparse(const ConstView &map, const ReleaseFunction &release = ReleaseFunction()) 
+            : m_holder(externalHolder(map.outerIndexPtr(), release)) {
+            m_external.rows = map.rows();
+            m_external.cols = map.cols();
+            m_external.outer = map.outerIndexPtr();
+            m_external.inner = map.innerIndexPtr();
+            m_external.values = map.valuePtr();
+        }
         
+        /**
+         * @brief Creates a matrix from external memory in compressed column storage (no copy)
+         * @param outer The (cols + 1) offsets of the columns in inner and values
+         * @param inner The row indices
+         * @param values The values
+         */
+        static boost::shared_ptr<Self> wrap(Index rows, Index cols, const StorageIndex *outer, const StorageIndex *inner, const Scalar *values,
+                                            const ReleaseFunction &release = ReleaseFunction()) {
+            return boost::shared_ptr<Self>(new Self(ConstView(rows, cols, outer[cols] - outer[0], 
+                                                              const_cast<StorageIndex*>(outer), const_cast<StorageIndex*>(inner), const_cast<Scalar*>(values)),
+                                                    release));
+        }
 #endif
 
         Sparse(const ScalarMatrix &mat, double threshold = 0) : m_matrix(mat.rows(), mat.cols()) {            
+            m_external.clear();
             Matrix<Real, 1, Dynamic> thresholds = threshold * mat.colwise().norm();
 
             Matrix<Index, 1, Dynamic> countsPerCol((mat.array().abs() >= thresholds.colwise().replicate(mat.rows()).array()).template cast<Index>().colwise().sum());
@@ -64,26 +107,42 @@ namespace kqp {
                 for(Index j = 0; j < mat.cols(); j++)
                     if (std::abs(mat(i,j)) > thresholds[j]) 
                         m_matrix.insert(i,j) = mat(i,j);
+            m_matrix.makeCompressed();
         }
         
-        Sparse(const Storage &storage) : m_matrix(storage) {}
-        Sparse(const Eigen::SparseMatrix<Scalar, Eigen::RowMajor>  &storage) : m_matrix(storage) {}
+        Sparse(const Storage &storage) : m_matrix(storage) { m_matrix.makeCompressed(); m_external.clear(); }
+        Sparse(const Eigen::SparseMatrix<Scalar, Eigen::RowMajor>  &storage) : m_matrix(storage) { m_matrix.makeCompressed(); m_external.clear(); }
 
-        ScalarMatrix toDense() {
-            return ScalarMatrix(m_matrix);
+        ScalarMatrix toDense() const {
+            return ScalarMatrix(view());
         }
         
+        //! Read-only view on the pre-images
+        ConstView view() const {
+            if (m_holder) 
+                return ConstView(m_external.rows, m_external.cols, m_external.outer[m_external.cols] - m_external.outer[0], 
+                                 const_cast<StorageIndex*>(m_external.outer), const_cast<StorageIndex*>(m_external.inner), const_cast<Scalar*>(m_external.values));
+            Storage &m = const_cast<Storage&>(m_matrix);
+            return ConstView(m.rows(), m.cols(), m.nonZeros(), m.outerIndexPtr(), m.innerIndexPtr(), m.valuePtr());
+        }
+
+        //! Returns true if the pre-images are stored in memory not owned by this matrix
+        bool isExternal() const {
+            return (bool)m_holder;
+        }
+
         // --- Base methods 
         inline Index size() const { 
-            return m_matrix.cols();
+            return m_holder ? m_external.cols : m_matrix.cols();
         }
         
         inline Index dimension() const {
-            return m_matrix.rows();
+            return m_holder ? m_external.rows : m_matrix.rows();
         }
         
         void add(const FMatrixBase &_other, const std::vector<bool> *which = NULL) override {
-            const Self &other = kqp::our_dynamic_cast<const Self&>(_other);
+            if (m_holder) detach();
+            const ConstView other = kqp::our_dynamic_cast<const Self&>(_other).view();
             
             // Computes the indices of the vectors to add
             std::vector<Index> ix;
@@ -95,7 +154,7 @@ namespace kqp {
                     
                 toAdd = ix.size();
             } 
-            else toAdd = other.size();
+            else toAdd = other.cols();
             
             //FIXME: re-implement when conservativeResize is implemented in Eigen::SparseMatrix
             
@@ -106,7 +165,7 @@ namespace kqp {
               counts.push_back(m_matrix.col(i).nonZeros());
         
             for(Index i = 0; i < toAdd; i++)
-              counts.push_back(other.m_matrix.col(ix.empty() ? i : ix[i]).nonZeros());
+              counts.push_back(other.outerIndexPtr()[(ix.empty() ? i : ix[i]) + 1] - other.outerIndexPtr()[ix.empty() ? i : ix[i]]);
             
         
             // Prepare the resultant sparse matrix
@@ -123,7 +182,7 @@ namespace kqp {
                     s.insert(it.row(), i) = it.value();
                     
             for(Index i = 0; i < toAdd; ++i)
-                for (typename Storage::InnerIterator it(other.m_matrix, ix.empty() ? i : ix[i]); it; ++it) 
+                for (typename ConstView::InnerIterator it(other, ix.empty() ? i : ix[i]); it; ++it) 
                     s.insert(it.row(), offset+i) = it.value();
                 
                     
@@ -141,11 +200,9 @@ namespace kqp {
             Index tofill = size() - current;
             
             // Compute the remaining inner products
-            Index ncols = m_matrix.cols();
+            const ConstView matrix = view();
             
-            for(Index i = 0; i < ncols; ++i)
-                for(Index j = current; j < ncols; ++j)
-                    m_gramMatrix(i,j) = m_matrix.col(i).dot(m_matrix.col(j));
+            innerProducts(matrix, current, m_gramMatrix);
             m_gramMatrix.bottomLeftCorner(tofill, current) = m_gramMatrix.topRightCorner(current, tofill).adjoint().eval();
             
             return m_gramMatrix;
@@ -154,24 +211,33 @@ namespace kqp {
         
         FMatrixBasePtr subset(const std::vector<bool>::const_iterator &begin, const std::vector<bool>::const_iterator &end) const override{
             // Construct
+            const ConstView matrix = view();
             std::vector<Index> selected;
             auto it = begin;
-            for(Index i = 0; i < m_matrix.cols(); i++) {
+            for(Index i = 0; i < matrix.cols(); i++) {
                 if (it == end || *it)
                     selected.push_back(i);
                 it++;
             }
             
+            // External storage: a contiguous selection is a view on the same memory
+            if (m_holder && (selected.empty() || selected.back() - selected.front() + 1 == (Index)selected.size())) {
+                External e = m_external;
+                e.outer += selected.empty() ? 0 : selected.front();
+                e.cols = selected.size();
+                return FMatrixBasePtr(new Self(e, m_holder));
+            }
+            
             // Prepare the resultant sparse matrix
-            Storage s(m_matrix.rows(), selected.size());
+            Storage s(matrix.rows(), selected.size());
             Eigen::VectorXi counts(selected.size());
             for(size_t i = 0; i < selected.size(); ++i)
-                counts[i] = m_matrix.col(selected[i]).nonZeros();
+                counts[i] = matrix.outerIndexPtr()[selected[i]+1] - matrix.outerIndexPtr()[selected[i]];
             s.reserve(counts);
 
             // Fill the result
             for(size_t i = 0; i < selected.size(); ++i)
-                for (typename Storage::InnerIterator it(m_matrix,selected[i]); it; ++it) 
+                for (typename ConstView::InnerIterator it(matrix,selected[i]); it; ++it) 
                     s.insert(it.row(), i) = it.value();
             
             return FMatrixBasePtr(new Self(std::move(s)));
@@ -183,13 +249,16 @@ namespace kqp {
             return FMatrixBasePtr(new Self(*this));
         }
         
-        //! Direct access to underlying matrix
-        const Storage *operator->() const { return &m_matrix; }
-        const Storage &operator*() const { return m_matrix; }
+        //! Direct access to the owned matrix (see getMatrix())
+        const Storage *operator->() const { return &getMatrix(); }
+        //! Read-only view on the pre-images (see view())
+        ConstView operator*() const { return view(); }
 
         FMatrixBase& operator=(const Self &other)  {
             m_matrix = other.m_matrix;
             m_gramMatrix = other.m_gramMatrix;
+            m_holder = other.m_holder;
+            m_external = other.m_external;
             return *this;
         }
 
@@ -197,28 +266,107 @@ namespace kqp {
             return *this = kqp::our_dynamic_cast<const Self&>(other);
         }
 
-        //! Get the dense matrix
+        /**
+         * @brief Get the sparse matrix
+         *
+         * Pre-images stored in external memory (see isExternal()) have no sparse
+         * matrix: use view().
+         */
         const Storage &getMatrix() const {
+            if (m_holder)
+                KQP_THROW_EXCEPTION(illegal_operation_exception, "Pre-images are stored in external memory: use view()");
             return m_matrix;
         }
 
+    protected:
+        //! External compressed column storage
+        struct External {
+            Index rows, cols;
+            //! Column start offsets (cols + 1 entries) in inner and values 
+            const StorageIndex *outer;
+            const StorageIndex *inner;
+            const Scalar *values;
+            void clear() { rows = cols = 0; outer = inner = 0; values = 0; }
+        };
+        
+        /**
+         * @brief Construction from external memory (no copy)
+         * @param holder Keeps the memory alive as long as a matrix refers to it
+         */
+        Sparse(const External &external, const boost::shared_ptr<void> &holder) : m_holder(holder), m_external(external) {}
+
+        //! Sets the external storage (the Gram matrix cache is kept, and should be still valid for the first columns)
+        void setExternal(const External &external, const boost::shared_ptr<void> &holder) {
+            m_matrix = Storage();
+            m_holder = holder;
+            m_external = external;
+        }
+
+        //! Copy the external pre-images into an owned matrix (before any modification)
+        void detach() {
+            m_matrix = view();
+            m_matrix.makeCompressed();
+            m_holder.reset();
+            m_external.clear();
+        }
 
     private:
+        //! Fills the inner products between all the columns and the columns from "from"
+        template<typename View, typename Gram>
+        static void innerProducts(const View &matrix, Index from, Gram &gram) {
+            for(Index i = 0; i < matrix.cols(); ++i)
+                for(Index j = from; j < matrix.cols(); ++j)
+                    gram(i,j) = matrix.col(i).dot(matrix.col(j));
+        }
+        
+        /**
+         * Real case: each column is scattered in a dense vector, and the inner products with the other columns
+         * are computed by the (runtime selected) gather kernel rather than by merging the indices
+         */
+        static void innerProducts(const Eigen::MappedSparseMatrix<double, Eigen::ColMajor, int> &matrix, Index from, Eigen::MatrixXd &gram) {
+            const Index ncols = matrix.cols();
+            
+            // Scattering costs the number of rows, and saves about the number of entries of the other columns
+            if (matrix.rows() * ncols > (ncols - from) * matrix.nonZeros()) {
+                innerProducts<Eigen::MappedSparseMatrix<double, Eigen::ColMajor, int>, Eigen::MatrixXd>(matrix, from, gram);
+                return;
+            }
+            
+            const int *outer = matrix.outerIndexPtr(), *inner = matrix.innerIndexPtr();
+            const double *values = matrix.valuePtr();
+            const cpu::Kernels &kernels = cpu::kernels();
+            
+            std::vector<double> x(matrix.rows(), 0.);
+            for(Index i = 0; i < ncols; ++i) {
+                for(int k = outer[i]; k < outer[i+1]; ++k)
+                    x[inner[k]] = values[k];
+                for(Index j = from; j < ncols; ++j)
+                    gram(i,j) = kernels.gatherDot(inner + outer[j], values + outer[j], outer[j+1] - outer[j], x.data());
+                for(int k = outer[i]; k < outer[i+1]; ++k)
+                    x[inner[k]] = 0;
+            }
+        }
         
         //! The Gram matrix
         mutable ScalarMatrix m_gramMatrix;
         
 
-        //! The underlying sparse matrix
+        //! The underlying sparse matrix (when the storage is owned)
         Storage m_matrix;
         
+        //! Keeps the external storage alive (null when the storage is owned)
+        boost::shared_ptr<void> m_holder;
+        
+        //! External storage
+        External m_external;
+        
     };
     
     
     
     template<typename Scalar>
     std::ostream& operator<<(std::ostream &out, const Sparse<Scalar> &f) {
-        return out << "[Sparse Matrix with scalar " << KQP_DEMANGLE((Scalar)0) << "]" << std::endl << f.getMatrix();
+        return out << "[Sparse Matrix with scalar " << KQP_DEMANGLE((Scalar)0) << "]" << std::endl << f.view();
     }
     
     
@@ -256,8 +404,26 @@ namespace kqp {
         
         virtual ScalarMatrix k(const FeatureMatrixBase<Scalar> &mX1, const ScalarAltMatrix &mY1, const RealAltVector &mD1,
                                const FeatureMatrixBase<Scalar> &mX2, const ScalarAltMatrix &mY2, const RealAltVector &mD2) const override {        
-            return mD1.asDiagonal() * mY1.adjoint() * cast(mX1)->adjoint() * *cast(mX2) * mY2 * mD2.asDiagonal();
+            return k(cast(mX1), mY1, mD1, cast(mX2), mY2, mD2);
         };
+
+#ifndef SWIG
+        // --- Statically typed versions (see StaticSpace)
+
+        //! Type of the feature matrices
+        typedef Sparse<Scalar> FMatrixType;
+
+        //! Gram matrix
+        inline const ScalarMatrix &k(const Sparse<Scalar> &mX) const {
+            return mX.gramMatrix();
+        }
+
+        //! Inner products \f$D_1^\dagger Y_1^\dagger X_1^\dagger X_2 Y_2 D_2\f$
+        ScalarMatrix k(const Sparse<Scalar> &mX1, const ScalarAltMatrix &mY1, const RealAltVector &mD1,
+                       const Sparse<Scalar> &mX2, const ScalarAltMatrix &mY2, const RealAltVector &mD2) const {
+            return mD1.asDiagonal() * mY1.adjoint() * mX1.view().adjoint() * mX2.view() * mY2 * mD2.asDiagonal();
+        }
+#endif
                 
         virtual void load(const pugi::xml_node &node) override {
             m_dimension = boost::lexical_cast<Index>(node.attribute("dimension").value());
@@ -477,7 +477,7 @@ namespace kqp {
                                const FeatureMatrixBase<Scalar> &mX2, const ScalarAltMatrix &mY2, const RealAltVector &mD2) const override {        
             ScalarMatrix inner;
             cast(mX1).inner(cast(mX2), inner);
-            return mD1.asDiagonal() * mY1.adjoint() * inner * mY2 * mD2.asDiagonal();
+            return mD1.asDiagonal() * bilinear(mY1, inner, mY2) * mD2.asDiagonal();
         };
  
         virtual FMatrixBasePtr linearCombination(const FeatureMatrixBase<Scalar> &mX, const ScalarAltMatrix &mA, Scalar alpha, 
@@ -19,7 +19,10 @@
 
 #include <boost/lexical_cast.hpp>
 #include <boost/unordered_map.hpp>
+#include <kqp/cpu.hpp>
 #include <kqp/feature_matrix.hpp>
+#include <kqp/feature_matrix/dense.hpp>
+#include <kqp/gauss_transform.hpp>
 #include <kqp/space_factory.hpp>
 
 namespace kqp {
@@ -41,7 +44,8 @@ namespace kqp {
             // So we suppose we are not multithreaded... and compute it each time.
             // ScalarMatrix &gram = m_gramCache[static_cast<const void*>(&mX)];
             
-            static ScalarMatrix gram;
+            // (one per thread, since kernel sums evaluate their subspaces concurrently)
+            static thread_local ScalarMatrix gram;
             
             gram.resize(0,0);
             
@@ -115,22 +119,106 @@ namespace kqp {
         using UnaryKernelSpace<Scalar>::m_base;
         using UnaryKernelSpace<Scalar>::k;
 #endif
-        GaussianSpace(Real sigma, const FSpaceCPtr &base) : UnaryKernelSpace<Scalar>(base), m_sigma(sigma) {}
-        GaussianSpace() :  UnaryKernelSpace<Scalar>(FSpace()), m_sigma(1) {}
+        GaussianSpace(Real sigma, const FSpaceCPtr &base) : UnaryKernelSpace<Scalar>(base), m_sigma(sigma), m_tolerance(0) {}
+        GaussianSpace() :  UnaryKernelSpace<Scalar>(FSpace()), m_sigma(1), m_tolerance(0) {}
 
-        virtual FSpacePtr copy() const override { return FSpacePtr(new GaussianSpace<Scalar>(m_sigma, m_base)); }        
+        virtual FSpacePtr copy() const override { 
+            GaussianSpace<Scalar> *space = new GaussianSpace<Scalar>(m_sigma, m_base);
+            space->m_tolerance = m_tolerance;
+            return FSpacePtr(space); 
+        }        
 
         virtual Index dimension() const override { return -1; }
         virtual bool _canLinearlyCombine() const override { return false; }
 
+        /**
+         * @brief Tolerance of approximate inner products (0, the default, for exact computation)
+         *
+         * When positive and the base space is a dense space, the inner products 
+         * \f$Y_1^\dagger X_1^\dagger X_2 Y_2\f$ are computed with an improved fast Gauss transform,
+         * without computing the Gram matrix: the absolute error on \f$X_1^\dagger X_2 Y_2\f$ is 
+         * below the tolerance times the \f$\ell_1\f$ norm of the corresponding column of \f$Y_2\f$.
+         */
+        Real tolerance() const { return m_tolerance; }
+        void tolerance(Real tolerance) { m_tolerance = tolerance; }
+        
+        virtual ScalarMatrix k(const FMatrixBase &mX, const ScalarAltMatrix &mY, const RealAltVector &mD) const override {
+            if (m_tolerance > 0)
+                return k(mX, mY, mD, mX, mY, mD);
+            return SpaceBase<Scalar>::k(mX, mY, mD);
+        }
         
         virtual ScalarMatrix k(const FMatrixBase &mX1, const ScalarAltMatrix &mY1, const RealAltVector &mD1, 
                                const FMatrixBase &mX2, const ScalarAltMatrix &mY2, const RealAltVector &mD2) const override {
-            return mD1.asDiagonal() * mY1.adjoint() 
-                    * this->f(m_base->k(mX1, mX2), m_base->k(mX1).diagonal(), m_base->k(mX2).diagonal())
-                    * mY2 * mD2.asDiagonal();
+            if (m_tolerance > 0) {
+                ScalarMatrix result;
+                if (approximate(mX1, mY1, mD1, mX2, mY2, mD2, result))
+                    return result;
+            }
+            return mD1.asDiagonal() 
+                    * bilinear(mY1, this->f(m_base->k(mX1, mX2), m_base->k(mX1).diagonal(), m_base->k(mX2).diagonal()), mY2)
+                    * mD2.asDiagonal();
+        }
+
+#ifndef SWIG
+        //! Squared distances \f$\Vert x_i - y_j \Vert^2\f$ between the pre-images, in the base space
+        RealMatrix squaredDistances(const FMatrixBase &mX1, const FMatrixBase &mX2) const {
+            // Copies the norms, since the base space might return the same Gram matrix object
+            const ScalarVector norms1 = m_base->k(mX1).diagonal();
+            const ScalarVector norms2 = m_base->k(mX2).diagonal();
+            return distances(m_base->k(mX1, mX2), norms1, norms2);
+        }
+
+        //! Squared distances between the pre-images of a feature matrix, in the base space
+        RealMatrix squaredDistances(const FMatrixBase &mX) const {
+            const ScalarMatrix &gram = m_base->k(mX);
+            return distances(gram, gram.diagonal(), gram.diagonal());
+        }
+
+        /**
+         * @brief Inner products \f$X_1^\dagger X_2\f$ for several bandwidths
+         *
+         * The bandwidth of this space is ignored: the base inner products and the squared
+         * distances are computed once, and only the exponentials are evaluated for each bandwidth.
+         */
+        std::vector<ScalarMatrix> kernelMatrices(const FMatrixBase &mX1, const FMatrixBase &mX2, const std::vector<Real> &sigmas) const {
+            return kernelMatrices(squaredDistances(mX1, mX2), sigmas);
+        }
+
+        //! Gram matrices of a feature matrix for several bandwidths
+        std::vector<ScalarMatrix> kernelMatrices(const FMatrixBase &mX, const std::vector<Real> &sigmas) const {
+            return kernelMatrices(squaredDistances(mX), sigmas);
         }
-        
+
+        /**
+         * @brief Gaussian kernel matrices \f$\exp(-D / \sigma^2)\f$ for several bandwidths
+         *
+         * The exponentials of a column of D are evaluated together for all the bandwidths
+         * (in one array expression), so that the column is read once.
+         */
+        static std::vector<ScalarMatrix> kernelMatrices(const RealMatrix &distances, const std::vector<Real> &sigmas) {
+            std::vector<ScalarMatrix> kernels(sigmas.size(), ScalarMatrix(distances.rows(), distances.cols()));
+            if (sigmas.empty())
+                return kernels;
+
+            RealVector gammas(sigmas.size());
+            for(size_t s = 0; s < sigmas.size(); s++)
+                gammas[s] = -1. / (sigmas[s] * sigmas[s]);
+
+#pragma omp parallel
+            {
+                RealMatrix values(distances.rows(), gammas.size());
+#pragma omp for schedule(static)
+                for(Index j = 0; j < distances.cols(); j++) {
+                    values.noalias() = distances.col(j) * gammas.transpose();
+                    expInPlace(values.data(), values.size());
+                    for(size_t s = 0; s < sigmas.size(); s++)
+                        kernels[s].col(j) = values.col(s).template cast<Scalar>();
+                }
+            }
+            return kernels;
+        }
+#endif
 
         virtual void update(std::vector< KernelValues<Scalar> > &values, int kOffset = 0) const override {
             auto &self = values[kOffset];
@@ -161,6 +249,34 @@ namespace kqp {
             m_base->updatePartials(- beta, partials, offset+1, values, kOffset + 1, 1);
         }
 
+#ifndef SWIG
+        virtual void update(KernelValuesBlock<Scalar> &values, int kOffset = 0) const override {
+            m_base->update(values, kOffset+1);
+            RealVector v = (2. * values.inner(kOffset+1).real() - values.innerX(kOffset+1).real() - values.innerY(kOffset+1).real()) 
+                           / (m_sigma * m_sigma);
+            expInPlace(v.data(), v.size());
+            values._inner.col(kOffset) = v.template cast<Scalar>();
+            values._innerX.col(kOffset).setOnes();
+            values._innerY.col(kOffset).setOnes();
+        }
+
+        virtual void updatePartials(const RealVector &alpha, std::vector<Real> &partials, int offset, const KernelValuesBlock<Scalar> &values, int kOffset, int mode) const override {
+            Real sigma_2 = m_sigma * m_sigma;
+            RealVector beta = alpha / sigma_2;
+            if (mode == 0) {
+                // The exponentials were computed by update()
+                const RealVector exp_v = values.inner(kOffset).real();
+                const RealVector v = (2. * values.inner(kOffset+1).real() - values.innerX(kOffset+1).real() - values.innerY(kOffset+1).real()) / sigma_2;
+                partials[offset] += -2. / m_sigma * (alpha.array() * v.array() * exp_v.array()).sum();
+                beta.array() *= exp_v.array();
+            }
+
+            m_base->updatePartials(RealVector(2 * beta), partials, offset+1, values, kOffset + 1, 0);
+            m_base->updatePartials(RealVector(-beta), partials, offset+1, values, kOffset + 1, -1);
+            m_base->updatePartials(RealVector(-beta), partials, offset+1, values, kOffset + 1, 1);
+        }
+#endif
+
         virtual int numberOfParameters() const {
             return 1 + m_base->numberOfParameters();
         }
@@ -179,12 +295,15 @@ namespace kqp {
 
         virtual void load(const pugi::xml_node &node) override {
             m_sigma = kqp::attribute(node, "sigma", 1.);
+            m_tolerance = kqp::attribute(node, "tolerance", 0.);
             UnaryKernelSpace<Scalar>::load(node);
         }
 
         virtual pugi::xml_node save(pugi::xml_node &node) const override {
             pugi::xml_node self = UnaryKernelSpace<Scalar>::save(node);
             self.append_attribute("sigma") = boost::lexical_cast<std::string>(m_sigma).c_str();
+            if (m_tolerance > 0)
+                self.append_attribute("tolerance") = boost::lexical_cast<std::string>(m_tolerance).c_str();
             if (m_base)
                 m_base->save(self);
             return self;
@@ -198,16 +317,76 @@ namespace kqp {
         
 
     private:
-
+        /**
+         * @brief Approximate inner products with the fast Gauss transform
+         * @return false if the transform cannot be used (complex pre-images, or a non dense base space) or would be slower
+         */
+        bool approximate(const FMatrixBase &mX1, const ScalarAltMatrix &mY1, const RealAltVector &mD1, 
+                         const FMatrixBase &mX2, const ScalarAltMatrix &mY2, const RealAltVector &mD2, ScalarMatrix &result) const {
+            typedef typename ImprovedFastGaussTransform<Scalar>::RealMatrix RealMatrix;
+            // (the transform is defined on real points)
+            if (Eigen::NumTraits<Scalar>::IsComplex)
+                return false;
+
+            const Dense<Scalar> *dX1 = dynamic_cast<const Dense<Scalar> *>(&mX1);
+            const Dense<Scalar> *dX2 = dynamic_cast<const Dense<Scalar> *>(&mX2);
+            if (!dX1 || !dX2 || !m_base->template castable_as< const DenseSpace<Scalar> >())
+                return false;
+            
+            ScalarMatrix left = mY1 * mD1.asDiagonal();
+            ScalarMatrix right = mY2 * mD2.asDiagonal();
+            
+            // The transform is applied on the side with the fewest columns
+            bool swap = left.cols() < right.cols();
+            ScalarMatrix decoded;
+            const RealMatrix sources = (swap ? dX1 : dX2)->getMatrix(decoded).real();
+            const RealMatrix targets = (swap ? dX2 : dX1)->getMatrix(decoded).real();
+            
+            ImprovedFastGaussTransform<Scalar> transform(sources, m_sigma, m_tolerance);
+            ScalarMatrix kw;
+            if (!transform.run(targets, swap ? left : right, kw))
+                return false;
+            
+            if (swap) 
+                result.noalias() = kw.adjoint() * right;
+            else 
+                result.noalias() = left.adjoint() * kw;
+            return true;
+        }
 
         template<typename Derived, typename DerivedRow, typename DerivedCol>
         inline ScalarMatrix f(const Eigen::MatrixBase<Derived> &k, 
                                   const Eigen::MatrixBase<DerivedRow>& rowNorms, 
                                   const Eigen::MatrixBase<DerivedCol>& colNorms) const { 
-            return (-(rowNorms.derived().rowwise().replicate(k.cols()) + colNorms.derived().adjoint().colwise().replicate(k.rows()) - 2 * k.derived().real()) / (m_sigma*m_sigma)).array().exp();
+            RealMatrix v = (-(rowNorms.derived().real().rowwise().replicate(k.cols()) + colNorms.derived().real().adjoint().colwise().replicate(k.rows()) - 2 * k.derived().real()) / (m_sigma*m_sigma));
+            expInPlace(v.data(), v.size());
+            return v.template cast<Scalar>();
+        }
+
+        //! In-place exponentials (using the kernel selected at runtime for doubles)
+        static inline void expInPlace(double *x, Index n) {
+            cpu::kernels().exp(x, n);
+        }
+
+        template<typename T>
+        static inline void expInPlace(T *x, Index n) {
+            Eigen::Map< Eigen::Array<T, Eigen::Dynamic, 1> > a(x, n);
+            a = a.exp();
+        }
+
+        //! Squared distances from inner products and squared norms (clamped to 0)
+        template<typename Derived, typename DerivedRow, typename DerivedCol>
+        static RealMatrix distances(const Eigen::MatrixBase<Derived> &k,
+                                    const Eigen::MatrixBase<DerivedRow>& rowNorms,
+                                    const Eigen::MatrixBase<DerivedCol>& colNorms) {
+            RealMatrix d = rowNorms.derived().real().rowwise().replicate(k.cols()) + colNorms.derived().real().adjoint().colwise().replicate(k.rows()) - 2 * k.derived().real();
+            return d.cwiseMax(RealMatrix::Zero(d.rows(), d.cols()));
         }
       
         Real m_sigma;
+        
+        //! Tolerance for approximate inner products (0 if exact)
+        Real m_tolerance;
     };
     
     //! Polynomial Kernel \f$k'(x,y) = (k(x,y) + D)^p\f$
@@ -229,12 +408,12 @@ namespace kqp {
 
         virtual ScalarMatrix k(const FMatrixBase &mX1, const ScalarAltMatrix &mY1, const RealAltVector &mD1, 
                                const FMatrixBase &mX2, const ScalarAltMatrix &mY2, const RealAltVector &mD2) const override {
-            return mD1.asDiagonal() * mY1.adjoint() * this->f(m_base->k(mX1,mX2)) * mY2 * mD2.asDiagonal();
+            return mD1.asDiagonal() * bilinear(mY1, this->f(m_base->k(mX1,mX2)), mY2) * mD2.asDiagonal();
         }
 
         virtual void updatePartials(Real alpha, std::vector<Real> &partials, int offset, 
             const std::vector< KernelValues<Scalar> > &values, int kOffset, int mode) const override {
-            Scalar v = (Scalar)m_degree * Eigen::internal::pow(values[kOffset+1].inner(mode) + m_bias, (Scalar)m_degree - 1);
+            Scalar v = (Scalar)m_degree * power(values[kOffset+1].inner(mode) + m_bias, m_degree - 1);
             partials[offset] += alpha * v;
 
             m_base->updatePartials(alpha * v, partials, offset+1, values, kOffset + 1, mode);
@@ -244,11 +423,28 @@ namespace kqp {
             m_base->update(values, kOffset+1);
             auto &self = values[kOffset];
             auto &child = values[kOffset+1];
-            self._inner = Eigen::internal::pow(child._inner + m_bias, (Scalar)m_degree);
-            self._innerX = Eigen::internal::pow(child._innerX + m_bias, (Scalar)m_degree);            
-            self._innerY = Eigen::internal::pow(child._innerY + m_bias, (Scalar)m_degree);
+            self._inner = power(child._inner + m_bias, m_degree);
+            self._innerX = power(child._innerX + m_bias, m_degree);            
+            self._innerY = power(child._innerY + m_bias, m_degree);
+        }
+
+#ifndef SWIG
+        virtual void update(KernelValuesBlock<Scalar> &values, int kOffset = 0) const override {
+            m_base->update(values, kOffset+1);
+            values._inner.col(kOffset) = power(values.inner(kOffset+1), m_bias, m_degree);
+            values._innerX.col(kOffset) = power(values.innerX(kOffset+1), m_bias, m_degree);
+            values._innerY.col(kOffset) = power(values.innerY(kOffset+1), m_bias, m_degree);
         }
 
+        virtual void updatePartials(const RealVector &alpha, std::vector<Real> &partials, int offset, 
+            const KernelValuesBlock<Scalar> &values, int kOffset, int mode) const override {
+            const RealVector v = alpha.cwiseProduct((Real)m_degree * power(values.inner(kOffset+1, mode), m_bias, m_degree - 1).real());
+            partials[offset] += v.sum();
+
+            m_base->updatePartials(v, partials, offset+1, values, kOffset + 1, mode);
+        }
+#endif
+
         virtual int numberOfParameters() const {
             return 1 + m_base->numberOfParameters();
         }
@@ -285,10 +481,57 @@ namespace kqp {
         }
 
         
+    public:
+#ifndef SWIG
+        //! Maximum degree computed by repeated squaring (higher degrees use pow)
+        static const int MAX_INTEGER_DEGREE = 64;
+
+        //! Computes \f$x^n\f$ by repeated squaring when \f$0 \le n \le\f$ MAX_INTEGER_DEGREE
+        static inline Scalar power(Scalar x, int n) {
+            if (n < 0 || n > MAX_INTEGER_DEGREE)
+                return Eigen::internal::pow(x, (Scalar)n);
+            Scalar r = 1;
+            for(; n > 0; n >>= 1, x *= x)
+                if (n & 1) r *= x;
+            return r;
+        }
+
+        /**
+         * @brief Computes \f$(K + b)^n\f$ elementwise
+         *
+         * For integer degrees up to MAX_INTEGER_DEGREE, the bias is added and the power computed by 
+         * repeated squaring column by column, with vectorized products on a column kept in cache.
+         */
+        template<typename Derived>
+        static ScalarMatrix power(const Eigen::MatrixBase<Derived> &k, Real bias, int n) {
+            if (n < 0 || n > MAX_INTEGER_DEGREE)
+                return (k.derived() + ScalarMatrix::Constant(k.rows(), k.cols(), bias)).array().pow(n);
+
+            ScalarMatrix result(k.rows(), k.cols());
+            Eigen::Array<Scalar, Eigen::Dynamic, 1> x(k.rows());
+            for(Index j = 0; j < k.cols(); j++) {
+                x = k.derived().col(j).array() + Scalar(bias);
+                int m = n;
+                for(; !(m & 1) && m > 0; m >>= 1)
+                    x *= x;
+                if (m == 0) {
+                    result.col(j).setOnes();
+                    continue;
+                }
+                result.col(j) = x;
+                for(m >>= 1; m > 0; m >>= 1) {
+                    x *= x;
+                    if (m & 1) result.col(j).array() *= x;
+                }
+            }
+            return result;
+        }
+#endif
+
     private:
         template<typename Derived>
         inline ScalarMatrix f(const Eigen::MatrixBase<Derived> &k) const { 
-            return (k.derived() + ScalarMatrix::Constant(k.rows(), k.cols(), m_bias)).array().pow(m_degree);
+            return power(k, m_bias, m_degree);
         }
       
         Real m_bias;
@@ -0,0 +1,251 @@
+/*
+ This file is part of the Kernel Quantum Probability library (KQP).
+
+ KQP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ KQP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with KQP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __KQP_GAUSS_TRANSFORM_H__
+#define __KQP_GAUSS_TRANSFORM_H__
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include <kqp/kqp.hpp>
+#include <Eigen/Core>
+
+namespace kqp {
+
+    /**
+     * @brief Improved fast Gauss transform
+     *
+     * Computes \f$ G = K W \f$ where \f$K_{ji} = \exp(-\Vert y_j - x_i \Vert^2 / h^2)\f$ for targets \f$y_j\f$
+     * and sources \f$x_i\f$, without computing the kernel matrix K. Sources are grouped with a farthest
+     * point clustering, and the kernel is replaced by a truncated Taylor expansion around the cluster
+     * centers; clusters farther than a cutoff radius from a target are ignored.
+     *
+     * The truncation order and the cutoff radius are chosen so that the absolute error of
+     * \f$G_{jk}\f$ is below \f$\epsilon \sum_i \vert W_{ik} \vert\f$ (Raykar et al., 2005).
+     */
+    template<typename Scalar>
+    class ImprovedFastGaussTransform {
+    public:
+        typedef typename Eigen::NumTraits<Scalar>::Real Real;
+        typedef Eigen::Matrix<Real, Eigen::Dynamic, Eigen::Dynamic> RealMatrix;
+        typedef Eigen::Matrix<Real, Eigen::Dynamic, 1> RealVector;
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> ScalarMatrix;
+
+        //! Maximum order of the Taylor expansions
+        static const int MAX_ORDER = 30;
+
+        //! Estimated cost of an exponential (in multiply-adds)
+        static const int EXP_COST = 10;
+
+        /**
+         * @brief Prepares the transform for a set of sources
+         * @param sources The sources (one per column)
+         * @param h The bandwidth
+         * @param epsilon The (relative) tolerance
+         */
+        ImprovedFastGaussTransform(const RealMatrix &sources, Real h, Real epsilon)
+            : m_sources(sources), m_h(h), m_epsilon(epsilon), m_order(-1) {
+            if (sources.cols() == 0 || epsilon <= 0 || epsilon >= 1 || h <= 0)
+                return;
+
+            // Cutoff radius: the neglected kernel values are below epsilon / 2
+            m_cutoff = h * std::sqrt(std::log(2. / epsilon));
+
+            cluster();
+
+            // Smallest order such that the truncation error is below epsilon / 2
+            Real rx = m_radii.maxCoeff();
+            for(int p = 1; p <= MAX_ORDER && m_order < 0; p++) {
+                // 2^p / p! (rx b / h^2)^p exp(-(b - rx)^2 / h^2), where b maximizes the bound
+                Real b = std::min<Real>((rx + std::sqrt(rx * rx + 2. * p * h * h)) / 2., rx + m_cutoff);
+                if (rx == 0 || std::exp(p * std::log(2. * rx * b / (h * h)) - std::lgamma(p + 1.) - (b - rx) * (b - rx) / (h * h)) <= epsilon / 2)
+                    m_order = p;
+            }
+
+            // The number of terms C(p - 1 + d, d) should stay below the number of sources
+            if (m_order > 0 && std::lgamma(m_order + sources.rows()) - std::lgamma(m_order) - std::lgamma(sources.rows() + 1.) > std::log((double)sources.cols()))
+                m_order = -1;
+
+            if (m_order > 0)
+                monomialConstants();
+        }
+
+        //! Returns false if the expansion could not reach the required tolerance
+        bool valid() const { return m_order > 0; }
+
+        //! Order of the Taylor expansions
+        int order() const { return m_order; }
+
+        //! Number of clusters
+        Index clusters() const { return m_centers.cols(); }
+
+        //! Number of terms of the Taylor expansions
+        Index terms() const { return m_constants.size(); }
+
+        /**
+         * @brief Computes the transform for a set of targets
+         *
+         * @param result The (targets x weights) result
+         * @return false if the direct computation is estimated to be faster (result is then left untouched)
+         */
+        bool run(const RealMatrix &targets, const ScalarMatrix &weights, ScalarMatrix &result) const {
+            if (!valid() || weights.rows() != m_sources.cols())
+                return false;
+
+            const Index d = m_sources.rows(), n = targets.cols(), m = m_sources.cols(), K = clusters();
+
+            // Interaction lists
+            std::vector< std::vector<Index> > neighbours(n);
+            double interactions = 0;
+            for(Index j = 0; j < n; j++) {
+                for(Index k = 0; k < K; k++) {
+                    Real r = m_radii[k] + m_cutoff;
+                    if ((targets.col(j) - m_centers.col(k)).squaredNorm() <= r * r)
+                        neighbours[j].push_back(k);
+                }
+                interactions += neighbours[j].size();
+            }
+
+            // Compare with the direct computation (an exponential costing about EXP_COST operations)
+            const double T = terms();
+            if ((interactions + m) * T * (weights.cols() + 1) >= (double)n * m * (weights.cols() + d + EXP_COST))
+                return false;
+
+            // Coefficients of the expansion around each center
+            std::vector<ScalarMatrix> coefficients(K, ScalarMatrix::Zero(terms(), weights.cols()));
+            RealVector monomials(terms());
+            for(Index i = 0; i < m; i++) {
+                Index k = m_assignments[i];
+                RealVector dx = (m_sources.col(i) - m_centers.col(k)) / m_h;
+                computeMonomials(dx, monomials);
+                monomials *= std::exp(-dx.squaredNorm());
+                coefficients[k].noalias() += monomials * weights.row(i);
+            }
+            for(Index k = 0; k < K; k++)
+                coefficients[k] = m_constants.asDiagonal() * coefficients[k];
+
+            // Evaluation
+            result.resize(n, weights.cols());
+#pragma omp parallel
+            {
+                RealVector monomials(terms());
+#pragma omp for schedule(dynamic, 64)
+                for(Index j = 0; j < n; j++) {
+                    result.row(j).setZero();
+                    for(size_t l = 0; l < neighbours[j].size(); l++) {
+                        Index k = neighbours[j][l];
+                        RealVector dy = (targets.col(j) - m_centers.col(k)) / m_h;
+                        computeMonomials(dy, monomials);
+                        monomials *= std::exp(-dy.squaredNorm());
+                        result.row(j).noalias() += monomials.transpose().template cast<Scalar>() * coefficients[k];
+                    }
+                }
+            }
+
+            return true;
+        }
+
+    private:
+        //! Farthest point clustering, until the radius of the clusters is below h / 2
+        void cluster() {
+            const Index m = m_sources.cols();
+            const Index maxClusters = std::max(Index(1), std::min(m, Index(4 * std::sqrt((double)m))));
+
+            m_assignments.assign(m, 0);
+            RealVector distances(m);
+            std::vector<Index> centers(1, 0);
+            for(Index i = 0; i < m; i++)
+                distances[i] = (m_sources.col(i) - m_sources.col(0)).squaredNorm();
+
+            Index farthest;
+            while (distances.maxCoeff(&farthest) > m_h * m_h / 4 && (Index)centers.size() < maxClusters) {
+                Index k = centers.size();
+                centers.push_back(farthest);
+                for(Index i = 0; i < m; i++) {
+                    Real d = (m_sources.col(i) - m_sources.col(farthest)).squaredNorm();
+                    if (d < distances[i]) {
+                        distances[i] = d;
+                        m_assignments[i] = k;
+                    }
+                }
+            }
+
+            m_centers.resize(m_sources.rows(), centers.size());
+            for(size_t k = 0; k < centers.size(); k++)
+                m_centers.col(k) = m_sources.col(centers[k]);
+
+            m_radii = RealVector::Zero(centers.size());
+            for(Index i = 0; i < m; i++)
+                m_radii[m_assignments[i]] = std::max(m_radii[m_assignments[i]], std::sqrt(distances[i]));
+        }
+
+        /**
+         * Monomials \f$ x^\alpha \f$ for \f$\vert\alpha\vert < p\f$ in graded order: those of degree k
+         * are obtained by multiplying those of degree k-1 starting at the head of variable i by \f$x_i\f$
+         */
+        void computeMonomials(const RealVector &x, RealVector &monomials) const {
+            const Index d = x.size();
+            std::vector<Index> heads(d, 0);
+            monomials[0] = 1;
+            Index t = 1, tail = 1;
+            for(int k = 1; k < m_order; k++) {
+                for(Index i = 0; i < d; i++) {
+                    Index head = heads[i];
+                    heads[i] = t;
+                    for(Index j = head; j < tail; j++, t++)
+                        monomials[t] = x[i] * monomials[j];
+                }
+                tail = t;
+            }
+        }
+
+        //! Constants \f$ 2^{\vert\alpha\vert} / \alpha! \f$, in the same order as the monomials
+        void monomialConstants() {
+            const Index d = m_sources.rows();
+            std::vector< std::vector<int> > alphas(1, std::vector<int>(d, 0));
+            std::vector<Real> constants(1, 1);
+            std::vector<Index> heads(d, 0);
+            Index tail = 1;
+            for(int k = 1; k < m_order; k++) {
+                for(Index i = 0; i < d; i++) {
+                    Index head = heads[i];
+                    heads[i] = alphas.size();
+                    for(Index j = head; j < tail; j++) {
+                        std::vector<int> alpha = alphas[j];
+                        alpha[i]++;
+                        constants.push_back(constants[j] * 2. / alpha[i]);
+                        alphas.push_back(alpha);
+                    }
+                }
+                tail = alphas.size();
+            }
+            m_constants = Eigen::Map<RealVector>(&constants[0], constants.size());
+        }
+
+        RealMatrix m_sources;
+        Real m_h, m_epsilon, m_cutoff;
+        int m_order;
+
+        RealMatrix m_centers;
+        RealVector m_radii;
+        std::vector<Index> m_assignments;
+        RealVector m_constants;
+    };
+
+}
+
+#endif
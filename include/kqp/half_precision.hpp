@@ -0,0 +1,193 @@
+/*
+ This file is part of the Kernel Quantum Probability library (KQP).
+
+ KQP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ KQP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with KQP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __KQP_HALF_PRECISION_H__
+#define __KQP_HALF_PRECISION_H__
+
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <stdint.h>
+
+#ifndef SWIG
+#  ifdef __SSE2__
+#    include <immintrin.h>
+#  endif
+#endif
+
+#include <kqp/kqp.hpp>
+#include <kqp/cpu.hpp>
+
+namespace kqp {
+
+    /**
+     * @brief Storage precision of dense pre-images
+     *
+     * Reduced precisions store each real value on 16 bits (half, bfloat16) or 32 bits (single):
+     * computations are done in double precision, the values being converted when packed in the blocks 
+     * fed to the matrix products, except for the single precision where the products between two
+     * single precision matrices are computed in single precision (mixed precision mode).
+     */
+    struct DensePrecision {
+        enum Type {
+            //! Full (scalar) precision
+            FULL,
+            //! IEEE 754 half precision (11 bits of mantissa, range up to 65504)
+            HALF,
+            //! Brain floating point (8 bits of mantissa, same range as float)
+            BFLOAT16,
+            //! IEEE 754 single precision (float)
+            SINGLE
+        };
+
+        //! Name of a precision (as used in XML files)
+        static std::string name(Type type) {
+            switch(type) {
+                case FULL: return "full";
+                case HALF: return "half";
+                case BFLOAT16: return "bfloat16";
+                case SINGLE: return "single";
+            }
+            KQP_THROW_EXCEPTION_F(illegal_argument_exception, "Unknown precision %d", %type);
+        }
+
+        //! Precision from its name
+        static Type get(const std::string &name) {
+            if (name.empty() || name == "full") return FULL;
+            if (name == "half") return HALF;
+            if (name == "bfloat16") return BFLOAT16;
+            if (name == "single") return SINGLE;
+            KQP_THROW_EXCEPTION_F(illegal_argument_exception, "Unknown precision [%s]", %name);
+        }
+
+        //! Number of 16 bits units used to store a value
+        static int units(Type type) {
+            return type == SINGLE ? 2 : 1;
+        }
+    };
+
+#ifndef SWIG
+    namespace half {
+        inline uint32_t bits(float f) { uint32_t u; std::memcpy(&u, &f, sizeof(u)); return u; }
+        inline float fromBits(uint32_t u) { float f; std::memcpy(&f, &u, sizeof(f)); return f; }
+
+        //! Converts to IEEE half precision (round to nearest even)
+        inline uint16_t fromFloat(float f) {
+            uint32_t u = bits(f);
+            uint16_t sign = (u >> 16) & 0x8000;
+            u &= 0x7fffffff;
+
+            // Overflow, infinity and NaN
+            if (u >= 0x47800000)
+                return sign | (u > 0x7f800000 ? 0x7e00 : 0x7c00);
+
+            // Rounds up to infinity
+            if (u >= 0x477ff000)
+                return sign | 0x7c00;
+
+            // Subnormals (and zero): the FPU rounds to the nearest multiple of 2^-24
+            if (u < 0x38800000)
+                return sign | (uint16_t)std::nearbyint(fromBits(u) * 16777216.f);
+
+            // Normal numbers: rebias the exponent and round the mantissa
+            u += 0xc8000fff + ((u >> 13) & 1);
+            return sign | (uint16_t)(u >> 13);
+        }
+
+        //! Converts from IEEE half precision
+        inline float toFloat(uint16_t h) {
+            uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+            uint32_t exponent = (h >> 10) & 0x1f;
+            uint32_t mantissa = h & 0x3ff;
+
+            if (exponent == 0)
+                return fromBits(sign | bits(mantissa * (1.f / 16777216.f)));
+            if (exponent == 0x1f)
+                return fromBits(sign | 0x7f800000 | (mantissa << 13));
+            return fromBits(sign | ((exponent + 112) << 23) | (mantissa << 13));
+        }
+    }
+
+    namespace bfloat16 {
+        //! Converts to bfloat16 (round to nearest even)
+        inline uint16_t fromFloat(float f) {
+            uint32_t u = half::bits(f);
+            if ((u & 0x7fffffff) > 0x7f800000)
+                return (u >> 16) | 0x40;
+            u += 0x7fff + ((u >> 16) & 1);
+            return u >> 16;
+        }
+
+        //! Converts from bfloat16
+        inline float toFloat(uint16_t b) {
+            return half::fromBits((uint32_t)b << 16);
+        }
+    }
+
+    /**
+     * @brief Encodes real values into a reduced precision
+     * @param precision The target precision (HALF, BFLOAT16 or SINGLE)
+     * @param out The output (DensePrecision::units() units by value)
+     */
+    template<typename Iterator>
+    void encodePrecision(DensePrecision::Type precision, Iterator begin, Iterator end, uint16_t *out) {
+        if (precision == DensePrecision::SINGLE) {
+            for(; begin != end; ++begin, out += 2) { float f = (float)*begin; std::memcpy(out, &f, sizeof(f)); }
+        } else if (precision == DensePrecision::HALF) {
+            for(; begin != end; ++begin, ++out) *out = half::fromFloat((float)*begin);
+        } else {
+            for(; begin != end; ++begin, ++out) *out = bfloat16::fromFloat((float)*begin);
+        }
+    }
+
+    /**
+     * @brief Decodes a contiguous run of reduced precision values into doubles
+     *
+     * This is the inner loop of the reduced precision matrix products: half precision
+     * values are converted by the numerical kernels (see cpu::Kernels), which use the F16C
+     * instructions when the host supports them, and bfloat16 ones with SSE2 when available.
+     */
+    inline void decodePrecision(DensePrecision::Type precision, const uint16_t *in, std::size_t n, double *out) {
+        std::size_t i = 0;
+        if (precision == DensePrecision::SINGLE) {
+            for(; i < n; i++, in += 2) { float f; std::memcpy(&f, in, sizeof(f)); out[i] = f; }
+        } else if (precision == DensePrecision::HALF) {
+            cpu::kernels().decodeHalf(in, n, out);
+        } else {
+#if defined(__SSE2__) && !defined(SWIG)
+            const __m128i zero = _mm_setzero_si128();
+            for(; i + 8 <= n; i += 8) {
+                __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+                __m128 lo = _mm_castsi128_ps(_mm_unpacklo_epi16(zero, b));
+                __m128 hi = _mm_castsi128_ps(_mm_unpackhi_epi16(zero, b));
+                _mm_storeu_pd(out + i, _mm_cvtps_pd(lo));
+                _mm_storeu_pd(out + i + 2, _mm_cvtps_pd(_mm_movehl_ps(lo, lo)));
+                _mm_storeu_pd(out + i + 4, _mm_cvtps_pd(hi));
+                _mm_storeu_pd(out + i + 6, _mm_cvtps_pd(_mm_movehl_ps(hi, hi)));
+            }
+#endif
+            for(; i < n; i++) out[i] = bfloat16::toFloat(in[i]);
+        }
+    }
+
+    //! Copies a contiguous run of single precision values
+    inline void decodeSingle(const uint16_t *in, std::size_t n, float *out) {
+        std::memcpy(out, in, n * sizeof(float));
+    }
+#endif // SWIG
+}
+
+#endif
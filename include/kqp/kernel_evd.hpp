@@ -24,6 +24,7 @@
 #include <kqp/decomposition.hpp>
 #include <kqp/feature_matrix.hpp>
 #include <kqp/rank_selector.hpp>
+#include <kqp/checkpoint.hpp>
 
 
 
@@ -84,6 +85,9 @@ namespace kqp {
 
         /**
          * Get the current decomposition
+         *
+         * The pre-images of the decomposition can be shared with the builder, which
+         * copies them before modifying them (copy-on-write).
          */
         Decomposition<Scalar> getDecomposition() const {
             Decomposition<Scalar> d(_getDecomposition());
@@ -108,6 +112,26 @@ namespace kqp {
         Index getUpdateCount() const {
             return nbUpdates;
         }
+
+        /**
+         * @brief Saves the state of the builder in a checkpoint
+         *
+         * Only the state is saved: the builder which loads it should be created with the
+         * same feature space and settings (selector, cleaners, sub-builders, etc.).
+         *
+         * @param prefix Prefix of the names of the checkpoint blocks
+         */
+        void save(CheckpointWriter &writer, const std::string &prefix = "") const {
+            _save(writer, prefix);
+            writer.writeValue<int64_t>(prefix + "updates", nbUpdates);
+        }
+
+        //! Replaces the state of the builder by the one saved in a checkpoint (see save())
+        void load(const CheckpointReader &reader, const std::string &prefix = "") {
+            reset();
+            _load(reader, prefix);
+            nbUpdates = reader.value<int64_t>(prefix + "updates");
+        }
     
         const FSpace &getFSpace() const { return m_featureSpace; }
         
@@ -126,6 +150,16 @@ namespace kqp {
 
         /** Get the decomposition */
         virtual Decomposition<Scalar> _getDecomposition() const = 0;
+
+        //! Saves the state of the builder (by default, builders cannot be checkpointed)
+        virtual void _save(CheckpointWriter &, const std::string &) const {
+            KQP_THROW_EXCEPTION_F(not_implemented_exception, "Builder %s cannot be checkpointed", %KQP_DEMANGLE(*this));
+        }
+
+        //! Loads the state of the builder (after a reset)
+        virtual void _load(const CheckpointReader &, const std::string &) {
+            KQP_THROW_EXCEPTION_F(not_implemented_exception, "Builder %s cannot be checkpointed", %KQP_DEMANGLE(*this));
+        }
     
     private:
         Index nbUpdates;
@@ -18,20 +18,343 @@
 #ifndef __KQP_ACCUMULATOR_BUILDER_H__
 #define __KQP_ACCUMULATOR_BUILDER_H__
 
+#include <algorithm>
+
 #include <boost/static_assert.hpp>
 
 #include <kqp/alt_matrix.hpp>
 #include <kqp/kernel_evd.hpp>
 #include <kqp/evd_utils.hpp>
+#include <kqp/subset.hpp>
+#include <kqp/feature_matrix/unary_kernel.hpp>
 
 namespace kqp{
     
+    /**
+     * @brief Pre-images with signed weights, accumulated by the accumulation based builders
+     *
+     * Represents the operator \f$X W X^\dagger\f$, where the Hermitian weight matrix \f$W\f$ is 
+     * diagonal (a signed weight per pre-image) as long as the added weights are, and dense otherwise.
+     *
+     * Pre-images are identified by their value (their distance in the feature space is null, 
+     * up to rounding errors), and not by the feature matrix which holds them: a pre-image which
+     * is added again has its weights updated, so that a downdate cancels out the corresponding 
+     * update (or a subset of its pre-images), whatever feature matrix it uses. 
+     * Pre-images whose weights become null are removed.
+     *
+     * The Gram matrix of the pre-images is kept (except for spaces with sparse Gram matrices):
+     * only the inner products with new pre-images are computed, and it is reduced with the 
+     * pre-images when some are removed.
+     */
+    template<typename Scalar>
+    class WeightedPreImages {
+    public:
+        KQP_SCALAR_TYPEDEFS(Scalar);
+        
+        WeightedPreImages(const FSpace &fs) : m_fs(fs) {
+            reset();
+        }
+        
+        //! Removes all the pre-images
+        void reset() {
+            m_mX = m_fs->newMatrix();
+            m_gram.resize(0,0);
+            m_norms.resize(0);
+            m_diagonal.resize(0);
+            m_weights.resize(0,0);
+            m_dense = false;
+        }
+        
+        //! Number of pre-images
+        Index size() const {
+            return m_mX->size();
+        }
+        
+        //! The pre-images (never modified once returned by a decomposition)
+        const FMatrix &preImages() const {
+            return m_mX;
+        }
+        
+        /**
+         * @brief Adds \f$X_1 W_1 X_1^\dagger\f$ to the operator
+         *
+         * @param mX The pre-images
+         * @param mW The (Hermitian) weights of the pre-images
+         */
+        void add(const FMatrixBase &mX, const ScalarMatrix &mW) {
+            const Index n = size(), m = mX.size();
+            if (m == 0)
+                return;
+            
+            // Inner products with the current pre-images (the Gram matrix of mX is copied
+            // since spaces may reuse its storage)
+            const ScalarMatrix cross = n > 0 ? m_fs->k(*m_mX, mX) : ScalarMatrix(0, m);
+            const ScalarMatrix gram = m_fs->k(mX);
+            
+            // Position of the pre-images of mX: an identical pre-image, or a new one
+            std::vector<Index> position(m);
+            std::vector<bool> which(m, false);
+            std::vector<Index> added;
+            for(Index j = 0; j < m; j++) {
+                const Real norm = Eigen::internal::real(gram(j,j));
+                Index p = -1;
+                for(Index i = 0; i < n && p < 0; i++)
+                    if (same(m_norms[i], norm, cross(i,j)))
+                        p = i;
+                for(size_t l = 0; l < added.size() && p < 0; l++)
+                    if (same(Eigen::internal::real(gram(added[l], added[l])), norm, gram(added[l], j)))
+                        p = n + l;
+                if (p < 0) {
+                    p = n + added.size();
+                    added.push_back(j);
+                    which[j] = true;
+                }
+                position[j] = p;
+            }
+            
+            const Index nAdded = added.size(), size = n + nAdded;
+            if (nAdded > 0) {
+                // The pre-images might be shared with a decomposition
+                if (!m_mX.unique())
+                    m_mX = m_mX->copy();
+                m_mX->add(mX, &which);
+                
+                m_norms.conservativeResize(size);
+                for(Index l = 0; l < nAdded; l++)
+                    m_norms[n + l] = Eigen::internal::real(gram(added[l], added[l]));
+                
+                if (!m_fs->hasSparseGram()) {
+                    m_gram.conservativeResize(size, size);
+                    for(Index l = 0; l < nAdded; l++) {
+                        m_gram.col(n + l).head(n) = cross.col(added[l]);
+                        for(Index l2 = 0; l2 < nAdded; l2++)
+                            m_gram(n + l2, n + l) = gram(added[l2], added[l]);
+                    }
+                    m_gram.bottomLeftCorner(nAdded, n) = m_gram.topRightCorner(n, nAdded).adjoint().eval();
+                }
+                
+                m_diagonal.conservativeResize(size);
+                m_diagonal.tail(nAdded).setZero();
+                if (m_dense) {
+                    m_weights.conservativeResize(size, size);
+                    m_weights.rightCols(nAdded).setZero();
+                    m_weights.bottomRows(nAdded).setZero();
+                }
+            }
+            
+            // Updates the weights
+            if (!m_dense && !isDiagonal(mW)) {
+                m_weights = m_diagonal.template cast<Scalar>().asDiagonal();
+                m_dense = true;
+            }
+            
+            // Weights are null when they are small relative to the added ones (rounding errors)
+            const Real threshold = Eigen::NumTraits<Scalar>::dummy_precision() * mW.cwiseAbs().maxCoeff();
+            std::vector<bool> to_keep(size, true);
+            bool removed = false;
+            
+            for(Index j = 0; j < m; j++) {
+                const Index p = position[j];
+                if (m_dense) {
+                    for(Index l = 0; l < m; l++) 
+                        m_weights(p, position[l]) += mW(j, l);
+                } else 
+                    m_diagonal[p] += Eigen::internal::real(mW(j, j));
+            }
+            
+            for(Index j = 0; j < m; j++) {
+                const Index p = position[j];
+                if (m_dense) {
+                    for(Index l = 0; l < m; l++) 
+                        if (std::abs(m_weights(p, position[l])) <= threshold)
+                            m_weights(p, position[l]) = 0;
+                    to_keep[p] = !m_weights.col(p).isZero(0);
+                } else {
+                    if (std::abs(m_diagonal[p]) <= threshold)
+                        m_diagonal[p] = 0;
+                    to_keep[p] = m_diagonal[p] != 0;
+                }
+                removed |= !to_keep[p];
+            }
+            
+            if (removed)
+                remove(to_keep);
+        }
+        
+        //! Decomposition of the operator
+        Decomposition<Scalar> decomposition() const {
+            if (m_fs->hasSparseGram())
+                return decomposition(m_fs, m_fs->sparseK(*m_mX));
+            return decomposition(m_fs, m_gram);
+        }
+        
+        /**
+         * @brief Decomposition of the operator in a feature space, given the Gram matrix of the pre-images
+         *
+         * @param fs The feature space of the decomposition
+         * @param gram The Gram matrix of the pre-images in this space (dense or sparse)
+         */
+        template<typename Gram>
+        Decomposition<Scalar> decomposition(const FSpace &fs, const Gram &gram) const {
+            Decomposition<Scalar> d(fs);
+            if (size() == 0) {
+                d.mY.resize(0,0);
+                d.mD.resize(0,1);
+                return d;
+            }
+            
+            // W = F S F^\dagger (S being the signs): the operator is the signed sum
+            // of the rank-one operators of the columns of X F
+            ScalarMatrix mF, gramF;
+            RealVector signs, scale;
+            if (m_dense) {
+                factor(mF, signs);
+                const ScalarMatrix kF = gram * mF;
+                gramF.noalias() = mF.adjoint() * kF;
+            } else {
+                scale = m_diagonal.cwiseAbs().cwiseSqrt();
+                signs = m_diagonal.unaryExpr([](Real w) -> Real { return w < 0 ? -1 : 1; });
+                gramF = scale.template cast<Scalar>().asDiagonal() * dense(gram) * scale.template cast<Scalar>().asDiagonal();
+            }
+            
+            ScalarMatrix _mY;
+            RealVector _mD;
+            if ((signs.array() < 0).any()) 
+                SignedEVD<Scalar>::run(gramF, signs, _mY, _mD);
+            else {
+                Eigen::SelfAdjointEigenSolver<ScalarMatrix> evd(gramF.template selfadjointView<Eigen::Lower>());
+                kqp::ThinEVD<ScalarMatrix>::run(evd, _mY, _mD);
+                
+                // Y <- Y * D^-1/2 (use cwiseAbs to avoid problems with small negative values)
+                _mY = (_mY * _mD.cwiseAbs().cwiseSqrt().cwiseInverse().asDiagonal()).eval();
+            }
+            
+            // Mixture matrix of the pre-images X
+            ScalarMatrix __mY;
+            if (m_dense)
+                __mY.noalias() = mF * _mY;
+            else
+                __mY = scale.template cast<Scalar>().asDiagonal() * _mY;
+            
+            d.mX = m_mX;
+            d.mY.swap(__mY);
+            d.mD.swap(_mD);
+            return d;
+        }
+        
+        //! Saves the pre-images, their weights and their Gram matrix
+        void save(CheckpointWriter &writer, const std::string &prefix) const {
+            writer.writeFeatures<Scalar>(prefix + "mX", m_mX);
+            writer.writeMatrix(prefix + "norms", m_norms);
+            if (m_dense)
+                writer.writeMatrix(prefix + "weights", m_weights);
+            else
+                writer.writeMatrix(prefix + "diagonal", m_diagonal);
+            if (!m_fs->hasSparseGram())
+                writer.writeMatrix(prefix + "gram", m_gram);
+        }
+        
+        //! Loads the state saved by save()
+        void load(const CheckpointReader &reader, const std::string &prefix) {
+            m_mX = reader.features<Scalar>(prefix + "mX", m_fs->dimension());
+            m_norms = reader.matrix<Real>(prefix + "norms");
+            m_dense = reader.has(prefix + "weights");
+            if (m_dense) {
+                m_weights = reader.matrix<Scalar>(prefix + "weights");
+                m_diagonal = RealVector::Zero(m_weights.rows());
+            } else
+                m_diagonal = reader.matrix<Real>(prefix + "diagonal");
+            
+            const Index n = m_mX->size();
+            if (m_norms.size() != n || m_diagonal.size() != n || (m_dense && m_weights.cols() != n))
+                KQP_THROW_EXCEPTION_F(illegal_argument_exception, "Inconsistent weighted pre-images %s (%d pre-images)", %prefix %n);
+            
+            if (!m_fs->hasSparseGram()) {
+                m_gram = reader.matrix<Scalar>(prefix + "gram");
+                if (m_gram.rows() != n || m_gram.cols() != n)
+                    KQP_THROW_EXCEPTION_F(illegal_argument_exception, "Inconsistent Gram matrix %s (%d pre-images)", %prefix %n);
+            }
+        }
+        
+    private:
+        //! Returns true if the (distance in the feature space between the) two pre-images is null up to rounding errors
+        static inline bool same(Real norm1, Real norm2, Scalar product) {
+            return std::abs(norm1 + norm2 - 2 * Eigen::internal::real(product)) <= Eigen::NumTraits<Scalar>::dummy_precision() * (norm1 + norm2);
+        }
+        
+        //! Returns true if the matrix is (exactly) diagonal
+        static bool isDiagonal(const ScalarMatrix &m) {
+            for(Index j = 0; j < m.cols(); j++)
+                for(Index i = 0; i < m.rows(); i++)
+                    if (i != j && m(i,j) != Scalar(0))
+                        return false;
+            return true;
+        }
+        
+        static inline const ScalarMatrix &dense(const ScalarMatrix &m) {
+            return m;
+        }
+        static inline ScalarMatrix dense(const Eigen::SparseMatrix<Scalar> &m) {
+            return m.toDense();
+        }
+        
+        //! Factorises the dense weights \f$W = F S F^\dagger\f$ (S being the signs of the non null eigenvalues)
+        void factor(ScalarMatrix &mF, RealVector &signs) const {
+            Eigen::SelfAdjointEigenSolver<ScalarMatrix> evd(m_weights.template selfadjointView<Eigen::Lower>());
+            RealVector mL;
+            kqp::ThinEVD<ScalarMatrix>::run(evd, mF, mL);
+            signs = mL.unaryExpr([](Real l) -> Real { return l < 0 ? -1 : 1; });
+            mF = (mF * mL.cwiseAbs().cwiseSqrt().template cast<Scalar>().asDiagonal()).eval();
+        }
+        
+        //! Removes pre-images (and their weights and inner products)
+        void remove(const std::vector<bool> &to_keep) {
+            m_mX = m_mX->subset(to_keep);
+            select_rows(to_keep, m_norms, m_norms);
+            select_rows(to_keep, m_diagonal, m_diagonal);
+            if (m_dense) {
+                select_rows(to_keep, m_weights, m_weights);
+                select_columns(to_keep, m_weights, m_weights);
+            }
+            if (!m_fs->hasSparseGram()) {
+                select_rows(to_keep, m_gram, m_gram);
+                select_columns(to_keep, m_gram, m_gram);
+            }
+        }
+        
+        //! The feature space
+        FSpace m_fs;
+        
+        //! The pre-images
+        FMatrix m_mX;
+        
+        //! Gram matrix of the pre-images (if the space has dense Gram matrices)
+        ScalarMatrix m_gram;
+        
+        //! Squared norms of the pre-images
+        RealVector m_norms;
+        
+        //! Weights of the pre-images (when the weight matrix is diagonal)
+        RealVector m_diagonal;
+        
+        //! Weight matrix (when dense)
+        ScalarMatrix m_weights;
+        
+        //! Whether the weight matrix is dense
+        bool m_dense;
+    };
+    
     /**
      * @brief Accumulation based computation of the density.
      *
      * Supposes that we can compute a linear combination of the pre-images.
      * Performs an SVD of the feature vectors (if doable) or and EVD of the 
      * inner product of feature vectors.
+     *
+     * Downdates (negative coefficients) are supported: the decomposition is the one
+     * of the net operator (see WeightedPreImages). The weights of the pre-images (or
+     * of their linear combinations) of a downdate are subtracted from those of the
+     * identical accumulated pre-images, which are removed when their weights become null.
      * 
      * @ingroup KernelEVD
      */
@@ -46,7 +369,7 @@ namespace kqp{
         
         KQP_SCALAR_TYPEDEFS(Scalar);
         
-        AccumulatorKernelEVD(const FSpace &fs) : KernelEVD<Scalar>(fs), fMatrix(fs->newMatrix()) {
+        AccumulatorKernelEVD(const FSpace &fs) : KernelEVD<Scalar>(fs), preImages(fs) {
         }
         
         virtual ~AccumulatorKernelEVD() {
@@ -54,38 +377,32 @@ namespace kqp{
         
         
         virtual void _add(Real alpha, const FMatrix &mX, const ScalarAltMatrix &mA) override {           
-            // Just add the vectors using linear combination
-            if(alpha < 0)
-                KQP_THROW_EXCEPTION(not_implemented_exception, "Downdating with accumulator");
-            
-            FMatrix fm = this->getFSpace()->linearCombination(mX, mA, Eigen::internal::sqrt(alpha));
-            fMatrix->add(*fm);
+            // The combined pre-images X A, with weight alpha
+            FMatrix fm = this->getFSpace()->linearCombination(*mX, mA);
+            preImages.add(*fm, ScalarMatrix(alpha * ScalarMatrix::Identity(fm->size(), fm->size())));
         }
         
         void reset() override {
             KernelEVD<Scalar>::reset();
-            fMatrix = this->getFSpace()->newMatrix();
+            preImages.reset();
         }
         
         //! Actually performs the computation
         virtual Decomposition<Scalar> _getDecomposition() const override {
-            
-            const ScalarMatrix& gram = this->getFSpace()->k(fMatrix);
-            Eigen::SelfAdjointEigenSolver<ScalarMatrix> evd(gram.template selfadjointView<Eigen::Lower>());
-            
-            ScalarMatrix _mY;
-            RealVector _mD;
-            kqp::ThinEVD<ScalarMatrix>::run(evd, _mY, _mD);
-            
-            ScalarMatrix __mY;
-            __mY.noalias() = _mY * _mD.cwiseAbs().cwiseSqrt().cwiseInverse().asDiagonal();
-            
-            return Decomposition<Scalar>(this->getFSpace(), fMatrix, __mY, _mD, true);
+            return preImages.decomposition();
+        }
+        
+        virtual void _save(CheckpointWriter &writer, const std::string &prefix) const override {
+            preImages.save(writer, prefix);
+        }
+        
+        virtual void _load(const CheckpointReader &reader, const std::string &prefix) override {
+            preImages.load(reader, prefix);
         }
         
     private:
-        //! concatenation of pre-image matrices
-        FMatrix fMatrix;        
+        //! The combined pre-images and their weights
+        WeightedPreImages<Scalar> preImages;
     };
     
     
@@ -97,115 +414,82 @@ namespace kqp{
 
         KQP_SCALAR_TYPEDEFS(Scalar);
         
-        AccumulatorKernelEVD(const FSpace &fs) : KernelEVD<Scalar>(fs), fMatrix(fs->newMatrix()) {
-            offsets_X.push_back(0);
-            offsets_A.push_back(0);
+        AccumulatorKernelEVD(const FSpace &fs) : KernelEVD<Scalar>(fs), preImages(fs) {
         }
         
         virtual ~AccumulatorKernelEVD() {}
         
     protected:
         virtual void _add(Real alpha, const FMatrix &mX, const ScalarAltMatrix &mA) override {           
-            if(alpha < 0)
-                KQP_THROW_EXCEPTION(not_implemented_exception, "Downdating with accumulator");
-
             // If there is nothing to add            
             if (mA.cols() == 0)
                 return;
             
-            // Do a deep copy of mA
-            combination_matrices.push_back(mA);
-            alphas.push_back(Eigen::internal::sqrt(alpha));
-            fMatrix->add(mX);
-            offsets_X.push_back(offsets_X.back() + mX->size());
-            offsets_A.push_back(offsets_A.back() + mA.cols());
+            // The weights of the pre-images are alpha A A^\dagger
+            ScalarMatrix a;
+            mA.evalTo(a);
+            preImages.add(*mX, ScalarMatrix(alpha * (a * a.adjoint())));
         }
         
         void reset() {
             KernelEVD<Scalar>::reset();
-
-            fMatrix = this->getFSpace()->newMatrix();
-            alphas.clear();
-            offsets_X.clear();
-            offsets_A.clear();
-            combination_matrices.clear();
-            
-            offsets_X.push_back(0);
-            offsets_A.push_back(0);
+            preImages.reset();
         }
 
         
     protected:
         //! Actually performs the computation
         virtual Decomposition<Scalar> _getDecomposition() const override {
-            Decomposition<Scalar> d(this->getFSpace());
-            // Compute A^T X^T X A^T 
-            // where A = diag(A_1 ... A_n) and X = (X_1 ... X_n)
-            
-            Index size = offsets_A.back();
-            
-            // Nothing to do
-            if (size == 0) {
-                d.mX = this->getFSpace()->newMatrix();
-                d.mY.resize(0,0);
-                d.mD.resize(0,1);
-                return d;
-            }
-            
-            ScalarMatrix gram_X = this->getFSpace()->k(fMatrix);
-            ScalarMatrix gram(size, size);
-            
-            for(size_t i = 0; i < combination_matrices.size(); i++) {
-                const ScalarAltMatrix &mAi = combination_matrices[i];
-                for(size_t j = 0; j <= i; j++) {
-                    const ScalarAltMatrix &mAj = combination_matrices[j];
-                    getBlock(gram, offsets_A, i, j) 
-                            =  (mAi.adjoint() *  ((Eigen::internal::conj(alphas[i]) * alphas[j]) * getBlock(gram_X, offsets_X, i, j))) * mAj;
-                }
-            }
-            
-            
-            // Direct EVD
-            ScalarMatrix _mY;
-            RealVector _mD;
-            Eigen::SelfAdjointEigenSolver<ScalarMatrix> evd(gram.template selfadjointView<Eigen::Lower>());
-            kqp::ThinEVD<ScalarMatrix>::run(evd, _mY, _mD);
-            d.mD.swap(_mD);
-            
-            // Y <- A * Y * D^-1/2 (use cwiseAbs to avoid problems with small negative values)
-            ScalarMatrix _mY2 = _mY * d.mD.cwiseAbs().cwiseSqrt().cwiseInverse().asDiagonal();
-            _mY = _mY2;
-            ScalarMatrix __mY(offsets_X.back(), _mY.cols());
-            
-            for(size_t i = 0; i < combination_matrices.size(); i++) {
-                const ScalarAltMatrix &mAi = combination_matrices[i];
-                __mY.block(offsets_X[i], 0, offsets_X[i+1]-offsets_X[i], __mY.cols()) = mAi * (alphas[i] * _mY.block(offsets_A[i], 0,  offsets_A[i+1]-offsets_A[i], _mY.cols()));
-            }
-            
-            d.mY.swap(__mY);
-            d.mX = fMatrix;
-            return d;
+            return preImages.decomposition();
         }
         
-    private:
-        static inline Eigen::Block<ScalarMatrix> getBlock(ScalarMatrix &m, const std::vector<Index> &offsets, size_t i, size_t j) {
-            return m.block(offsets[i], offsets[j], offsets[i+1] - offsets[i], offsets[j+1]-offsets[j]);
+        virtual void _save(CheckpointWriter &writer, const std::string &prefix) const override {
+            preImages.save(writer, prefix);
         }
         
-        //! Pre-images matrices
-        FMatrix fMatrix;        
-        
-        //! Linear combination matrices
-        std::vector<ScalarAltMatrix> combination_matrices;
-        
-        //! Offsets
-        std::vector<Index> offsets_A;
-        std::vector<Index> offsets_X;
-        
+        virtual void _load(const CheckpointReader &reader, const std::string &prefix) override {
+            preImages.load(reader, prefix);
+        }
         
-        //! Alphas 
-        std::vector<Scalar> alphas;
+    public:
+#ifndef SWIG
+        /**
+         * @brief Decompositions for several bandwidths of a Gaussian space
+         *
+         * The feature space of this builder should be a Gaussian space (whose bandwidth is ignored).
+         * The squared distances between the accumulated pre-images are computed only once, 
+         * and all the Gram matrices are computed (and kept in memory) before the decompositions.
+         */
+        std::vector< Decomposition<Scalar> > getDecompositions(const std::vector<Real> &sigmas) const {
+            const GaussianSpace<Scalar> &gaussian = kqp::our_dynamic_cast<const GaussianSpace<Scalar> &>(*this->getFSpace());
+
+            std::vector< Decomposition<Scalar> > decompositions;
+            std::vector<ScalarMatrix> grams;
+            if (preImages.size() > 0)
+                grams = gaussian.kernelMatrices(*preImages.preImages(), sigmas);
+            
+            for(size_t s = 0; s < sigmas.size(); s++) {
+                boost::shared_ptr< GaussianSpace<Scalar> > fs(new GaussianSpace<Scalar>(sigmas[s], gaussian.base()));
+                fs->tolerance(gaussian.tolerance());
+                
+                Decomposition<Scalar> d(grams.empty() ? Decomposition<Scalar>(fs) : preImages.decomposition(fs, grams[s]));
+                if (grams.empty()) {
+                    d.mY.resize(0,0);
+                    d.mD.resize(0,1);
+                }
+                d.updateCount = this->getUpdateCount();
+                if (!d.check())
+                    KQP_THROW_EXCEPTION_F(assertion_exception, "Decomposition in an invalid state (%d, %dx%d, %d) for bandwidth %g", 
+                                          %d.mX->size() %d.mY.rows() %d.mY.cols() %d.mD.rows() %sigmas[s]);
+                decompositions.push_back(d);
+            }
+            return decompositions;
+        }
+#endif
         
+    private:
+        //! The pre-images and their weights
+        WeightedPreImages<Scalar> preImages;
     };
     
 }
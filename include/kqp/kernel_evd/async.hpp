@@ -0,0 +1,506 @@
+/*
+ This file is part of the Kernel Quantum Probability library (KQP).
+
+ KQP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ KQP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with KQP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __KQP_ASYNC_BUILDER_H__
+#define __KQP_ASYNC_BUILDER_H__
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <thread>
+
+#include <kqp/kernel_evd.hpp>
+#include <kqp/snapshot.hpp>
+
+namespace kqp {
+
+#   include <kqp/define_header_logger.hpp>
+    DEFINE_KQP_HLOGGER("kqp.kevd.async");
+
+    /**
+     * @brief Asynchronous updates of a kernel EVD builder.
+     *
+     * Updates from any number of threads are put in a bounded queue, and a worker thread
+     * adds them to the underlying builder. Consecutive updates with coefficients of the same
+     * sign are coalesced into one update, so that the per update cost of the builder (EVD,
+     * cleaning) is amortized. Getting the decomposition waits until the updates queued
+     * before the call have been added, but neither for later updates nor while holding
+     * the queue: producers can queue updates while the decomposition is computed.
+     *
+     * When publishing is enabled, the worker publishes an immutable snapshot of the
+     * decomposition when it has processed all the queued updates, and at most once per
+     * publication period otherwise: getSnapshot() can then be called from any thread,
+     * without waiting for the queue or copying the decomposition. Only this wrapper
+     * publishes snapshots, the underlying builder is not aware of them; the pre-images
+     * of the snapshots are shared with the builder, which copies them before modifying
+     * them (see KernelEVD::getDecomposition).
+     *
+     * Updates with a null coefficient are ignored, and dropped updates (see Overflow) are
+     * not counted in the number of updates of the decomposition.
+     *
+     * The pre-images of an update should not be modified once added. Coalesced updates are
+     * given to the builder as a new feature matrix holding all their pre-images; this is 
+     * transparent for builders that identify pre-images by value (e.g. downdates of
+     * AccumulatorKernelEVD). Since coalescing changes the number of updates seen by the builder, 
+     * it should be disabled (setMaxCoalesced(1)) for builders that count their updates 
+     * (e.g. SlidingWindowKernelEVD).
+     *
+     * @ingroup KernelEVD
+     */
+    template <typename Scalar> class AsyncKernelEVD : public KernelEVD<Scalar> {
+    public:
+        KQP_SCALAR_TYPEDEFS(Scalar);
+
+        //! What to do when adding an update to a full queue
+        enum Overflow {
+            //! Wait until the worker has removed some updates from the queue
+            BLOCK,
+            //! Discard the update
+            DROP
+        };
+
+        /**
+         * @param builder The builder
+         * @param capacity The maximum number of updates in the queue
+         */
+        AsyncKernelEVD(const boost::shared_ptr< KernelEVD<Scalar> > &builder, Index capacity = 64)
+            : KernelEVD<Scalar>(builder->getFSpace()), builder(builder), capacity(capacity), reserved(0), maxCoalesced(16),
+              overflow(BLOCK), dropped(0), publishing(false), period(0), pushed(0), processed(0), requested(0), busy(false),
+              readers(0), reading(false), stopping(false) {
+            if (capacity < 1)
+                KQP_THROW_EXCEPTION_F(illegal_argument_exception, "The capacity of the queue should be positive (got %d)", %capacity);
+            worker = std::thread(&AsyncKernelEVD::run, this);
+        }
+
+        //! Processes the remaining updates and stops the worker
+        virtual ~AsyncKernelEVD() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            notEmpty.notify_all();
+            worker.join();
+        }
+
+        //! Sets the maximum number of updates coalesced into one update of the builder
+        void setMaxCoalesced(Index maxCoalesced) {
+            std::lock_guard<std::mutex> lock(mutex);
+            this->maxCoalesced = std::max<Index>(1, maxCoalesced);
+        }
+
+        //! Sets what to do when the queue is full
+        void setOverflow(Overflow overflow) {
+            std::lock_guard<std::mutex> lock(mutex);
+            this->overflow = overflow;
+        }
+
+        //! Number of updates (calls to add) discarded because the queue was full
+        Index getDroppedCount() const {
+            std::lock_guard<std::mutex> lock(mutex);
+            return dropped;
+        }
+
+        /**
+         * @brief Publish (or not) snapshots of the decomposition
+         *
+         * When enabled, the current decomposition is published immediately. Each
+         * publication computes the decomposition (the pre-images are shared, not copied):
+         * while the queue is not empty, publications are spaced by at least the given period.
+         *
+         * @param period Minimum time (in seconds) between two publications of a busy worker
+         */
+        void setPublishing(bool publishing, double period = 0.1) {
+            std::unique_lock<std::mutex> lock(mutex);
+            wait(lock);
+            this->publishing = publishing;
+            this->period = std::chrono::duration<double>(period);
+            if (publishing)
+                publish();
+            else
+                snapshots.clear();
+        }
+
+        /**
+         * @brief Returns the last published decomposition
+         *
+         * The snapshot is immutable and is not copied; it does not reflect the updates that are
+         * still in the queue, nor (for a busy worker) those of the last publication period.
+         * Returns a null pointer when publishing is disabled.
+         */
+        boost::shared_ptr< const Decomposition<Scalar> > getSnapshot() const {
+            return snapshots.get();
+        }
+
+        //! Returns the underlying builder (call flush() before using it)
+        const boost::shared_ptr< KernelEVD<Scalar> > &getBuilder() const {
+            return builder;
+        }
+
+        virtual void add(Real alpha, const FMatrix &mX, const ScalarAltMatrix &mA) override {
+            check(mX, mA);
+            {
+                // Reserves a slot in the queue (dropped updates are not counted)
+                std::unique_lock<std::mutex> lock(mutex);
+                rethrow();
+                if (overflow == DROP && full()) {
+                    dropped++;
+                    return;
+                }
+                notFull.wait(lock, [this] { return !full() || error; });
+                rethrow();
+                reserved++;
+            }
+            enqueue(alpha, mX, mA);
+        }
+
+        /**
+         * @brief Adds an update if the queue is not full
+         *
+         * Never waits for the worker nor for blocked producers.
+         * @return true if the update was queued
+         */
+        bool tryAdd(Real alpha, const FMatrix &mX, const ScalarAltMatrix &mA) {
+            check(mX, mA);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                rethrow();
+                if (full())
+                    return false;
+                reserved++;
+            }
+            enqueue(alpha, mX, mA);
+            return true;
+        }
+
+        //! Waits until all the queued updates have been added to the builder
+        void flush() const {
+            std::unique_lock<std::mutex> lock(mutex);
+            wait(lock);
+        }
+
+        void reset() override {
+            // Drains the queue first, so that producers are not blocked while the worker catches up
+            flush();
+            std::lock_guard<std::mutex> producersLock(producers);
+            std::unique_lock<std::mutex> lock(mutex);
+            wait(lock);
+            KernelEVD<Scalar>::reset();
+            builder->reset();
+            if (publishing)
+                publish();
+        }
+
+    protected:
+        //! Queues the update in the slot reserved by add() or tryAdd()
+        virtual void _add(Real alpha, const FMatrix &mX, const ScalarAltMatrix &mA) override {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                reserved--;
+                // Nothing to add (and it cannot be coalesced)
+                if (alpha != 0) {
+                    queue.push_back(Update(alpha, mX, mA));
+                    pushed++;
+                }
+            }
+            if (alpha != 0)
+                notEmpty.notify_one();
+            else
+                notFull.notify_one();
+        }
+
+        /**
+         * Waits until the updates queued before the call have been added, and computes the
+         * decomposition without holding the queue lock. The worker does not start a new
+         * batch of updates while readers are waiting or computing the decomposition.
+         */
+        virtual Decomposition<Scalar> _getDecomposition() const override {
+            AsyncKernelEVD &self = const_cast<AsyncKernelEVD&>(*this);
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                Index target = pushed;
+                self.requested = std::max(requested, target);
+                self.readers++;
+                idle.wait(lock, [this, target] { return (processed >= target && !busy && !reading) || error; });
+                if (error) {
+                    self.readers--;
+                    notEmpty.notify_one();
+                    rethrow();
+                }
+                self.reading = true;
+            }
+
+            try {
+                Decomposition<Scalar> d = builder->getDecomposition();
+                self.endReading();
+                return d;
+            } catch(...) {
+                self.endReading();
+                throw;
+            }
+        }
+
+        //! Saves the state of the builder, once the queued updates have been added
+        virtual void _save(CheckpointWriter &writer, const std::string &prefix) const override {
+            std::unique_lock<std::mutex> lock(mutex);
+            wait(lock);
+            builder->save(writer, prefix + "builder.");
+        }
+
+        virtual void _load(const CheckpointReader &reader, const std::string &prefix) override {
+            std::unique_lock<std::mutex> lock(mutex);
+            wait(lock);
+            builder->load(reader, prefix + "builder.");
+            if (publishing)
+                publish();
+        }
+
+    private:
+        //! A queued update
+        struct Update {
+            Update(Real alpha, const FMatrix &mX, const ScalarAltMatrix &mA) : alpha(alpha), mX(mX), mA(mA) {}
+            Real alpha;
+            FMatrix mX;
+            ScalarAltMatrix mA;
+        };
+
+        //! Checks the update before reserving a slot (the same check as KernelEVD::add)
+        static void check(const FMatrix &mX, const ScalarAltMatrix &mA) {
+            if (mX->size() != mA.rows())
+                KQP_THROW_EXCEPTION_F(illegal_argument_exception, "Cannot combine %d pre-images with a %d rows matrix", %mX->size() %mA.rows());
+        }
+
+        //! True if there is no free slot in the queue (the lock should be held)
+        bool full() const {
+            return (Index)queue.size() + reserved >= capacity;
+        }
+
+        /**
+         * @brief Counts and queues an update whose slot is reserved
+         *
+         * The producers are serialized since the update count is not thread safe, but
+         * never wait while holding the producers lock.
+         */
+        void enqueue(Real alpha, const FMatrix &mX, const ScalarAltMatrix &mA) {
+            std::lock_guard<std::mutex> lock(producers);
+            KernelEVD<Scalar>::add(alpha, mX, mA);
+        }
+
+        //! Waits until the queue is empty, the worker idle and no reader computes the decomposition (the lock should be held)
+        void wait(std::unique_lock<std::mutex> &lock) const {
+            idle.wait(lock, [this] { return (queue.empty() && !busy && !reading) || error; });
+            rethrow();
+        }
+
+        //! Called by a reader once the decomposition is computed
+        void endReading() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                reading = false;
+                readers--;
+            }
+            idle.notify_all();
+            notEmpty.notify_one();
+        }
+
+        //! Throws the exception of the worker, if any (the lock should be held)
+        void rethrow() const {
+            if (error) {
+                std::exception_ptr e = error;
+                const_cast<AsyncKernelEVD&>(*this).error = std::exception_ptr();
+                std::rethrow_exception(e);
+            }
+        }
+
+        //! Publishes the current decomposition of the builder (by the worker, or while it is idle)
+        void publish() {
+            snapshots.publish(boost::shared_ptr< Decomposition<Scalar> >(new Decomposition<Scalar>(builder->getDecomposition())));
+            published = std::chrono::steady_clock::now();
+        }
+
+        //! The worker loop
+        void run() {
+            std::vector<Update> updates;
+            while (true) {
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    // Readers compute the decomposition between two batches, once the updates they wait for are processed
+                    notEmpty.wait(lock, [this] { return (!queue.empty() && (readers == 0 || processed < requested)) || stopping; });
+                    if (queue.empty())
+                        return;
+
+                    // Take all the queued updates
+                    updates.assign(queue.begin(), queue.end());
+                    queue.clear();
+                    busy = true;
+                }
+                notFull.notify_all();
+
+                try {
+                    process(updates);
+                } catch(...) {
+                    KQP_HLOG_WARN("Exception while updating the kernel EVD builder");
+                    std::lock_guard<std::mutex> lock(mutex);
+                    error = std::current_exception();
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    busy = false;
+                    processed += updates.size();
+                }
+                updates.clear();
+                idle.notify_all();
+                notFull.notify_all();
+            }
+        }
+
+        //! Adds updates to the builder, coalescing consecutive updates of the same sign
+        void process(const std::vector<Update> &updates) {
+            Index maxCoalesced;
+            bool publishing;
+            std::chrono::duration<double> period;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                maxCoalesced = this->maxCoalesced;
+                publishing = this->publishing;
+                period = this->period;
+            }
+
+            for(size_t i = 0; i < updates.size();) {
+                const Update &first = updates[i];
+                size_t j = i + 1;
+                while (j < updates.size() && (Index)(j - i) < maxCoalesced && (updates[j].alpha < 0) == (first.alpha < 0))
+                    j++;
+
+                if (j == i + 1) {
+                    builder->add(first.alpha, first.mX, first.mA);
+                } else {
+                    // alpha_k A_k A_k^T = alpha (c_k A_k) (c_k A_k)^T with c_k = sqrt(alpha_k / alpha)
+                    Index rows = 0, cols = 0;
+                    for(size_t k = i; k < j; k++) {
+                        rows += updates[k].mA.rows();
+                        cols += updates[k].mA.cols();
+                    }
+
+                    FMatrix mX = builder->getFSpace()->newMatrix();
+                    ScalarMatrix mA = ScalarMatrix::Zero(rows, cols);
+                    Index row = 0, col = 0;
+                    for(size_t k = i; k < j; k++) {
+                        const Update &u = updates[k];
+                        mX->add(*u.mX);
+                        ScalarMatrix mAk;
+                        u.mA.evalTo(mAk);
+                        mA.block(row, col, mAk.rows(), mAk.cols()) = (Scalar)std::sqrt(u.alpha / first.alpha) * mAk;
+                        row += mAk.rows();
+                        col += mAk.cols();
+                    }
+
+                    KQP_HLOG_DEBUG_F("Coalesced %d updates (%d pre-images)", %(j - i) %rows);
+                    builder->add(first.alpha, mX, mA);
+                }
+                i = j;
+            }
+            
+            if (!publishing)
+                return;
+
+            // Publishes when the worker catches up, or if the last snapshot is too old
+            bool last;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                last = queue.empty();
+            }
+            if (last || std::chrono::steady_clock::now() - published >= period)
+                publish();
+        }
+
+        //! The underlying builder
+        boost::shared_ptr< KernelEVD<Scalar> > builder;
+
+        //! Queued updates
+        std::deque<Update> queue;
+
+        //! Maximum size of the queue
+        Index capacity;
+
+        //! Number of slots of the queue reserved by producers
+        Index reserved;
+
+        //! Maximum number of updates coalesced
+        Index maxCoalesced;
+
+        //! Overflow policy
+        Overflow overflow;
+
+        //! Number of dropped updates
+        Index dropped;
+
+        //! Snapshots of the decomposition
+        Snapshots< Decomposition<Scalar> > snapshots;
+
+        //! True if snapshots are published
+        bool publishing;
+
+        //! Minimum time between two publications of a busy worker
+        std::chrono::duration<double> period;
+
+        //! Time of the last publication (used by the worker, or while it is idle)
+        std::chrono::steady_clock::time_point published;
+
+        //! Number of updates queued and processed by the worker since the creation
+        Index pushed, processed;
+
+        //! Number of updates that the readers wait for
+        Index requested;
+
+        //! True when the worker is updating the builder
+        bool busy;
+
+        //! Number of readers waiting for or computing the decomposition
+        Index readers;
+
+        //! True when a reader computes the decomposition
+        bool reading;
+
+        //! True when the worker should stop
+        bool stopping;
+
+        //! Exception thrown by the worker
+        std::exception_ptr error;
+
+        //! Protects the queue and the state
+        mutable std::mutex mutex;
+
+        //! Serializes the counting of updates by producers (never held while waiting)
+        std::mutex producers;
+
+        //! Signaled when the queue is not empty, not full, or the worker is idle
+        mutable std::condition_variable notEmpty, notFull, idle;
+
+        //! The worker
+        std::thread worker;
+    };
+}
+
+#ifndef SWIG
+#define KQP_SCALAR_GEN(type) extern template class kqp::AsyncKernelEVD<type>;
+#include <kqp/for_all_scalar_gen.h.inc>
+#endif
+
+#endif
@@ -58,7 +58,11 @@ namespace kqp {
 
 
         virtual void _add(Real alpha, const FMatrix &mX, const ScalarAltMatrix &mA) override {
-            rankUpdate2(matrix.template selfadjointView<Eigen::Lower>(), kqp::our_dynamic_cast<const FDense &>(*mX).getMatrix() * mA, (Scalar)alpha);
+            const FDense &dX = kqp::our_dynamic_cast<const FDense &>(*mX);
+            if (dX.isCompact())
+                rankUpdate(matrix.template selfadjointView<Eigen::Lower>(), dX.combine(mA), (Scalar)alpha);
+            else
+                rankUpdate2(matrix.template selfadjointView<Eigen::Lower>(), dX.view() * mA, (Scalar)alpha);
         }
         
         virtual Decomposition<Scalar> _getDecomposition() const override {
@@ -72,6 +76,17 @@ namespace kqp {
             d.mY = Eigen::Identity<Scalar>(d.mX->size(), d.mX->size());
             return d;
         }
+
+        virtual void _save(CheckpointWriter &writer, const std::string &prefix) const override {
+            writer.writeMatrix(prefix + "matrix", matrix);
+        }
+
+        virtual void _load(const CheckpointReader &reader, const std::string &prefix) override {
+            auto m = reader.matrix<Scalar>(prefix + "matrix");
+            if (m.rows() != matrix.rows() || m.cols() != matrix.cols())
+                KQP_THROW_EXCEPTION_F(illegal_argument_exception, "Cannot load a %dx%d matrix in a dense builder of dimension %d", %m.rows() %m.cols() %matrix.rows());
+            matrix = m;
+        }
         
         
     public:
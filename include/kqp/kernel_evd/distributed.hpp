@@ -0,0 +1,242 @@
+/*
+ This file is part of the Kernel Quantum Probability library (KQP).
+
+ KQP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ KQP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with KQP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __KQP_DISTRIBUTED_BUILDER_H__
+#define __KQP_DISTRIBUTED_BUILDER_H__
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/lexical_cast.hpp>
+
+#include <kqp/checkpoint.hpp>
+#include <kqp/cleanup.hpp>
+#include <kqp/kernel_evd.hpp>
+#include <kqp/kernel_evd/divide_and_conquer.hpp>
+
+namespace kqp {
+
+#   include <kqp/define_header_logger.hpp>
+    DEFINE_KQP_HLOGGER("kqp.kevd.distributed");
+
+    //! A job of a merge tree: merges the partial decompositions of the inputs into the output
+    struct MergeJob {
+        //! Level of the job in the tree (the jobs of a level only depend on the previous levels)
+        Index level;
+        //! Partial decompositions to merge
+        std::vector<std::string> inputs;
+        //! Merged decomposition
+        std::string output;
+    };
+
+    /**
+     * @brief Kernel EVD distributed over processes.
+     *
+     * The data is split in shards, and the partial decomposition of each shard is computed
+     * by a separate process (build) and written to disk as a checkpoint. Partial decompositions
+     * are then merged, any number at a time, in a tree of merge jobs (plan) as in
+     * DivideAndConquerBuilder. All the processes should use the same feature space definition,
+     * which is saved with each partial decomposition and checked when reading it.
+     *
+     * A shard is a checkpoint with a feature matrix "features" (dense or sparse), and
+     * optionally non negative "weights" (one for each pre-image, 1 by default):
+     * the shard adds the operator \f$ \sum_i w_i x_i x_i^\dagger \f$.
+     *
+     * @ingroup KernelEVD
+     */
+    template <typename Scalar> class DistributedKernelEVD {
+    public:
+        KQP_SCALAR_TYPEDEFS(Scalar);
+
+        //! @param fs The feature space shared by all the shards
+        DistributedKernelEVD(const FSpace &fs) : fs(fs), definition(getDefinition(fs)) {}
+
+        //! Returns the feature space
+        const FSpace &getFSpace() const { return fs; }
+
+        //! Sets the builder used for the shards
+        void setBuilder(const boost::shared_ptr< KernelEVD<Scalar> > &builder) {
+            this->builder = builder;
+        }
+
+        //! Sets the builder used to merge partial decompositions
+        void setMerger(const boost::shared_ptr< KernelEVD<Scalar> > &merger) {
+            this->merger = merger;
+        }
+
+        //! Sets the cleaner of the partial and merged decompositions
+        void setCleaner(const boost::shared_ptr< Cleaner<Scalar> > &cleaner) {
+            this->cleaner = cleaner;
+        }
+
+        //! Adds the updates of a shard to a builder
+        void add(KernelEVD<Scalar> &builder, const std::string &shard) const {
+            CheckpointReader reader(shard);
+            FMatrix mX = reader.features<Scalar>("features", fs->dimension());
+
+            if (!reader.has("weights")) {
+                builder.add(1, mX, Eigen::Identity<Scalar>(mX->size(), mX->size()));
+                return;
+            }
+
+            RealVector weights = reader.matrix<Real>("weights");
+            if (weights.size() != mX->size())
+                KQP_THROW_EXCEPTION_F(illegal_argument_exception, "Shard %s has %d weights for %d pre-images", %shard %weights.size() %mX->size());
+            if (weights.size() > 0 && weights.minCoeff() < 0)
+                KQP_THROW_EXCEPTION_F(illegal_argument_exception, "Shard %s has negative weights", %shard);
+            builder.add(1, mX, ScalarMatrix(weights.cwiseSqrt().template cast<Scalar>().asDiagonal()));
+        }
+
+        //! Computes the partial decomposition of shards
+        Decomposition<Scalar> build(const std::vector<std::string> &shards) const {
+            if (!builder)
+                KQP_THROW_EXCEPTION(illegal_argument_exception, "No builder was set");
+
+            builder->reset();
+            for(auto i = shards.begin(); i != shards.end(); ++i) {
+                KQP_HLOG_DEBUG_F("Adding shard %s", %*i);
+                add(*builder, *i);
+            }
+
+            Decomposition<Scalar> d = builder->getDecomposition();
+            if (cleaner)
+                cleaner->cleanup(d);
+            return d;
+        }
+
+        //! Computes the partial decomposition of shards and writes it
+        void build(const std::vector<std::string> &shards, const std::string &output) const {
+            write(output, build(shards));
+        }
+
+        /**
+         * @brief Merges partial decompositions
+         *
+         * As in DivideAndConquerBuilder, the positive and negative parts of each decomposition are
+         * added to the merger. The pre-images are read from the mapped files without being copied.
+         */
+        Decomposition<Scalar> merge(const std::vector<std::string> &inputs) const {
+            if (!merger)
+                KQP_THROW_EXCEPTION(illegal_argument_exception, "No merger was set");
+            if (inputs.empty())
+                KQP_THROW_EXCEPTION(illegal_argument_exception, "No partial decomposition to merge");
+
+            merger->reset();
+            Index updateCount = 0;
+            for(auto i = inputs.begin(); i != inputs.end(); ++i) {
+                Decomposition<Scalar> d = read(*i);
+                KQP_HLOG_DEBUG_F("Merging %s [rank=%d, pre-images=%d, updates=%d]", %*i %d.mD.rows() %d.mX->size() %d.updateCount);
+                updateCount += d.updateCount;
+                if (d.mD.rows() > 0)
+                    DivideAndConquerBuilder<Scalar>::merge(*merger, d);
+            }
+
+            Decomposition<Scalar> d = merger->getDecomposition();
+            if (cleaner)
+                cleaner->cleanup(d);
+            d.updateCount = updateCount;
+            return d;
+        }
+
+        //! Merges partial decompositions and writes the result
+        void merge(const std::vector<std::string> &inputs, const std::string &output) const {
+            write(output, merge(inputs));
+        }
+
+        //! Runs a merge job
+        void run(const MergeJob &job) const {
+            merge(job.inputs, job.output);
+        }
+
+        //! Writes a partial decomposition (with the definition of the feature space)
+        void write(const std::string &path, const Decomposition<Scalar> &d) const {
+            CheckpointWriter writer(path);
+            writer.writeText("space", definition);
+            writer.writeDecomposition("", d, false);
+            writer.commit();
+        }
+
+        //! Reads a partial decomposition, checking that it was computed with the same feature space
+        Decomposition<Scalar> read(const std::string &path) const {
+            CheckpointReader reader(path);
+            if (reader.text("space") != definition)
+                KQP_THROW_EXCEPTION_F(illegal_argument_exception, "The feature space of %s differs from the one of the builder", %path);
+            return reader.decomposition<Scalar>("", fs);
+        }
+
+        /**
+         * @brief Plans a tree of merge jobs
+         *
+         * Inputs are merged by groups of (at most) fanIn, level after level, until one
+         * decomposition remains. Intermediate decompositions are written next to the output
+         * (its path followed by the level and the index of the job).
+         */
+        static std::vector<MergeJob> plan(const std::vector<std::string> &inputs, const std::string &output, Index fanIn) {
+            if (fanIn < 2)
+                KQP_THROW_EXCEPTION_F(illegal_argument_exception, "The fan-in of the merges should be at least 2 (got %d)", %fanIn);
+            if (inputs.empty())
+                KQP_THROW_EXCEPTION(illegal_argument_exception, "No partial decomposition to merge");
+
+            std::vector<MergeJob> jobs;
+            std::vector<std::string> level = inputs;
+            Index levelIndex = 0;
+            do {
+                const bool last = (Index)level.size() <= fanIn;
+                std::vector<std::string> next;
+                for(size_t i = 0; i < level.size(); i += fanIn) {
+                    MergeJob job;
+                    job.level = levelIndex;
+                    job.inputs.assign(level.begin() + i, level.begin() + std::min(level.size(), i + fanIn));
+                    job.output = last ? output : output + "." + boost::lexical_cast<std::string>(levelIndex) + "." + boost::lexical_cast<std::string>(next.size());
+                    next.push_back(job.output);
+                    jobs.push_back(job);
+                }
+                level.swap(next);
+                levelIndex++;
+            } while (level.size() > 1);
+
+            return jobs;
+        }
+
+        //! Returns the definition (XML) of a feature space
+        static std::string getDefinition(const FSpace &fs) {
+            pugi::xml_document doc;
+            fs->save(doc);
+            std::ostringstream buffer;
+            doc.save(buffer);
+            return buffer.str();
+        }
+
+    private:
+        //! The feature space
+        FSpace fs;
+
+        //! Its definition
+        std::string definition;
+
+        boost::shared_ptr< KernelEVD<Scalar> > builder, merger;
+        boost::shared_ptr< Cleaner<Scalar> > cleaner;
+    };
+}
+
+#ifndef SWIG
+#define KQP_SCALAR_GEN(type) extern template class kqp::DistributedKernelEVD<type>;
+#include <kqp/for_all_scalar_gen.h.inc>
+#endif
+
+#endif
@@ -18,6 +18,7 @@
 #ifndef __KQP_DIVIDE_AND_CONQUER_BUILDER_H__
 #define __KQP_DIVIDE_AND_CONQUER_BUILDER_H__
 
+#include <boost/lexical_cast.hpp>
 #include <boost/type_traits/is_complex.hpp>
 #include <kqp/cleanup.hpp>
 #include <kqp/kernel_evd.hpp>
@@ -85,6 +86,24 @@ namespace kqp {
             const_cast<DivideAndConquerBuilder&>(*this).merge(true);
             return decompositions[0];
         }
+
+        /**
+         * Saves the stack of decompositions and the state of the builder
+         * (the merger state is only used during a merge)
+         */
+        virtual void _save(CheckpointWriter &writer, const std::string &prefix) const override {
+            writer.writeValue<int64_t>(prefix + "stack", decompositions.size());
+            for(size_t i = 0; i < decompositions.size(); i++)
+                writer.writeDecomposition(prefix + "stack." + boost::lexical_cast<std::string>(i) + ".", decompositions[i], false);
+            builder->save(writer, prefix + "builder.");
+        }
+
+        virtual void _load(const CheckpointReader &reader, const std::string &prefix) override {
+            int64_t size = reader.value<int64_t>(prefix + "stack");
+            for(int64_t i = 0; i < size; i++)
+                decompositions.push_back(reader.decomposition<Scalar>(prefix + "stack." + boost::lexical_cast<std::string>(i) + ".", this->getFSpace()));
+            builder->load(reader, prefix + "builder.");
+        }
         
         // Rank update
         virtual void _add(Real alpha, const FMatrix &mU, const ScalarAltMatrix &mA) override {
@@ -114,7 +133,13 @@ namespace kqp {
             builder->reset();
         }
         
-        //! Add a decomposition to a merger
+    public:
+        /**
+         * @brief Add a decomposition to a merger
+         *
+         * The positive and negative parts of the decomposition are added with a
+         * coefficient of 1 and -1 respectively.
+         */
         static void merge(KernelEVD<Scalar> &merger, const Decomposition<Scalar> &d) {
             Index posCount = 0;
             
@@ -150,6 +175,8 @@ namespace kqp {
                 merger.add(-1, d.mX, mYNeg);
         }
 
+    private:
+
         
         /**
          * Merge the decompositions
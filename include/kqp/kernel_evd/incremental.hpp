@@ -18,6 +18,8 @@
 #ifndef __KQP_INCREMENTAL_BUILDER_H__
 #define __KQP_INCREMENTAL_BUILDER_H__
 
+#include <chrono>
+#include <future>
 #include <iostream>
 #include <limits>
 
@@ -38,13 +40,51 @@ namespace kqp {
     
 
     
+    /**
+     * @brief When the incremental kernel EVD is cleaned up
+     *
+     * A clean-up selects the eigenvalues, removes the unused pre-images and
+     * reduces the number of pre-images. By default, it is done after every update.
+     * @ingroup KernelEVD
+     */
+    struct CleanupPolicy {
+        CleanupPolicy() : everyUpdate(true), maxPreImages(0), maxRank(0), maxMemory(0), onRead(false), background(false) {}
+        
+        //! Clean up after every update
+        bool everyUpdate;
+        
+        //! Clean up when the number of pre-images is above (0 to disable)
+        Index maxPreImages;
+        
+        //! Clean up when the rank is above (0 to disable)
+        Index maxRank;
+        
+        //! Clean up when the mixture matrices (Y and Z) use more bytes (0 to disable)
+        size_t maxMemory;
+        
+        //! Clean up before returning a decomposition
+        bool onRead;
+        
+        /**
+         * Clean up a copy of the decomposition on a background thread: the updates that 
+         * are made in the meanwhile are applied again on the cleaned up decomposition (the
+         * inner products of the feature space should be thread safe)
+         */
+        bool background;
+    };
+    
     /**
      * @brief Uses other operator builders and combine them.
+     *
+     * @tparam Space The type of the feature space: when it has statically typed
+     *   inner products (e.g. DenseSpace), they are used without casts or virtual calls
+     *   (see StaticSpace)
      * @ingroup KernelEVD
      */
-    template <typename Scalar> class IncrementalKernelEVD : public KernelEVD<Scalar> {
+    template <typename Scalar, typename Space = SpaceBase<Scalar> > class IncrementalKernelEVD : public KernelEVD<Scalar> {
     public:
         KQP_SCALAR_TYPEDEFS(Scalar);
+        typedef typename StaticSpace<Scalar, Space>::FMatrixType FMatrixType;
         
         using KernelEVD<Scalar>::getFSpace;
         
@@ -60,15 +100,25 @@ namespace kqp {
 #endif
         
         IncrementalKernelEVD(const FSpace &fs) 
-            : KernelEVD<Scalar>(fs), mX(fs->newMatrix()), 
-              preImageRatios(std::numeric_limits<Scalar>::infinity(), std::numeric_limits<Scalar>::infinity()) {}
-        virtual ~IncrementalKernelEVD() {}
+            : KernelEVD<Scalar>(fs), m_space(fs), mX(fs->newMatrix()), mScale(1),
+              preImageRatios(std::numeric_limits<Scalar>::infinity(), std::numeric_limits<Scalar>::infinity()),
+              forgettingFactor(1), pruningThreshold(0) {}
+        virtual ~IncrementalKernelEVD() {
+            if (m_cleaning.valid())
+                m_cleaning.wait();
+        }
         
         void reset() {
+            if (m_cleaning.valid())
+                m_cleaning.wait();
+            m_cleaning = std::future<State>();
+            m_journal.clear();
+            
             mX = this->getFSpace()->newMatrix();
             mY = ScalarMatrix();
             mZ = ScalarMatrix();
             mD = RealVector();
+            mScale = 1;
             // mutable ScalarMatrix k;        
         }
                
@@ -81,21 +131,102 @@ namespace kqp {
            this->preImageRatios = std::make_pair(minimum, maximum);
         }
         
+        /**
+         * @brief Sets the forgetting factor
+         *
+         * Before each update, the current operator is multiplied by the factor. The decay is lazy:
+         * a global scale is folded into the coefficients of the rank-one updates, so that
+         * the eigenvalues and pre-images are not modified.
+         *
+         * @param factor The forgetting factor, in ]0,1] (1 to disable forgetting)
+         */
+        void setForgettingFactor(Real factor) {
+            if (!(factor > 0 && factor <= 1))
+                KQP_THROW_EXCEPTION_F(illegal_argument_exception, "The forgetting factor should be in ]0,1] (got %g)", %factor);
+            this->forgettingFactor = factor;
+        }
+        
+        /**
+         * Eigenvalues whose absolute value (after decay) is below the threshold are removed 
+         * after each update, together with the pre-images they were the only ones to use
+         */
+        void setPruningThreshold(Real threshold) {
+            this->pruningThreshold = threshold;
+        }
+        
+        //! Sets when to clean up the decomposition
+        void setCleanupPolicy(const CleanupPolicy &policy) {
+            this->m_policy = policy;
+        }
+        
+        //! Cleans up the decomposition now (waiting for a background clean-up if any)
+        void cleanup() {
+            if (m_cleaning.valid()) 
+                splice();
+            
+            State state;
+            swap(state);
+            cleanup(settings(), state);
+            swap(state);
+        }
+        
                
         virtual void _add(Real alpha, const FMatrix &mU, const ScalarAltMatrix &mA) override {
+            // The pre-images are checked once, and recorded updates are not checked again
+            update(alpha, mU, m_space.cast(*mU), mA);
+            
+            // --- Clean-up (or record the update if a clean-up is running)
+            
+            if (m_cleaning.valid()) {
+                m_journal.push_back(Update(alpha, mU, mA));
+                if (m_cleaning.wait_for(std::chrono::seconds(0)) == std::future_status::ready)
+                    splice();
+            } else if (needsCleanup()) {
+                if (m_policy.background) 
+                    startCleanup();
+                else
+                    cleanup();
+            }
+        }
+        
+        //! Rank-n update of the decomposition (without clean-up), with the pre-images cast to the space type
+        void update(Real alpha, const FMatrix &mU, const FMatrixType &u, const ScalarAltMatrix &mA) {
             // --- Info
             
 //            KQP_LOG_DEBUG_F(KQP_HLOGGER, "Dimensions: X [%d], Y [%dx%d], Z [%dx%d], D [%d], U [%d], A [%dx%d]", 
 //                           %mX->size() %mY.rows() %mY.cols() %mZ.rows() %mZ.cols() %mD.rows() %mU.size() %mA.rows() %mA.cols());
             
+            // --- Decay
+            
+            // The operator is mScale X Y Z D Z^T Y^T X^T: decaying only changes the scale,
+            // which is folded into D when it becomes too small
+            mScale *= forgettingFactor;
+            if (mScale < Eigen::NumTraits<Real>::epsilon()) {
+                mD *= mScale;
+                mScale = 1;
+            }
+            
             // --- Pre-computations
             
             // Compute W = Y^T X^T
             
-            ScalarMatrix mW =  getFSpace()->k(mX, mY, mU, mA);
+            const FMatrixType &x = m_space.cast(*mX);
+            ScalarMatrix mW =  m_space.k(x, mY, u, mA);
             
             // Compute V^T V
-            ScalarMatrix vtv = getFSpace()->k(mU, mA);
+            ScalarMatrix vtv = m_space.k(u, mA);
+            
+            // The null space threshold is relative to U^T U and not to V^T V, since
+            // the latter is only rounding noise when U lies in the span of X Y
+            // (e.g. when downdating). This noise grows with the loss of orthonormality
+            // of X Y, which accumulates with the updates.
+            Real orthonormality = 0;
+            if (mY.cols() > 0) {
+                ScalarMatrix yky = m_space.k(x, mY);
+                orthonormality = (yky - ScalarMatrix::Identity(yky.rows(), yky.cols())).cwiseAbs().maxCoeff();
+            }
+            Real threshold = (Eigen::NumTraits<Scalar>::epsilon() * (Real)(vtv.rows() + mW.rows()) + orthonormality)
+                    * (vtv.size() > 0 ? vtv.cwiseAbs().maxCoeff() : 0);
             vtv -= mW.adjoint() * mW;
             
             
@@ -104,7 +235,7 @@ namespace kqp {
             ScalarMatrix mQ;
             ScalarMatrix mQ0;
             RealVector mDQ;
-            kqp::ThinEVD<ScalarMatrix>::run(evd, mQ, mDQ, &mQ0);
+            kqp::ThinEVD<ScalarMatrix>::run(evd, mQ, mDQ, &mQ0, threshold);
 
             Index rank_Q = mQ.cols();             
             mDQ = mDQ.cwiseAbs().cwiseSqrt();
@@ -134,7 +265,7 @@ namespace kqp {
                 // Rank-1 update:
                 // For better accuracy, we don't decrease the rank yet using the selector,
                 // but this might be an option in the future (so as to improve speed)
-                evdRankOneUpdate.update(mD, alpha, v, false, 0, false, result, &mZ);
+                evdRankOneUpdate.update(mD, alpha / mScale, v, false, 0, false, result, &mZ);
                 
                 // Take the new diagonal
                 mD = result.mD;
@@ -142,7 +273,9 @@ namespace kqp {
             
             // Update X and Y if the rank has changed
             if (rank_Q > 0) {
-                // Add the pre-images from U
+                // Add the pre-images from U (copying X if it is shared with a decomposition)
+                if (!mX.unique())
+                    mX = mX->copy();
                 mX->add(mU);
                 
                 // Update mY
@@ -156,90 +289,219 @@ namespace kqp {
                     mY.topRightCorner(old_Y_rows, mQ.cols()) = - mY.topLeftCorner(old_Y_rows, mW.rows()) * mW * mQ;
             }
                               
-            // (4) Clean-up
+        }
+        
+        // Gets the decomposition
+        virtual Decomposition<Scalar> _getDecomposition() const override {
+            IncrementalKernelEVD &self = const_cast<IncrementalKernelEVD&>(*this);
+            if (m_policy.onRead) 
+                self.cleanup();
+            else if (m_cleaning.valid())
+                self.splice();
             
-
-
+            Decomposition<Scalar> d(this->getFSpace());
+            
+            d.mX = this->mX;
+            
+            const_cast<ScalarMatrix&>(this->mY) = this->mY * this->mZ;
+            const_cast<ScalarMatrix&>(this->mZ) = Eigen::Identity<Scalar>(mY.cols(), mY.cols());
+            
+            d.mY = ScalarAltMatrix(this->mY);
+            
+            d.mD = RealVector(this->mScale * this->mD);
+            
+            return d;
+        }
+        
+        virtual void _save(CheckpointWriter &writer, const std::string &prefix) const override {
+            // Includes the updates made during a background clean-up
+            if (m_cleaning.valid())
+                const_cast<IncrementalKernelEVD&>(*this).splice();
+            writer.writeFeatures<Scalar>(prefix + "mX", mX);
+            writer.writeMatrix(prefix + "mY", mY);
+            writer.writeMatrix(prefix + "mZ", mZ);
+            writer.writeMatrix(prefix + "mD", mD);
+            writer.writeValue<Real>(prefix + "scale", mScale);
+        }
+        
+        virtual void _load(const CheckpointReader &reader, const std::string &prefix) override {
+            mX = reader.features<Scalar>(prefix + "mX", this->getFSpace()->dimension());
+            mY = reader.matrix<Scalar>(prefix + "mY");
+            mZ = reader.matrix<Scalar>(prefix + "mZ");
+            mD = reader.matrix<Real>(prefix + "mD");
+            mScale = reader.value<Real>(prefix + "scale");
+        }
+        
+        
+    private:
+        //! A decomposition (to be cleaned up)
+        struct State {
+            FMatrix mX;
+            ScalarMatrix mY, mZ;
+            RealVector mD;
+            Real mScale;
+        };
+        
+        //! An update
+        struct Update {
+            Update(Real alpha, const FMatrix &mU, const ScalarAltMatrix &mA) : alpha(alpha), mU(mU), mA(mA) {}
+            Real alpha;
+            FMatrix mU;
+            ScalarAltMatrix mA;
+        };
+        
+        //! Settings of a clean-up (copied for background clean-ups)
+        struct Settings {
+            FSpace fs;
+            boost::shared_ptr< const Selector<Real> > selector;
+            std::pair<float,float> preImageRatios;
+            Real pruningThreshold;
+        };
+        
+        //! Returns the current clean-up settings
+        Settings settings() const {
+            Settings settings;
+            settings.fs = getFSpace();
+            settings.selector = selector;
+            settings.preImageRatios = preImageRatios;
+            settings.pruningThreshold = pruningThreshold;
+            return settings;
+        }
+        
+        //! Swaps the decomposition with a state
+        void swap(State &state) {
+            std::swap(mX, state.mX);
+            mY.swap(state.mY);
+            mZ.swap(state.mZ);
+            mD.swap(state.mD);
+            std::swap(mScale, state.mScale);
+        }
+        
+        //! Whether the clean-up policy triggers a clean-up
+        bool needsCleanup() const {
+            return m_policy.everyUpdate 
+                || (m_policy.maxPreImages > 0 && mX->size() > m_policy.maxPreImages)
+                || (m_policy.maxRank > 0 && mD.rows() > m_policy.maxRank)
+                || (m_policy.maxMemory > 0 && (size_t)(mY.size() + mZ.size()) * sizeof(Scalar) > m_policy.maxMemory);
+        }
+        
+        //! Starts a background clean-up of a copy of the decomposition
+        void startCleanup() {
+            State state;
+            state.mX = mX->copy();
+            state.mY = mY;
+            state.mZ = mZ;
+            state.mD = mD;
+            state.mScale = mScale;
+            
+            KQP_LOG_DEBUG_F(KQP_HLOGGER, "Starting a background clean-up [%d pre-images, rank %d]", %mX->size() %mD.rows());
+            // The task does not use the builder, which can be modified or destroyed meanwhile
+            Settings settings = this->settings();
+            m_cleaning = std::async(std::launch::async, [settings, state]() mutable {
+                cleanup(settings, state);
+                return state;
+            });
+        }
+        
+        /**
+         * @brief Waits for the background clean-up, and applies again the updates made in the meanwhile
+         *
+         * If the clean-up failed, its exception is thrown and the decomposition (which
+         * includes all the updates) is kept as is.
+         */
+        void splice() {
+            // Both are cleared before waiting, so that the updates are never applied twice
+            std::future<State> cleaning(std::move(m_cleaning));
+            std::vector<Update> journal;
+            journal.swap(m_journal);
+            
+            State state = cleaning.get();
+            swap(state);
+            
+            KQP_LOG_DEBUG_F(KQP_HLOGGER, "Background clean-up done [%d pre-images, rank %d], applying %d updates", 
+                            %mX->size() %mD.rows() %journal.size());
+            for(auto &update: journal)
+                this->update(update.alpha, update.mU, m_space.staticCast(*update.mU), update.mA);
+        }
+        
+        //! Cleans up a decomposition
+        static void cleanup(const Settings &settings, State &state) {
             // --- Rankselection   
-            DecompositionList<Real> list(mD);
             bool identityZ = false;
-            if (this->selector) {
+            if (settings.selector || settings.pruningThreshold > 0) {
                 // Selects the eigenvalues
-                this->selector->selection(list);
+                DecompositionList<Real> list(state.mScale * state.mD);
+                if (settings.selector)
+                    settings.selector->selection(list);
+                
+                // Prune small eigenvalues
+                if (settings.pruningThreshold > 0)
+                    for(Index i = 0; i < list.size(); i++)
+                        if (std::abs(list.get(i)) < settings.pruningThreshold)
+                            list.remove(i);
                 
                 // Remove corresponding entries
-                select_rows(list.getSelected(), mD, mD);                
-                mY = mY * mZ;
-                select_columns(list.getSelected(), mY, mY);
+                select_rows(list.getSelected(), state.mD, state.mD);                
+                state.mY = state.mY * state.mZ;
+                select_columns(list.getSelected(), state.mY, state.mY);
 
                 identityZ = true;
             }
             
             
+            // The cleaners modify the pre-images in place: copy them if they are shared with a decomposition
+            if (!state.mX.unique())
+                state.mX = state.mX->copy();
+
             // First, tries to remove unused pre-images images
-            CleanerUnused<Scalar>::run(mX, mY);
+            CleanerUnused<Scalar>::run(state.mX, state.mY);
             
             // --- Ensure we have a small enough number of pre-images
-            float maxRank = this->preImageRatios.second * (float)mD.rows();
-            if (mX->size() > maxRank) {
+            float maxRank = settings.preImageRatios.second * (float)state.mD.rows();
+            if (state.mX->size() > maxRank) {
                 
                 // Get rid of Z
-                if (!identityZ) mY = mY * mZ;
+                if (!identityZ) state.mY = state.mY * state.mZ;
                 identityZ = true;
 
                 // Try again to remove unused pre-images
-                CleanerUnused<Scalar>::run(mX, mY);
-                KQP_LOG_DEBUG_F(KQP_HLOGGER, "Rank after unused pre-images algorithm: %d [%d]", %mY.rows() %maxRank);
+                CleanerUnused<Scalar>::run(state.mX, state.mY);
+                KQP_LOG_DEBUG_F(KQP_HLOGGER, "Rank after unused pre-images algorithm: %d [%d]", %state.mY.rows() %maxRank);
 
                 // Try to remove null space pre-images
-                ReducedSetNullSpace<Scalar>::run(getFSpace(), mX, mY);
-                KQP_LOG_DEBUG_F(KQP_HLOGGER, "Rank after null space algorithm: %d [%d]", %mY.rows() %maxRank);
+                ReducedSetNullSpace<Scalar>::run(settings.fs, state.mX, state.mY);
+                KQP_LOG_DEBUG_F(KQP_HLOGGER, "Rank after null space algorithm: %d [%d]", %state.mY.rows() %maxRank);
 
-                if (mX->size() > maxRank) {
-                    if (getFSpace()->canLinearlyCombine()) {
+                if (state.mX->size() > maxRank) {
+                    if (settings.fs->canLinearlyCombine()) {
                         // Easy case: we can linearly combine pre-images
-                        mX = getFSpace()->linearCombination(mX, mY);
-                        mY = Eigen::Identity<Scalar>(mX->size(), mX->size());
+                        state.mX = settings.fs->linearCombination(state.mX, state.mY);
+                        state.mY = Eigen::Identity<Scalar>(state.mX->size(), state.mX->size());
                     } else {
                         // Use QP approach
                         ReducedSetWithQP<Scalar> qp_rs;
-                        qp_rs.run(this->preImageRatios.first * (float)mD.rows(), getFSpace(), mX, mY, mD);
+                        qp_rs.run(settings.preImageRatios.first * (float)state.mD.rows(), settings.fs, state.mX, state.mY, state.mD);
                         
                         // Get the decomposition
-                        mX = qp_rs.getFeatureMatrix();
-                        mY = qp_rs.getMixtureMatrix();
-                        mD = qp_rs.getEigenValues();
+                        state.mX = qp_rs.getFeatureMatrix();
+                        state.mY = qp_rs.getMixtureMatrix();
+                        state.mD = qp_rs.getEigenValues();
                         
                         // The decomposition is not orthonormal anymore
-                        Orthonormalize<Scalar>::run(getFSpace(), mX, mY, mD);
+                        Orthonormalize<Scalar>::run(settings.fs, state.mX, state.mY, state.mD);
                     }
                 }
             
             }
             
             if (identityZ) 
-                mZ = Eigen::Identity<Scalar>(mY.cols(), mY.cols());
+                state.mZ = Eigen::Identity<Scalar>(state.mY.cols(), state.mY.cols());
             
         }
         
-        // Gets the decomposition
-        virtual Decomposition<Scalar> _getDecomposition() const override {
-            Decomposition<Scalar> d(this->getFSpace());
-            
-            d.mX = this->mX;
-            
-            const_cast<ScalarMatrix&>(this->mY) = this->mY * this->mZ;
-            const_cast<ScalarMatrix&>(this->mZ) = Eigen::Identity<Scalar>(mY.rows(), mY.rows());
-            
-            d.mY = ScalarAltMatrix(this->mY);
-            
-            d.mD = this->mD;
-            
-            return d;
-        }
-        
-        
-    private:
+        //! The (statically typed) feature space
+        StaticSpace<Scalar, Space> m_space;
+
         //! The feature matrix with n pre-images
         FMatrix mX;
         
@@ -252,6 +514,9 @@ namespace kqp {
         //! A diagonal matrix (vector representation)
         RealVector mD;
         
+        //! Scale of the diagonal matrix (decay of the operator)
+        Real mScale;
+        
         // Rank-one EVD update
         FastRankOneUpdate<Scalar> evdRankOneUpdate;
         
@@ -264,6 +529,21 @@ namespace kqp {
         //! Minimum/Maximum number of pre-images per rank
         std::pair<float,float> preImageRatios;            
         
+        //! Forgetting factor
+        Real forgettingFactor;
+        
+        //! Eigenvalues below this threshold are removed
+        Real pruningThreshold;
+        
+        //! Clean-up policy
+        CleanupPolicy m_policy;
+        
+        //! Updates made since the background clean-up started
+        std::vector<Update> m_journal;
+        
+        //! Background clean-up
+        std::future<State> m_cleaning;
+        
     };
 
 #ifndef SWIG    
@@ -0,0 +1,217 @@
+/*
+ This file is part of the Kernel Quantum Probability library (KQP).
+
+ KQP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ KQP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with KQP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef __KQP_SLIDING_WINDOW_BUILDER_H__
+#define __KQP_SLIDING_WINDOW_BUILDER_H__
+
+#include <deque>
+
+#include <boost/lexical_cast.hpp>
+
+#include <kqp/checkpoint.hpp>
+#include <kqp/kernel_evd.hpp>
+#include <kqp/kernel_evd/incremental.hpp>
+#include <kqp/kernel_evd/divide_and_conquer.hpp>
+
+namespace kqp {
+
+#   include <kqp/define_header_logger.hpp>
+    DEFINE_KQP_HLOGGER("kqp.kevd.sliding-window");
+
+    /**
+     * @brief Kernel EVD of the last W updates.
+     *
+     * Each call to add() is a batch; only the last W batches are kept in the decomposition.
+     *
+     * The batches are split in two blocks, each one with its own incremental builder:
+     * new batches are added to the back block, while expired batches are removed from the
+     * front block with a rank-one downdate (i.e. an update with \f$-\alpha\f$). When the front
+     * block is empty, the back block becomes the front one, so that expiry is exact and a
+     * decomposition never accumulates more than W downdates. To further bound the numerical
+     * drift, the front block is rebuilt from its remaining batches every rebuild period
+     * downdates.
+     *
+     * Checkpoints hold the batches of the window, so their pre-images should be dense
+     * or sparse feature matrices.
+     *
+     * @ingroup KernelEVD
+     */
+    template <typename Scalar> class SlidingWindowKernelEVD : public KernelEVD<Scalar> {
+    public:
+        KQP_SCALAR_TYPEDEFS(Scalar);
+
+        SlidingWindowKernelEVD(const FSpace &fs, Index windowSize)
+            : KernelEVD<Scalar>(fs), windowSize(windowSize), rebuildPeriod(std::max<Index>(1, windowSize / 2)),
+              front(new Builder(fs)), back(new Builder(fs)), downdates(0) {
+            if (windowSize < 1)
+                KQP_THROW_EXCEPTION_F(illegal_argument_exception, "The window size should be positive (got %d)", %windowSize);
+        }
+
+        virtual ~SlidingWindowKernelEVD() {}
+
+        //! Returns the number of batches in the window
+        Index getWindowSize() const { return windowSize; }
+
+        /**
+         * Sets the number of downdates after which the front block is rebuilt
+         * from its batches (0 to only rebuild when the block is exhausted)
+         */
+        void setRebuildPeriod(Index rebuildPeriod) {
+            this->rebuildPeriod = rebuildPeriod;
+        }
+
+        //! Sets the eigenvalue selector used by the block builders and when merging them
+        void setSelector(const boost::shared_ptr< const Selector<Real> > &selector) {
+            this->selector = selector;
+            front->setSelector(selector);
+            back->setSelector(selector);
+        }
+
+        void reset() {
+            KernelEVD<Scalar>::reset();
+            front->reset();
+            back->reset();
+            frontBatches.clear();
+            backBatches.clear();
+            downdates = 0;
+        }
+
+    protected:
+        virtual void _add(Real alpha, const FMatrix &mU, const ScalarAltMatrix &mA) override {
+            back->add(alpha, mU, mA);
+            backBatches.push_back(Batch(alpha, mU, mA));
+
+            while ((Index)(frontBatches.size() + backBatches.size()) > windowSize)
+                expire();
+        }
+
+        virtual Decomposition<Scalar> _getDecomposition() const override {
+            if (frontBatches.empty() && backBatches.empty())
+                return Decomposition<Scalar>();
+            if (frontBatches.empty())
+                return back->getDecomposition();
+            if (backBatches.empty())
+                return front->getDecomposition();
+
+            Builder merger(this->getFSpace());
+            merger.setSelector(selector);
+            DivideAndConquerBuilder<Scalar>::merge(merger, front->getDecomposition());
+            DivideAndConquerBuilder<Scalar>::merge(merger, back->getDecomposition());
+            return merger.getDecomposition();
+        }
+
+        //! Saves the batches of the window and the state of the block builders
+        virtual void _save(CheckpointWriter &writer, const std::string &prefix) const override {
+            save(writer, prefix + "front.", *front, frontBatches);
+            save(writer, prefix + "back.", *back, backBatches);
+            writer.writeValue<int64_t>(prefix + "downdates", downdates);
+        }
+
+        virtual void _load(const CheckpointReader &reader, const std::string &prefix) override {
+            load(reader, prefix + "front.", *front, frontBatches);
+            load(reader, prefix + "back.", *back, backBatches);
+            downdates = reader.value<int64_t>(prefix + "downdates");
+        }
+
+    private:
+        typedef IncrementalKernelEVD<Scalar> Builder;
+
+        //! A rank-n update
+        struct Batch {
+            Batch(Real alpha, const FMatrix &mX, const ScalarAltMatrix &mA) : alpha(alpha), mX(mX), mA(mA) {}
+            Real alpha;
+            FMatrix mX;
+            ScalarAltMatrix mA;
+        };
+
+        //! Saves a block
+        static void save(CheckpointWriter &writer, const std::string &prefix, const Builder &builder, const std::deque<Batch> &batches) {
+            writer.writeValue<int64_t>(prefix + "batches", batches.size());
+            for(size_t i = 0; i < batches.size(); i++) {
+                const std::string name = prefix + "batches." + boost::lexical_cast<std::string>(i) + ".";
+                writer.writeValue<Real>(name + "alpha", batches[i].alpha);
+                writer.writeFeatures<Scalar>(name + "mX", batches[i].mX);
+                writer.writeAlt<Scalar>(name + "mA", batches[i].mA);
+            }
+            builder.save(writer, prefix + "builder.");
+        }
+
+        //! Loads a block
+        void load(const CheckpointReader &reader, const std::string &prefix, Builder &builder, std::deque<Batch> &batches) {
+            int64_t size = reader.value<int64_t>(prefix + "batches");
+            for(int64_t i = 0; i < size; i++) {
+                const std::string name = prefix + "batches." + boost::lexical_cast<std::string>(i) + ".";
+                batches.push_back(Batch(reader.value<Real>(name + "alpha"), reader.features<Scalar>(name + "mX", this->getFSpace()->dimension()),
+                                        reader.alt<Scalar>(name + "mA")));
+            }
+            builder.load(reader, prefix + "builder.");
+        }
+
+        //! Removes the oldest batch from the window
+        void expire() {
+            // Flip the blocks when the front one is exhausted
+            if (frontBatches.empty()) {
+                std::swap(front, back);
+                std::swap(frontBatches, backBatches);
+                back->reset();
+                downdates = 0;
+                KQP_HLOG_DEBUG_F("New front block with %d batches", %frontBatches.size());
+            }
+
+            Batch batch = frontBatches.front();
+            frontBatches.pop_front();
+
+            if (frontBatches.empty()) {
+                // Exact expiry
+                front->reset();
+            } else if (rebuildPeriod > 0 && ++downdates >= rebuildPeriod) {
+                KQP_HLOG_DEBUG_F("Rebuilding the front block from %d batches", %frontBatches.size());
+                front->reset();
+                for(auto i = frontBatches.begin(); i != frontBatches.end(); ++i)
+                    front->add(i->alpha, i->mX, i->mA);
+                downdates = 0;
+            } else {
+                front->add(-batch.alpha, batch.mX, batch.mA);
+            }
+        }
+
+        //! Number of batches in the window
+        Index windowSize;
+
+        //! Number of downdates before rebuilding the front block
+        Index rebuildPeriod;
+
+        //! Builders for the oldest and the newest batches
+        boost::shared_ptr<Builder> front, back;
+
+        //! Batches of each block
+        std::deque<Batch> frontBatches, backBatches;
+
+        //! Number of downdates since the front block was built
+        Index downdates;
+
+        //! Eigen value selector
+        boost::shared_ptr< const Selector<Real> > selector;
+    };
+}
+
+#ifndef SWIG
+#define KQP_SCALAR_GEN(type) extern template class kqp::SlidingWindowKernelEVD<type>;
+#include <kqp/for_all_scalar_gen.h.inc>
+#endif
+
+#endif
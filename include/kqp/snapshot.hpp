@@ -0,0 +1,58 @@
+/*
+ This file is part of the Kernel Quantum Probability library (KQP).
+
+ KQP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ KQP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with KQP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __KQP_SNAPSHOT_H__
+#define __KQP_SNAPSHOT_H__
+
+#include <boost/shared_ptr.hpp>
+
+namespace kqp {
+    /**
+     * @brief Publication of immutable snapshots (read-copy-update)
+     *
+     * A writer publishes new versions of an object, and readers get the current version
+     * without copying it. A version is freed when its last reader releases it.
+     *
+     * Readers never wait while a version is computed, only while the pointer is swapped:
+     * boost::atomic_load and boost::atomic_store protect the shared pointer with a
+     * spinlock (from a pool), held while copying a pointer and its reference count.
+     * This is not lock-free, but the critical section is a few instructions long.
+     */
+    template<typename T> class Snapshots {
+    public:
+        typedef boost::shared_ptr<const T> Ptr;
+
+        //! Returns the current version (null if nothing was published)
+        Ptr get() const {
+            return boost::atomic_load(&current);
+        }
+
+        //! Publishes a new version (which should not be modified anymore)
+        void publish(const Ptr &version) {
+            boost::atomic_store(&current, version);
+        }
+
+        //! Clears the current version
+        void clear() {
+            publish(Ptr());
+        }
+
+    private:
+        Ptr current;
+    };
+}
+
+#endif
@@ -38,7 +38,7 @@ namespace kqp {
         //! Load a space, starting with an XML node
         static inline boost::shared_ptr<AbstractSpace> load(const pugi::xml_node &node) {
           auto scalar_node = node.attribute("scalar");
-          std::string scalar_name = scalar_node.empty() ? scalar_node.value() : "double";
+          std::string scalar_name = scalar_node.empty() ? "double" : scalar_node.value();
           std::string name = std::string(node.name()) + "[" + scalar_name + "]";
           BaseConstructor constructor = constructors()[name];
           if (!constructor)
@@ -0,0 +1,171 @@
+/*
+ This file is part of the Kernel Quantum Probability library (KQP).
+ 
+ KQP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ KQP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with KQP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <kqp/checkpoint.hpp>
+
+DEFINE_LOGGER(logger, "kqp.checkpoint");
+
+namespace kqp {
+    namespace {
+        uint64_t align(uint64_t position) {
+            return (position + CheckpointHeader::ALIGNMENT - 1) / CheckpointHeader::ALIGNMENT * CheckpointHeader::ALIGNMENT;
+        }
+    }
+
+    CheckpointWriter::CheckpointWriter(const std::string &path)
+        : m_path(path), m_temporary(path + ".tmp"), m_position(0) {
+        m_fd = ::open(m_temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (m_fd < 0)
+            KQP_THROW_EXCEPTION_F(io_exception, "Cannot create %s: %s", %m_temporary %std::strerror(errno));
+
+        // The header is written by commit()
+        CheckpointHeader header;
+        std::memset(&header, 0, sizeof(header));
+        append(&header, sizeof(header));
+    }
+
+    CheckpointWriter::~CheckpointWriter() {
+        if (m_fd >= 0) {
+            ::close(m_fd);
+            ::unlink(m_temporary.c_str());
+        }
+    }
+
+    void CheckpointWriter::writeText(const std::string &name, const std::string &text) {
+        begin(name, CheckpointEntry::TEXT, 1, text.size(), 1);
+        append(text.data(), text.size());
+    }
+
+    void CheckpointWriter::begin(const std::string &name, int kind, std::size_t elementSize, uint64_t rows, uint64_t cols) {
+        if (m_fd < 0)
+            KQP_THROW_EXCEPTION_F(illegal_operation_exception, "Checkpoint %s was already committed", %m_path);
+
+        CheckpointEntry entry;
+        std::memset(&entry, 0, sizeof(entry));
+        if (name.size() >= sizeof(entry.name))
+            KQP_THROW_EXCEPTION_F(illegal_argument_exception, "Block name %s is too long (maximum %d characters)", %name %(sizeof(entry.name) - 1));
+        for(auto &e: m_entries)
+            if (name == e.name)
+                KQP_THROW_EXCEPTION_F(illegal_argument_exception, "Block %s was already written in %s", %name %m_path);
+
+        std::strcpy(entry.name, name.c_str());
+        entry.kind = kind;
+        entry.elementSize = elementSize;
+        entry.rows = rows;
+        entry.cols = cols;
+
+        static const char zeros[CheckpointHeader::ALIGNMENT] = {};
+        append(zeros, align(m_position) - m_position);
+        entry.offset = m_position;
+        m_entries.push_back(entry);
+    }
+
+    void CheckpointWriter::append(const void *data, std::size_t size) {
+        const char *p = static_cast<const char *>(data);
+        while (size > 0) {
+            ssize_t n = ::write(m_fd, p, size);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                KQP_THROW_EXCEPTION_F(io_exception, "Cannot write to %s: %s", %m_temporary %std::strerror(errno));
+            }
+            p += n;
+            size -= n;
+            m_position += n;
+        }
+    }
+
+    void CheckpointWriter::commit() {
+        if (m_fd < 0)
+            KQP_THROW_EXCEPTION_F(illegal_operation_exception, "Checkpoint %s was already committed", %m_path);
+
+        CheckpointHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::strcpy(header.magic, CheckpointHeader::MAGIC());
+        header.version = CheckpointHeader::VERSION;
+        header.entries = m_entries.size();
+
+        static const char zeros[CheckpointHeader::ALIGNMENT] = {};
+        append(zeros, align(m_position) - m_position);
+        header.tableOffset = m_position;
+        if (!m_entries.empty())
+            append(&m_entries[0], m_entries.size() * sizeof(CheckpointEntry));
+        header.size = m_position;
+
+        if (::pwrite(m_fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) || ::fsync(m_fd) != 0)
+            KQP_THROW_EXCEPTION_F(io_exception, "Cannot write to %s: %s", %m_temporary %std::strerror(errno));
+        ::close(m_fd);
+        m_fd = -1;
+
+        if (std::rename(m_temporary.c_str(), m_path.c_str()) != 0)
+            KQP_THROW_EXCEPTION_F(io_exception, "Cannot rename %s to %s: %s", %m_temporary %m_path %std::strerror(errno));
+        KQP_LOG_DEBUG_F(logger, "Wrote checkpoint %s (%d blocks, %d bytes)", %m_path %m_entries.size() %header.size);
+    }
+
+
+    CheckpointReader::CheckpointReader(const std::string &path) : m_file(MappedFile::openAny(path, false)) {
+        if (m_file->size() < sizeof(CheckpointHeader))
+            KQP_THROW_EXCEPTION_F(illegal_argument_exception, "File %s is too small to be a checkpoint", %path);
+
+        const CheckpointHeader &h = *m_file->at<CheckpointHeader>(0);
+        if (std::strncmp(h.magic, CheckpointHeader::MAGIC(), sizeof(h.magic)) != 0)
+            KQP_THROW_EXCEPTION_F(illegal_argument_exception, "File %s is not a checkpoint", %path);
+        if (h.version != CheckpointHeader::VERSION)
+            KQP_THROW_EXCEPTION_F(illegal_argument_exception, "Checkpoint %s has version %d (expected %d)", %path %h.version %CheckpointHeader::VERSION);
+        if (h.size != m_file->size() || h.tableOffset + h.entries * sizeof(CheckpointEntry) > h.size)
+            KQP_THROW_EXCEPTION_F(illegal_argument_exception, "Checkpoint %s is truncated or corrupted", %path);
+
+        const CheckpointEntry *entries = m_file->at<CheckpointEntry>(h.tableOffset);
+        for(uint64_t i = 0; i < h.entries; i++) {
+            const CheckpointEntry &e = entries[i];
+            if (e.offset + e.rows * e.cols * e.elementSize > h.tableOffset || e.name[sizeof(e.name) - 1] != 0)
+                KQP_THROW_EXCEPTION_F(illegal_argument_exception, "Checkpoint %s has a corrupted entry (%d)", %path %i);
+            m_index[e.name] = &e;
+        }
+    }
+
+    bool CheckpointReader::has(const std::string &name) const {
+        return m_index.find(name) != m_index.end();
+    }
+
+    std::vector<std::string> CheckpointReader::names() const {
+        std::vector<std::string> list;
+        for(auto &e: m_index)
+            list.push_back(e.first);
+        return list;
+    }
+
+    std::string CheckpointReader::text(const std::string &name) const {
+        const CheckpointEntry &e = entry(name, CheckpointEntry::TEXT, 1);
+        return std::string(m_file->at<char>(e.offset), e.rows * e.cols);
+    }
+
+    const CheckpointEntry &CheckpointReader::entry(const std::string &name, int kind, std::size_t elementSize) const {
+        auto i = m_index.find(name);
+        if (i == m_index.end())
+            KQP_THROW_EXCEPTION_F(illegal_argument_exception, "No block %s in checkpoint %s", %name %m_file->path());
+        const CheckpointEntry &e = *i->second;
+        if (e.kind != (uint32_t)kind || e.elementSize != elementSize)
+            KQP_THROW_EXCEPTION_F(illegal_argument_exception, "Block %s of %s has elements of kind %d and size %d (expected kind %d and size %d)",
+                                  %name %m_file->path() %e.kind %e.elementSize %kind %elementSize);
+        return e;
+    }
+}
@@ -0,0 +1,101 @@
+/*
+ This file is part of the Kernel Quantum Probability library (KQP).
+
+ KQP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ KQP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with KQP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+
+#include <kqp/kqp.hpp>
+#include <kqp/cpu.hpp>
+
+DEFINE_LOGGER(logger, "kqp.cpu");
+
+namespace kqp { namespace cpu {
+    // Kernels of each level (KQP_CPU_AVX2 and KQP_CPU_AVX512 are defined by the build
+    // when the corresponding translation units are compiled with the right flags)
+    namespace baseline { const Kernels &kernels(); }
+    namespace avx2 { const Kernels &kernels(); }
+    namespace avx512 { const Kernels &kernels(); }
+
+    namespace {
+        std::atomic<const Kernels *> current(nullptr);
+
+        Level fromEnvironment(Level level) {
+            const char *value = std::getenv("KQP_CPU");
+            if (!value) return level;
+            for(int l = BASELINE; l <= AVX512; l++)
+                if (std::strcmp(value, name((Level)l)) == 0)
+                    return (Level)l;
+            KQP_LOG_WARN_F(logger, "Unknown instruction set level %s in KQP_CPU", %value);
+            return level;
+        }
+    }
+
+    const char *name(Level level) {
+        switch(level) {
+            case BASELINE: return "baseline";
+            case AVX2: return "avx2";
+            case AVX512: return "avx512";
+        }
+        return "unknown";
+    }
+
+    Level detect() {
+        Level level = BASELINE;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+        __builtin_cpu_init();
+#  ifdef KQP_CPU_AVX2
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") && __builtin_cpu_supports("f16c"))
+            level = AVX2;
+#  endif
+#  ifdef KQP_CPU_AVX512
+        if (level == AVX2 && __builtin_cpu_supports("avx512f"))
+            level = AVX512;
+#  endif
+#endif
+        return level;
+    }
+
+    const Kernels &kernels(Level level) {
+        switch(std::min(level, detect())) {
+            case AVX512: return avx512::kernels();
+            case AVX2: return avx2::kernels();
+            default: return baseline::kernels();
+        }
+    }
+
+    Level setLevel(Level level) {
+        const Kernels &k = kernels(level);
+        current.store(&k);
+        KQP_LOG_DEBUG_F(logger, "Using the %s numerical kernels", %name(k.level));
+        return k.level;
+    }
+
+    Level level() {
+        return kernels().level;
+    }
+
+    const Kernels &kernels() {
+        const Kernels *k = current.load(std::memory_order_acquire);
+        if (!k) {
+            setLevel(fromEnvironment(AVX512));
+            k = current.load(std::memory_order_acquire);
+        }
+        return *k;
+    }
+}}
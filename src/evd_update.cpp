@@ -9,6 +9,7 @@
 
 #include <kqp/kqp.hpp>
 #include <kqp/evd_update.hpp>
+#include <kqp/cpu.hpp>
 
 DEFINE_LOGGER(logger, "kqp.evd-update");
 
@@ -438,12 +439,21 @@ namespace kqp {
         // For the stopping criterion
         double e = gamma * EPSILON * M;
         KQP_LOG_DEBUG(logger, "Computing " << convert(M) << " eigenvalues");
+        
+        // Contiguous squared z and shifted diagonal, for the (vectorized) secular equation kernel
+        const cpu::Kernels &kernels = cpu::kernels();
+        std::vector<double> z2(M), shifted(M);
+        for (int i = 0; i < M; i++)
+            z2[i] = kqp::norm(v[i]->z);
+        
         for (int j = 0; j < M; j++) {
             IndexedValue<Scalar> &svj = *v[j];
             double diagj = svj.d;
             
             double interval = (j == 0 ? mzNorm : v[j - 1]->d - diagj) / 2;
             double middle = diagj + interval;
+            for (int i = 0; i < M; i++)
+                shifted[i] = v[i]->d - middle;
             
             // Stopping criteria from Gu & Eisenstat
             double psi = 0;
@@ -470,18 +480,9 @@ namespace kqp {
                 }
                 
                 // Compute the new phi, psi and f
-                psi = phi = 0;
-                
                 // lambda is between diagj and (diagj1 + diagj)/2
-                for (int i = j; i < M; i++) {
-                    IndexedValue<Scalar> &vi = *v[i];
-                    psi += kqp::norm(vi.z) / (vi.d - middle - nu);
-                }
-                
-                for (int i = 0; i < j; i++) {
-                    IndexedValue<Scalar> &vi = *v[i];
-                    phi += kqp::norm(vi.z) / (vi.d - middle - nu);
-                }
+                psi = kernels.secular(&z2[j], &shifted[j], M - j, nu);
+                phi = kernels.secular(&z2[0], &shifted[0], j, nu);
                 
                 f = 1 + psi + phi;
                 
@@ -0,0 +1,6 @@
+#include <kqp/feature_matrix/binary_fmatrix.hpp>
+
+namespace kqp {
+#define KQP_SCALAR_GEN(scalar) template class BinaryMatrix<scalar>; template class BinarySpace<scalar>;
+#include <kqp/for_all_scalar_gen.h.inc>
+}
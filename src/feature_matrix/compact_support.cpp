@@ -0,0 +1,6 @@
+#include <kqp/feature_matrix/compact_support.hpp>
+
+namespace kqp {
+#define KQP_SCALAR_GEN(scalar) template class CompactSupportSpace<scalar>;
+#include <kqp/for_all_scalar_gen.h.inc>
+}
@@ -0,0 +1,12 @@
+#include <atomic>
+#include <kqp/feature_matrix/generic.hpp>
+
+namespace kqp {
+    uint64_t GenericVector::nextId() {
+        static std::atomic<uint64_t> counter(0);
+        return ++counter;
+    }
+
+#define KQP_SCALAR_GEN(scalar) template class FeatureList<scalar>; template class GenericSpace<scalar>;
+#include <kqp/for_all_scalar_gen.h.inc>
+}
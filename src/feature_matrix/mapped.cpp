@@ -0,0 +1,102 @@
+#include <cerrno>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <kqp/feature_matrix/mapped.hpp>
+
+DEFINE_LOGGER(logger, "kqp.feature-matrix.mapped");
+
+namespace kqp {
+
+    namespace {
+        //! Unmaps a region when the last reference is released
+        struct Unmap {
+            std::size_t size;
+            Unmap(std::size_t size) : size(size) {}
+            void operator()(void *base) const {
+                munmap(base, size);
+            }
+        };
+    }
+
+    MappedFile::MappedFile(const std::string &path, int fd, bool writable)
+        : m_path(path), m_fd(fd), m_writable(writable), m_base(0), m_size(0) {
+    }
+
+    MappedFile::~MappedFile() {
+        close(m_fd);
+    }
+
+    boost::shared_ptr<MappedFile> MappedFile::create(const std::string &path, const MappedHeader &header, std::size_t size) {
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+            KQP_THROW_EXCEPTION_F(io_exception, "Cannot create %s: %s", %path %std::strerror(errno));
+
+        boost::shared_ptr<MappedFile> file(new MappedFile(path, fd, true));
+        file->resize(std::max(size, sizeof(MappedHeader)));
+        file->header() = header;
+        return file;
+    }
+
+    boost::shared_ptr<MappedFile> MappedFile::openAny(const std::string &path, bool writable) {
+        int fd = ::open(path.c_str(), writable ? O_RDWR : O_RDONLY);
+        if (fd < 0)
+            KQP_THROW_EXCEPTION_F(io_exception, "Cannot open %s: %s", %path %std::strerror(errno));
+        boost::shared_ptr<MappedFile> file(new MappedFile(path, fd, writable));
+
+        struct stat s;
+        if (fstat(fd, &s) != 0)
+            KQP_THROW_EXCEPTION_F(io_exception, "Cannot get the size of %s: %s", %path %std::strerror(errno));
+        if (s.st_size == 0)
+            KQP_THROW_EXCEPTION_F(illegal_argument_exception, "File %s is empty", %path);
+
+        file->m_size = s.st_size;
+        file->map();
+        return file;
+    }
+
+    boost::shared_ptr<MappedFile> MappedFile::open(const std::string &path, bool writable) {
+        boost::shared_ptr<MappedFile> file = openAny(path, writable);
+        if (file->size() < sizeof(MappedHeader))
+            KQP_THROW_EXCEPTION_F(illegal_argument_exception, "File %s is too small to be a feature matrix", %path);
+
+        const MappedHeader &h = file->header();
+        if (std::strncmp(h.magic, MappedHeader::MAGIC(), sizeof(h.magic)) != 0)
+            KQP_THROW_EXCEPTION_F(illegal_argument_exception, "File %s is not a feature matrix file", %path);
+        if (h.version != MappedHeader::VERSION)
+            KQP_THROW_EXCEPTION_F(illegal_argument_exception, "Feature matrix file %s has version %d (expected %d)", %path %h.version %MappedHeader::VERSION);
+
+        return file;
+    }
+
+    void MappedFile::map() {
+        void *base = mmap(0, m_size, PROT_READ | (m_writable ? PROT_WRITE : 0), MAP_SHARED, m_fd, 0);
+        if (base == MAP_FAILED)
+            KQP_THROW_EXCEPTION_F(io_exception, "Cannot map %s in memory: %s", %m_path %std::strerror(errno));
+
+        m_base = static_cast<char*>(base);
+        m_region = boost::shared_ptr<void>(base, Unmap(m_size));
+    }
+
+    void MappedFile::resize(std::size_t size) {
+        if (size <= m_size && m_base) return;
+
+        KQP_LOG_DEBUG_F(logger, "Resizing %s from %d to %d bytes", %m_path %m_size %size);
+        if (ftruncate(m_fd, size) != 0)
+            KQP_THROW_EXCEPTION_F(io_exception, "Cannot extend %s to %d bytes: %s", %m_path %size %std::strerror(errno));
+
+        // The previous region stays mapped while referenced
+        m_size = size;
+        map();
+    }
+
+    void MappedFile::sync() {
+        if (m_writable && msync(m_base, m_size, MS_SYNC) != 0)
+            KQP_THROW_EXCEPTION_F(io_exception, "Cannot synchronize %s: %s", %m_path %std::strerror(errno));
+    }
+
+#define KQP_SCALAR_GEN(scalar) template class MappedDense<scalar>; template class MappedSparse<scalar>;
+#include <kqp/for_all_scalar_gen.h.inc>
+}
@@ -0,0 +1,4 @@
+#include <kqp/kernel_evd/sliding_window.hpp>
+
+#define KQP_SCALAR_GEN(type) template class kqp::SlidingWindowKernelEVD<type>;
+#include <kqp/for_all_scalar_gen.h.inc>
@@ -27,9 +27,13 @@
     
     SCALARMATRIX getDense() { return $self->t1(); }
     
+    // Sparse representation
+    bool isSparse() const { return $self->isSparse(); }
+    bool sparsify(@RTYPE@ maxFillRatio) { return $self->sparsify(maxFillRatio); }
+    
     // Multiply with another matrix
     SCALARMATRIX multBy(const SCALARMATRIX &other) {
-         return SCALARMATRIX((*$self) * other); 
+         return kqp::multiply(*$self, other); 
     }
 }
 
@@ -159,6 +159,115 @@ FMatrixCommonDefs(SparseDense@SNAME@, kqp::SparseDense< @STYPE@ >)
 SpaceCommonDefs(SparseSpace@SNAME@, kqp::SparseSpace< @STYPE@ >)
 FMatrixCommonDefs(Sparse@SNAME@, kqp::Sparse< @STYPE@ >)
 
+// Hashed sparse
+%ignore kqp::HashedSparseSpace::Builder;
+%include <kqp/feature_matrix/hashed_sparse.hpp>
+SpaceCommonDefs(HashedSparseSpace@SNAME@, kqp::HashedSparseSpace< @STYPE@ >)
+
+// Zero-copy construction from native arrays
+
+#ifdef SWIGPYTHON
+%extend kqp::Dense< @STYPE@ > {
+  /** Wraps an array (e.g. NumPy) without copying it: a C-contiguous array of shape (n, dimension) 
+      or a Fortran-contiguous array of shape (dimension, n) holds n pre-images */
+  static boost::shared_ptr< kqp::Dense< @STYPE@ > > wrap(PyObject *array) {
+    kqp::PythonBufferRelease release;
+    release.views.push_back(kqp::pythonBuffer(array, kqp::PythonFormat< @STYPE@ >::code(), sizeof(@STYPE@)));
+    const Py_buffer &view = *release.views[0];
+    
+    Index rows = view.shape[0], cols = 1;
+    if (view.ndim == 2) {
+      if (PyBuffer_IsContiguous(&view, 'C')) { rows = view.shape[1]; cols = view.shape[0]; }
+      else cols = view.shape[1];
+    } else if (view.ndim != 1) {
+      release();
+      KQP_THROW_EXCEPTION_F(kqp::illegal_argument_exception, "Expected an array with 1 or 2 dimensions (got %d)", %view.ndim);
+    }
+    
+    return kqp::Dense< @STYPE@ >::wrap(static_cast<const @STYPE@ *>(view.buf), rows, cols, release);
+  }
+};
+
+%extend kqp::Sparse< @STYPE@ > {
+  /** Wraps compressed sparse column arrays (e.g. the indptr, indices and data of a scipy.sparse.csc_matrix with 32 bits indices) without copying them */
+  static boost::shared_ptr< kqp::Sparse< @STYPE@ > > wrap(Index rows, PyObject *indptr, PyObject *indices, PyObject *data) {
+    typedef kqp::Sparse< @STYPE@ >::StorageIndex StorageIndex;
+    kqp::PythonBufferRelease release;
+    try {
+      release.views.push_back(kqp::pythonBuffer(indptr, 0, sizeof(StorageIndex)));
+      release.views.push_back(kqp::pythonBuffer(indices, 0, sizeof(StorageIndex)));
+      release.views.push_back(kqp::pythonBuffer(data, kqp::PythonFormat< @STYPE@ >::code(), sizeof(@STYPE@)));
+    } catch(...) {
+      // Releases the buffers acquired so far
+      release();
+      throw;
+    }
+    
+    // Checks the arrays, since they are not copied
+    const StorageIndex *outer = static_cast<const StorageIndex *>(release.views[0]->buf);
+    const StorageIndex *inner = static_cast<const StorageIndex *>(release.views[1]->buf);
+    Index cols = release.views[0]->len / sizeof(StorageIndex) - 1;
+    const char *error = 0;
+    if (cols < 0 || outer[0] != 0)
+      error = "indptr should start with 0";
+    for(Index j = 0; !error && j < cols; j++)
+      if (outer[j + 1] < outer[j]) error = "indptr should be non decreasing";
+    if (!error) {
+      Index nnz = outer[cols];
+      if (release.views[1]->len / (Py_ssize_t)sizeof(StorageIndex) < nnz || release.views[2]->len / (Py_ssize_t)sizeof(@STYPE@) < nnz)
+        error = "indices and data should have indptr[-1] elements";
+      for(Index k = 0; !error && k < nnz; k++)
+        if (inner[k] < 0 || inner[k] >= rows) error = "indices should be between 0 and the number of rows";
+    }
+    if (error) {
+      release();
+      KQP_THROW_EXCEPTION_F(kqp::illegal_argument_exception, "Invalid compressed sparse column arrays: %s", %error);
+    }
+    
+    return kqp::Sparse< @STYPE@ >::wrap(rows, cols, outer, inner, static_cast<const @STYPE@ *>(release.views[2]->buf), release);
+  }
+};
+#endif
+
+#ifdef SWIGJAVA
+%extend kqp::Dense< @STYPE@ > {
+  /** Wraps a direct buffer (in native byte order) holding the pre-images in column-major order, without copying it */
+  static boost::shared_ptr< kqp::Dense< @STYPE@ > > wrap(kqp::JavaDirectBuffer buffer, Index rows, Index cols) {
+    const @STYPE@ *data = buffer.address< @STYPE@ >(rows * cols);
+    kqp::JavaBufferRelease release(buffer.env);
+    release.add(buffer);
+    return kqp::Dense< @STYPE@ >::wrap(data, rows, cols, release);
+  }
+};
+
+%extend kqp::Sparse< @STYPE@ > {
+  /** Wraps direct buffers (in native byte order) holding the matrix in compressed sparse column format, without copying them */
+  static boost::shared_ptr< kqp::Sparse< @STYPE@ > > wrap(Index rows, Index cols, kqp::JavaDirectBuffer outer, kqp::JavaDirectBuffer inner, kqp::JavaDirectBuffer values) {
+    typedef kqp::Sparse< @STYPE@ >::StorageIndex StorageIndex;
+    const StorageIndex *outerPtr = outer.address<StorageIndex>(cols + 1);
+    Index nnz = outerPtr[cols];
+    
+    kqp::JavaBufferRelease release(outer.env);
+    release.add(outer);
+    release.add(inner);
+    release.add(values);
+    return kqp::Sparse< @STYPE@ >::wrap(rows, cols, outerPtr, inner.address<StorageIndex>(nnz), values.address< @STYPE@ >(nnz), release);
+  }
+};
+#endif
+
+// Memory-mapped dense and sparse
+%ignore kqp::MappedFile;
+%ignore kqp::MappedHeader;
+%include <kqp/feature_matrix/mapped.hpp>
+FMatrixCommonDefs(MappedDense@SNAME@, kqp::MappedDense< @STYPE@ >)
+FMatrixCommonDefs(MappedSparse@SNAME@, kqp::MappedSparse< @STYPE@ >)
+
+// Binary
+%include <kqp/feature_matrix/binary_fmatrix.hpp>
+SpaceCommonDefs(BinarySpace@SNAME@, kqp::BinarySpace< @STYPE@ >)
+FMatrixCommonDefs(BinaryMatrix@SNAME@, kqp::BinaryMatrix< @STYPE@ >)
+
 // ---- Kernel spaces
 
 %include <kqp/feature_matrix/unary_kernel.hpp>
@@ -169,6 +278,9 @@ SpaceCommonDefs(GaussianSpace@SNAME@, kqp::GaussianSpace< @STYPE@ >);
 
 SpaceCommonDefs(PolynomialSpace@SNAME@, kqp::PolynomialSpace< @STYPE@ >);
 
+%include <kqp/feature_matrix/compact_support.hpp>
+SpaceCommonDefs(CompactSupportSpace@SNAME@, kqp::CompactSupportSpace< @STYPE@ >);
+
 
 %include <kqp/feature_matrix/kernel_sum.hpp>
 
@@ -66,6 +66,7 @@ shared_template(CleanerNullSpace@SNAME@, kqp::CleanerNullSpace< @STYPE@ >);
 %shared_ptr(kqp::AccumulatorKernelEVD< @STYPE@, false >)
 %shared_ptr(kqp::DivideAndConquerBuilder< @STYPE@ >)
 %shared_ptr(kqp::IncrementalKernelEVD< @STYPE@ >)
+%shared_ptr(kqp::SlidingWindowKernelEVD< @STYPE@ >)
 
 %include "kqp/kernel_evd.hpp"
 %template(KEVD@SNAME@) kqp::KernelEVD< @STYPE@ >;
@@ -84,3 +85,6 @@ shared_template(CleanerNullSpace@SNAME@, kqp::CleanerNullSpace< @STYPE@ >);
 
 %include "kqp/kernel_evd/divide_and_conquer.hpp"
 %template(KEVDDivideAndConquer@SNAME@) kqp::DivideAndConquerBuilder< @STYPE@ >;
+
+%include "kqp/kernel_evd/sliding_window.hpp"
+%template(KEVDSlidingWindow@SNAME@) kqp::SlidingWindowKernelEVD< @STYPE@ >;
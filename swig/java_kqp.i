@@ -196,3 +196,64 @@
 }
 
 
+// --- Direct byte buffers (zero-copy access from native code)
+
+%{
+namespace kqp {
+    //! A direct java.nio.ByteBuffer
+    struct JavaDirectBuffer {
+        JNIEnv *env;
+        jobject buffer;
+        
+        //! Returns the buffer address, checking that it can hold size elements
+        template<typename T> const T *address(Index size) const {
+            void *address = env->GetDirectBufferAddress(buffer);
+            if (!address)
+                KQP_THROW_EXCEPTION(illegal_argument_exception, "The buffer is not a direct buffer");
+            if (env->GetDirectBufferCapacity(buffer) < (jlong)(size * sizeof(T)))
+                KQP_THROW_EXCEPTION_F(illegal_argument_exception, "The buffer capacity (%d bytes) is too small (%d bytes needed)", 
+                                      %env->GetDirectBufferCapacity(buffer) %(size * sizeof(T)));
+            return static_cast<const T*>(address);
+        }
+    };
+
+    //! Releases the references on direct buffers (from any thread)
+    struct JavaBufferRelease {
+        JavaVM *vm;
+        std::vector<jobject> buffers;
+        
+        JavaBufferRelease(JNIEnv *env) {
+            env->GetJavaVM(&vm);
+        }
+        
+        //! Keeps a buffer alive until release
+        void add(const JavaDirectBuffer &b) {
+            buffers.push_back(b.env->NewGlobalRef(b.buffer));
+        }
+        
+        void operator()() const {
+            JNIEnv *env;
+            bool attached = false;
+            if (vm->GetEnv((void**)&env, JNI_VERSION_1_2) == JNI_EDETACHED) {
+                vm->AttachCurrentThread((void**)&env, 0);
+                attached = true;
+            }
+            for(size_t i = 0; i < buffers.size(); i++)
+                env->DeleteGlobalRef(buffers[i]);
+            if (attached) 
+                vm->DetachCurrentThread();
+        }
+    };
+}
+%}
+
+%typemap(jni) kqp::JavaDirectBuffer "jobject"
+%typemap(jtype) kqp::JavaDirectBuffer "java.nio.ByteBuffer"
+%typemap(jstype) kqp::JavaDirectBuffer "java.nio.ByteBuffer"
+%typemap(javain, pre="    if ($javainput.order() != java.nio.ByteOrder.nativeOrder()) throw new IllegalArgumentException(\"The buffer should use the native byte order\");") 
+    kqp::JavaDirectBuffer "$javainput"
+%typemap(in) kqp::JavaDirectBuffer %{ 
+    $1.env = jenv; 
+    $1.buffer = $input; 
+%}
+
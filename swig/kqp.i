@@ -35,8 +35,12 @@
     #include <kqp/logging.hpp>
     #include <kqp/decomposition.hpp>
 
+    #include <kqp/feature_matrix/binary_fmatrix.hpp>
+    #include <kqp/feature_matrix/compact_support.hpp>
     #include <kqp/feature_matrix/dense.hpp>
+    #include <kqp/feature_matrix/hashed_sparse.hpp>
     #include <kqp/feature_matrix/kernel_sum.hpp>
+    #include <kqp/feature_matrix/mapped.hpp>
     #include <kqp/feature_matrix/sparse.hpp>
     #include <kqp/feature_matrix/sparse_dense.hpp>
     #include <kqp/feature_matrix/unary_kernel.hpp>
@@ -45,6 +49,7 @@
     #include <kqp/kernel_evd/accumulator.hpp>
     #include <kqp/kernel_evd/incremental.hpp>
     #include <kqp/kernel_evd/divide_and_conquer.hpp>
+    #include <kqp/kernel_evd/sliding_window.hpp>
 
     #include <kqp/cleaning/unused.hpp>
     #include <kqp/cleaning/qp_approach.hpp>
@@ -96,6 +101,7 @@
 
 #ifdef SWIGPYTHON
 %include <pycontainer.swg>
+%include "kqp_buffers.i"
 #endif
 
 // --- STL related types
@@ -218,6 +224,7 @@ namespace Eigen {
 
 %include <kqp/eigen_identity.hpp>
 %include <kqp/logging.hpp>
+%include <kqp/half_precision.hpp>
 
 %define shared_template(NAME, TYPE)
 %shared_ptr(TYPE)
@@ -0,0 +1,53 @@
+/*
+  Zero-copy access to Python objects exposing a buffer (e.g. NumPy arrays)
+*/
+
+%{
+#include <cstring>
+
+namespace kqp {
+    //! Buffer format codes of scalars
+    template<typename Scalar> struct PythonFormat;
+    template<> struct PythonFormat<double> { static const char *code() { return "d"; } };
+    template<> struct PythonFormat<float> { static const char *code() { return "f"; } };
+    template<> struct PythonFormat< std::complex<double> > { static const char *code() { return "Zd"; } };
+    template<> struct PythonFormat< std::complex<float> > { static const char *code() { return "Zf"; } };
+
+    //! Releases Python buffers (the GIL is acquired first)
+    struct PythonBufferRelease {
+        std::vector< boost::shared_ptr<Py_buffer> > views;
+
+        void operator()() const {
+            PyGILState_STATE state = PyGILState_Ensure();
+            for(size_t i = 0; i < views.size(); i++)
+                PyBuffer_Release(views[i].get());
+            PyGILState_Release(state);
+        }
+    };
+
+    /**
+     * @brief Gets a read-only contiguous buffer on a Python object
+     * @param format The expected format (ignoring the native byte order prefix), or 0 for any integer format
+     */
+    inline boost::shared_ptr<Py_buffer> pythonBuffer(PyObject *object, const char *format, Py_ssize_t itemSize) {
+        boost::shared_ptr<Py_buffer> view(new Py_buffer());
+        if (PyObject_GetBuffer(object, view.get(), PyBUF_ANY_CONTIGUOUS | PyBUF_FORMAT) != 0) {
+            PyErr_Clear();
+            KQP_THROW_EXCEPTION(illegal_argument_exception, "The object does not expose a contiguous buffer");
+        }
+
+        const char *f = view->format ? view->format : "B";
+        if (*f == '@' || *f == '=' || (*f == '<' && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)) f++;
+
+        bool ok = view->itemsize == itemSize && (format ? std::strcmp(f, format) == 0 : std::strchr("bBhHiIlLqQ", *f) != 0 && f[1] == 0);
+        if (!ok) {
+            std::string got(view->format ? view->format : "B");
+            Py_ssize_t gotSize = view->itemsize;
+            PyBuffer_Release(view.get());
+            KQP_THROW_EXCEPTION_F(illegal_argument_exception, "Buffer has format %s with items of size %d (expected %s with items of size %d)",
+                                  %got %gotSize %(format ? format : "an integer format") %itemSize);
+        }
+        return view;
+    }
+}
+%}
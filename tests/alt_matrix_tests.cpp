@@ -306,6 +306,45 @@ namespace {
         return error1 > EPSILON || error2 > EPSILON;
     }
     
+    int test_sparse_representation() {
+        typedef AltDense<double>::type AltType;
+        
+        // A matrix with about 10% of non null coefficients
+        MatrixXd m = (MatrixXd::Random(20,8).array() > 0.8).select(MatrixXd::Random(20,8), 0);
+        MatrixXd d = RANDOM_M(double, 8, 5), k = RANDOM_M(double, 20, 20);
+        AltType alt_m(m), alt_d(d), alt_id = Identity<double>(8), alt_id2 = Identity<double>(20);
+        
+        int code = 0;
+        code |= alt_m.sparsify(0.01) || !alt_m.sparsify(0.5) || alt_d.sparsify(0.5) || alt_id.sparsify(0.5);
+        std::cerr << "Fill ratio: " << alt_m.fillRatio() << ", sparse: " << alt_m.isSparse() << std::endl;
+        
+        AltType alt_m2(MatrixXd(m.leftCols(6))), alt_mt(MatrixXd(m.adjoint()));
+        alt_m2.sparsify(0.5);
+        alt_mt.sparsify(0.5);
+        
+        double errors[] = {
+            (multiply(alt_m, d) - m * d).squaredNorm(),
+            (multiply(MatrixXd(d.adjoint()), alt_mt) - d.adjoint() * m.adjoint()).squaredNorm(),
+            (multiply(alt_m, alt_d) - m * d).squaredNorm(),
+            (multiply(alt_m, alt_id) - m).squaredNorm(),
+            (multiply(alt_id2, alt_m) - m).squaredNorm(),
+            (multiply(alt_mt, alt_m) - m.adjoint() * m).squaredNorm(),
+            (multiplyAdjoint(alt_m, k) - m.adjoint() * k).squaredNorm(),
+            (bilinear(alt_m, k, alt_m2) - m.adjoint() * k * m.leftCols(6)).squaredNorm(),
+            (bilinear(alt_m, k, alt_id2) - m.adjoint() * k).squaredNorm()
+        };
+        for(size_t i = 0; i < sizeof(errors) / sizeof(double); i++) {
+            std::cerr << "Sparse representation error [" << i << "]: " << errors[i] << std::endl;
+            code |= errors[i] > EPSILON;
+        }
+        
+        // Modifications drop the sparse representation
+        alt_m.t1()(0,0) = 1;
+        code |= alt_m.isSparse();
+        
+        return code;
+    }
+    
     int test_rowwise() {
         typedef double Scalar;
         AltDense<Scalar>::type a = AltDense<Scalar>::Identity(10);
@@ -366,6 +405,7 @@ test_adjoint_post_product(x,y);
         // Sparse
         
         code |= test_sparse<double>();
+        code |= test_sparse_representation();
         
         // Row-wise
         
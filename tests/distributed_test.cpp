@@ -0,0 +1,195 @@
+/*
+ This file is part of the Kernel Quantum Probability library (KQP).
+
+ KQP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ KQP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with KQP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <deque>
+#include <set>
+
+#include <spawn.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <kqp/feature_matrix/dense.hpp>
+#include <kqp/kernel_evd/dense_direct.hpp>
+#include <kqp/kernel_evd/distributed.hpp>
+
+extern char **environ;
+
+DEFINE_LOGGER(logger, "kqp.test.distributed");
+
+namespace kqp {
+    namespace {
+        const Index DIMENSION = 10;
+        const Index SHARDS = 5;
+
+        //! Temporary directory with shards, and the expected operator
+        struct Shards {
+            std::string directory;
+            std::vector<std::string> paths, files;
+            Eigen::MatrixXd expected;
+            //! Number of rank-one updates
+            Index updates;
+
+            Shards() : expected(Eigen::MatrixXd::Zero(DIMENSION, DIMENSION)), updates(0) {
+                char path[] = "/tmp/kqp-distributed-XXXXXX";
+                if (!mkdtemp(path))
+                    KQP_THROW_EXCEPTION(io_exception, "Cannot create a temporary directory");
+                directory = path;
+
+                for(Index i = 0; i < SHARDS; i++) {
+                    Eigen::MatrixXd mX = Eigen::MatrixXd::Random(DIMENSION, 3 + i);
+                    Eigen::VectorXd weights = Eigen::VectorXd::Random(mX.cols()).cwiseAbs();
+                    expected += mX * weights.asDiagonal() * mX.adjoint();
+                    updates += mX.cols();
+
+                    CheckpointWriter writer(file("shard-" + boost::lexical_cast<std::string>(i)));
+                    writer.writeFeatures<double>("features", Dense<double>::create(mX));
+                    writer.writeMatrix("weights", weights);
+                    writer.commit();
+                    paths.push_back(files.back());
+                }
+            }
+
+            ~Shards() {
+                for(auto i = files.begin(); i != files.end(); ++i)
+                    std::remove(i->c_str());
+                rmdir(directory.c_str());
+            }
+
+            //! Returns the path of a file in the directory (removed at the end)
+            std::string file(const std::string &name) {
+                files.push_back(directory + "/" + name);
+                return files.back();
+            }
+
+            //! Compares a decomposition with the expected operator
+            int check(const Decomposition<double> &d) const {
+                Eigen::MatrixXd mX = d.mX->as<Dense<double>>().view();
+                Eigen::MatrixXd mY(d.mY);
+                Eigen::MatrixXd op = mX * mY * Eigen::VectorXd(d.mD).asDiagonal() * mY.adjoint() * mX.adjoint();
+
+                double error = (op - expected).squaredNorm() / expected.squaredNorm();
+                std::cerr << "Relative squared error is " << error << " (" << d.updateCount << " updates)" << std::endl;
+                return error < 1e-20 && d.updateCount == updates ? 0 : 1;
+            }
+        };
+
+        //! Runs a program and waits for it
+        pid_t spawn(const std::vector<std::string> &args) {
+            std::vector<char *> argv;
+            for(auto i = args.begin(); i != args.end(); ++i)
+                argv.push_back(const_cast<char *>(i->c_str()));
+            argv.push_back(0);
+
+            pid_t pid;
+            if (posix_spawn(&pid, argv[0], 0, 0, &argv[0], environ) != 0)
+                return -1;
+            return pid;
+        }
+
+        bool succeeded(pid_t pid) {
+            int status;
+            return pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+        }
+    }
+
+    int test_plan(std::deque<std::string> &/*args*/) {
+        std::vector<std::string> inputs;
+        for(int i = 0; i < 7; i++)
+            inputs.push_back("partial-" + boost::lexical_cast<std::string>(i));
+        std::vector<MergeJob> jobs = DistributedKernelEVD<double>::plan(inputs, "result", 3);
+
+        // Each input and intermediate result is merged exactly once, level after level
+        std::set<std::string> available(inputs.begin(), inputs.end());
+        for(auto job = jobs.begin(); job != jobs.end(); ++job) {
+            std::cerr << job->level << " " << job->output << " <-";
+            for(auto i = job->inputs.begin(); i != job->inputs.end(); ++i) {
+                std::cerr << " " << *i;
+                if (available.erase(*i) != 1)
+                    return 1;
+            }
+            std::cerr << std::endl;
+            available.insert(job->output);
+        }
+
+        return jobs.size() == 4 && available.size() == 1 && *available.begin() == "result" ? 0 : 1;
+    }
+
+    int test_merge(std::deque<std::string> &/*args*/) {
+        Shards shards;
+        auto fs = DenseSpace<double>::create(DIMENSION);
+        DistributedKernelEVD<double> kevd(fs);
+        kevd.setBuilder(boost::shared_ptr< KernelEVD<double> >(new DenseDirectBuilder<double>(DIMENSION)));
+        kevd.setMerger(boost::shared_ptr< KernelEVD<double> >(new DenseDirectBuilder<double>(DIMENSION)));
+
+        std::vector<std::string> partials;
+        for(Index i = 0; i < SHARDS; i++) {
+            partials.push_back(shards.file("partial-" + boost::lexical_cast<std::string>(i)));
+            kevd.build({ shards.paths[i] }, partials.back());
+        }
+
+        std::vector<MergeJob> jobs = DistributedKernelEVD<double>::plan(partials, shards.file("result"), 2);
+        for(auto job = jobs.begin(); job != jobs.end(); ++job) {
+            shards.files.push_back(job->output);
+            kevd.run(*job);
+        }
+
+        return shards.check(kevd.read(jobs.back().output));
+    }
+
+    int test_processes(std::deque<std::string> &args) {
+        if (args.empty())
+            KQP_THROW_EXCEPTION(illegal_argument_exception, "The path of kqp_evd should be given");
+        const std::string program = args[0];
+
+        Shards shards;
+        auto fs = DenseSpace<double>::create(DIMENSION);
+        const std::string space = shards.file("space.xml");
+        SpaceFactory::saveToFile(space, *fs);
+
+        // One process for each shard
+        std::vector<std::string> partials;
+        std::vector<pid_t> pids;
+        for(Index i = 0; i < SHARDS; i++) {
+            partials.push_back(shards.file("partial-" + boost::lexical_cast<std::string>(i)));
+            pids.push_back(spawn({ program, "--space", space, "--builder", "direct", "build", "--output", partials.back(), shards.paths[i] }));
+        }
+        for(auto pid = pids.begin(); pid != pids.end(); ++pid)
+            if (!succeeded(*pid)) {
+                std::cerr << "A build process failed" << std::endl;
+                return 1;
+            }
+
+        // Tree of merges (without the space, which is read from the partial decompositions)
+        const std::string result = shards.file("result");
+        std::vector<std::string> merge = { program, "--merger", "direct", "merge", "--fan-in", "2", "--jobs", "2", "--output", result };
+        merge.insert(merge.end(), partials.begin(), partials.end());
+        if (!succeeded(spawn(merge))) {
+            std::cerr << "The merge process failed" << std::endl;
+            return 1;
+        }
+
+        return shards.check(DistributedKernelEVD<double>(fs).read(result));
+    }
+}
+
+#include "main-tests.inc"
+DEFINE_TEST("plan", test_plan);
+DEFINE_TEST("merge", test_merge);
+DEFINE_TEST("processes", test_processes);
@@ -1,8 +1,22 @@
 #define KQP_NO_EXTERN_TEMPLATE
 
+#include <cstdlib>
+#include <unistd.h>
+#include <boost/bind.hpp>
+
+#include <kqp/cpu.hpp>
 #include <kqp/feature_matrix/dense.hpp>
 #include <kqp/feature_matrix/sparse.hpp>
 #include <kqp/feature_matrix/sparse_dense.hpp>
+#include <kqp/feature_matrix/mapped.hpp>
+#include <kqp/feature_matrix/binary_fmatrix.hpp>
+#include <kqp/feature_matrix/generic.hpp>
+#include <kqp/feature_matrix/hashed_sparse.hpp>
+#include <kqp/feature_matrix/unary_kernel.hpp>
+#include <kqp/feature_matrix/compact_support.hpp>
+#include <kqp/feature_matrix/kernel_sum.hpp>
+#include <kqp/kernel_evd/accumulator.hpp>
+#include <kqp/cleaning/null_space.hpp>
 
 using namespace kqp;
 
@@ -188,6 +202,791 @@ namespace kqp {
         }
     };
 
+    //! Tests a memory-mapped matrix against its in-memory counterpart
+    template<typename KQPSpace, typename KQPMatrix, typename MappedMatrix>
+    struct MappedTest {
+        typedef typename KQPMatrix::ScalarMatrix::Scalar Scalar;
+        KQP_SCALAR_TYPEDEFS(Scalar);
+        
+        std::string path;
+        int code;
+        
+        MappedTest() : code(0) {
+            char name[] = "/tmp/kqp-fmatrix-XXXXXX";
+            int fd = mkstemp(name);
+            close(fd);
+            path = name;
+        }
+        
+        ~MappedTest() {
+            unlink(path.c_str());
+        }
+        
+        void checkError(const std::string &name, double error) {
+            if (error < EPSILON) {
+                KQP_LOG_INFO_F(logger,  "Error for %s (%s) is %g", %name %KQP_DEMANGLE(MappedMatrix) %error);
+            } else {
+                KQP_LOG_ERROR_F(logger, "Error for %s (%s) is %g [!]", %name %KQP_DEMANGLE(MappedMatrix) %error);
+                code = 1;
+            }
+        }
+        
+        int test() {
+            Index dimension = 5;
+            ScalarMatrix m = ScalarMatrix::Random(dimension, 8);
+            m.row(3) *= 0;
+            ScalarMatrix m2 = ScalarMatrix::Random(dimension, 4);
+            m2.row(2) *= 0;
+            
+            KQPSpace fs(dimension);
+            
+            // --- Append (with a small capacity to force the file extension)
+            boost::shared_ptr<MappedMatrix> mapped = MappedMatrix::create(path, dimension);
+            mapped->add(KQPMatrix(m));
+            
+            // A copy should be a view unaffected by further additions
+            FMatrixBasePtr before = mapped->copy();
+            
+            std::vector<bool> which(4, true);
+            which[1] = false;
+            mapped->add(KQPMatrix(m2), &which);
+            mapped->sync();
+            
+            ScalarMatrix m2Sel, all(dimension, 11);
+            select_columns(which, m2, m2Sel);
+            all << m, m2Sel;
+            
+            checkError("append", (ScalarMatrix(mapped->view()) - all).norm() / all.norm());
+            checkError("view after append", (ScalarMatrix(before->template as<KQPMatrix>().view()) - m).norm() / m.norm());
+            code |= !before->template as<KQPMatrix>().isExternal();
+            
+            // --- Re-open (read-only) and compare the Gram matrices and the inner products with an in-memory matrix
+            boost::shared_ptr<MappedMatrix> opened = MappedMatrix::open(path);
+            KQPMatrix inMemory(all);
+            checkError("gram matrix", (fs.k(*opened) - all.adjoint() * all).norm() / all.squaredNorm());
+            checkError("inner", (fs.k(*opened, inMemory) - all.adjoint() * all).norm() / all.squaredNorm());
+            
+            // --- Contiguous subsets are views
+            std::vector<bool> selected(11, false);
+            selected[3] = selected[4] = selected[5] = true;
+            FMatrixBasePtr subset = opened->subset(selected.begin(), selected.end());
+            checkError("subset", (ScalarMatrix(subset->template as<KQPMatrix>().view()) - all.middleCols(3,3)).norm() / all.norm());
+            code |= !subset->template as<KQPMatrix>().isExternal();
+
+            selected[8] = true;
+            subset = opened->subset(selected.begin(), selected.end());
+            ScalarMatrix mSelect;
+            select_columns(selected, all, mSelect);
+            checkError("subset (copy)", (ScalarMatrix(subset->template as<KQPMatrix>().view()) - mSelect).norm() / all.norm());
+            
+            return code;
+        }
+
+        //! Creates a file whose dimension is set by the first pre-images
+        int testUnknownDimension() {
+            ScalarMatrix m = ScalarMatrix::Random(5, 3);
+            boost::shared_ptr<MappedMatrix> mapped = MappedMatrix::create(path, 0, 8);
+            mapped->add(KQPMatrix(m));
+            mapped->add(KQPMatrix(m));
+
+            ScalarMatrix all(5, 6);
+            all << m, m;
+            checkError("unknown dimension", (ScalarMatrix(mapped->view()) - all).norm() / all.norm());
+            return code;
+        }
+    };
+    
+    namespace {
+        void countRelease(int *count) { ++*count; }
+    }
+    
+    //! Tests matrices using external memory
+    int test_external(std::deque<std::string> &) {
+        typedef Dense<double>::ScalarMatrix ScalarMatrix;
+        int code = 0;
+        int released = 0;
+        
+        ScalarMatrix m = ScalarMatrix::Random(5, 8), m2 = ScalarMatrix::Random(5, 2);
+        {
+            // Dense: the memory is shared by copies and released once
+            boost::shared_ptr< Dense<double> > dense = Dense<double>::wrap(m.data(), m.rows(), m.cols(), boost::bind(&countRelease, &released));
+            code |= dense->view().data() != m.data();
+            
+            Dense<double> copy(*dense);
+            code |= copy.view().data() != m.data();
+            code |= (DenseSpace<double>(5).k(copy) - m.adjoint() * m).norm() > EPSILON;
+            
+            // Read accessors never copy the external memory
+            ScalarMatrix buffer;
+            code |= (copy.getMatrix(buffer) - m).norm() > EPSILON;
+            code |= !copy.isExternal() || copy.view().data() != m.data();
+            
+            // Adding pre-images copies the external memory first
+            copy.add(m2);
+            code |= copy.isExternal() || copy.size() != 10 || (copy.view().leftCols(8) - m).norm() > EPSILON;
+            code |= dense->size() != 8;
+        }
+        code |= released != 1;
+        KQP_LOG_INFO_F(logger, "Dense external memory released %d time(s)", %released);
+        
+        {
+            // Sparse
+            Sparse<double>::Storage storage = Sparse<double>(m).view();
+            boost::shared_ptr< Sparse<double> > sparse = Sparse<double>::wrap(storage.rows(), storage.cols(), 
+                        storage.outerIndexPtr(), storage.innerIndexPtr(), storage.valuePtr(), boost::bind(&countRelease, &released));
+            code |= !sparse->isExternal();
+            code |= (sparse->toDense() - m).norm() > EPSILON;
+            code |= (SparseSpace<double>(5).k(*sparse) - m.adjoint() * m).norm() > EPSILON;
+        }
+        code |= released != 2;
+        
+        return code;
+    }
+    
+    int test_reduced_precision(DensePrecision::Type precision) {
+        typedef Dense<double>::ScalarMatrix ScalarMatrix;
+        typedef Dense<double>::FMatrixBasePtr FMatrixBasePtr;
+        int code = 0;
+        
+        // Unit roundoff of the storage, and tolerance for double (or single) precision products
+        const double tolerance = 1e-10;
+        const double productTolerance = precision == DensePrecision::SINGLE ? 1e-5 : tolerance;
+        const double u = precision == DensePrecision::SINGLE ? std::ldexp(1., -24) : 
+                         (precision == DensePrecision::HALF ? std::ldexp(1., -11) : std::ldexp(1., -8));
+        
+        // Conversions: exactly representable values are kept, others are rounded
+        const double exact[] = { 0., 1., -2., 0.5, 3.75, std::ldexp(1., -14) };
+        for(size_t i = 0; i < sizeof(exact) / sizeof(exact[0]); i++) {
+            uint16_t c[2]; double d;
+            encodePrecision(precision, exact + i, exact + i + 1, c);
+            decodePrecision(precision, c, 1, &d);
+            code |= d != exact[i];
+        }
+        
+        Eigen::VectorXd values = Eigen::VectorXd::Random(1000).array() + 2., decoded(1000);
+        std::vector<uint16_t> compact(values.size() * DensePrecision::units(precision));
+        encodePrecision(precision, values.data(), values.data() + values.size(), &compact[0]);
+        decodePrecision(precision, &compact[0], values.size(), decoded.data());
+        double conversionError = ((decoded - values).array().abs() / values.array().abs()).maxCoeff();
+        KQP_LOG_INFO_F(logger, "Maximum relative conversion error is %g (unit roundoff %g)", %conversionError %u);
+        code |= conversionError > u;
+        
+        // Feature matrices: blocks of different sizes are used for products
+        DenseSpace<double> space(300, precision), fullSpace(300);
+        ScalarMatrix m1 = ScalarMatrix::Random(300, 150), m2 = ScalarMatrix::Random(300, 40);
+        
+        FMatrixBasePtr mX = space.newMatrix();
+        Dense<double> &dX = dynamic_cast<Dense<double> &>(*mX);
+        dX.add(m1);
+        space.k(dX);
+        dX.add(m2);
+        code |= dX.precision() != precision || dX.size() != 190 || dX.dimension() != 300;
+        
+        ScalarMatrix m(300, 190);
+        m << m1, m2;
+        const ScalarMatrix decodedX = dX.toDense();
+        
+        // Products are exact (up to the product precision) for the stored values
+        double gramError = (space.k(dX) - decodedX.adjoint() * decodedX).norm() / decodedX.squaredNorm();
+        double gramStorageError = (space.k(dX) - m.adjoint() * m).norm() / m.squaredNorm();
+        KQP_LOG_INFO_F(logger, "Relative Gram error is %g (storage: %g)", %gramError %gramStorageError);
+        code |= gramError > productTolerance || gramStorageError > 4 * u + productTolerance;
+        
+        // Inner products with full precision pre-images and subsets
+        Dense<double> dY(m2);
+        ScalarMatrix mY1 = ScalarMatrix::Random(190, 3), mY2 = ScalarMatrix::Random(40, 2);
+        Eigen::VectorXd mD1 = Eigen::VectorXd::Random(3), mD2 = Eigen::VectorXd::Random(2);
+        ScalarMatrix expected = mD1.asDiagonal() * mY1.adjoint() * decodedX.adjoint() * m2 * mY2 * mD2.asDiagonal();
+        code |= (space.k(dX, mY1, mD1, dY, mY2, mD2) - expected).norm() > tolerance * expected.norm();
+        
+        std::vector<bool> which(190, false);
+        which[3] = which[160] = which[170] = true;
+        FMatrixBasePtr subset = dX.subset(which.begin(), which.end());
+        const Dense<double> &dSubset = dynamic_cast<const Dense<double> &>(*subset);
+        code |= !dSubset.isCompact() || dSubset.size() != 3;
+        code |= (dSubset.toDense().col(1) - decodedX.col(160)).norm() > 0;
+        
+        // Linear combinations (decoded by blocks)
+        ScalarMatrix mA = ScalarMatrix::Random(190, 4);
+        ScalarMatrix combined = decodedX * mA;
+        code |= (dX.combine(mA) - combined).norm() > 1e-12 * combined.norm();
+        
+        // Conversion from a full precision matrix
+        FMatrixBasePtr converted = space.newMatrix(Dense<double>(m));
+        code |= (space.k(*converted) - space.k(dX)).norm() > 0;
+        code |= (fullSpace.k(*fullSpace.newMatrix(dX)) - space.k(dX)).norm() > productTolerance * space.k(dX).norm();
+        
+        return code;
+    }
+    
+    int test_dense_single(std::deque<std::string> &) {
+        return test_reduced_precision(DensePrecision::SINGLE);
+    }
+    
+    int test_dense_half(std::deque<std::string> &) {
+        return test_reduced_precision(DensePrecision::HALF);
+    }
+    int test_dense_bfloat16(std::deque<std::string> &) {
+        return test_reduced_precision(DensePrecision::BFLOAT16);
+    }
+    
+    int test_binary(std::deque<std::string> &) {
+        typedef Dense<double>::ScalarMatrix ScalarMatrix;
+        typedef Dense<double>::FMatrixBasePtr FMatrixBasePtr;
+        const double tolerance = 1e-10;
+        int code = 0;
+        
+        // Random fingerprints (the dimension is not a multiple of 64, and there is more than one block of vectors)
+        const Index dimension = 150;
+        ScalarMatrix m = (ScalarMatrix::Random(dimension, 150).array() > 0.5).cast<double>();
+        m.col(7).setZero();
+        m.col(8).setZero();
+        
+        BinaryMatrix<double> mX(m.leftCols(100));
+        code |= mX.size() != 100 || mX.dimension() != dimension || mX.count(7) != 0;
+        code |= (mX.toDense() - m.leftCols(100)).norm() > 0;
+        
+        // Gram matrices are computed incrementally
+        BinarySpace<double> linear(dimension), hamming(dimension, BinarySpace<double>::HAMMING), tanimoto(dimension, BinarySpace<double>::TANIMOTO);
+        code |= (linear.k(mX) - m.leftCols(100).adjoint() * m.leftCols(100)).norm() > 0;
+        
+        Eigen::SparseMatrix<double> sparse = m.rightCols(50).sparseView();
+        mX.add(sparse);
+        code |= (mX.toDense() - m).norm() > 0;
+        
+        const ScalarMatrix common = m.adjoint() * m;
+        const Eigen::VectorXd counts = m.colwise().sum().adjoint();
+        ScalarMatrix distance = -2 * common;
+        distance.colwise() += counts;
+        distance.rowwise() += counts.adjoint();
+        
+        ScalarMatrix expected = (ScalarMatrix::Constant(150, 150, dimension) - distance).eval();
+        code |= (linear.k(mX) - common).norm() > 0;
+        code |= (hamming.k(mX) - expected).norm() > 0;
+        
+        expected = common.array() / (distance + common).array();
+        expected(7, 7) = expected(7, 8) = expected(8, 7) = expected(8, 8) = 1;
+        code |= (tanimoto.k(mX) - expected).norm() > tolerance;
+        
+        // Inner products between matrices and subsets
+        std::vector<bool> which(150, false);
+        which[1] = which[70] = which[140] = true;
+        FMatrixBasePtr mY = mX.subset(which.begin(), which.end());
+        ScalarMatrix mY2(3, 2);
+        mY2 << 1, 0, 0, 1, 2, -1;
+        code |= (tanimoto.k(mX, Eigen::Identity<double>(150, 150), *mY, mY2) - expected.col(1) * mY2.row(0) - expected.col(70) * mY2.row(1) - expected.col(140) * mY2.row(2)).norm() > tolerance;
+        
+        BinaryMatrix<double> mZ(dimension);
+        mZ.addWords(mX.words(0), 150);
+        code |= (linear.k(mZ) - common).norm() > 0;
+        
+        // Gaussian kernel on the Hamming distance
+        GaussianSpace<double> gaussian(4., linear.copy());
+        expected = (-distance / 16.).array().exp();
+        code |= (gaussian.k(mX) - expected).norm() > tolerance * expected.norm();
+        
+        return code;
+    }
+    
+    //! A string, with a kernel counting common characters
+    struct StringVector : public GenericVector {
+        std::string value;
+        StringVector(const std::string &value) : value(value) {}
+        
+        static void kernel(int *calls, const FeatureList<double>::List &x, const FeatureList<double>::List &y, Eigen::MatrixXd &result) {
+            (*calls)++;
+            for(size_t i = 0; i < x.size(); i++)
+                for(size_t j = 0; j < y.size(); j++) {
+                    const std::string &a = static_cast<const StringVector &>(*x[i]).value, &b = static_cast<const StringVector &>(*y[j]).value;
+                    result(i, j) = 0;
+                    for(size_t k = 0; k < std::min(a.size(), b.size()); k++)
+                        result(i, j) += a[k] == b[k];
+                }
+        }
+    };
+    
+    int test_generic(std::deque<std::string> &) {
+        typedef Dense<double>::FMatrixBasePtr FMatrixBasePtr;
+        int code = 0;
+        int calls = 0;
+        
+        const char *strings[] = { "kernel", "kennel", "colonel", "karnel", "quantum", "quorum" };
+        FeatureList<double> list;
+        for(size_t i = 0; i < 4; i++)
+            list.add(FeatureList<double>::VectorPtr(new StringVector(strings[i])));
+        
+        GenericSpace<double> space(boost::shared_ptr< GenericKernel<double> >(new FunctionKernel<double>(boost::bind(&StringVector::kernel, &calls, _1, _2, _3))), 2);
+        
+        // Blocks of (at most) 2 x 2 values
+        const Eigen::MatrixXd gram = space.k(list);
+        code |= calls != 4 || space.evaluations() != 16 || gram(0, 1) != 5 || gram(1, 2) != 0 || gram(3, 3) != 6;
+        
+        // Adding vectors only computes the new columns
+        list.add(FeatureList<double>::VectorPtr(new StringVector(strings[4])));
+        list.add(FeatureList<double>::VectorPtr(new StringVector(strings[5])));
+        Eigen::MatrixXd gram2 = space.k(list);
+        code |= space.evaluations() != 16 + 12 || (gram2.topLeftCorner(4, 4) - gram).norm() > 0 || gram2(4, 5) != 2 || gram2(5, 4) != 2;
+        
+        // Subsets and copies use the cache
+        std::vector<bool> which(6, true);
+        which[1] = false;
+        FMatrixBasePtr subset = list.subset(which.begin(), which.end());
+        FeatureList<double> copy(list);
+        int before = calls;
+        Eigen::MatrixXd expected(5, 6);
+        expected << gram2.row(0), gram2.bottomRows(4);
+        code |= (space.k(*subset, copy) - expected).norm() > 0;
+        code |= (space.k(copy) - gram2).norm() > 0;
+        code |= calls != before;
+        KQP_LOG_INFO_F(logger, "Generic kernel: %d calls, %d evaluations, %d cached values", %calls %space.evaluations() %space.cacheSize());
+        
+        // Concurrent evaluations on copies of the space (sharing the cache)
+        int errors = 0;
+#pragma omp parallel for reduction(+:errors)
+        for(int i = 0; i < 8; i++) {
+            GenericSpace<double> spaceCopy(space);
+            FeatureList<double> listCopy(list.list());
+            errors += (spaceCopy.k(listCopy) - gram2).norm() > 0;
+        }
+        code |= errors > 0;
+        
+        // Changing the kernel invalidates the Gram matrices
+        space.kernel(boost::shared_ptr< GenericKernel<double> >(new FunctionKernel<double>(
+            [&calls](const FeatureList<double>::List &x, const FeatureList<double>::List &y, Eigen::MatrixXd &result) {
+                StringVector::kernel(&calls, x, y, result);
+                result *= 2;
+            })));
+        code |= (space.k(list) - 2 * gram2).norm() > 0;
+        
+        return code;
+    }
+    
+    int test_hashed_sparse(std::deque<std::string> &) {
+        typedef std::vector< std::pair<uint64_t, double> > Features;
+        int code = 0;
+        
+        // Two vectors sharing 20 of their 50 features (positive values, so that collisions without signs would be biased)
+        Features x, y;
+        double exact = 0, xNorm = 0;
+        for(int i = 0; i < 50; i++) {
+            uint64_t id = ((uint64_t)std::rand() << 32) ^ std::rand();
+            x.push_back(std::make_pair(id, Eigen::internal::random<double>(0, 1)));
+            xNorm += x.back().second * x.back().second;
+            if (i < 20) {
+                y.push_back(std::make_pair(id, Eigen::internal::random<double>(0, 1)));
+                exact += x.back().second * y.back().second;
+            } else 
+                y.push_back(std::make_pair(id + 1, Eigen::internal::random<double>(0, 1)));
+        }
+        
+        // Without collisions, inner products are exact
+        {
+            HashedSparseSpace<double> space(Index(1) << 20);
+            HashedSparseSpace<double>::Builder builder(space);
+            builder.add(x.begin(), x.end());
+            builder.next();
+            builder.add(y.begin(), y.end());
+            boost::shared_ptr< Sparse<double> > mX = builder.matrix();
+            code |= mX->size() != 2 || mX->dimension() != space.dimension();
+            code |= std::abs(space.k(*mX)(0, 1) - exact) > 1e-10 || std::abs(space.k(*mX)(0, 0) - xNorm) > 1e-10;
+        }
+        
+        // With collisions, inner products are unbiased estimates (the mean is within 4 standard errors)
+        const int samples = 5000;
+        Eigen::ArrayXd inner(samples), norm(samples);
+        for(int seed = 0; seed < samples; seed++) {
+            HashedSparseSpace<double> space(8, seed);
+            boost::shared_ptr< Sparse<double> > mX = space.hash(x.begin(), x.end()), mY = space.hash(y.begin(), y.end());
+            inner[seed] = space.k(*mX, *mY)(0, 0);
+            norm[seed] = space.k(*mX)(0, 0);
+        }
+        
+        double innerError = std::abs(inner.mean() - exact) / std::sqrt((inner - inner.mean()).square().sum() / (samples - 1) / samples);
+        double normError = std::abs(norm.mean() - xNorm) / std::sqrt((norm - norm.mean()).square().sum() / (samples - 1) / samples);
+        KQP_LOG_INFO_F(logger, "Hashed inner product: %g (exact %g, %g standard errors)", %inner.mean() %exact %innerError);
+        KQP_LOG_INFO_F(logger, "Hashed squared norm: %g (exact %g, %g standard errors)", %norm.mean() %xNorm %normError);
+        code |= innerError > 4 || normError > 4;
+        
+        return code;
+    }
+    
+    //! Brute force Wendland kernel
+    Eigen::MatrixXd wendland(const Eigen::MatrixXd &x, const Eigen::MatrixXd &y, double support) {
+        Eigen::MatrixXd k(x.cols(), y.cols());
+        for(Index i = 0; i < x.cols(); i++)
+            for(Index j = 0; j < y.cols(); j++) {
+                double r = (x.col(i) - y.col(j)).norm() / support;
+                k(i, j) = r < 1 ? std::pow(1 - r, 4) * (4 * r + 1) : 0;
+            }
+        return k;
+    }
+    
+    int test_compact_support(std::deque<std::string> &) {
+        typedef Dense<double>::FMatrixBasePtr FMatrixBasePtr;
+        typedef Eigen::MatrixXd ScalarMatrix;
+        int code = 0;
+        
+        // Points in a 20 x 20 square (the last ones being duplicates), so that most kernel values are null
+        const Index n = 300, duplicates = 5;
+        ScalarMatrix points = 10 * (ScalarMatrix::Random(2, n) + ScalarMatrix::Ones(2, n));
+        points.rightCols(duplicates) = points.leftCols(duplicates);
+        
+        DenseSpace<double> base(2);
+        boost::shared_ptr< CompactSupportSpace<double> > space(new CompactSupportSpace<double>(1.5, base.copy()));
+        FMatrixBasePtr mX = base.newMatrix(points);
+        
+        // Sparse Gram matrix
+        const ScalarMatrix expected = wendland(points, points, 1.5);
+        Eigen::SparseMatrix<double> gram = space->sparseK(*mX);
+        KQP_LOG_INFO_F(logger, "Compact support Gram matrix: %d non null values out of %d", %gram.nonZeros() %(n * n));
+        code |= (gram.toDense() - expected).norm() > 1e-10 || gram.nonZeros() != (expected.array() != 0).count();
+        code |= (space->k(*mX) - expected).norm() > 1e-10;
+        
+        // Inner products
+        const ScalarMatrix others = 10 * (ScalarMatrix::Random(2, 50) + ScalarMatrix::Ones(2, 50));
+        FMatrixBasePtr mY = base.newMatrix(others);
+        ScalarMatrix mY1 = ScalarMatrix::Random(n, 3), mY2 = ScalarMatrix::Random(50, 2);
+        ScalarMatrix inner = mY1.adjoint() * wendland(points, others, 1.5) * mY2;
+        code |= (space->k(*mX, mY1, *mY, mY2) - inner).norm() > 1e-10 * inner.norm();
+        code |= (space->k(*mY, mY2, *mX, mY1) - inner.adjoint()).norm() > 1e-10 * inner.norm();
+        
+        // Kernel values
+        std::vector< KernelValues<double> > values(2);
+        values[1] = KernelValues<double>(points.col(0).dot(points.col(1)), points.col(0).squaredNorm(), points.col(1).squaredNorm());
+        space->update(values);
+        code |= std::abs(values[0]._inner - expected(0, 1)) > 1e-10 || values[0]._innerX != 1;
+        
+        // Accumulator: the operator should be X A A^T X^T (checked through the inner products with X),
+        // and the duplicated pre-images are merged
+        {
+            ScalarMatrix mA = ScalarMatrix::Random(n, 10);
+            AccumulatorKernelEVD<double, false> builder(space);
+            builder.add(2., mX->copy(), mA);
+            Decomposition<double> d = builder.getDecomposition();
+            ScalarMatrix mY = d.mY * d.mD.asDiagonal() * d.mY.adjoint();
+            ScalarMatrix cross = space->k(*mX, *d.mX);
+            ScalarMatrix delta = expected * (2. * mA * mA.adjoint()) * expected - cross * mY * cross.adjoint();
+            code |= d.mX->size() != n - duplicates || delta.norm() > 1e-10 * expected.squaredNorm() * mA.squaredNorm();
+        }
+        
+        // Null space cleaning: duplicates are removed, and the feature vectors are kept
+        {
+            FMatrixBasePtr mF = mX->copy();
+            const ScalarMatrix original = ScalarMatrix::Random(n, 4);
+            ScalarMatrix mA = original;
+            ReducedSetNullSpace<double>::run(space, mF, mA);
+            
+            double norm = (space->k(*mX, original, *mX, original)).trace();
+            double error = norm + space->k(*mF, mA, *mF, mA).trace() - 2 * space->k(*mX, original, *mF, mA).trace();
+            KQP_LOG_INFO_F(logger, "Null space cleaning: %d pre-images out of %d [error %g]", %mF->size() %n %error);
+            code |= mF->size() > n - duplicates || std::abs(error) > 1e-10 * norm;
+        }
+        
+        return code;
+    }
+    
+    int test_gauss_transform(std::deque<std::string> &) {
+        typedef Dense<double>::FMatrixBasePtr FMatrixBasePtr;
+        typedef Eigen::MatrixXd ScalarMatrix;
+        int code = 0;
+        
+        // Points in a 10 x 10 square (few enough for a quick test, with a bandwidth large enough
+        // for the transform to be faster than the direct computation)
+        const Index n = 600, m = 400;
+        const double sigma = 4, tolerance = 1e-4;
+        const ScalarMatrix sources = 5 * (ScalarMatrix::Random(2, m) + ScalarMatrix::Ones(2, m));
+        const ScalarMatrix targets = 5 * (ScalarMatrix::Random(2, n) + ScalarMatrix::Ones(2, n));
+        const ScalarMatrix weights = ScalarMatrix::Random(m, 3);
+        
+        ScalarMatrix exact(n, m);
+        for(Index j = 0; j < n; j++)
+            for(Index i = 0; i < m; i++)
+                exact(j, i) = std::exp(-(targets.col(j) - sources.col(i)).squaredNorm() / (sigma * sigma));
+        const ScalarMatrix kw = exact * weights;
+        const Eigen::RowVectorXd bound = tolerance * weights.cwiseAbs().colwise().sum();
+        
+        // Transform
+        ImprovedFastGaussTransform<double> transform(sources, sigma, tolerance);
+        ScalarMatrix result;
+        code |= !transform.run(targets, weights, result);
+        double error = ((result - kw).cwiseAbs().array().rowwise() / bound.array()).maxCoeff();
+        KQP_LOG_INFO_F(logger, "Fast Gauss transform: %d clusters, order %d, %d terms [error %g of the bound]", 
+                       %transform.clusters() %transform.order() %transform.terms() %error);
+        code |= error > 1;
+        
+        // Gaussian space inner products
+        DenseSpace<double> base(2);
+        GaussianSpace<double> space(sigma, base.copy());
+        space.tolerance(tolerance);
+        FMatrixBasePtr mX1 = base.newMatrix(targets), mX2 = base.newMatrix(sources);
+        const ScalarMatrix mY1 = ScalarMatrix::Random(n, 2);
+        const SpaceBase<double> &fs = space;
+        ScalarMatrix inner = fs.k(*mX1, mY1, *mX2, weights);
+        ScalarMatrix expected = mY1.adjoint() * kw;
+        code |= ((inner - expected).cwiseAbs().array() / (mY1.cwiseAbs().colwise().sum().transpose() * bound).array()).maxCoeff() > 1;
+        
+        // Exact computation when the tolerance is null
+        space.tolerance(0);
+        code |= (fs.k(*mX1, mY1, *mX2, weights) - expected).norm() > 1e-10 * expected.norm();
+        
+        return code;
+    }
+    
+    int test_multi_bandwidth(std::deque<std::string> &) {
+        typedef GaussianSpace<double>::ScalarMatrix ScalarMatrix;
+        typedef GaussianSpace<double>::FMatrixBasePtr FMatrixBasePtr;
+        int code = 0;
+        
+        const Index dimension = 5;
+        const std::vector<double> sigmas = { 0.5, 1, 2, 4 };
+        DenseSpace<double> base(dimension);
+        FMatrixBasePtr mX1 = base.newMatrix(ScalarMatrix(ScalarMatrix::Random(dimension, 40)));
+        FMatrixBasePtr mX2 = base.newMatrix(ScalarMatrix(ScalarMatrix::Random(dimension, 30)));
+        
+        // Kernel matrices, compared with one Gaussian space per bandwidth
+        GaussianSpace<double> space(1, base.copy());
+        std::vector<ScalarMatrix> grams = space.kernelMatrices(*mX1, sigmas);
+        std::vector<ScalarMatrix> inners = space.kernelMatrices(*mX1, *mX2, sigmas);
+        code |= grams.size() != sigmas.size() || inners.size() != sigmas.size();
+        for(size_t s = 0; s < sigmas.size() && !code; s++) {
+            GaussianSpace<double> other(sigmas[s], base.copy());
+            const SpaceBase<double> &fs = other;
+            double error = (grams[s] - fs.k(*mX1)).norm() + (inners[s] - fs.k(*mX1, Eigen::Identity<double>(40, 40), *mX2, Eigen::Identity<double>(30, 30))).norm();
+            KQP_LOG_INFO_F(logger, "Bandwidth %g: error %g", %sigmas[s] %error);
+            code |= error > 1e-10;
+        }
+        
+        // Decompositions, compared with one accumulator per bandwidth
+        const ScalarMatrix mA1 = ScalarMatrix::Random(40, 10), mA2 = ScalarMatrix::Random(30, 5);
+        AccumulatorKernelEVD<double, false> accumulator(space.copy());
+        accumulator.add(1, mX1, mA1);
+        accumulator.add(.5, mX2, mA2);
+        std::vector< Decomposition<double> > decompositions = accumulator.getDecompositions(sigmas);
+        code |= decompositions.size() != sigmas.size();
+        for(size_t s = 0; s < sigmas.size() && !code; s++) {
+            AccumulatorKernelEVD<double, false> single(GaussianSpace<double>(sigmas[s], base.copy()).copy());
+            single.add(1, mX1, mA1);
+            single.add(.5, mX2, mA2);
+            Decomposition<double> expected = single.getDecomposition();
+            const Decomposition<double> &d = decompositions[s];
+            
+            ScalarMatrix op = d.mY * d.mD.asDiagonal() * d.mY.adjoint();
+            ScalarMatrix expectedOp = expected.mY * expected.mD.asDiagonal() * expected.mY.adjoint();
+            double error = (op - expectedOp).norm() / expectedOp.norm();
+            KQP_LOG_INFO_F(logger, "Bandwidth %g: decomposition error %g", %sigmas[s] %error);
+            std::vector<double> parameters(d.fs->numberOfParameters());
+            d.fs->getParameters(parameters, 0);
+            code |= error > 1e-8 || parameters[0] != sigmas[s];
+        }
+        
+        return code;
+    }
+    
+    int test_polynomial(std::deque<std::string> &) {
+        typedef PolynomialSpace<double>::ScalarMatrix ScalarMatrix;
+        int code = 0;
+        
+        DenseSpace<double> base(5);
+        const ScalarMatrix m = ScalarMatrix::Random(5, 20);
+        auto mX = base.newMatrix(m);
+        const ScalarMatrix gram = m.adjoint() * m;
+        
+        // Repeated squaring against pow (including the fallback for large degrees)
+        for(int degree = 0; degree <= PolynomialSpace<double>::MAX_INTEGER_DEGREE + 1; degree += (degree < 10 ? 1 : 55)) {
+            PolynomialSpace<double> space(.5, degree, base.copy());
+            const ScalarMatrix expected = (gram + ScalarMatrix::Constant(20, 20, .5)).array().pow(degree);
+            double error = (space.k(*mX) - expected).norm() / expected.norm();
+            double scalarError = std::abs(PolynomialSpace<double>::power(1.5, degree) / std::pow(1.5, degree) - 1);
+            KQP_LOG_INFO_F(logger, "Polynomial kernel of degree %d: error %g, scalar error %g", %degree %error %scalarError);
+            code |= error > 1e-12 || scalarError > 1e-12;
+        }
+        
+        return code;
+    }
+    
+    /// Compares the kernel values and partials of a block with those computed pair by pair
+    int checkKernelValuesBlock(const SpaceBase<double> &space, const Eigen::VectorXd &inner, const Eigen::VectorXd &normsX, const Eigen::VectorXd &normsY, const std::vector<int> &leaves) {
+        typedef Eigen::VectorXd RealVector;
+        const Index n = inner.size();
+        const int count = space.numberOfKernelValues();
+        const RealVector alpha = RealVector::Random(n);
+        
+        KernelValuesBlock<double> block(n, count);
+        for(int leaf: leaves) {
+            block._inner.col(leaf) = inner;
+            block._innerX.col(leaf) = normsX;
+            block._innerY.col(leaf) = normsY;
+        }
+        space.update(block);
+        
+        std::vector<double> partials(space.numberOfParameters(), 0), blockPartials(space.numberOfParameters(), 0);
+        for(int mode = -1; mode <= 1; mode++)
+            space.updatePartials(alpha, blockPartials, block, mode);
+
+        double error = 0;
+        std::vector< KernelValues<double> > values(count);
+        for(Index i = 0; i < n; i++) {
+            for(int leaf: leaves)
+                values[leaf] = KernelValues<double>(inner[i], normsX[i], normsY[i]);
+            space.update(values);
+            for(int k = 0; k < count; k++)
+                error += std::abs(values[k]._inner - block._inner(i, k)) + std::abs(values[k]._innerX - block._innerX(i, k)) + std::abs(values[k]._innerY - block._innerY(i, k));
+            for(int mode = -1; mode <= 1; mode++)
+                space.updatePartials(alpha[i], partials, values, mode);
+        }
+        
+        double partialsError = 0, partialsNorm = 0;
+        for(size_t j = 0; j < partials.size(); j++) {
+            partialsError += std::abs(partials[j] - blockPartials[j]);
+            partialsNorm += std::abs(partials[j]);
+        }
+        KQP_LOG_INFO_F(logger, "Kernel values error %g, partials error %g (norm %g)", %error %partialsError %partialsNorm);
+        return error > 1e-10 * n || partialsError > 1e-10 * partialsNorm || partialsNorm == 0;
+    }
+    
+    int test_kernel_values_block(std::deque<std::string> &) {
+        typedef Eigen::MatrixXd ScalarMatrix;
+        int code = 0;
+        
+        // Pairs of vectors (with their base inner products)
+        const Index n = 200;
+        const ScalarMatrix mX = ScalarMatrix::Random(3, n), mY = ScalarMatrix::Random(3, n);
+        const Eigen::VectorXd inner = mX.cwiseProduct(mY).colwise().sum().transpose();
+        const Eigen::VectorXd normsX = mX.colwise().squaredNorm().transpose(), normsY = mY.colwise().squaredNorm().transpose();
+        
+        typedef SpaceBase<double>::FSpace FSpace;
+        const FSpace base = DenseSpace<double>(3).copy();
+        const FSpace gaussian(new GaussianSpace<double>(1.5, base));
+        const FSpace polynomial(new PolynomialSpace<double>(.5, 3, base));
+        code |= checkKernelValuesBlock(*gaussian, inner, normsX, normsY, { 1 });
+        code |= checkKernelValuesBlock(*polynomial, inner, normsX, normsY, { 1 });
+        
+        // Sum of both kernels (kernel values: sum, gaussian, dense, polynomial, dense)
+        KernelSumSpace<double> sum;
+        sum.addSpace(1., gaussian);
+        sum.addSpace(2., polynomial);
+        code |= checkKernelValuesBlock(sum, inner, normsX, normsY, { 2, 4 });
+        
+        // Pair by pair fallback
+        code |= checkKernelValuesBlock(CompactSupportSpace<double>(3., base), inner, normsX, normsY, { 1 });
+        
+        return code;
+    }
+    
+    int test_kernel_sum(std::deque<std::string> &) {
+        typedef Eigen::MatrixXd ScalarMatrix;
+        typedef SpaceBase<double>::FSpace FSpace;
+        typedef SpaceBase<double>::FMatrix FMatrix;
+        int code = 0;
+        
+        // Subspaces over different bases
+        const Index n = 50;
+        std::vector<FSpace> spaces;
+        std::vector<FMatrix> matrices;
+        for(Index d = 2; d < 8; d++) {
+            const FSpace base = DenseSpace<double>(d).copy();
+            spaces.push_back(d % 2 ? FSpace(new GaussianSpace<double>(d, base)) : FSpace(new PolynomialSpace<double>(1, 2, base)));
+            matrices.push_back(Dense<double>::create(ScalarMatrix(ScalarMatrix::Random(d, n))));
+        }
+        spaces.push_back(DenseSpace<double>(3).copy());
+        matrices.push_back(matrices[1]);
+        
+        KernelSumSpace<double> sum;
+        double total = 0;
+        for(size_t i = 0; i < spaces.size(); i++) {
+            sum.addSpace(i + 1., spaces[i]);
+            total += (i + 1.) * (i + 1.);
+        }
+        
+        ScalarMatrix expected = ScalarMatrix::Zero(n, n);
+        for(size_t i = 0; i < spaces.size(); i++) 
+            expected += (i + 1.) * (i + 1.) / total * spaces[i]->k(*matrices[i]);
+        
+        // The last subspace shares a matrix (evaluated sequentially)
+        const SpaceBase<double> &fs = sum;
+        for(int shared = 0; shared < 2; shared++) {
+            std::vector<FMatrix> m(matrices);
+            if (!shared)
+                m.back() = matrices[1]->copy();
+            KernelSumMatrix<double> mX(m);
+            
+            double error = (fs.k(mX) - expected).norm() / expected.norm();
+            const ScalarMatrix mY1 = ScalarMatrix::Random(n, 3), mY2 = ScalarMatrix::Random(n, 4);
+            const ScalarMatrix expectedInner = mY1.adjoint() * expected * mY2;
+            double innerError = (fs.k(mX, mY1, mX, mY2) - expectedInner).norm() / expectedInner.norm();
+            KQP_LOG_INFO_F(logger, "Kernel sum (shared matrix = %d): Gram error %g, inner products error %g", %shared %error %innerError);
+            code |= error > 1e-12 || innerError > 1e-12;
+        }
+        
+        // A subspace used twice (evaluated sequentially)
+        KernelSumSpace<double> twice;
+        twice.addSpace(1., spaces[0]);
+        twice.addSpace(1., spaces[0]);
+        const SpaceBase<double> &fsTwice = twice;
+        KernelSumMatrix<double> mX(std::vector<FMatrix>({ matrices[0], matrices[0]->copy() }));
+        const ScalarMatrix &gram = spaces[0]->k(*matrices[0]);
+        code |= (fsTwice.k(mX) - gram).norm() > 1e-12 * gram.norm();
+        
+        return code;
+    }
+    
+    int test_cpu_kernels(std::deque<std::string> &) {
+        int code = 0;
+        const Index n = 1003;
+        Eigen::VectorXd x = 750 * Eigen::VectorXd::Random(n);
+        x.head(8) << 0, -0., 1e-300, -706.9, 709.7, -710, 800, -1e300;
+        const Eigen::VectorXd z2 = Eigen::VectorXd::Random(n).cwiseAbs(), d = Eigen::VectorXd::Random(n);
+        Eigen::VectorXi indices(n);
+        for(Index i = 0; i < n; i++) indices[i] = (7 * i) % n;
+
+        // All the half precision values
+        std::vector<uint16_t> halves(65536);
+        for(size_t i = 0; i < halves.size(); i++) halves[i] = (uint16_t)i;
+
+        double secular = 0, gatherDot = 0;
+        for(Index i = 0; i < n; i++) {
+            secular += z2[i] / (d[i] - 2.);
+            gatherDot += z2[i] * d[indices[i]];
+        }
+
+        KQP_LOG_INFO_F(logger, "Detected level: %s, in use: %s", %cpu::name(cpu::detect()) %cpu::name(cpu::level()));
+        for(int l = cpu::BASELINE; l <= cpu::detect(); l++) {
+            const cpu::Kernels &kernels = cpu::kernels((cpu::Level)l);
+            Eigen::VectorXd e = x;
+            kernels.exp(e.data(), n);
+            double expError = 0;
+            for(Index i = 0; i < n; i++) {
+                double expected = std::exp(x[i]);
+                // Values below 1e-307 are flushed to zero
+                if (expected < 1e-307) expError = std::max(expError, e[i]);
+                else if (std::isinf(expected)) expError = std::max(expError, std::isinf(e[i]) ? 0. : 1.);
+                else expError = std::max(expError, std::abs(e[i] - expected) / expected);
+            }
+            double secularError = std::abs(kernels.secular(z2.data(), d.data(), n, 2.) - secular) / std::abs(secular);
+            double dotError = std::abs(kernels.gatherDot(indices.data(), z2.data(), n, d.data()) - gatherDot) / std::abs(gatherDot);
+            std::vector<double> decoded(halves.size());
+            kernels.decodeHalf(&halves[0], halves.size(), &decoded[0]);
+            Index halfErrors = 0;
+            for(size_t i = 0; i < halves.size(); i++) {
+                const double expected = half::toFloat(halves[i]);
+                halfErrors += std::isnan(expected) ? !std::isnan(decoded[i]) : decoded[i] != expected || std::signbit(decoded[i]) != std::signbit(expected);
+            }
+            KQP_LOG_INFO_F(logger, "Kernels %s: exp error %g, secular error %g, gather error %g, half errors %d", 
+                           %cpu::name(kernels.level) %expError %secularError %dotError %halfErrors);
+            code |= kernels.level != l || expError > 1e-15 || secularError > 1e-12 || dotError > 1e-12 || halfErrors > 0;
+        }
+        
+        return code;
+    }
+    
+    int test_mapped_dense(std::deque<std::string> &) {
+        return kqp::MappedTest<DenseSpace<double>, Dense<double>, MappedDense<double>>().test()
+            | kqp::MappedTest<DenseSpace<double>, Dense<double>, MappedDense<double>>().testUnknownDimension();
+    }
+    int test_mapped_sparse(std::deque<std::string> &) {
+        return kqp::MappedTest<SparseSpace<double>, Sparse<double>, MappedSparse<double>>().test();  
+    }
+
     int test_dense(std::deque<std::string> &) {
         return kqp::FMatrixTest<DenseSpace<double>, Dense<double>>().test();  
     }
@@ -203,3 +1002,19 @@ namespace kqp {
 DEFINE_TEST("dense", test_dense);
 DEFINE_TEST("sparse-dense", test_sparse);
 DEFINE_TEST("sparse", test_sparseDense);
+DEFINE_TEST("external", test_external);
+DEFINE_TEST("mapped-dense", test_mapped_dense);
+DEFINE_TEST("mapped-sparse", test_mapped_sparse);
+DEFINE_TEST("dense-half", test_dense_half);
+DEFINE_TEST("dense-bfloat16", test_dense_bfloat16);
+DEFINE_TEST("dense-single", test_dense_single);
+DEFINE_TEST("binary", test_binary);
+DEFINE_TEST("generic", test_generic);
+DEFINE_TEST("hashed-sparse", test_hashed_sparse);
+DEFINE_TEST("compact-support", test_compact_support);
+DEFINE_TEST("gauss-transform", test_gauss_transform);
+DEFINE_TEST("multi-bandwidth", test_multi_bandwidth);
+DEFINE_TEST("polynomial", test_polynomial);
+DEFINE_TEST("kernel-values-block", test_kernel_values_block);
+DEFINE_TEST("kernel-sum", test_kernel_sum);
+DEFINE_TEST("cpu-kernels", test_cpu_kernels);
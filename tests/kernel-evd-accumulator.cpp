@@ -29,10 +29,26 @@ namespace kqp {
         template<bool use_lc>
         int _accumulator(const Dense_evd_test &test) {
             AccumulatorKernelEVD<double, use_lc> builder(DenseSpace<double>::create(test.n));
-            return test.run<double>(logger, builder);
+            int code = test.run<double>(logger, builder);
+            
+            // Downdate of a subset of the pre-images of an update, held by another feature matrix:
+            // only the other pre-image is left
+            if (test.downdates) {
+                AccumulatorKernelEVD<double, use_lc> partial(DenseSpace<double>::create(test.n));
+                Eigen::MatrixXd m = Eigen::MatrixXd::Random(test.n, 4);
+                partial.add(1., Dense<double>::create(m), Eigen::Identity<double>(4, 4));
+                partial.add(-1., Dense<double>::create(Eigen::MatrixXd(m.leftCols(3))), Eigen::Identity<double>(3, 3));
+                Decomposition<double> d = partial.getDecomposition();
+                KQP_LOG_INFO_F(logger, "Partial downdate: %d pre-images left", %d.mX->size());
+                code |= d.mX->size() != 1;
+            }
+            
+            return code;
         }
         
-        int kevd_tests::Accumulator::run(const Dense_evd_test &test) const {
+        int kevd_tests::Accumulator::run(const Dense_evd_test &_test) const {
+            Dense_evd_test test = _test;
+            test.downdates = this->downdates;
             if (this->use_lc) 
                 return _accumulator<true>(test);
             return _accumulator<false>(test);
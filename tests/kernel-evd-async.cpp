@@ -0,0 +1,164 @@
+/*
+ This file is part of the Kernel Quantum Probability library (KQP).
+ 
+ KQP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ KQP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with KQP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <future>
+#include <thread>
+
+#include "kernel-evd-tests.hpp"
+#include <kqp/kernel_evd/async.hpp>
+#include <kqp/kernel_evd/incremental.hpp>
+
+DEFINE_LOGGER(logger, "kqp.test.kernel_evd.async")
+
+namespace kqp {
+    namespace kevd_tests {        
+        namespace {
+            const int PRODUCERS = 4;
+            
+            //! A builder whose updates wait until it is opened
+            class GateKernelEVD : public KernelEVD<double> {
+            public:
+                KQP_SCALAR_TYPEDEFS(double);
+                GateKernelEVD(const boost::shared_ptr< KernelEVD<double> > &builder) 
+                    : KernelEVD<double>(builder->getFSpace()), builder(builder), opened(gate.get_future().share()) {}
+                void open() { gate.set_value(); }
+            protected:
+                virtual void _add(Real alpha, const FMatrix &mX, const ScalarAltMatrix &mA) override {
+                    opened.wait();
+                    builder->add(alpha, mX, mA);
+                }
+                virtual Decomposition<double> _getDecomposition() const override {
+                    return builder->getDecomposition();
+                }
+            private:
+                boost::shared_ptr< KernelEVD<double> > builder;
+                std::promise<void> gate;
+                std::shared_future<void> opened;
+            };
+            
+            //! Updates from several threads, each adding one update out of PRODUCERS
+            int runProducers(const Dense_evd_test &test) {
+                KQP_SCALAR_TYPEDEFS(double);
+                std::vector<double> alphas;
+                std::vector<FMatrixPtr> preImages;
+                std::vector<Eigen::MatrixXd> combinations;
+                Eigen::MatrixXd matrix = Eigen::MatrixXd::Zero(test.n, test.n);
+                Index updates = 0;
+                for(int i = 0; i < test.nb_add; i++) {
+                    // (the random generator is not thread safe)
+                    Eigen::MatrixXd m = Eigen::MatrixXd::Random(test.n, test.max_preimages);
+                    Eigen::MatrixXd mA = Eigen::MatrixXd::Random(test.max_preimages, test.max_lc);
+                    // Null updates are ignored
+                    double alpha = i % 5 == 4 ? 0. : std::abs(Eigen::internal::random_impl<double>::run()) + 1e-3;
+                    matrix += alpha * m * mA * mA.adjoint() * m.adjoint();
+                    alphas.push_back(alpha);
+                    preImages.push_back(Dense<double>::create(m));
+                    combinations.push_back(mA);
+                    updates += mA.cols();
+                }
+                
+                auto produce = [&](KernelEVD<double> &builder) {
+                    std::vector<std::thread> threads;
+                    for(int t = 0; t < PRODUCERS; t++)
+                        threads.push_back(std::thread([&, t] {
+                            for(int i = t; i < test.nb_add; i += PRODUCERS)
+                                builder.add(alphas[i], preImages[i], combinations[i]);
+                        }));
+                    for(auto thread = threads.begin(); thread != threads.end(); ++thread)
+                        thread->join();
+                };
+                
+                // Blocking producers: all the updates are added
+                boost::shared_ptr< KernelEVD<double> > incremental(new IncrementalKernelEVD<double>(DenseSpace<double>::create(test.n)));
+                AsyncKernelEVD<double> builder(incremental, 2);
+                builder.setMaxCoalesced(3);
+                produce(builder);
+                
+                auto d = builder.getDecomposition();
+                Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> evd(matrix);
+                Eigen::MatrixXd mY = Eigen::MatrixXd::Identity(test.n, test.n);
+                double error = KernelOperators<double>::difference(d.fs, d.mX, d.mY, d.mD, Dense<double>::create(evd.eigenvectors()), mY, evd.eigenvalues());
+                KQP_LOG_INFO_F(logger, "Squared error with %d producers is %e (%d updates)", %PRODUCERS %error %d.updateCount);
+                if (error >= test.tolerance || d.updateCount != updates)
+                    return 1;
+                
+                // Dropping producers: dropped updates are not counted
+                boost::shared_ptr< KernelEVD<double> > incremental2(new IncrementalKernelEVD<double>(DenseSpace<double>::create(test.n)));
+                AsyncKernelEVD<double> dropping(incremental2, 1);
+                dropping.setOverflow(AsyncKernelEVD<double>::DROP);
+                produce(dropping);
+                dropping.flush();
+                
+                KQP_LOG_INFO_F(logger, "Dropped %d updates out of %d", %dropping.getDroppedCount() %test.nb_add);
+                if (dropping.getUpdateCount() + dropping.getDroppedCount() * test.max_lc != updates)
+                    return 1;
+                
+                // tryAdd() does not wait for a producer blocked on the full queue
+                if (test.nb_add < 4)
+                    return 0;
+                boost::shared_ptr<GateKernelEVD> gate(new GateKernelEVD(
+                    boost::shared_ptr< KernelEVD<double> >(new IncrementalKernelEVD<double>(DenseSpace<double>::create(test.n)))));
+                AsyncKernelEVD<double> blocking(gate, 1);
+                blocking.setMaxCoalesced(1);
+                blocking.add(alphas[0], preImages[0], combinations[0]);
+                blocking.add(alphas[1], preImages[1], combinations[1]);
+                std::thread blocked([&] { blocking.add(alphas[2], preImages[2], combinations[2]); });
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                bool queued = blocking.tryAdd(alphas[3], preImages[3], combinations[3]);
+                gate->open();
+                blocked.join();
+                blocking.flush();
+                KQP_LOG_INFO_F(logger, "Non blocking add with a blocked producer: queued=%s, %d updates", %queued %blocking.getUpdateCount());
+                return !queued && blocking.getUpdateCount() == 3 * test.max_lc ? 0 : 1;
+            }
+        }
+        
+        int Async::run(const Dense_evd_test &test) const {
+            if (producers)
+                return runProducers(test);
+            
+            // Small queue so that producers block and updates are coalesced, and snapshots
+            // (a long period, so that they are only published when the worker catches up)
+            boost::shared_ptr< KernelEVD<double> > incremental(new IncrementalKernelEVD<double>(DenseSpace<double>::create(test.n)));
+            AsyncKernelEVD<double> builder(incremental, 2);
+            builder.setMaxCoalesced(3);
+            builder.setPublishing(true, 3600);
+            if (int code = test.run(logger, builder))
+                return code;
+            
+            // The last snapshot should be the current decomposition
+            auto snapshot = builder.getSnapshot();
+            auto d = builder.getDecomposition();
+            double error = KernelOperators<double>::difference(d.fs, snapshot->mX, snapshot->mY, snapshot->mD, d.mX, d.mY, d.mD);
+            KQP_LOG_INFO_F(logger, "Squared error between the snapshot and the decomposition is %e", %error);
+            if (error >= test.tolerance)
+                return 1;
+            
+            // The pre-images of the snapshot are shared with the builder, which should not modify them
+            auto preImages = snapshot->mX->copy();
+            builder.add(1., Dense<double>::create(Eigen::MatrixXd::Random(test.n, test.max_preimages)), 
+                        Eigen::MatrixXd::Random(test.max_preimages, test.max_lc));
+            builder.flush();
+            Eigen::MatrixXd mY = Eigen::MatrixXd::Identity(preImages->size(), preImages->size());
+            Eigen::VectorXd mD = Eigen::VectorXd::Ones(preImages->size());
+            double change = snapshot->mX->size() != preImages->size() ? 1.
+                    : KernelOperators<double>::difference(d.fs, snapshot->mX, mY, mD, preImages, mY, mD);
+            KQP_LOG_INFO_F(logger, "Change of the snapshot after an update is %e", %change);
+            return change == 0 ? 0 : 1;
+        }
+    }
+}
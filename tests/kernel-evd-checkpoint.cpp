@@ -0,0 +1,66 @@
+/*
+ This file is part of the Kernel Quantum Probability library (KQP).
+ 
+ KQP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+ 
+ KQP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+ 
+ You should have received a copy of the GNU General Public License
+ along with KQP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "kernel-evd-tests.hpp"
+
+#include <kqp/kernel_evd/accumulator.hpp>
+#include <kqp/kernel_evd/async.hpp>
+#include <kqp/kernel_evd/dense_direct.hpp>
+#include <kqp/kernel_evd/divide_and_conquer.hpp>
+#include <kqp/kernel_evd/incremental.hpp>
+
+DEFINE_LOGGER(logger, "kqp.test.kernel_evd.checkpoint")
+
+namespace kqp {
+    namespace kevd_tests {
+        namespace {
+            typedef boost::shared_ptr< KernelEVD<double> > BuilderPtr;
+
+            //! Creates a new builder (with an empty state)
+            BuilderPtr create(Checkpoint::Kind kind, const Dense_evd_test &test) {
+                auto fs = DenseSpace<double>::create(test.n);
+                switch(kind) {
+                    case Checkpoint::DIRECT:
+                        return BuilderPtr(new DenseDirectBuilder<double>(test.n));
+                    case Checkpoint::ACCUMULATOR:
+                        return BuilderPtr(new AccumulatorKernelEVD<double, true>(fs));
+                    case Checkpoint::ACCUMULATOR_NO_LC:
+                        return BuilderPtr(new AccumulatorKernelEVD<double, false>(fs));
+                    case Checkpoint::INCREMENTAL:
+                        return BuilderPtr(new IncrementalKernelEVD<double>(fs));
+                    case Checkpoint::DIVIDE_AND_CONQUER: {
+                        // Small batches, so that the checkpoint holds a stack of decompositions
+                        boost::shared_ptr< DivideAndConquerBuilder<double> > builder(new DivideAndConquerBuilder<double>(fs));
+                        builder->setBatchSize(std::max(1, test.nb_add * test.min_preimages / 4));
+                        builder->setBuilder(BuilderPtr(new IncrementalKernelEVD<double>(fs)));
+                        builder->setMerger(BuilderPtr(new DenseDirectBuilder<double>(test.n)));
+                        return builder;
+                    }
+                    case Checkpoint::ASYNC:
+                        return BuilderPtr(new AsyncKernelEVD<double>(BuilderPtr(new IncrementalKernelEVD<double>(fs)), 2));
+                }
+                KQP_THROW_EXCEPTION(illegal_argument_exception, "Unknown builder");
+            }
+        }
+
+        int Checkpoint::run(const Dense_evd_test &test) const {
+            BuilderPtr builder = create(kind, test);
+            BuilderPtr resumed = create(kind, test);
+            return test.run(logger, *builder, resumed.get());
+        }
+    }
+}
@@ -14,6 +14,9 @@
  You should have received a copy of the GNU General Public License
  along with KQP.  If not, see <http://www.gnu.org/licenses/>.
  */
+#include <atomic>
+#include <stdexcept>
+
 #include "kernel-evd-tests.hpp"
 #include <kqp/kernel_evd/incremental.hpp>
 
@@ -21,9 +24,97 @@ DEFINE_LOGGER(logger, "kqp.test.kernel_evd.incremental")
 
 namespace kqp {
     namespace kevd_tests {        
-        int Incremental::run(const Dense_evd_test &test) const {
-            IncrementalKernelEVD< double > builder(DenseSpace<double>::create(test.n));
-            return test.run(logger, builder);
+        namespace {
+            //! A selector whose first selection fails
+            struct FailingSelector : public Selector<double> {
+                mutable std::atomic<bool> failed;
+                FailingSelector() : failed(false) {}
+                virtual void selection(EigenList<double> &) const override {
+                    if (!failed.exchange(true))
+                        throw std::runtime_error("Failing selection");
+                }
+            };
+            
+            //! A failed background clean-up keeps the updates (once)
+            int failedCleanup(const Dense_evd_test &test) {
+                CleanupPolicy policy;
+                policy.everyUpdate = false;
+                policy.maxPreImages = 1;
+                policy.background = true;
+                
+                IncrementalKernelEVD< double > builder(DenseSpace<double>::create(test.n));
+                builder.setCleanupPolicy(policy);
+                builder.setSelector(boost::shared_ptr< Selector<double> >(new FailingSelector()));
+                
+                Eigen::MatrixXd matrix = Eigen::MatrixXd::Zero(test.n, test.n);
+                int failures = 0;
+                for(int i = 0; i < 5; i++) {
+                    Eigen::MatrixXd m = Eigen::MatrixXd::Random(test.n, 1);
+                    matrix += m * m.adjoint();
+                    try {
+                        builder.add(1, Dense<double>::create(m), Eigen::Identity<double>(1, 1));
+                    } catch(const std::runtime_error &) {
+                        failures++;
+                    }
+                }
+                
+                Decomposition<double> d;
+                try {
+                    d = builder.getDecomposition();
+                } catch(const std::runtime_error &) {
+                    failures++;
+                    d = builder.getDecomposition();
+                }
+                
+                Eigen::SelfAdjointEigenSolver<Eigen::MatrixXd> evd(matrix);
+                Eigen::MatrixXd mY = Eigen::MatrixXd::Identity(test.n, test.n);
+                double error = KernelOperators<double>::difference(d.fs, d.mX, d.mY, d.mD, Dense<double>::create(evd.eigenvectors()), mY, evd.eigenvalues());
+                KQP_LOG_INFO_F(logger, "Squared error after a failed clean-up is %e (%d failures)", %error %failures);
+                return failures == 1 && error < test.tolerance ? 0 : 1;
+            }
+        }
+        
+        int Incremental::run(const Dense_evd_test &_test) const {
+            Dense_evd_test test = _test;
+            
+            switch(variant) {
+                case STATIC_SPACE: {
+                    IncrementalKernelEVD< double, DenseSpace<double> > builder(DenseSpace<double>::create(test.n));
+                    return test.run(logger, builder);
+                }
+                    
+                case FORGETTING: {
+                    // Strong decay so that the scale is folded and old eigenvalues are pruned
+                    test.forgetting = 0.08;
+                    
+                    IncrementalKernelEVD< double > builder(DenseSpace<double>::create(test.n));
+                    builder.setForgettingFactor(test.forgetting);
+                    builder.setPruningThreshold(1e-6);
+                    return test.run(logger, builder);
+                }
+                    
+                case DEFERRED: 
+                case BACKGROUND: {
+                    // Clean-ups reduce the number of pre-images (by linear combination)
+                    CleanupPolicy policy;
+                    policy.everyUpdate = false;
+                    policy.maxPreImages = 4;
+                    policy.onRead = variant == DEFERRED;
+                    policy.background = variant == BACKGROUND;
+                    
+                    IncrementalKernelEVD< double > builder(DenseSpace<double>::create(test.n));
+                    builder.setPreImagesPerRank(1, 1);
+                    builder.setCleanupPolicy(policy);
+                    if (int code = test.run(logger, builder))
+                        return code;
+                    return variant == BACKGROUND ? failedCleanup(test) : 0;
+                }
+                    
+                default: {
+                    IncrementalKernelEVD< double > builder(DenseSpace<double>::create(test.n));
+                    return test.run(logger, builder);
+                }
+            }
         }
     }
 }
\ No newline at end of file
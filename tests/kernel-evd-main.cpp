@@ -89,12 +89,66 @@ namespace kqp {
         if (name == "accumulator-no-lc")
             return kevd_tests::Accumulator(false).run(test);
         
+        if (name == "accumulator-downdate") 
+            return kevd_tests::Accumulator(true, true).run(test);
+        
+        if (name == "accumulator-no-lc-downdate")
+            return kevd_tests::Accumulator(false, true).run(test);
+        
         if (name == "incremental") 
-            return kevd_tests::Incremental().run(test);
+            return kevd_tests::Incremental(Incremental::DEFAULT).run(test);
+
+        if (name == "incremental-static") 
+            return kevd_tests::Incremental(Incremental::STATIC_SPACE).run(test);
+
+        if (name == "incremental-forgetting") 
+            return kevd_tests::Incremental(Incremental::FORGETTING).run(test);
+
+        if (name == "incremental-deferred") 
+            return kevd_tests::Incremental(Incremental::DEFERRED).run(test);
+
+        if (name == "incremental-background") 
+            return kevd_tests::Incremental(Incremental::BACKGROUND).run(test);
 
         if (name == "divide-and-conquer") 
             return kevd_tests::DivideAndConquer().run(test);
 
+        if (name == "single") 
+            return kevd_tests::Precision(false).run(test);
+
+        if (name == "mixed") 
+            return kevd_tests::Precision(true).run(test);
+
+        if (name == "sliding-window") 
+            return kevd_tests::SlidingWindow().run(test);
+
+        if (name == "async") 
+            return kevd_tests::Async().run(test);
+
+        if (name == "async-producers") 
+            return kevd_tests::Async(true).run(test);
+
+        if (name == "checkpoint-direct") 
+            return kevd_tests::Checkpoint(kevd_tests::Checkpoint::DIRECT).run(test);
+
+        if (name == "checkpoint-accumulator") 
+            return kevd_tests::Checkpoint(kevd_tests::Checkpoint::ACCUMULATOR).run(test);
+
+        if (name == "checkpoint-accumulator-no-lc") 
+            return kevd_tests::Checkpoint(kevd_tests::Checkpoint::ACCUMULATOR_NO_LC).run(test);
+
+        if (name == "checkpoint-incremental") 
+            return kevd_tests::Checkpoint(kevd_tests::Checkpoint::INCREMENTAL).run(test);
+
+        if (name == "checkpoint-divide-and-conquer") 
+            return kevd_tests::Checkpoint(kevd_tests::Checkpoint::DIVIDE_AND_CONQUER).run(test);
+
+        if (name == "checkpoint-async") 
+            return kevd_tests::Checkpoint(kevd_tests::Checkpoint::ASYNC).run(test);
+
+        if (name == "checkpoint-sliding-window") 
+            return kevd_tests::SlidingWindow(true).run(test);
+
         
         KQP_THROW_EXCEPTION_F(illegal_argument_exception, "Unknown evd_update_test [%s]", %name);
         
@@ -108,5 +162,5 @@ int main(int argc, const char **argv) {
     std::deque<std::string> args;
     for(int i = 1; i < argc; i++) 
         args.push_back(argv[i]);
-    kqp::do_kevd_tests(args);
+    return kqp::do_kevd_tests(args);
 }
\ No newline at end of file
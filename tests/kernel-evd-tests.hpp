@@ -18,6 +18,7 @@
 #ifndef _KQP_KERNEL_EVD_TESTS_H_
 #define _KQP_KERNEL_EVD_TESTS_H_
 
+#include <unistd.h>
 #include <boost/format.hpp>
 
 #include <kqp/kqp.hpp>
@@ -94,19 +95,42 @@ namespace kqp {
             int min_lc;
             int max_lc;
             
-            Dense_evd_test() : min_preimages(1), min_lc(1) {}
+            //! Maximum squared error
+            double tolerance;
             
+            //! If positive, only the last window updates are expected in the decomposition
+            int window;
+            
+            //! The expected operator is multiplied by this factor before each update
+            double forgetting;
+            
+            //! Removes one update out of three at the end (with the same or a copy of the pre-images)
+            bool downdates;
+            
+            Dense_evd_test() : min_preimages(1), min_lc(1), tolerance(kevd_tests::tolerance), window(0), forgetting(1), downdates(false) {}
+            
+            /**
+             * @param resumed If not null, the state of the builder is saved in a checkpoint after half of
+             * the updates, and loaded in this builder which then gets the remaining updates
+             */
             template<class Scalar> 
-            int run(const log4cxx::LoggerPtr &logger, KernelEVD<Scalar> &builder) const {
+            int run(const log4cxx::LoggerPtr &logger, KernelEVD<Scalar> &_builder, KernelEVD<Scalar> *resumed = nullptr) const {
                 KQP_SCALAR_TYPEDEFS(Scalar);
+                KernelEVD<Scalar> *builder = &_builder;
                 
-                KQP_LOG_INFO_F(logger, "Kernel EVD with dense vectors and builder \"%s\" (pre-images = %d, linear combination = %d)", %KQP_DEMANGLE(builder) %max_preimages %max_lc);
+                KQP_LOG_INFO_F(logger, "Kernel EVD with dense vectors and builder \"%s\" (pre-images = %d, linear combination = %d)", %KQP_DEMANGLE(*builder) %max_preimages %max_lc);
                 
                 ScalarMatrix matrix(n,n);
                 matrix.setConstant(0);
                 
+                std::vector<Scalar> alphas;
+                std::vector<FMatrixPtr> preImages;
+                std::vector<ScalarMatrix> matrices, combinations;
+                
                 // Construction
                 for(int i = 0; i < nb_add; i++) {
+                    if (resumed && i == nb_add / 2) 
+                        builder = checkpoint(logger, *builder, *resumed);
                     
                     Scalar alpha = Eigen::internal::abs(Eigen::internal::random_impl<Scalar>::run()) + 1e-3;
                     
@@ -120,12 +144,29 @@ namespace kqp {
                     // Generate the linear combination matrix
                     ScalarMatrix mA = ScalarMatrix::Random(k, p);
                     
-                    matrix.template selfadjointView<Eigen::Lower>().rankUpdate(m * mA, alpha);
+                    matrix *= (Scalar)forgetting;
+                    if (window <= 0 || i >= nb_add - window)
+                        matrix.template selfadjointView<Eigen::Lower>().rankUpdate(m * mA, alpha);
                     
                     
-                    builder.add(alpha, FMatrixPtr(new Dense<Scalar>(m)), mA);
+                    FMatrixPtr mX(new Dense<Scalar>(m));
+                    builder->add(alpha, mX, mA);
+                    
+                    alphas.push_back(alpha);
+                    preImages.push_back(mX);
+                    matrices.push_back(m);
+                    combinations.push_back(mA);
                 }
                 
+                // Downdates
+                if (downdates) 
+                    for(int i = 0; i < nb_add; i += 3) {
+                        const ScalarMatrix &m = matrices[i];
+                        KQP_LOG_INFO_F(logger, "Removing update %d", %i);
+                        matrix.template selfadjointView<Eigen::Lower>().rankUpdate(m * combinations[i], -alphas[i]);
+                        builder->add(-alphas[i], (i / 3) % 2 == 0 ? preImages[i] : FMatrixPtr(new Dense<Scalar>(m)), combinations[i]);
+                    }
+                
                 // Computing via EVD
                 KQP_LOG_INFO(logger, "Computing an LDLT decomposition");
                 
@@ -143,7 +184,7 @@ namespace kqp {
                 
                 KQP_LOG_INFO(logger, "Retrieving the decomposition");
                 
-                auto kevd = builder.getDecomposition();
+                auto kevd = builder->getDecomposition();
                 
                 ScalarAltMatrix mUY = Eigen::Identity<Scalar>(mL.rows(), mL.rows());
                 
@@ -159,7 +200,31 @@ namespace kqp {
                 double error = KernelOperators<Scalar>::difference(kevd.fs, kevd.mX, kevd.mY, kevd.mD, mU, mUY, mU_d);
                 
                 KQP_LOG_INFO_F(logger, "Squared error is %e", %error);
-                return error < tolerance ? 0 : 1;
+                return error < this->tolerance ? 0 : 1;
+            }
+
+            //! Saves the state of a builder in a checkpoint, and loads it in another one
+            template<class Scalar> 
+            static KernelEVD<Scalar> *checkpoint(const log4cxx::LoggerPtr &logger, const KernelEVD<Scalar> &builder, KernelEVD<Scalar> &resumed) {
+                char path[] = "/tmp/kqp-checkpoint-XXXXXX";
+                int fd = mkstemp(path);
+                if (fd < 0) 
+                    KQP_THROW_EXCEPTION(io_exception, "Cannot create a temporary file");
+                close(fd);
+                
+                KQP_LOG_INFO_F(logger, "Checkpointing the builder after %d updates in %s", %builder.getUpdateCount() %path);
+                {
+                    CheckpointWriter writer(path);
+                    builder.save(writer, "builder.");
+                    writer.commit();
+                }
+                {
+                    CheckpointReader reader(path);
+                    resumed.load(reader, "builder.");
+                }
+                // The pre-images stay mapped
+                unlink(path);
+                return &resumed;
             }
         };
         
@@ -175,19 +240,72 @@ namespace kqp {
         };
         
         struct Accumulator : public Builder {
-            Accumulator(bool use_lc) : use_lc(use_lc) {}
+            Accumulator(bool use_lc, bool downdates = false) : use_lc(use_lc), downdates(downdates) {}
             virtual int run(const Dense_evd_test &) const;
             
             bool use_lc;
+            
+            //! Removes some of the updates
+            bool downdates;
         };
         struct Incremental : public Builder {
+            enum Variant {
+                //! Default
+                DEFAULT,
+                //! Statically typed feature space
+                STATIC_SPACE,
+                //! Exponential forgetting (with pruning)
+                FORGETTING,
+                //! Clean-up triggered by the number of pre-images, and on read
+                DEFERRED,
+                //! Background clean-up
+                BACKGROUND
+            };
+            
+            Incremental(Variant variant) : variant(variant) {}
             virtual int run(const Dense_evd_test &) const;
+            
+            Variant variant;
         };
         
         struct DivideAndConquer : public Builder {
             virtual int run(const Dense_evd_test &) const;
         };
         
+        struct Precision : public Builder {
+            Precision(bool mixed) : mixed(mixed) {}
+            virtual int run(const Dense_evd_test &) const;
+            
+            //! Mixed precision (single precision pre-images, double precision EVD) instead of single precision
+            bool mixed;
+        };
+        
+        struct SlidingWindow : public Builder {
+            SlidingWindow(bool checkpoint = false) : checkpoint(checkpoint) {}
+            virtual int run(const Dense_evd_test &) const;
+            
+            //! Resumes the builder from a checkpoint after half of the updates
+            bool checkpoint;
+        };
+        
+        struct Async : public Builder {
+            Async(bool producers = false) : producers(producers) {}
+            virtual int run(const Dense_evd_test &) const;
+            
+            //! Updates from several threads (including dropped and null updates)
+            bool producers;
+        };
+        
+        //! Resumes a builder from a checkpoint after half of the updates
+        struct Checkpoint : public Builder {
+            enum Kind { DIRECT, ACCUMULATOR, ACCUMULATOR_NO_LC, INCREMENTAL, DIVIDE_AND_CONQUER, ASYNC };
+            
+            Checkpoint(Kind kind) : kind(kind) {}
+            virtual int run(const Dense_evd_test &) const;
+            
+            Kind kind;
+        };
+        
     }
     
 }
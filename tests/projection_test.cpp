@@ -42,7 +42,7 @@ namespace kqp {
         int isApproxEqual(const std::string & name, const Density< double > &a, const Eigen::MatrixXd &b) {
             auto _a = a.matrix();
             auto m = kqp::our_dynamic_cast<Dense<double>&>(*_a);
-            KQP_MATRIX(double) op = m.getMatrix() * m.getMatrix().adjoint();
+            KQP_MATRIX(double) op = m.view() * m.view().adjoint();
             return isApproxEqual(name, op, b);
         }
     }
@@ -50,7 +50,7 @@ namespace kqp {
     
     template<typename Scalar>
     const Matrix<Scalar,Dynamic,Dynamic> getMatrix(const Density<Scalar> &d) {
-        return kqp::our_dynamic_cast<Dense<double>&>(*d.matrix()).getMatrix();
+        return kqp::our_dynamic_cast<Dense<double>&>(*d.matrix()).view();
     }
     
     int simple_projection_test(std::deque<std::string> &/*args*/) {
@@ -85,7 +85,7 @@ namespace kqp {
         return  inners.squaredNorm() < EPSILON 
         && getMatrix(v1_p).squaredNorm() < EPSILON
         && getMatrix(v2_p).squaredNorm() < EPSILON
-        && (getMatrix(v1) + getMatrix(v2) - v->as<Dense<double>>().getMatrix()).squaredNorm() < EPSILON 
+        && (getMatrix(v1) + getMatrix(v2) - v->as<Dense<double>>().view()).squaredNorm() < EPSILON 
         ? 0 : 1;
         
     }
@@ -19,7 +19,7 @@ namespace kqp {
         
         CleanerUnused<double>::run(mF, mY);
         
-        Eigen::MatrixXd m1 = mF->as<Dense<double>>().getMatrix() * mY;
+        Eigen::MatrixXd m1 = mF->as<Dense<double>>().view() * mY;
         Eigen::MatrixXd m2 = _mF * _mY;
         double error = (m1 - m2).norm();
         
@@ -21,13 +21,14 @@
 #define KQP_NO_EXTERN_TEMPLATE
 
 #include <kqp/evd_utils.hpp>
+#include <kqp/batched_evd.hpp>
 #include <kqp/feature_matrix/dense.hpp>
 #include "tests_utils.hpp"
 
 DEFINE_LOGGER(logger, "kqp.test.probabilities");
 
 namespace kqp {
-    template<typename Scalar> int test_orthonormalization(bool positive = false) {
+    template<typename Scalar> int test_orthonormalization(bool positive = false, bool batched = false) {
         KQP_SCALAR_TYPEDEFS(Scalar);
         
         int dim = 10;
@@ -43,7 +44,12 @@ namespace kqp {
         auto fs = DenseSpace<Scalar>::create(dim);
         
         Decomposition<Scalar> d(fs, typename Dense<Scalar>::SelfPtr(new Dense<Scalar>(mX)), mY, mD, false);
-        Orthonormalize<Scalar>::run(d.fs, d.mX, d.mY, d.mD);
+        if (batched) {
+            std::vector< Decomposition<Scalar> > ds(1, d);
+            BatchedEVD<Scalar>().orthonormalize(ds);
+            d = ds[0];
+        } else
+            Orthonormalize<Scalar>::run(d.fs, d.mX, d.mY, d.mD);
         ScalarMatrix inners = fs->k(d.mX, d.mY);
         
         Real error = (inners - Eigen::Identity<Scalar>(inners.rows(),inners.rows())).squaredNorm();
@@ -71,10 +77,63 @@ namespace kqp {
     int test_orthonormalization_complex(std::deque<std::string> &/*args*/) {
         return test_orthonormalization<std::complex<double>>();
     }
+    int test_orthonormalization_batched(std::deque<std::string> &/*args*/) {
+        return test_orthonormalization<double>(true, true) + test_orthonormalization<double>(false, true);
+    }
+
+    //! Compares the batched EVDs with SelfAdjointEigenSolver
+    template<typename Scalar> int test_batched_evd() {
+        KQP_SCALAR_TYPEDEFS(Scalar);
+
+        // Sizes below and above the maximum size of the Jacobi kernel,
+        // with an incomplete group for some sizes
+        std::vector<ScalarMatrix> matrices;
+        for(int i = 0; i < 60; i++) {
+            Index n = i % 13 == 12 ? 40 : 1 + i % 7;
+            ScalarMatrix m = ScalarMatrix::Random(n, n);
+            matrices.push_back(m + m.adjoint());
+        }
+        matrices.push_back(ScalarMatrix::Zero(3, 3));
+        matrices.push_back(ScalarMatrix::Zero(0, 0));
+
+        std::vector<RealVector> eigenvalues;
+        std::vector<ScalarMatrix> eigenvectors;
+        BatchedEVD<Scalar>().compute(matrices, eigenvalues, eigenvectors);
+
+        Real maxError = 0;
+        for(size_t i = 0; i < matrices.size(); i++) {
+            const ScalarMatrix &m = matrices[i];
+            const RealVector &d = eigenvalues[i];
+            const ScalarMatrix &u = eigenvectors[i];
+            if (d.size() != m.rows() || u.rows() != m.rows() || u.cols() != m.rows()) {
+                std::cerr << "Wrong dimensions for matrix " << i << std::endl;
+                return 1;
+            }
+            if (m.rows() == 0) continue;
+
+            Real norm = std::max(m.norm(), (Real)1);
+            Real error = std::max((u * d.asDiagonal() * u.adjoint() - m).norm() / norm,
+                                  (u.adjoint() * u - ScalarMatrix::Identity(m.rows(), m.rows())).norm());
+
+            Eigen::SelfAdjointEigenSolver<ScalarMatrix> evd(m);
+            error = std::max(error, (evd.eigenvalues() - d).norm() / norm);
+            maxError = std::max(maxError, error / (Real)m.rows());
+        }
+
+        Real threshold = 1000 * Eigen::NumTraits<Scalar>::epsilon();
+        std::cerr << "Batched EVD maximum error (relative to the size) is " << maxError << " (threshold " << threshold << ")" << std::endl;
+        return maxError < threshold ? 0 : 1;
+    }
+
+    int test_batched_evd_real(std::deque<std::string> &/*args*/) {
+        return test_batched_evd<double>() + test_batched_evd<float>();
+    }
 }
 
 #include "main-tests.inc"
 DEFINE_TEST("orthonormalization/real-positive", test_orthonormalization_real_positive);
 DEFINE_TEST("orthonormalization/real", test_orthonormalization_real);
 DEFINE_TEST("orthonormalization/complex", test_orthonormalization_complex);
+DEFINE_TEST("orthonormalization/batched", test_orthonormalization_batched);
+DEFINE_TEST("batched-evd", test_batched_evd_real);
 
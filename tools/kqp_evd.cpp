@@ -0,0 +1,312 @@
+/*
+ This file is part of the Kernel Quantum Probability library (KQP).
+
+ KQP is free software: you can redistribute it and/or modify
+ it under the terms of the GNU General Public License as published by
+ the Free Software Foundation, either version 3 of the License, or
+ (at your option) any later version.
+
+ KQP is distributed in the hope that it will be useful,
+ but WITHOUT ANY WARRANTY; without even the implied warranty of
+ MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ GNU General Public License for more details.
+
+ You should have received a copy of the GNU General Public License
+ along with KQP.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Distributed kernel EVD: builds partial decompositions of shards and merges them
+//
+// kqp_evd [options] build --output PARTIAL SHARD...
+// kqp_evd [options] merge --output RESULT [--fan-in K] [--jobs J] [--keep] PARTIAL...
+// kqp_evd [options] plan --output RESULT [--fan-in K] PARTIAL...
+//
+// with the options
+//   --space FILE        XML definition of the feature space (for merges, defaults to the one of the first partial decomposition)
+//   --builder NAME      builder for the shards (accumulator, incremental or direct)
+//   --merger NAME       builder for the merges (accumulator, incremental or direct)
+//   --rank R            maximum rank of the partial and merged decompositions
+//   --debug ID, --log-level ID LEVEL
+//
+// plan prints the merge jobs (one per line: level, output and inputs separated by tabulations) so that
+// they can be submitted to a batch scheduler; each job is then run with "merge --output OUTPUT INPUTS...".
+// With more inputs than the fan-in, merge runs the tree of jobs itself, with at most J concurrent processes.
+
+#include <cstdio>
+#include <deque>
+#include <iostream>
+
+#include <spawn.h>
+#include <sys/wait.h>
+
+#include <boost/exception/diagnostic_information.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include <kqp/kqp.hpp>
+#include <kqp/logging.hpp>
+#include <kqp/space_factory.hpp>
+
+#include <kqp/feature_matrix/dense.hpp>
+#include <kqp/feature_matrix/sparse.hpp>
+#include <kqp/feature_matrix/sparse_dense.hpp>
+#include <kqp/feature_matrix/unary_kernel.hpp>
+#include <kqp/feature_matrix/kernel_sum.hpp>
+
+#include <kqp/rank_selector.hpp>
+#include <kqp/kernel_evd/accumulator.hpp>
+#include <kqp/kernel_evd/dense_direct.hpp>
+#include <kqp/kernel_evd/incremental.hpp>
+#include <kqp/kernel_evd/distributed.hpp>
+
+extern char **environ;
+
+DEFINE_LOGGER(logger, "kqp.evd");
+
+namespace kqp {
+    namespace {
+        // Spaces that can be defined in the XML files
+#       define KQP_SCALAR_GEN(Scalar) \
+        SpaceFactory::Register<Scalar, DenseSpace<Scalar>> REGISTER_DENSE_ ## Scalar; \
+        SpaceFactory::Register<Scalar, SparseSpace<Scalar>> REGISTER_SPARSE_ ## Scalar; \
+        SpaceFactory::Register<Scalar, SparseDenseSpace<Scalar>> REGISTER_SPARSE_DENSE_ ## Scalar; \
+        SpaceFactory::Register<Scalar, GaussianSpace<Scalar>> REGISTER_GAUSSIAN_ ## Scalar; \
+        SpaceFactory::Register<Scalar, PolynomialSpace<Scalar>> REGISTER_POLYNOMIAL_ ## Scalar; \
+        SpaceFactory::Register<Scalar, KernelSumSpace<Scalar>> REGISTER_KERNEL_SUM_ ## Scalar;
+        KQP_SCALAR_GEN(double)
+        KQP_SCALAR_GEN(float)
+#       undef KQP_SCALAR_GEN
+
+        //! Command line options
+        struct Options {
+            std::string command, output, space, builder, merger;
+            Index rank, fanIn, jobs;
+            bool keep;
+            std::vector<std::string> inputs;
+
+            Options() : builder("accumulator"), merger("accumulator"), rank(-1), fanIn(2), jobs(1), keep(false) {}
+        };
+
+        //! Runs a command of this program in a new process
+        pid_t spawn(const std::string &program, const std::vector<std::string> &args) {
+            std::vector<char *> argv;
+            argv.push_back(const_cast<char *>(program.c_str()));
+            for(auto i = args.begin(); i != args.end(); ++i)
+                argv.push_back(const_cast<char *>(i->c_str()));
+            argv.push_back(0);
+
+            pid_t pid;
+            int error = posix_spawnp(&pid, program.c_str(), 0, 0, &argv[0], environ);
+            if (error != 0)
+                KQP_THROW_EXCEPTION_F(exception, "Cannot run %s (error %d)", %program %error);
+            return pid;
+        }
+
+        //! Waits for a process and returns true if it succeeded
+        bool join(pid_t pid) {
+            int status;
+            if (waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0)
+                return true;
+            KQP_LOG_ERROR_F(logger, "Merge process %d failed", %pid);
+            return false;
+        }
+
+        //! Waits for all the processes and returns the number of failures
+        Index join(std::deque<pid_t> &running) {
+            Index failures = 0;
+            for(; !running.empty(); running.pop_front())
+                if (!join(running.front()))
+                    failures++;
+            return failures;
+        }
+
+        template<typename Scalar>
+        boost::shared_ptr< KernelEVD<Scalar> > getBuilder(const std::string &name, const typename DistributedKernelEVD<Scalar>::FSpace &fs,
+                                                          const boost::shared_ptr< const Selector<typename Eigen::NumTraits<Scalar>::Real> > &selector) {
+            if (name == "accumulator")
+                return boost::shared_ptr< KernelEVD<Scalar> >(new AccumulatorKernelEVD<Scalar, true>(fs));
+
+            if (name == "incremental") {
+                boost::shared_ptr< IncrementalKernelEVD<Scalar> > builder(new IncrementalKernelEVD<Scalar>(fs));
+                if (selector)
+                    builder->setSelector(selector);
+                return builder;
+            }
+
+            if (name == "direct") {
+                auto dense = kqp::our_dynamic_cast< const DenseSpace<Scalar> >(fs);
+                return boost::shared_ptr< KernelEVD<Scalar> >(new DenseDirectBuilder<Scalar>(dense->dimension()));
+            }
+
+            KQP_THROW_EXCEPTION_F(illegal_argument_exception, "Unknown builder %s", %name);
+        }
+
+        template<typename Scalar>
+        int run(const std::string &program, const Options &options, const boost::shared_ptr<AbstractSpace> &space) {
+            KQP_SCALAR_TYPEDEFS(Scalar);
+            FSpace fs = kqp::our_dynamic_cast< SpaceBase<Scalar> >(space);
+            DistributedKernelEVD<Scalar> kevd(fs);
+
+            boost::shared_ptr< const Selector<Real> > selector;
+            if (options.rank > 0) {
+                selector.reset(new RankSelector<Real, true>(options.rank));
+                kevd.setCleaner(boost::shared_ptr< Cleaner<Scalar> >(new CleanerRank<Scalar>(selector)));
+            }
+
+            if (options.command == "build") {
+                kevd.setBuilder(getBuilder<Scalar>(options.builder, fs, selector));
+                kevd.build(options.inputs, options.output);
+                return 0;
+            }
+
+            std::vector<MergeJob> jobs = DistributedKernelEVD<Scalar>::plan(options.inputs, options.output, options.fanIn);
+            kevd.setMerger(getBuilder<Scalar>(options.merger, fs, selector));
+            if (jobs.size() == 1) {
+                kevd.run(jobs[0]);
+                return 0;
+            }
+
+            // Runs the tree, one level at a time, with one process per job
+            std::vector<std::string> common = { "--merger", options.merger, "--rank", boost::lexical_cast<std::string>(options.rank) };
+            if (!options.space.empty())
+                common.insert(common.end(), { "--space", options.space });
+
+            for(size_t begin = 0; begin < jobs.size();) {
+                size_t end = begin;
+                while (end < jobs.size() && jobs[end].level == jobs[begin].level)
+                    end++;
+                KQP_LOG_INFO_F(logger, "Running the %d merge jobs of level %d", %(end - begin) %jobs[begin].level);
+
+                // No job is started after a failure, but the running ones are always waited for
+                std::deque<pid_t> running;
+                Index failures = 0;
+                try {
+                    for(size_t k = begin; k < end; k++) {
+                        if ((Index)running.size() >= options.jobs) {
+                            if (!join(running.front()))
+                                failures++;
+                            running.pop_front();
+                        }
+                        if (failures > 0)
+                            break;
+                        std::vector<std::string> args = common;
+                        args.insert(args.end(), { "merge", "--output", jobs[k].output });
+                        args.insert(args.end(), jobs[k].inputs.begin(), jobs[k].inputs.end());
+                        running.push_back(spawn(program, args));
+                    }
+                } catch(...) {
+                    join(running);
+                    throw;
+                }
+                failures += join(running);
+                if (failures > 0)
+                    KQP_THROW_EXCEPTION_F(exception, "%d merge processes of level %d failed", %failures %jobs[begin].level);
+
+                // Intermediate decompositions are not needed anymore
+                if (!options.keep && jobs[begin].level > 0)
+                    for(size_t k = begin; k < end; k++)
+                        for(auto i = jobs[k].inputs.begin(); i != jobs[k].inputs.end(); ++i)
+                            std::remove(i->c_str());
+
+                begin = end;
+            }
+
+            return 0;
+        }
+    }
+}
+
+using namespace kqp;
+
+int main(int argc, const char **argv) {
+    LOGGER_CONFIG.setDefaultLevel("INFO");
+
+    std::deque<std::string> args;
+    for(int i = 1; i < argc; i++)
+        args.push_back(argv[i]);
+
+    try {
+        Options options;
+
+        // Parses the options (before and after the command)
+        while (args.size() > 0) {
+            const std::string arg = args.front();
+            args.pop_front();
+
+            if (arg == "--debug" && args.size() >= 1) {
+                LOGGER_CONFIG.setLevel(args[0], "DEBUG");
+                args.pop_front();
+            } else if (arg == "--log-level" && args.size() >= 2) {
+                LOGGER_CONFIG.setLevel(args[0], args[1]);
+                args.pop_front();
+                args.pop_front();
+            } else if (arg == "--space" && args.size() >= 1) {
+                options.space = args[0];
+                args.pop_front();
+            } else if (arg == "--builder" && args.size() >= 1) {
+                options.builder = args[0];
+                args.pop_front();
+            } else if (arg == "--merger" && args.size() >= 1) {
+                options.merger = args[0];
+                args.pop_front();
+            } else if (arg == "--rank" && args.size() >= 1) {
+                options.rank = boost::lexical_cast<Index>(args[0]);
+                args.pop_front();
+            } else if (arg == "--output" && args.size() >= 1) {
+                options.output = args[0];
+                args.pop_front();
+            } else if (arg == "--fan-in" && args.size() >= 1) {
+                options.fanIn = boost::lexical_cast<Index>(args[0]);
+                args.pop_front();
+            } else if (arg == "--jobs" && args.size() >= 1) {
+                options.jobs = std::max<Index>(1, boost::lexical_cast<Index>(args[0]));
+                args.pop_front();
+            } else if (arg == "--keep") {
+                options.keep = true;
+            } else if (options.command.empty()) {
+                options.command = arg;
+            } else {
+                options.inputs.push_back(arg);
+            }
+        }
+
+        if (options.command != "build" && options.command != "merge" && options.command != "plan") {
+            std::cerr << "Usage: " << argv[0] << " [options] (build|merge|plan) --output FILE INPUT..." << std::endl;
+            return 1;
+        }
+        if (options.output.empty() || options.inputs.empty())
+            KQP_THROW_EXCEPTION(illegal_argument_exception, "An output and at least one input should be given");
+
+        if (options.command == "plan") {
+            // (the plan does not depend on the scalar type)
+            std::vector<MergeJob> jobs = DistributedKernelEVD<double>::plan(options.inputs, options.output, options.fanIn);
+            for(auto job = jobs.begin(); job != jobs.end(); ++job) {
+                std::cout << job->level << "\t" << job->output;
+                for(auto i = job->inputs.begin(); i != job->inputs.end(); ++i)
+                    std::cout << "\t" << *i;
+                std::cout << std::endl;
+            }
+            return 0;
+        }
+
+        // The space definition
+        boost::shared_ptr<AbstractSpace> space;
+        if (!options.space.empty())
+            space = SpaceFactory::loadFromFile(options.space);
+        else if (options.command != "build")
+            space = SpaceFactory::loadFromString(CheckpointReader(options.inputs[0]).text("space"));
+        else
+            KQP_THROW_EXCEPTION(illegal_argument_exception, "The feature space should be given (--space)");
+
+        if (boost::dynamic_pointer_cast< SpaceBase<double> >(space))
+            return run<double>(argv[0], options, space);
+        if (boost::dynamic_pointer_cast< SpaceBase<float> >(space))
+            return run<float>(argv[0], options, space);
+        KQP_THROW_EXCEPTION_F(illegal_argument_exception, "Unsupported scalar for space %s", %space->name());
+
+    } catch(const boost::exception &e) {
+        std::cerr << boost::diagnostic_information(e) << std::endl;
+    } catch(const std::exception &e) {
+        std::cerr << e.what() << std::endl;
+    }
+    return 1;
+}